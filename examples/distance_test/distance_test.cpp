@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include <max485ttl.hpp>
 #include <usr_lg206_p.h>
+#include <usr_lg206_p_rpc.h>
 
 // #define DEBUG_PRINT
 
@@ -16,19 +17,57 @@ const size_t kMessageFrequency = 10000;
 
 RS485 rs = RS485(kEnablePin, kEnablePin, &Serial1);
 UsrLg206P lora = UsrLg206P(&rs);
+LoRaRpc::LoRaRpc rpc = LoRaRpc::LoRaRpc(&lora, kIsSensorNode ? kSensorAddress : kBaseAddress, kIsSensorNode ? kSensorChannel : kBaseChannel);
 int state = 0;
 
-const size_t buffer_size = 64;
-uint8_t buffer[buffer_size];
+unsigned long time_send = 0;
+long amount_correct = 0;
+// Code sent with every pending request
+long codes[kLoRaRpcAmountOfPending];
 
 void SetupRandomCode()
 {
     randomSeed(analogRead(0));
 }
 
-String GetRandomCode()
+long GetRandomCode()
+{
+    return random(10000, 99999);
+}
+
+size_t EchoHandler(const uint8_t *request, const size_t size, const uint16_t source_address, uint8_t *response, const size_t response_size)
 {
-    return String(random(10000, 99999));
+    memcpy(response, request, size);
+    return size;
+}
+
+void ResponseCallback(const uint16_t destination_address, const uint8_t correlation_id, const uint8_t *response, const size_t size)
+{
+    if (response == nullptr)
+    {
+#ifdef DEBUG_PRINT
+        Serial.println("Nothing received");
+#endif
+        return;
+    }
+
+    long code;
+    if (size != sizeof(code))
+    {
+        Serial.println("Incorrect message received");
+        return;
+    }
+
+    memcpy(&code, response, sizeof(code));
+    if (code != codes[correlation_id % kLoRaRpcAmountOfPending])
+    {
+        Serial.println("Incorrect message received");
+    }
+    else
+    {
+        Serial.print("Correct messages: ");
+        Serial.println(++amount_correct);
+    }
 }
 
 void setup()
@@ -47,9 +86,11 @@ void setup()
     Serial1.begin(115200, SERIAL_8N1);
 
     SetupRandomCode();
-}
 
-long amount_correct = 0;
+    rpc.SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268);
+    rpc.SetRequestHandler(EchoHandler);
+    rpc.SetResponseCallback(ResponseCallback);
+}
 
 void loop()
 {
@@ -196,95 +237,27 @@ void loop()
     }
     case 7:
     {
-        // Base station code
-        String message = GetRandomCode();
-        int time_send = millis();
-        int bytes = lora.SendMessage(message.c_str(), message.length(), kSensorAddress, kSensorChannel);
-        if (!bytes)
+        // Base station code, a new request does not wait for the response of the previous one
+        rpc.Update();
+        if (millis() - time_send < kMessageFrequency)
         {
-#ifdef DEBUG_PRINT
-            Serial.println("Message not sent correctly");
-#endif
-            return;
+            break;
         }
 
-        size_t length = lora.ReceiveMessage(buffer, buffer_size);
-        if (length)
-        {
-            if (length < buffer_size - 1)
-            {
-                buffer[length] = '\0';
-            }
-            else
-            {
-                buffer[buffer_size - 1] = '\0';
-            }
-        }
-
-        int time_received = millis();
-
-        // Only if something is received write it in the loggs
-        if (length)
-        {
-#ifdef DEBUG_PRINT
-            Serial.print("Time in millis: ");
-            Serial.println(time_received - time_send);
-            Serial.print("S:");
-            Serial.println(message);
-            Serial.print("R:");
-            Serial.println(reinterpret_cast<char *>(buffer));
-#endif
-            if (!message.equals(reinterpret_cast<char *>(buffer)))
-            {
-                Serial.println("Incorrect message received");
-            }
-            else
-            {
-                Serial.print("Correct messages: ");
-                Serial.println(++amount_correct);
-            }
-        }
-        else
-        {
-#ifdef DEBUG_PRINT
-            Serial.println("Nothing received");
-#endif
-        }
-
-        size_t time_remaining = 0;
-        if ((time_received - time_send) < kMessageFrequency)
+        time_send = millis();
+        const long code = GetRandomCode();
+        uint8_t correlation_id;
+        response_code = rpc.Call(reinterpret_cast<const uint8_t *>(&code), sizeof(code), kSensorAddress, kSensorChannel, &correlation_id, sizeof(code));
+        if (response_code == LoRaErrorCode::kSucces)
         {
-            time_remaining = kMessageFrequency - (time_received - time_send);
+            codes[correlation_id % kLoRaRpcAmountOfPending] = code;
         }
-
-        delay(time_remaining);
         break;
     }
     case 8:
     {
-        // Sender node
-        size_t length = lora.ReceiveMessage(buffer, buffer_size);
-        if (length)
-        {
-            if (length < buffer_size - 1)
-            {
-                buffer[length] = '\0';
-#ifdef DEBUG_PRINT
-                Serial.print("Length: ");
-                Serial.print((int)length);
-                Serial.print(':');
-                Serial.println(reinterpret_cast<char *>(buffer));
-#endif
-                int bytes = lora.SendMessage(reinterpret_cast<char *>(buffer), length, kBaseAddress, kBaseChannel);
-                if (bytes != length + 3)
-                {
-#ifdef DEBUG_PRINT
-                    Serial.println("Message not sent correctly");
-#endif
-                }
-            }
-        }
-
+        // Sensor node, requests are answered by EchoHandler
+        rpc.Update();
         break;
     }
     default:
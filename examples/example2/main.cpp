@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include <max485ttl.hpp>
 #include "usr_lg206_p.h"
+#include "usr_lg206_p_dispatcher.h"
 
 #define SENDER
 
@@ -38,13 +39,25 @@ void loop()
     delay(1000);
 }
 #else
+LoRaDispatcher::LoRaDispatcher dispatcher = LoRaDispatcher::LoRaDispatcher(&lora);
+
+void PrintMessage(const uint8_t *message, const size_t size, const uint16_t source_address)
+{
+    Serial.write(message, size);
+    Serial.println();
+}
+
 void loop()
 {
-    if (lora.Available())
+    if (!setup_complete)
     {
-        String r = lora.ReceiveMessage();
-        Serial.println(r);
+        lora.BeginAtMode();
+        lora.SetWorkMode(LoRaSettings::WorkMode::kWorkModeTransparent);
+        lora.EndAtMode();
+        dispatcher.Register(LoRaSettings::WorkMode::kWorkModeTransparent, PrintMessage);
+        setup_complete = true;
     }
-    delay(10);
+
+    dispatcher.Poll();
 }
 #endif
\ No newline at end of file
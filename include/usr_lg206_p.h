@@ -15,10 +15,18 @@
 #include <Arduino.h>
 #include <MAX485TTL.hpp>
 
+#include "usr_lg206_p_air_time.h"
+#include "usr_lg206_p_crc.h"
 #include "usr_lg206_p_error_code.h"
 #include "usr_lg206_p_settings.h"
 #include "usr_lg206_p_uart_settings.h"
 
+/**
+ * @brief Version of the library, kept equal to the version in library.json
+ *
+ */
+#define USR_LG206_P_VERSION "1.0.0"
+
 /**
  * @brief OUT is used as a identifier for output parameters
  *
@@ -141,6 +149,13 @@ public:
      */
     LoRaErrorCode GetWorkMode(LoRaSettings::WorkMode &setting);
 
+    /**
+     * @brief Get the work mode last set or read, without sending a command to the module
+     *
+     * @return the work mode, kWorkModeUndefined if it is not known yet
+     */
+    LoRaSettings::WorkMode GetKnownWorkMode(void) const;
+
     /**
      * @brief Set the uart settings of the LoRa module
      *
@@ -279,6 +294,22 @@ public:
      */
     LoRaErrorCode SetKey(String key = "FFFFFFFFFFFFFFFF");
 
+    /**
+     * @brief Turn the end to end checksum on or off, every module in the network must use the same setting
+     * Messages are sent as their length, the message and a CRC-16, so corruption on the UART between the module and the
+     * microcontroller is detected as well. Frames which fail the check are dropped by ReceiveMessage.
+     *
+     * @param enabled true to turn the checksum on
+     */
+    void SetChecksum(const bool enabled);
+
+    /**
+     * @brief Get the amount of received frames dropped because their checksum was wrong or they were incomplete
+     *
+     * @return amount of frames
+     */
+    unsigned long GetChecksumErrors(void) const;
+
     /**
      * @brief Function used to check if messages are received
      *
@@ -288,6 +319,8 @@ public:
 
     /**
      * @brief Function used to retrieve a message from the module
+     * Data which does not fit in the buffer stays available for the next call. With the checksum turned on one frame
+     * is returned per call and the part of a frame which does not fit in the buffer is dropped.
      *
      * @return the data received
      */
@@ -297,7 +330,7 @@ public:
      * @brief Function used to send data
      *
      * @param message data that needs to be send
-     * @return amount of bytes written
+     * @return amount of bytes written, -1 if the checksum is on and the message is larger than kMaximumCheckedMessageSize
      */
     int SendMessage(const uint8_t *message, const size_t length);
 
@@ -310,10 +343,23 @@ public:
      * @param message_size is the size of data
      * @param destination_address of the other module
      * @param channel of the other module
-     * @return int amount of bytes written
+     * @return int amount of bytes written, -2 if not in fixed point mode or -1 if the checksum is on and the message is
+     * larger than kMaximumCheckedMessageSize
      */
     int SendMessage(const char *message, const size_t message_size, const uint16_t destination_address, const uint8_t channel);
 
+    /**
+     * @brief Largest message which can be sent with the checksum turned on, its length is sent in one byte
+     *
+     */
+    static const size_t kMaximumCheckedMessageSize = 255;
+
+    /**
+     * @brief Bytes added to every message when the checksum is turned on, the length and the CRC-16
+     *
+     */
+    static const size_t kChecksumOverhead = 3;
+
 private:
     /**
      * @brief Stream to which the communication with the module is sent
@@ -327,6 +373,13 @@ private:
      */
     LoRaSettings::LoRaSettings settings_;
 
+    /**
+     * @brief True if messages are sent and received with a checksum
+     *
+     */
+    bool checksum_;
+    unsigned long checksum_errors_;
+
     /**
      * @brief Function used to set the value on the LoRa module
      *
@@ -352,6 +405,40 @@ private:
      * @return String response
      */
     size_t SendCommand(String command);
+
+    /**
+     * @brief Helper function to read everything the module sent, used for responses to commands
+     *
+     * @param buffer to store the data in
+     * @param buffer_size size of the buffer
+     * @return amount of bytes read
+     */
+    size_t ReceiveResponse(uint8_t *buffer, size_t buffer_size);
+
+    /**
+     * @brief Helper function to read one frame sent with a checksum
+     *
+     * @param buffer to store the message in
+     * @param buffer_size size of the buffer
+     * @return size of the message, 0 if no valid frame was received
+     */
+    size_t ReceiveCheckedMessage(uint8_t *buffer, size_t buffer_size);
+
+    /**
+     * @brief Helper function to read one byte, waiting shortly for it to arrive
+     *
+     * @return the byte or -1 if none arrived
+     */
+    int ReadByte(void);
+
+    /**
+     * @brief Helper function to write a message to the module with or without checksum
+     *
+     * @param message data that needs to be send
+     * @param message_size is the size of data
+     * @return amount of bytes written
+     */
+    size_t WriteFrame(const char *message, const size_t message_size);
 };
 
 #endif // USR_LG206_P_H_
\ No newline at end of file
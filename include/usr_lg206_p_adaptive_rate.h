@@ -0,0 +1,215 @@
+/**
+ * @file usr_lg206_p_adaptive_rate.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Adaptive air rate level per peer, based on the delivery results reported by the sketch
+ * @version 0.1
+ * @date 2024-03-13
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_ADAPTIVE_RATE_H_
+#define USR_LG206_P_ADAPTIVE_RATE_H_
+
+#include "usr_lg206_p.h"
+
+/**
+ * @brief Amount of peers of which the air rate level is remembered
+ *
+ */
+#ifndef kLoRaAdaptiveRateAmountOfPeers
+#define kLoRaAdaptiveRateAmountOfPeers 4
+#endif
+
+/**
+ * @brief Amount of deliveries in a row before a faster air rate level is tried
+ *
+ */
+#ifndef kLoRaAdaptiveRateStepUpThreshold
+#define kLoRaAdaptiveRateStepUpThreshold 10
+#endif
+
+/**
+ * @brief Amount of failed deliveries in a row before a slower air rate level is used
+ *
+ */
+#ifndef kLoRaAdaptiveRateStepDownThreshold
+#define kLoRaAdaptiveRateStepDownThreshold 3
+#endif
+
+/**
+ * @brief Time in milliseconds without hearing a peer after which both sides return to the slowest level
+ *
+ */
+#ifndef kLoRaAdaptiveRateSilenceTimeout
+#define kLoRaAdaptiveRateSilenceTimeout 60000
+#endif
+
+/**
+ * @brief Amount of times a request to change the level is sent before giving up
+ *
+ */
+#ifndef kLoRaAdaptiveRateMaximumRequests
+#define kLoRaAdaptiveRateMaximumRequests 3
+#endif
+
+namespace LoRaAdaptiveRate
+{
+    /**
+     * @brief Size of a request or acknowledgement
+     * type, length, source address (2 bytes) and the new air rate level
+     *
+     */
+    const size_t kFrameSize = 5;
+
+    enum class FrameType : uint8_t
+    {
+        kFrameTypeRequest = 0x60,
+        kFrameTypeAcknowledgement = 0x70,
+    };
+
+    /**
+     * @brief Time in milliseconds added to the request timeout for UART transfers and switching the level
+     *
+     */
+    const unsigned long kProcessingTime = 200;
+
+    /**
+     * @brief Largest factor the step up threshold grows with after failed attempts to go faster
+     *
+     */
+    const uint8_t kMaximumBackoffFactor = 8;
+
+    /**
+     * @brief Counters of the adaptive rate layer
+     *
+     */
+    struct LoRaAdaptiveRateStatistics
+    {
+        unsigned long steps_up;
+        unsigned long steps_down;
+        unsigned long fallbacks;       // Returned to the slowest level because the peer was not heard
+        unsigned long failed_requests; // Peer did not acknowledge a change
+    };
+
+    /**
+     * @brief Chooses the air rate level per peer
+     * Both sides switch after a request and acknowledgement, sent on the old level.
+     * A failed attempt to go faster doubles the amount of deliveries needed for the next attempt.
+     * The module listens on one level, so a gateway should expect its peers one at a time, see Select.
+     *
+     */
+    class LoRaAdaptiveRate
+    {
+    public:
+        /**
+         * @brief Construct a new adaptive rate layer
+         *
+         * @param lora driver of the module, which must be in fixed point transmission mode
+         * @param local_address address of this module
+         * @param channel channel of the network
+         */
+        LoRaAdaptiveRate(UsrLg206P *const lora, const uint16_t local_address, const uint8_t channel);
+
+        /**
+         * @brief Set the slowest and fastest level to use, peers start at the slowest
+         *
+         * @return kInvalidParameter if a level is undefined or the minimum is faster than the maximum
+         */
+        LoRaErrorCode SetLevelRange(const LoRaSettings::LoRaAirRateLevel minimum, const LoRaSettings::LoRaAirRateLevel maximum);
+
+        /**
+         * @brief Switch the module to the level of a peer, call this before sending to or expecting a message from it
+         *
+         * @return error of the driver if the level could not be set
+         */
+        LoRaErrorCode Select(const uint16_t address);
+
+        /**
+         * @brief Report the result of a message sent to a peer, for example from the delivery callback of the reliable layer
+         *
+         * @param address of the peer
+         * @param delivered true if the peer acknowledged the message
+         */
+        void ReportDelivery(const uint16_t address, const bool delivered);
+
+        /**
+         * @brief Report a message received from a peer, so it is not seen as silent
+         *
+         */
+        void ReportReception(const uint16_t address);
+
+        /**
+         * @brief Send requests to change the level and fall back for silent peers, call this regularly
+         *
+         */
+        void Update(void);
+
+        /**
+         * @brief Read a frame from the module, requests and acknowledgements are handled and not returned
+         *
+         * @param buffer to store other frames in
+         * @param buffer_size size of the buffer
+         * @return size of the frame, 0 if nothing or a frame of this layer was received
+         */
+        size_t Receive(uint8_t *buffer, const size_t buffer_size);
+
+        /**
+         * @brief Handle a frame received by the sketch itself
+         *
+         * @return true if the frame was a request or acknowledgement
+         */
+        bool HandleFrame(const uint8_t *frame, const size_t size);
+
+        /**
+         * @brief Get the level used for a peer
+         *
+         * @return level, the slowest level for unknown peers
+         */
+        LoRaSettings::LoRaAirRateLevel GetLevel(const uint16_t address) const;
+
+        /**
+         * @brief Check if a change of level for a peer waits for an acknowledgement
+         *
+         */
+        bool HasPendingChange(const uint16_t address) const;
+
+        const LoRaAdaptiveRateStatistics &GetStatistics(void) const;
+
+    private:
+        struct Peer
+        {
+            bool in_use;
+            uint16_t address;
+            LoRaSettings::LoRaAirRateLevel level;
+            LoRaSettings::LoRaAirRateLevel requested_level; // Undefined when no change is pending
+            uint8_t requests;                               // Amount of times the request was sent
+            unsigned long requested_at;
+            uint8_t successes;        // Deliveries in a row
+            uint8_t failures;         // Failed deliveries in a row
+            uint8_t backoff_factor;   // Step up threshold is multiplied by this
+            bool probing;             // Level was raised and no message was delivered on it yet
+            unsigned long last_heard; // Used for the fall back and to replace the least recently heard peer
+        };
+
+        UsrLg206P *lora_;
+        uint16_t local_address_;
+        uint8_t channel_;
+        LoRaSettings::LoRaAirRateLevel minimum_level_;
+        LoRaSettings::LoRaAirRateLevel maximum_level_;
+        LoRaSettings::LoRaAirRateLevel module_level_; // Level set on the module, undefined until set by this layer
+        uint16_t selected_address_;
+        LoRaAdaptiveRateStatistics statistics_;
+        Peer peers_[kLoRaAdaptiveRateAmountOfPeers];
+
+        Peer *GetPeer(const uint16_t address);
+        const Peer *FindPeer(const uint16_t address) const;
+        void Request(Peer &peer, const LoRaSettings::LoRaAirRateLevel level);
+        void ChangeLevel(Peer &peer, const LoRaSettings::LoRaAirRateLevel level);
+        LoRaErrorCode ApplyLevel(const LoRaSettings::LoRaAirRateLevel level);
+        bool SendFrame(const FrameType type, const uint16_t destination_address, const LoRaSettings::LoRaAirRateLevel level);
+        unsigned long GetRequestTimeout(const LoRaSettings::LoRaAirRateLevel level) const;
+    };
+} // namespace LoRaAdaptiveRate
+
+#endif // USR_LG206_P_ADAPTIVE_RATE_H_
@@ -0,0 +1,183 @@
+/**
+ * @file usr_lg206_p_aggregation.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Coalesces small records per destination into one frame, so the overhead of a transmission is shared
+ * @version 0.1
+ * @date 2024-03-09
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_AGGREGATION_H_
+#define USR_LG206_P_AGGREGATION_H_
+
+#include "usr_lg206_p.h"
+#include "usr_lg206_p_frame_reader.h"
+
+/**
+ * @brief Largest frame sent, a batch never grows larger than this
+ *
+ */
+#ifndef kLoRaAggregationFrameSize
+#define kLoRaAggregationFrameSize 64
+#endif
+
+/**
+ * @brief Amount of destinations records can be collected for at the same time
+ *
+ */
+#ifndef kLoRaAggregationAmountOfBuffers
+#define kLoRaAggregationAmountOfBuffers 2
+#endif
+
+/**
+ * @brief Time in milliseconds a record may wait before its batch is sent
+ *
+ */
+#ifndef kLoRaAggregationMaximumAge
+#define kLoRaAggregationMaximumAge 5000
+#endif
+
+namespace LoRaAggregation
+{
+    /**
+     * @brief Every frame starts with one byte holding the size of the records after it
+     *
+     */
+    const size_t kFrameHeaderSize = 1;
+    static_assert(kLoRaAggregationFrameSize - kFrameHeaderSize <= 255, "The size of the records is sent in one byte");
+
+    /**
+     * @brief Every record is preceded by one byte holding its length
+     *
+     */
+    const size_t kRecordHeaderSize = 1;
+
+    /**
+     * @brief Largest record which can be written
+     *
+     */
+    const size_t kMaximumRecordSize = kLoRaAggregationFrameSize - kFrameHeaderSize - kRecordHeaderSize;
+
+    /**
+     * @brief Counters of the aggregator
+     *
+     */
+    struct LoRaAggregationStatistics
+    {
+        unsigned long records_written;
+        unsigned long frames_sent;
+        unsigned long records_received;
+        unsigned long frames_received;
+    };
+
+    /**
+     * @brief Class used to collect records and send them as one frame
+     * A batch is sent when the next record does not fit, when it reaches the flush threshold,
+     * when its oldest record reaches the maximum age or when Flush is called.
+     * Records sent in transparent mode are kept apart from records for fixed point destinations.
+     *
+     */
+    class LoRaAggregator
+    {
+    public:
+        LoRaAggregator(UsrLg206P *const lora);
+
+        /**
+         * @brief Set the size at which a batch is sent right away
+         *
+         * @param threshold in bytes of records, at most kLoRaAggregationFrameSize - kFrameHeaderSize
+         * @return kInvalidParameter if out of range
+         */
+        LoRaErrorCode SetFlushThreshold(const size_t threshold);
+
+        /**
+         * @brief Set the time a record may wait in a batch, checked by Update
+         *
+         * @param maximum_age in milliseconds
+         */
+        void SetMaximumAge(const unsigned long maximum_age);
+
+        /**
+         * @brief Add a record to the batch sent in transparent mode
+         *
+         * @param record data of the record
+         * @param size of the record, at most kMaximumRecordSize
+         * @return kMessageTooLarge, kInvalidParameter for an empty record or the first failed flush
+         */
+        LoRaErrorCode Write(const uint8_t *record, const size_t size);
+
+        /**
+         * @brief Add a record to the batch of a destination in fixed point mode
+         *
+         * @param record data of the record
+         * @param size of the record, at most kMaximumRecordSize
+         * @param destination_address of the other module
+         * @param channel of the other module
+         * @return kMessageTooLarge, kInvalidParameter for an empty record or the first failed flush
+         */
+        LoRaErrorCode Write(const uint8_t *record, const size_t size, const uint16_t destination_address, const uint8_t channel);
+
+        /**
+         * @brief Send all batches
+         *
+         * @return kWrongWorkMode if a batch could not be sent
+         */
+        LoRaErrorCode Flush(void);
+
+        /**
+         * @brief Send the batches of which the oldest record reached the maximum age, call this regularly
+         *
+         * @return kWrongWorkMode if a batch could not be sent
+         */
+        LoRaErrorCode Update(void);
+
+        /**
+         * @brief Get the amount of bytes waiting to be sent
+         *
+         */
+        size_t GetAmountPending(void) const;
+
+        /**
+         * @brief Read the next record received, a corrupt record drops the rest of its frame
+         *
+         * @param buffer to store the record in
+         * @param buffer_size size of the buffer, a larger record is truncated
+         * @return size of the record, 0 if no record is available
+         */
+        size_t ReceiveRecord(uint8_t *buffer, const size_t buffer_size);
+
+        const LoRaAggregationStatistics &GetStatistics(void) const;
+
+    private:
+        struct Batch
+        {
+            bool in_use;
+            bool fixed_point;
+            uint16_t destination_address;
+            uint8_t channel;
+            unsigned long started_at;
+            // Size of the records, they start after the frame header
+            size_t size;
+            uint8_t data[kLoRaAggregationFrameSize];
+        };
+
+        UsrLg206P *lora_;
+        size_t flush_threshold_;
+        unsigned long maximum_age_;
+        LoRaAggregationStatistics statistics_;
+
+        Batch batches_[kLoRaAggregationAmountOfBuffers];
+        LoRaFrameReader::LoRaFrameReader<2 * kLoRaAggregationFrameSize + 1, kFrameHeaderSize, 0> receive_buffer_;
+        // Frame the records are read from, valid until the next frame is received
+        uint8_t *frame_;
+        size_t frame_size_;
+        size_t record_position_;
+
+        LoRaErrorCode Add(const uint8_t *record, const size_t size, const bool fixed_point, const uint16_t destination_address, const uint8_t channel);
+        Batch *GetBatch(const bool fixed_point, const uint16_t destination_address, const uint8_t channel, LoRaErrorCode &result);
+        LoRaErrorCode Send(Batch &batch);
+    };
+} // namespace LoRaAggregation
+
+#endif // USR_LG206_P_AGGREGATION_H_
@@ -0,0 +1,65 @@
+#ifndef USR_LG206_P_AIR_TIME_H_
+#define USR_LG206_P_AIR_TIME_H_
+#include <Arduino.h>
+#include "usr_lg206_p_settings.h"
+#include "usr_lg206_p_uart_settings.h"
+
+/**
+ * @brief Amount of preamble symbols the module sends in front of every packet
+ *
+ */
+#ifndef kLoRaPreambleLength
+#define kLoRaPreambleLength 8
+#endif
+
+namespace LoRaAirTime
+{
+    /**
+     * @brief Radio parameters behind one LoRaAirRateLevel
+     *
+     */
+    struct LoRaModulation
+    {
+        uint8_t spreading_factor;
+        uint32_t bandwidth; // in Hz
+        uint8_t coding_rate; // 1 for 4/5 up to 4 for 4/8
+    };
+
+    /**
+     * @brief Get the modulation the module uses for an air rate level
+     *
+     * @param level air rate level set with +SPD
+     * @param modulation OUTPUT spreading factor, bandwidth and coding rate
+     * @return true if the level is known, false if undefined
+     */
+    bool GetModulation(const LoRaSettings::LoRaAirRateLevel level, LoRaModulation &modulation);
+
+    /**
+     * @brief Get the nominal bit rate of an air rate level
+     *
+     * @param level air rate level set with +SPD
+     * @return bits per second, 0 if the level is undefined
+     */
+    uint16_t GetAirRate(const LoRaSettings::LoRaAirRateLevel level);
+
+    /**
+     * @brief Get the time a packet occupies the channel
+     * Calculated with the LoRa time on air formula for explicit header and CRC on
+     *
+     * @param level air rate level set with +SPD
+     * @param payload_size amount of bytes sent over the air
+     * @return time on air in microseconds, 0 if the level is undefined
+     */
+    unsigned long GetTimeOnAir(const LoRaSettings::LoRaAirRateLevel level, const size_t payload_size);
+
+    /**
+     * @brief Get the time bytes need to cross the UART between microcontroller and module
+     *
+     * @param settings uart settings of the module
+     * @param size amount of bytes
+     * @return time in microseconds, 0 if the baudrate is undefined
+     */
+    unsigned long GetUartTime(const LoRaUartSettings::LoRaUartSettings &settings, const size_t size);
+} // namespace LoRaAirTime
+
+#endif // USR_LG206_P_AIR_TIME_H_
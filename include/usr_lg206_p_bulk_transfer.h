@@ -0,0 +1,296 @@
+/**
+ * @file usr_lg206_p_bulk_transfer.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Transfer of files larger than memory over fixed point mode, with a selective repeat window and resume
+ * @version 0.1
+ * @date 2024-03-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_BULK_TRANSFER_H_
+#define USR_LG206_P_BULK_TRANSFER_H_
+
+#include "usr_lg206_p.h"
+#include "usr_lg206_p_frame_reader.h"
+
+/**
+ * @brief Largest amount of data in one chunk, the receiver keeps a window of chunks in memory
+ *
+ */
+#ifndef kLoRaBulkTransferMaximumChunkSize
+#define kLoRaBulkTransferMaximumChunkSize 48
+#endif
+
+/**
+ * @brief Largest amount of chunks sent before an acknowledgement is needed, at most 16
+ *
+ */
+#ifndef kLoRaBulkTransferWindowSize
+#define kLoRaBulkTransferWindowSize 8
+#endif
+
+/**
+ * @brief Time in milliseconds added to the acknowledgement timeout for UART transfers and processing on both sides
+ *
+ */
+#ifndef kLoRaBulkTransferProcessingTime
+#define kLoRaBulkTransferProcessingTime 200
+#endif
+
+namespace LoRaBulkTransfer
+{
+    static_assert(kLoRaBulkTransferWindowSize >= 1 && kLoRaBulkTransferWindowSize <= 16, "Acknowledgements hold a bitmap of 16 chunks");
+
+    /**
+     * @brief Size of the header in front of every frame
+     * type, payload length, transfer id, source address (2 bytes) and source channel
+     *
+     */
+    const size_t kHeaderSize = 6;
+
+    /**
+     * @brief Size of the chunk index in front of the data, its highest bit asks for an acknowledgement
+     *
+     */
+    const size_t kChunkIndexSize = 2;
+
+    const size_t kStartSize = 9;
+    const size_t kAcknowledgementSize = 5;
+
+    const uint16_t kFlagAcknowledge = 0x8000;
+
+    /**
+     * @brief Largest amount of chunks in one transfer, limited by the chunk index
+     *
+     */
+    const uint16_t kMaximumAmountOfChunks = 0x7FFF;
+
+    enum class FrameType : uint8_t
+    {
+        kFrameTypeStart = 0xF0,
+        kFrameTypeData = 0xF1,
+        kFrameTypeAcknowledgement = 0xF2,
+    };
+
+    /**
+     * @brief Counters of the bulk transfer layer
+     *
+     */
+    struct LoRaBulkTransferStatistics
+    {
+        unsigned long chunks_sent;
+        unsigned long retransmissions;
+        unsigned long chunks_received;
+        unsigned long duplicate_chunks;
+        unsigned long transfers_completed;
+        unsigned long transfers_failed;
+    };
+
+    /**
+     * @brief Called by the sender for the data of a chunk, chunks can be read more than once
+     *
+     * @param offset in the file
+     * @param buffer to store the data in
+     * @param size amount of bytes to read
+     * @return amount of bytes read
+     */
+    typedef size_t (*ReadCallback)(const uint32_t offset, uint8_t *buffer, const size_t size);
+
+    /**
+     * @brief Called by the receiver for every chunk, in order and once
+     *
+     * @param offset in the file
+     * @param data of the chunk
+     * @param size of the chunk
+     */
+    typedef void (*WriteCallback)(const uint32_t offset, const uint8_t *data, const size_t size);
+
+    /**
+     * @brief Called on both sides when more of the file is acknowledged or received in order
+     *
+     * @param peer_address address of the other module
+     * @param bytes_done amount of bytes transferred
+     * @param size of the file
+     */
+    typedef void (*ProgressCallback)(const uint16_t peer_address, const uint32_t bytes_done, const uint32_t size);
+
+    /**
+     * @brief Called on both sides when a transfer ends
+     *
+     * @param peer_address address of the other module
+     * @param sending true on the side that sent the file
+     * @param result kSucces, kChecksumMismatch, kNoResponse or the error the receiver refused the transfer with
+     */
+    typedef void (*CompleteCallback)(const uint16_t peer_address, const bool sending, const LoRaErrorCode result);
+
+    /**
+     * @brief Class used to send and receive files of up to kMaximumAmountOfChunks chunks in fixed point mode
+     * Chunks are sent back to back until the window is full, only the last one waits for an acknowledgement, which
+     * tells which chunks are missing so only those are sent again. The receiver remembers how far the last transfer
+     * got, so sending the same file again after an interruption continues where it stopped.
+     *
+     */
+    class LoRaBulkTransfer
+    {
+    public:
+        /**
+         * @brief Construct a new bulk transfer layer
+         *
+         * @param lora driver of the module, which must be in fixed point transmission mode
+         * @param local_address address of this module
+         * @param local_channel channel of this module
+         */
+        LoRaBulkTransfer(UsrLg206P *const lora, const uint16_t local_address, const uint8_t local_channel);
+
+        /**
+         * @brief Set the air rate level the module uses, chunks are spaced by their time on air and the timeout is derived from it
+         *
+         * @param level air rate level set on the module
+         */
+        void SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level);
+
+        /**
+         * @brief Set the size of the chunks sent
+         *
+         * @return kInvalidParameter if 0 or larger than kLoRaBulkTransferMaximumChunkSize
+         */
+        LoRaErrorCode SetChunkSize(const size_t chunk_size);
+
+        /**
+         * @brief Set the amount of chunks sent before an acknowledgement is needed
+         *
+         * @return kInvalidParameter if 0 or larger than kLoRaBulkTransferWindowSize
+         */
+        LoRaErrorCode SetWindowSize(const uint8_t window_size);
+
+        /**
+         * @brief Set the amount of timeouts in a row after which a transfer fails
+         *
+         */
+        void SetMaximumRetries(const uint8_t retries);
+
+        void SetReadCallback(ReadCallback callback);
+
+        /**
+         * @brief Set the callback files are written with, without one incoming transfers are refused
+         *
+         */
+        void SetWriteCallback(WriteCallback callback);
+
+        void SetProgressCallback(ProgressCallback callback);
+
+        void SetCompleteCallback(CompleteCallback callback);
+
+        /**
+         * @brief Start sending a file which is read with the read callback, Update sends the chunks
+         * The file is read once here to calculate its CRC-32.
+         *
+         * @param size of the file
+         * @param destination_address of the other module
+         * @param channel of the other module
+         * @return kQueueFull if a transfer is in progress, kMessageTooLarge, kInvalidParameter when empty or without read callback,
+         * kWrongWorkMode
+         */
+        LoRaErrorCode Send(const uint32_t size, const uint16_t destination_address, const uint8_t channel);
+
+        /**
+         * @brief Stop sending, the receiver keeps what it got so the transfer can be resumed
+         *
+         */
+        void Abort(void);
+
+        /**
+         * @brief Handle received frames and send the next chunk, call this regularly
+         *
+         */
+        void Update(void);
+
+        bool IsSending(void) const;
+
+        /**
+         * @brief Get the time the sender waits for an acknowledgement after the last chunk of a window
+         *
+         * @return timeout in milliseconds
+         */
+        unsigned long GetAcknowledgementTimeout(void) const;
+
+        const LoRaBulkTransferStatistics &GetStatistics(void) const;
+
+    private:
+        enum class State : uint8_t
+        {
+            kIdle,
+            kStarting, // Waiting for the receiver to accept
+            kSending,
+        };
+
+        struct Outgoing
+        {
+            State state;
+            uint8_t transfer_id;
+            uint16_t destination_address;
+            uint8_t channel;
+            uint32_t size;
+            uint32_t crc;
+            uint16_t amount_of_chunks;
+            uint16_t base;   // Lowest chunk not acknowledged
+            uint16_t next;   // Next chunk not sent before
+            uint16_t resend; // Bit i is set when chunk base + i must be sent again
+            bool waiting;    // Last chunk asked for an acknowledgement
+            uint8_t retries;
+            unsigned long sent_at;
+            unsigned long busy_for;
+        };
+
+        struct Incoming
+        {
+            bool active;
+            bool complete;
+            uint8_t transfer_id;
+            uint16_t source_address;
+            uint8_t channel;
+            uint32_t size;
+            uint32_t crc;          // Sent by the sender
+            uint32_t received_crc; // Of the chunks written so far
+            uint8_t chunk_size;
+            uint16_t amount_of_chunks;
+            uint16_t base;     // Lowest chunk not received
+            uint16_t received; // Bit i is set when chunk base + i is kept in the window
+            uint8_t sizes[kLoRaBulkTransferWindowSize];
+            uint8_t chunks[kLoRaBulkTransferWindowSize][kLoRaBulkTransferMaximumChunkSize];
+        };
+
+        UsrLg206P *lora_;
+        uint16_t local_address_;
+        uint8_t local_channel_;
+        LoRaSettings::LoRaAirRateLevel air_rate_level_;
+        size_t chunk_size_;
+        uint8_t window_size_;
+        uint8_t maximum_retries_;
+        ReadCallback read_callback_;
+        WriteCallback write_callback_;
+        ProgressCallback progress_callback_;
+        CompleteCallback complete_callback_;
+        LoRaBulkTransferStatistics statistics_;
+
+        Outgoing outgoing_;
+        Incoming incoming_;
+        uint8_t next_transfer_id_;
+
+        LoRaFrameReader::LoRaFrameReader<2 * (kHeaderSize + kChunkIndexSize + kLoRaBulkTransferMaximumChunkSize) + 1, kHeaderSize> receive_buffer_;
+
+        void WriteHeader(uint8_t *frame, const FrameType type, const uint8_t length, const uint8_t transfer_id) const;
+        bool Transmit(const uint8_t *frame, const size_t size, const uint16_t destination_address, const uint8_t channel);
+        void SendStart(void);
+        void SendChunk(void);
+        void SendAcknowledgement(const LoRaErrorCode status);
+        void Finish(const LoRaErrorCode result);
+        void HandleFrame(const uint8_t *frame, const size_t size);
+        void HandleStart(const uint8_t *frame, const uint16_t source_address, const uint8_t source_channel);
+        void HandleData(const uint8_t *frame, const size_t size, const uint16_t source_address);
+        void HandleAcknowledgement(const uint8_t *frame, const uint16_t source_address);
+    };
+} // namespace LoRaBulkTransfer
+
+#endif // USR_LG206_P_BULK_TRANSFER_H_
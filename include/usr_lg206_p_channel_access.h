@@ -0,0 +1,131 @@
+/**
+ * @file usr_lg206_p_channel_access.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Listen before talk with randomised exponential backoff, based on activity seen on the UART of the module
+ * @version 0.1
+ * @date 2024-03-11
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_CHANNEL_ACCESS_H_
+#define USR_LG206_P_CHANNEL_ACCESS_H_
+
+#include "usr_lg206_p.h"
+#include "usr_lg206_p_random.h"
+
+/**
+ * @brief Time in milliseconds of one backoff slot when no air rate level is set
+ *
+ */
+#ifndef kLoRaChannelAccessSlotTime
+#define kLoRaChannelAccessSlotTime 50
+#endif
+
+/**
+ * @brief Amount of times the channel is checked before a message is given up
+ *
+ */
+#ifndef kLoRaChannelAccessMaximumAttempts
+#define kLoRaChannelAccessMaximumAttempts 6
+#endif
+
+namespace LoRaChannelAccess
+{
+    /**
+     * @brief Backoff window does not grow beyond 2^kMaximumBackoffExponent slots
+     *
+     */
+    const uint8_t kMaximumBackoffExponent = 6;
+
+    /**
+     * @brief Counters of the channel access layer
+     *
+     */
+    struct LoRaChannelAccessStatistics
+    {
+        unsigned long transmissions;
+        unsigned long deferrals;    // Times the channel was busy and the message waited
+        unsigned long failures;     // Messages given up because the channel stayed busy
+        unsigned long backoff_time; // Total time in milliseconds spent waiting
+    };
+
+    /**
+     * @brief Class used to send only when no other module seems to be transmitting
+     * The module outputs a received frame over UART, so data arriving means the channel was just in use.
+     * The channel counts as busy until a guard time after the last byte, as answers often follow right away.
+     * Frames which are not received, e.g. for another address in fixed point mode, can not be detected.
+     *
+     */
+    class LoRaChannelAccess
+    {
+    public:
+        LoRaChannelAccess(UsrLg206P *const lora);
+
+        /**
+         * @brief Set the air rate level the module uses, the slot and guard time are derived from it
+         *
+         * @param level air rate level set on the module
+         */
+        void SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level);
+
+        /**
+         * @brief Set the amount of times the channel is checked before a message is given up
+         *
+         * @param attempts at least 1
+         * @return kInvalidParameter if 0
+         */
+        LoRaErrorCode SetMaximumAttempts(const uint8_t attempts);
+
+        /**
+         * @brief Seed the backoff, give every module a different seed e.g. its address
+         *
+         * @param seed of the pseudo random generator
+         */
+        void SetRandomSeed(const uint32_t seed);
+
+        /**
+         * @brief Check if the channel is clear, also keeps track of activity when called regularly
+         *
+         * @return true if no data arrived during the guard time
+         */
+        bool IsChannelClear(void);
+
+        /**
+         * @brief Send a message in transparent mode once the channel is clear, blocks during the backoff
+         *
+         * @return kChannelBusy if the channel stayed busy, kWrongWorkMode
+         */
+        LoRaErrorCode SendMessage(const uint8_t *message, const size_t size);
+
+        /**
+         * @brief Send a message in fixed point mode once the channel is clear, blocks during the backoff
+         *
+         * @return kChannelBusy if the channel stayed busy, kWrongWorkMode
+         */
+        LoRaErrorCode SendMessage(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel);
+
+        /**
+         * @brief Get the time of one backoff slot, equal to the guard time
+         *
+         * @return time in milliseconds
+         */
+        unsigned long GetSlotTime(void) const;
+
+        const LoRaChannelAccessStatistics &GetStatistics(void) const;
+
+    private:
+        UsrLg206P *lora_;
+        LoRaSettings::LoRaAirRateLevel air_rate_level_;
+        uint8_t maximum_attempts_;
+        uint32_t seed_;
+        int last_available_;
+        unsigned long last_activity_;
+        bool activity_seen_;
+        LoRaChannelAccessStatistics statistics_;
+
+        bool WaitForClearChannel(void);
+    };
+} // namespace LoRaChannelAccess
+
+#endif // USR_LG206_P_CHANNEL_ACCESS_H_
@@ -0,0 +1,167 @@
+/**
+ * @file usr_lg206_p_channel_survey.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Survey of a range of channels and moving a pair of modules to another channel together
+ * @version 0.1
+ * @date 2024-03-15
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_CHANNEL_SURVEY_H_
+#define USR_LG206_P_CHANNEL_SURVEY_H_
+
+#include "usr_lg206_p.h"
+
+/**
+ * @brief Largest amount of channels surveyed at once
+ *
+ */
+#ifndef kLoRaChannelSurveyMaximumChannels
+#define kLoRaChannelSurveyMaximumChannels 16
+#endif
+
+/**
+ * @brief Time in milliseconds between checks for received data while dwelling on a channel
+ *
+ */
+#ifndef kLoRaChannelSurveyPollInterval
+#define kLoRaChannelSurveyPollInterval 5
+#endif
+
+/**
+ * @brief Amount of times a request to move is sent on the old channel, and once more on the new one
+ *
+ */
+#ifndef kLoRaChannelSurveyMaximumRequests
+#define kLoRaChannelSurveyMaximumRequests 3
+#endif
+
+namespace LoRaChannelSurvey
+{
+    /**
+     * @brief Size of a request to move or its acknowledgement
+     * type, length, source address (2 bytes) and the new channel
+     *
+     */
+    const size_t kFrameSize = 5;
+
+    enum class FrameType : uint8_t
+    {
+        kFrameTypeMove = 0x80,
+        kFrameTypeMoveAcknowledgement = 0x90,
+    };
+
+    /**
+     * @brief Time in milliseconds added to the acknowledgement timeout for UART transfers and switching the channel
+     *
+     */
+    const unsigned long kProcessingTime = 200;
+
+    /**
+     * @brief Traffic seen on one channel
+     *
+     */
+    struct ChannelResult
+    {
+        uint8_t channel;
+        unsigned long frames;
+        unsigned long bytes;
+        uint16_t occupancy; // Estimated time on air of the received data, per mille of the dwell time
+    };
+
+    /**
+     * @brief Measures the traffic other modules send on a range of channels and ranks the channels
+     * The module has no signal strength, so only data received over UART is measured. Frames other modules
+     * receive on the same channel and air rate level are the interference this module would cause and suffer.
+     *
+     */
+    class LoRaChannelSurvey
+    {
+    public:
+        /**
+         * @brief Construct a new channel survey
+         *
+         * @param lora driver of the module
+         * @param local_address address of this module
+         * @param channel channel the module is on
+         */
+        LoRaChannelSurvey(UsrLg206P *const lora, const uint16_t local_address, const uint8_t channel);
+
+        /**
+         * @brief Set the air rate level of the module, used to estimate the occupancy of a channel
+         * The slowest level is assumed until it is set.
+         *
+         */
+        void SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level);
+
+        /**
+         * @brief Dwell on every channel of a range and measure the received traffic, blocks until done
+         * The module is in transparent mode meanwhile to receive frames for other modules as well. It returns to
+         * its channel and work mode afterwards, data received meanwhile is lost.
+         *
+         * @param first_channel first channel of the range
+         * @param last_channel last channel of the range, at most 127
+         * @param dwell_time time in milliseconds spent on every channel
+         * @return kInvalidParameter if the range is empty or too large, error of the driver if a setting could not be read or set
+         */
+        LoRaErrorCode Survey(const uint8_t first_channel, const uint8_t last_channel, const unsigned long dwell_time);
+
+        /**
+         * @brief Get the results of the last survey, best channel first
+         * Channels are ranked by occupancy, then by amount of frames.
+         *
+         * @param results OUTPUT array to store the results in
+         * @param size size of the array
+         * @return amount of results stored
+         */
+        size_t GetRanking(ChannelResult *results, const size_t size) const;
+
+        /**
+         * @brief Move this module and a peer to another channel together, blocks until done
+         * The peer has to pass its received frames to HandleFrame, or use Receive.
+         *
+         * @param peer_address address of the peer
+         * @param channel new channel
+         * @return kNoResponse if the peer did not acknowledge, both stay on the old channel then
+         */
+        LoRaErrorCode MovePair(const uint16_t peer_address, const uint8_t channel);
+
+        /**
+         * @brief Read a frame from the module, requests to move are handled and not returned
+         *
+         * @param buffer to store other frames in
+         * @param buffer_size size of the buffer
+         * @return size of the frame, 0 if nothing or a frame of this layer was received
+         */
+        size_t Receive(uint8_t *buffer, const size_t buffer_size);
+
+        /**
+         * @brief Handle a frame received by the sketch itself
+         *
+         * @return true if the frame was a request to move or its acknowledgement
+         */
+        bool HandleFrame(const uint8_t *frame, const size_t size);
+
+        /**
+         * @brief Get the channel the module is on
+         *
+         */
+        uint8_t GetChannel(void) const;
+
+    private:
+        UsrLg206P *lora_;
+        uint16_t local_address_;
+        uint8_t channel_;
+        LoRaSettings::LoRaAirRateLevel air_rate_level_;
+        ChannelResult results_[kLoRaChannelSurveyMaximumChannels];
+        size_t amount_of_results_;
+
+        LoRaErrorCode SwitchChannel(const uint8_t channel, const LoRaSettings::WorkMode work_mode);
+        bool SendFrame(const FrameType type, const uint16_t destination_address, const uint8_t channel);
+        bool WaitForAcknowledgement(const uint16_t peer_address, const uint8_t channel);
+        static bool IsBetter(const ChannelResult &a, const ChannelResult &b);
+    };
+} // namespace LoRaChannelSurvey
+
+#endif // USR_LG206_P_CHANNEL_SURVEY_H_
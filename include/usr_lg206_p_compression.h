@@ -0,0 +1,201 @@
+/**
+ * @file usr_lg206_p_compression.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Small RAM compression of payloads, with varint and delta helpers for series of integers
+ * @version 0.1
+ * @date 2024-03-08
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_COMPRESSION_H_
+#define USR_LG206_P_COMPRESSION_H_
+
+#include "usr_lg206_p.h"
+#include "usr_lg206_p_frame_reader.h"
+
+/**
+ * @brief Largest message the codec can send or receive, used for the buffers of the codec
+ *
+ */
+#ifndef kLoRaCompressionMaximumMessageSize
+#define kLoRaCompressionMaximumMessageSize 128
+#endif
+
+/**
+ * @brief Amount of entries of the hash table Compress finds matches with, 4 bytes per entry on the stack
+ * Each entry holds the last position of the 3 bytes with that hash, more entries find more matches.
+ *
+ */
+#ifndef kLoRaCompressionHashSize
+#define kLoRaCompressionHashSize 64
+#endif
+
+namespace LoRaCompression
+{
+    /**
+     * @brief Matches refer at most this many bytes back, into the dictionary as well
+     *
+     */
+    const size_t kMaximumOffset = 4095;
+    const size_t kMinimumMatchLength = 3;
+    const size_t kMaximumMatchLength = kMinimumMatchLength + 15;
+
+    /**
+     * @brief Method byte followed by the size of the payload
+     *
+     */
+    const size_t kHeaderSize = 2;
+    static_assert(kLoRaCompressionMaximumMessageSize <= 255, "The size of the payload is sent in one byte");
+
+    /**
+     * @brief First byte of a frame sent by the codec
+     *
+     */
+    enum class Method : uint8_t
+    {
+        kMethodRaw = 0,
+        kMethodCompressed = 1,
+    };
+
+    /**
+     * @brief Compress data with LZSS, a flag byte announces for 8 items whether they are a literal or a match
+     * A match takes 2 bytes, 12 bits offset and 4 bits length. Matches are found through a hash table of
+     * kLoRaCompressionHashSize entries instead of searching the whole window, so it is fast but may miss a match.
+     *
+     * @param input data to compress
+     * @param input_size size of the data
+     * @param output buffer for the compressed data
+     * @param output_size size of the buffer
+     * @param dictionary preset data matches can refer to, must be the same when decompressing
+     * @param dictionary_size size of the dictionary, only the last kMaximumOffset bytes are used
+     * @return size of the compressed data, 0 if it does not fit in output
+     */
+    size_t Compress(const uint8_t *input, const size_t input_size, uint8_t *output, const size_t output_size,
+                    const uint8_t *dictionary = nullptr, const size_t dictionary_size = 0);
+
+    /**
+     * @brief Decompress data compressed with Compress
+     *
+     * @return size of the decompressed data, 0 if the data is invalid or does not fit in output
+     */
+    size_t Decompress(const uint8_t *input, const size_t input_size, uint8_t *output, const size_t output_size,
+                      const uint8_t *dictionary = nullptr, const size_t dictionary_size = 0);
+
+    /**
+     * @brief Write an unsigned integer in 7 bits per byte, small values take one byte
+     *
+     * @param value to write
+     * @param buffer to write to
+     * @param buffer_size size of the buffer
+     * @return bytes written, 0 if it does not fit
+     */
+    size_t EncodeVarint(uint32_t value, uint8_t *buffer, const size_t buffer_size);
+
+    /**
+     * @brief Read an unsigned integer written by EncodeVarint
+     *
+     * @param buffer to read from
+     * @param buffer_size size of the buffer
+     * @param value OUTPUT value read
+     * @return bytes read, 0 if the buffer ends before the value
+     */
+    size_t DecodeVarint(const uint8_t *buffer, const size_t buffer_size, uint32_t &value);
+
+    /**
+     * @brief Map signed to unsigned integers so small negative values stay small, -1 becomes 1 and 1 becomes 2
+     *
+     */
+    uint32_t EncodeZigZag(const int32_t value);
+    int32_t DecodeZigZag(const uint32_t value);
+
+    /**
+     * @brief Write a series as the first value followed by the differences between values, as zigzag varints
+     *
+     * @param values series to write
+     * @param amount of values
+     * @param buffer to write to
+     * @param buffer_size size of the buffer
+     * @return bytes written, 0 if it does not fit
+     */
+    size_t EncodeDeltas(const int32_t *values, const size_t amount, uint8_t *buffer, const size_t buffer_size);
+
+    /**
+     * @brief Read a series written by EncodeDeltas
+     *
+     * @param buffer to read from
+     * @param buffer_size size of the data
+     * @param values OUTPUT series read
+     * @param maximum_amount of values that fit in values
+     * @return amount of values read
+     */
+    size_t DecodeDeltas(const uint8_t *buffer, const size_t buffer_size, int32_t *values, const size_t maximum_amount);
+
+    /**
+     * @brief Class used to compress messages before they are sent and decompress them when received
+     * A message which does not get smaller is sent as it is, so a message grows by at most the two header bytes.
+     *
+     */
+    class LoRaCompression
+    {
+    public:
+        LoRaCompression(UsrLg206P *const lora);
+
+        /**
+         * @brief Set the preset dictionary shared by sender and receiver, it is not copied
+         * Fill it with data that occurs often in messages, e.g. keys or a typical message.
+         *
+         * @param dictionary data, nullptr for none
+         * @param size of the dictionary
+         */
+        void SetDictionary(const uint8_t *dictionary, const size_t size);
+
+        /**
+         * @brief Send a message in transparent mode
+         *
+         * @return bytes sent to the module, -1 if the message is larger than kLoRaCompressionMaximumMessageSize
+         */
+        int SendMessage(const uint8_t *message, const size_t size);
+
+        /**
+         * @brief Send a message in fixed point mode
+         *
+         * @return bytes sent to the module, -1 if the message is too large and -2 if not in fixed point mode
+         */
+        int SendMessage(const uint8_t *message, const size_t size, const uint16_t address, const uint8_t channel);
+
+        /**
+         * @brief Receive and decompress a message, frames which arrive together are returned one per call
+         *
+         * @param buffer to store the message in
+         * @param buffer_size size of the buffer
+         * @return size of the message, 0 if nothing or invalid data was received
+         */
+        size_t ReceiveMessage(uint8_t *buffer, const size_t buffer_size);
+
+        /**
+         * @brief Get the amount of bytes given to SendMessage
+         *
+         */
+        unsigned long GetBytesIn(void) const;
+
+        /**
+         * @brief Get the amount of bytes sent over the air by SendMessage, without fixed point header
+         *
+         */
+        unsigned long GetBytesOut(void) const;
+
+    private:
+        UsrLg206P *lora_;
+        const uint8_t *dictionary_;
+        size_t dictionary_size_;
+        unsigned long bytes_in_;
+        unsigned long bytes_out_;
+        uint8_t buffer_[kHeaderSize + kLoRaCompressionMaximumMessageSize];
+        LoRaFrameReader::LoRaFrameReader<2 * (kHeaderSize + kLoRaCompressionMaximumMessageSize) + 1, kHeaderSize> receive_buffer_;
+
+        size_t Encode(const uint8_t *message, const size_t size);
+    };
+} // namespace LoRaCompression
+
+#endif // USR_LG206_P_COMPRESSION_H_
@@ -0,0 +1,58 @@
+/**
+ * @file usr_lg206_p_crc.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Table driven CRC-16 and CRC-32 to detect corrupted frames
+ * @version 0.1
+ * @date 2024-03-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_CRC_H_
+#define USR_LG206_P_CRC_H_
+
+#include <Arduino.h>
+
+/**
+ * @brief 1 to use tables of 16 entries stored in flash, 0 to use tables of 256 entries in RAM
+ * The large tables need 5 KB of RAM, which most AVR boards can not spare.
+ *
+ */
+#ifndef kLoRaCrcSmallTables
+#ifdef __AVR__
+#define kLoRaCrcSmallTables 1
+#else
+#define kLoRaCrcSmallTables 0
+#endif
+#endif
+
+namespace LoRaCrc
+{
+    /**
+     * @brief Start value of a CRC-16
+     *
+     */
+    const uint16_t kCrc16Initial = 0xFFFF;
+
+    /**
+     * @brief Get the CRC-16/CCITT-FALSE (polynomial 0x1021) of data
+     *
+     * @param data to check
+     * @param size of the data
+     * @param crc result of a previous call to continue from
+     * @return crc of the data
+     */
+    uint16_t Crc16(const uint8_t *data, const size_t size, uint16_t crc = kCrc16Initial);
+
+    /**
+     * @brief Get the CRC-32 (polynomial 0x04C11DB7, as used by zlib and ethernet) of data
+     *
+     * @param data to check
+     * @param size of the data
+     * @param crc result of a previous call to continue from, 0 to start
+     * @return crc of the data
+     */
+    uint32_t Crc32(const uint8_t *data, const size_t size, uint32_t crc = 0);
+} // namespace LoRaCrc
+
+#endif // USR_LG206_P_CRC_H_
@@ -0,0 +1,124 @@
+/**
+ * @file usr_lg206_p_deduplication.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Cache of recently received frames, to hand every message to the application only once
+ * @version 0.1
+ * @date 2024-03-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_DEDUPLICATION_H_
+#define USR_LG206_P_DEDUPLICATION_H_
+
+#include <Arduino.h>
+
+/**
+ * @brief Amount of frames remembered, the oldest one is forgotten first
+ *
+ */
+#ifndef kLoRaDeduplicationCacheSize
+#define kLoRaDeduplicationCacheSize 16
+#endif
+
+/**
+ * @brief Time in milliseconds a frame is remembered, so a sequence number can be used again later
+ *
+ */
+#ifndef kLoRaDeduplicationLifetime
+#define kLoRaDeduplicationLifetime 60000
+#endif
+
+namespace LoRaDeduplication
+{
+    /**
+     * @brief Counters of the cache
+     *
+     */
+    struct LoRaDeduplicationStatistics
+    {
+        unsigned long lookups;
+        unsigned long hits; // Frames seen before
+    };
+
+    /**
+     * @brief Get a 32 bit FNV-1a hash
+     *
+     * @param data to hash
+     * @param size of the data
+     * @param hash result of a previous call to continue from
+     * @return hash of the data
+     */
+    uint32_t Hash(const uint8_t *data, const size_t size, uint32_t hash = 2166136261UL);
+
+    /**
+     * @brief Remembers frames by source address and sequence number, or by the hash of their payload
+     * Layers without sequence numbers, like broadcasts of the same reading by several modules, use the payload.
+     *
+     */
+    class LoRaDeduplicationCache
+    {
+    public:
+        LoRaDeduplicationCache(void);
+
+        /**
+         * @brief Check if a frame was seen before and remember it
+         *
+         * @param source_address address of the module which sent the frame
+         * @param sequence_number sequence number of the frame
+         * @return true if it was seen before
+         */
+        bool IsDuplicate(const uint16_t source_address, const uint8_t sequence_number);
+
+        /**
+         * @brief Check if a payload was seen before and remember it
+         *
+         * @param payload of the frame
+         * @param size of the payload
+         * @return true if it was seen before
+         */
+        bool IsDuplicate(const uint8_t *payload, const size_t size);
+
+        /**
+         * @brief Remember a frame without checking it, for frames sent by this module
+         * Not counted as a lookup, so the hit rate only covers received frames.
+         *
+         * @param source_address address of the module which sent the frame
+         * @param sequence_number sequence number of the frame
+         */
+        void Remember(const uint16_t source_address, const uint8_t sequence_number);
+
+        /**
+         * @brief Forget all frames
+         *
+         */
+        void Clear(void);
+
+        /**
+         * @brief Get the share of lookups that found a duplicate
+         *
+         * @return percentage, 0 if nothing was looked up yet
+         */
+        uint8_t GetHitRate(void) const;
+
+        const LoRaDeduplicationStatistics &GetStatistics(void) const;
+
+    private:
+        struct Entry
+        {
+            uint32_t key;
+            unsigned long seen_at;
+        };
+
+        Entry entries_[kLoRaDeduplicationCacheSize];
+        size_t amount_of_entries_;
+        size_t next_entry_;
+        LoRaDeduplicationStatistics statistics_;
+
+        bool Lookup(const uint32_t key);
+        bool Find(const uint32_t key) const;
+        void Insert(const uint32_t key);
+    };
+} // namespace LoRaDeduplication
+
+#endif // USR_LG206_P_DEDUPLICATION_H_
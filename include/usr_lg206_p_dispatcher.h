@@ -0,0 +1,156 @@
+/**
+ * @file usr_lg206_p_dispatcher.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Hands received frames to handlers registered per work mode and source address
+ * @version 0.1
+ * @date 2024-03-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_DISPATCHER_H_
+#define USR_LG206_P_DISPATCHER_H_
+
+#include "usr_lg206_p.h"
+#include "usr_lg206_p_deduplication.h"
+
+/**
+ * @brief Amount of handlers which can be registered
+ *
+ */
+#ifndef kLoRaDispatcherAmountOfHandlers
+#define kLoRaDispatcherAmountOfHandlers 8
+#endif
+
+/**
+ * @brief Largest frame handed to a handler, larger frames are split over several calls
+ *
+ */
+#ifndef kLoRaDispatcherBufferSize
+#define kLoRaDispatcherBufferSize 128
+#endif
+
+namespace LoRaDispatcher
+{
+    /**
+     * @brief Source address of handlers which receive frames of every module, also passed when the source is unknown
+     *
+     */
+    const uint16_t kAnySource = 65535;
+
+    /**
+     * @brief Work mode of handlers which receive frames in every work mode, also when the work mode is not known
+     *
+     */
+    const LoRaSettings::WorkMode kAnyWorkMode = LoRaSettings::WorkMode::kWorkModeUndefined;
+
+    /**
+     * @brief Called for every received frame which matches the registration
+     *
+     */
+    typedef void (*MessageHandler)(const uint8_t *message, const size_t size, const uint16_t source_address);
+
+    /**
+     * @brief Counters of the dispatcher
+     *
+     */
+    struct LoRaDispatcherStatistics
+    {
+        unsigned long frames_received;
+        unsigned long frames_dispatched;
+        unsigned long frames_unhandled; // No handler matched
+        unsigned long frames_duplicate; // Dropped by the deduplication cache
+    };
+
+    /**
+     * @brief Reads frames from the module and calls the handlers registered for them
+     * The module does not tell which module sent a frame, in fixed point mode the source address is read from the frame
+     * at the offset set with SetSourceAddressOffset. Turn the checksum of the driver on so every frame is handed over on its own,
+     * otherwise frames arriving back to back are handed over as one. Frames received again, for example because
+     * several relays repeat them, are dropped before the handlers when a cache is set with SetDeduplicationCache.
+     * Frames are recognised by source address and sequence number when both offsets are set and the source address
+     * is known, otherwise by their payload. The payload is lossy: a module sending the same payload twice within
+     * kLoRaDeduplicationLifetime, or two modules sending the same payload in transparent mode, is only handed over once.
+     * The work mode is the one the driver knows of, it is unknown until the work mode is set or read with the driver.
+     * While it is unknown frames are only handed to handlers registered for kAnyWorkMode, other frames are counted as
+     * unhandled.
+     *
+     */
+    class LoRaDispatcher
+    {
+    public:
+        LoRaDispatcher(UsrLg206P *const lora);
+
+        /**
+         * @brief Register a handler
+         * Handlers registered for the source address of a frame are called, only when none is registered the handlers
+         * for kAnySource are called.
+         *
+         * @param work_mode in which the handler receives frames, kAnyWorkMode for all frames
+         * @param handler function to call
+         * @param source_address of the frames, only for fixed point mode, kAnySource for all frames
+         * @return kQueueFull if kLoRaDispatcherAmountOfHandlers handlers are registered, kInvalidParameter
+         */
+        LoRaErrorCode Register(const LoRaSettings::WorkMode work_mode, MessageHandler handler, const uint16_t source_address = kAnySource);
+
+        /**
+         * @brief Remove every registration of a handler
+         *
+         * @param handler function to remove
+         */
+        void Unregister(MessageHandler handler);
+
+        /**
+         * @brief Set where the address of the sender is found in frames received in fixed point mode
+         *
+         * @param offset of the two byte address, most significant byte first
+         */
+        void SetSourceAddressOffset(const size_t offset);
+
+        /**
+         * @brief Set where the sequence number of the sender is found in frames received in fixed point mode
+         * Used with the source address to recognise duplicates, so two frames with the same payload are both handed over.
+         *
+         * @param offset of the one byte sequence number
+         */
+        void SetSequenceNumberOffset(const size_t offset);
+
+        /**
+         * @brief Set the cache used to drop frames received before, nullptr to hand over every frame
+         *
+         * @param cache shared with other layers or only used by the dispatcher
+         */
+        void SetDeduplicationCache(LoRaDeduplication::LoRaDeduplicationCache *cache);
+
+        /**
+         * @brief Read every frame available and call its handlers, call this from the main loop
+         *
+         * @return amount of frames read
+         */
+        size_t Poll(void);
+
+        const LoRaDispatcherStatistics &GetStatistics(void) const;
+
+    private:
+        struct Registration
+        {
+            MessageHandler handler;
+            LoRaSettings::WorkMode work_mode;
+            uint16_t source_address;
+        };
+
+        UsrLg206P *lora_;
+        Registration registrations_[kLoRaDispatcherAmountOfHandlers];
+        bool has_source_address_offset_;
+        size_t source_address_offset_;
+        bool has_sequence_number_offset_;
+        size_t sequence_number_offset_;
+        LoRaDeduplication::LoRaDeduplicationCache *cache_;
+        LoRaDispatcherStatistics statistics_;
+        uint8_t buffer_[kLoRaDispatcherBufferSize];
+
+        size_t Dispatch(const LoRaSettings::WorkMode work_mode, const uint8_t *frame, const size_t size, const uint16_t source_address, const bool any_source);
+    };
+} // namespace LoRaDispatcher
+
+#endif // USR_LG206_P_DISPATCHER_H_
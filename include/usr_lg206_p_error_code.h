@@ -1,3 +1,6 @@
+#ifndef USR_LG206_P_ERROR_CODE_H_
+#define USR_LG206_P_ERROR_CODE_H_
+
 enum class LoRaErrorCode
 {
     kSucces = 0,
@@ -14,4 +17,13 @@ enum class LoRaErrorCode
     kCommandEchoNotReceived,
     kMissingOk,
     kMissingSettingClarification,
+    // Errors returned by the layers on top of the driver
+    kWrongWorkMode = 20, // Layer needs another work mode, mostly fixed point
+    kMessageTooLarge,    // Message does not fit in the buffers of the layer
+    kWindowFull,         // No room to keep another unacknowledged message
+    kQueueFull,          // Queue has no room left for the message
+    kChannelBusy,        // Channel stayed busy during all attempts
+    kChecksumMismatch,   // Data received does not match the checksum sent with it
 };
+
+#endif // USR_LG206_P_ERROR_CODE_H_
@@ -0,0 +1,211 @@
+/**
+ * @file usr_lg206_p_fragmentation.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Splits messages larger than one frame into fragments and reassembles them on the receiving side
+ * @version 0.1
+ * @date 2024-03-07
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_FRAGMENTATION_H_
+#define USR_LG206_P_FRAGMENTATION_H_
+
+#include "usr_lg206_p.h"
+#include "usr_lg206_p_frame_reader.h"
+
+/**
+ * @brief Largest frame sent in one transmission, header included
+ *
+ */
+#ifndef kLoRaFragmentationMaximumFrameSize
+#define kLoRaFragmentationMaximumFrameSize 64
+#endif
+
+/**
+ * @brief Largest message which can be reassembled, every reassembly buffer takes this much memory
+ *
+ */
+#ifndef kLoRaFragmentationMaximumMessageSize
+#define kLoRaFragmentationMaximumMessageSize 1024
+#endif
+
+/**
+ * @brief Amount of messages which can be reassembled at the same time
+ *
+ */
+#ifndef kLoRaFragmentationAmountOfBuffers
+#define kLoRaFragmentationAmountOfBuffers 2
+#endif
+
+/**
+ * @brief Time in milliseconds without a new fragment after which an incomplete message is dropped
+ * Counted from the last fragment, so the time on air of a long message at a slow air rate does not count against it.
+ *
+ */
+#ifndef kLoRaFragmentationReassemblyTimeout
+#define kLoRaFragmentationReassemblyTimeout 30000
+#endif
+
+namespace LoRaFragmentation
+{
+    /**
+     * @brief Size of the header in front of every fragment
+     * type, fragment length, source address (2 bytes), message id, fragment index, amount of fragments and message size (2 bytes)
+     *
+     */
+    const size_t kHeaderSize = 9;
+
+    const uint8_t kFrameTypeFragment = 0x40;
+
+    /**
+     * @brief Largest amount of fragments protected by one parity fragment, the group size is sent in the low nibble of the type
+     *
+     */
+    const size_t kMaximumParityGroupSize = 15;
+
+    /**
+     * @brief Amount of fragments one message can be split in, limited by the one byte index
+     *
+     */
+    const size_t kMaximumAmountOfFragments = 255;
+
+    /**
+     * @brief Counters of the fragmentation layer
+     *
+     */
+    struct LoRaFragmentationStatistics
+    {
+        unsigned long messages_sent;
+        unsigned long fragments_sent;
+        unsigned long messages_received;
+        unsigned long fragments_received;
+        unsigned long duplicate_fragments;
+        unsigned long messages_timed_out;
+        unsigned long messages_dropped; // Too large or no reassembly buffer left
+        unsigned long parity_sent;
+        unsigned long fragments_recovered; // Lost fragments rebuilt from a parity fragment
+    };
+
+    /**
+     * @brief Class used to send messages of several frames in fixed point mode
+     * Fragments are not retransmitted, a message of which a fragment is lost is dropped after the reassembly timeout.
+     * With parity turned on, one lost fragment per group is rebuilt from the XOR of the group sent after it.
+     *
+     */
+    class LoRaFragmentation
+    {
+    public:
+        /**
+         * @brief Construct a new fragmentation layer
+         *
+         * @param lora driver of the module, which must be in fixed point transmission mode
+         * @param local_address address of this module, set with SetDestinationAddress
+         */
+        LoRaFragmentation(UsrLg206P *const lora, const uint16_t local_address);
+
+        /**
+         * @brief Set the size of the frames sent
+         *
+         * @param frame_size between kHeaderSize + 1 and kLoRaFragmentationMaximumFrameSize
+         * @return kInvalidParameter if out of range
+         */
+        LoRaErrorCode SetFrameSize(const size_t frame_size);
+
+        /**
+         * @brief Set the air rate level the module uses, fragments are spaced by their time on air
+         * so the buffer of the module does not overflow
+         *
+         * @param level air rate level set on the module
+         */
+        void SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level);
+
+        /**
+         * @brief Send a parity fragment after every group of fragments, so one lost fragment per group can be rebuilt
+         * Costs one extra frame per group, messages of one fragment are sent without parity.
+         *
+         * @param group_size amount of fragments per parity fragment, 0 turns parity off
+         * @return kInvalidParameter if larger than kMaximumParityGroupSize
+         */
+        LoRaErrorCode SetParityGroupSize(const uint8_t group_size);
+
+        /**
+         * @brief Set the time without a new fragment after which an incomplete message is dropped
+         *
+         * @param timeout in milliseconds
+         */
+        void SetReassemblyTimeout(const unsigned long timeout);
+
+        /**
+         * @brief Send a message split in as many fragments as needed, blocks until all fragments are handed to the module
+         *
+         * @param message data that needs to be send
+         * @param size of the data
+         * @param destination_address of the other module
+         * @param channel of the other module
+         * @return kMessageTooLarge if the message does not fit in 255 fragments or the reassembly buffer, kWrongWorkMode
+         */
+        LoRaErrorCode Send(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel);
+
+        /**
+         * @brief Read fragments from the module if available
+         *
+         * @param buffer to store a complete message in
+         * @param buffer_size size of the buffer, a larger message is truncated
+         * @param source_address OUTPUT address of the sender
+         * @return size of the message, 0 if no message is complete yet
+         */
+        size_t Receive(uint8_t *buffer, const size_t buffer_size, uint16_t &source_address);
+
+        /**
+         * @brief Drop incomplete messages of which the timeout expired, also done by Receive
+         *
+         */
+        void Update(void);
+
+        /**
+         * @brief Get the amount of fragments a message is split in
+         *
+         * @param size of the message
+         * @return amount of fragments
+         */
+        size_t GetAmountOfFragments(const size_t size) const;
+
+        const LoRaFragmentationStatistics &GetStatistics(void) const;
+
+    private:
+        struct ReassemblyBuffer
+        {
+            bool in_use;
+            uint16_t source_address;
+            uint8_t message_id;
+            uint8_t amount_of_fragments;
+            uint8_t fragments_received;
+            size_t size;
+            unsigned long last_fragment_at;
+            uint8_t received[(kMaximumAmountOfFragments + 7) / 8]; // Bit per fragment
+            uint8_t data[kLoRaFragmentationMaximumMessageSize];
+        };
+
+        UsrLg206P *lora_;
+        uint16_t local_address_;
+        size_t frame_size_;
+        uint8_t parity_group_size_;
+        LoRaSettings::LoRaAirRateLevel air_rate_level_;
+        unsigned long reassembly_timeout_;
+        uint8_t next_message_id_;
+        LoRaFragmentationStatistics statistics_;
+
+        ReassemblyBuffer buffers_[kLoRaFragmentationAmountOfBuffers];
+        LoRaFrameReader::LoRaFrameReader<2 * kLoRaFragmentationMaximumFrameSize + 1, kHeaderSize> receive_buffer_;
+
+        ReassemblyBuffer *FindBuffer(const uint16_t source_address, const uint8_t message_id, const uint8_t amount_of_fragments, const size_t size);
+        ReassemblyBuffer *GetBuffer(const uint16_t source_address, const uint8_t message_id, const uint8_t amount_of_fragments, const size_t size);
+        size_t HandleFragment(const uint8_t *frame, const size_t size, uint8_t *buffer, const size_t buffer_size, uint16_t &source_address);
+        size_t CompleteMessage(ReassemblyBuffer *reassembly_buffer, uint8_t *buffer, const size_t buffer_size, uint16_t &source_address);
+        bool HandleParity(ReassemblyBuffer *reassembly_buffer, const uint8_t group_size, const uint8_t first_index, const uint8_t *parity, const size_t length);
+        bool Transmit(const uint8_t *frame, const size_t size, const uint16_t destination_address, const uint8_t channel, const size_t previous_size);
+    };
+} // namespace LoRaFragmentation
+
+#endif // USR_LG206_P_FRAGMENTATION_H_
@@ -0,0 +1,169 @@
+/**
+ * @file usr_lg206_p_frame_reader.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Splits the data received by the module into the frames of a layer
+ * @version 0.1
+ * @date 2024-03-26
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_FRAME_READER_H_
+#define USR_LG206_P_FRAME_READER_H_
+
+#include "usr_lg206_p.h"
+
+namespace LoRaFrameReader
+{
+    /**
+     * @brief Get the size of the frame at the start of the data, called once the header is received
+     *
+     * @param header of the frame
+     * @return size of the frame, 0 when the data does not start with a valid frame
+     */
+    typedef size_t (*FrameSize)(const uint8_t *header);
+
+    /**
+     * @brief Class used by the layers to get complete frames out of the data received by the module
+     * ReceiveMessage of the driver returns what the module received so far, which can be more than one frame or part
+     * of a frame. Every frame starts with a header holding the length of the payload following it, or a FrameSize
+     * function tells the size of a frame from its header.
+     *
+     * @tparam kBufferSize room for the data, twice the largest frame plus one byte: ReceiveMessage can return the end of
+     * one frame together with the next one, and the driver keeps the last byte for a terminator
+     * @tparam kHeaderSize amount of bytes needed to know the size of a frame
+     * @tparam kLengthIndex position of the payload length in the header
+     * @tparam kFrameSize function giving the size of a frame, used instead of the payload length when set
+     */
+    template <size_t kBufferSize, size_t kHeaderSize, size_t kLengthIndex = 1, FrameSize kFrameSize = nullptr>
+    class LoRaFrameReader
+    {
+        static_assert(kHeaderSize > 0 && kLengthIndex < kHeaderSize, "The length must be part of the header");
+        static_assert(kBufferSize >= kHeaderSize, "The buffer must hold a header");
+
+    public:
+        LoRaFrameReader(void)
+        {
+            this->size_ = 0;
+            this->consumed_ = 0;
+            this->amount_of_reads_ = 0;
+        };
+
+        /**
+         * @brief Read what the module received, as far as it fits
+         *
+         * @param lora driver of the module
+         * @return amount of bytes read
+         */
+        size_t Read(UsrLg206P *lora)
+        {
+            Remove();
+            // The driver keeps the last byte for a terminator
+            if (size_ + 1 >= kBufferSize || lora->Available() <= 0)
+            {
+                return 0;
+            }
+
+            const size_t size = lora->ReceiveMessage(buffer_ + size_, kBufferSize - size_);
+            if (size > 0)
+            {
+                size_ += size;
+                amount_of_reads_++;
+            }
+            return size;
+        };
+
+        /**
+         * @brief Get the next complete frame out of the data read so far
+         * The frame stays valid until the next call. Data which does not start with a valid frame is dropped, there is
+         * no way to find the start of the next frame.
+         *
+         * @param frame OUTPUT start of the frame
+         * @return size of the frame, 0 when no complete frame is read yet
+         */
+        size_t Next(uint8_t *&frame)
+        {
+            Remove();
+            if (size_ < kHeaderSize)
+            {
+                return 0;
+            }
+
+            const size_t frame_size = (kFrameSize != nullptr) ? kFrameSize(buffer_) : kHeaderSize + buffer_[kLengthIndex];
+            if (frame_size < kHeaderSize || frame_size > kBufferSize)
+            {
+                Clear();
+                return 0;
+            }
+
+            if (frame_size > size_)
+            {
+                return 0;
+            }
+
+            frame = buffer_;
+            consumed_ = frame_size;
+            return frame_size;
+        };
+
+        /**
+         * @brief Get the next complete frame, the module is read when no complete frame is read yet
+         * A frame which is not complete after reading is dropped together with the data after it.
+         *
+         * @param lora driver of the module
+         * @param frame OUTPUT start of the frame, valid until the next call
+         * @return size of the frame, 0 when there is none
+         */
+        size_t Receive(UsrLg206P *lora, uint8_t *&frame)
+        {
+            size_t frame_size = Next(frame);
+            if (frame_size > 0)
+            {
+                return frame_size;
+            }
+
+            Read(lora);
+            frame_size = Next(frame);
+            if (frame_size == 0 && size_ >= kHeaderSize)
+            {
+                // Incomplete or corrupt frame
+                Clear();
+            }
+            return frame_size;
+        };
+
+        /**
+         * @brief Drop all data read so far
+         *
+         */
+        void Clear(void)
+        {
+            size_ = 0;
+            consumed_ = 0;
+        };
+
+        /**
+         * @brief Get the amount of times data was read from the module
+         *
+         */
+        unsigned long GetAmountOfReads(void) const
+        {
+            return amount_of_reads_;
+        };
+
+    private:
+        uint8_t buffer_[kBufferSize];
+        size_t size_;
+        size_t consumed_; // Size of the frame handed out last, removed on the next call
+        unsigned long amount_of_reads_;
+
+        void Remove(void)
+        {
+            size_ -= consumed_;
+            memmove(buffer_, buffer_ + consumed_, size_);
+            consumed_ = 0;
+        };
+    };
+} // namespace LoRaFrameReader
+
+#endif // USR_LG206_P_FRAME_READER_H_
@@ -0,0 +1,256 @@
+/**
+ * @file usr_lg206_p_outbox.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Persistent outbox which keeps messages in EEPROM or a file until the reliable layer delivered them
+ * @version 0.1
+ * @date 2024-03-25
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_OUTBOX_H_
+#define USR_LG206_P_OUTBOX_H_
+
+#include "usr_lg206_p_reliable.h"
+
+/**
+ * @brief Largest message kept in the outbox
+ *
+ */
+#ifndef kLoRaOutboxMaximumMessageSize
+#define kLoRaOutboxMaximumMessageSize 48
+#endif
+
+/**
+ * @brief Largest amount of messages sent together in one reliable message
+ *
+ */
+#ifndef kLoRaOutboxBatchSize
+#define kLoRaOutboxBatchSize 8
+#endif
+
+/**
+ * @brief Time in milliseconds the outbox waits after a failed delivery before it tries again
+ *
+ */
+#ifndef kLoRaOutboxRetryInterval
+#define kLoRaOutboxRetryInterval 30000
+#endif
+
+namespace LoRaOutbox
+{
+    /**
+     * @brief Size of the header in front of every entry in storage
+     * state, priority, destination address (2 bytes), channel, size and sequence number (4 bytes)
+     *
+     */
+    const size_t kEntryHeaderSize = 10;
+
+    /**
+     * @brief Size of one slot in storage, every message takes a whole slot
+     *
+     */
+    const size_t kSlotSize = kEntryHeaderSize + kLoRaOutboxMaximumMessageSize;
+
+    /**
+     * @brief Size of the header at the start of the storage, marks it as formatted by this version
+     *
+     */
+    const size_t kStorageHeaderSize = 3;
+
+    /**
+     * @brief Every message in a batch is preceded by one byte holding its length, as done by the aggregation layer
+     *
+     */
+    const size_t kRecordHeaderSize = 1;
+
+    static_assert(kLoRaOutboxMaximumMessageSize + kRecordHeaderSize <= kLoRaReliableMaximumPayloadSize, "A message must fit in one reliable message");
+
+    /**
+     * @brief Read from storage, bytes never written must read as 0xFF like erased EEPROM
+     *
+     * @param address in the storage
+     * @param buffer to store the data in
+     * @param size amount of bytes to read
+     */
+    typedef void (*StorageRead)(const uint32_t address, uint8_t *buffer, const size_t size);
+
+    /**
+     * @brief Write to storage
+     *
+     * @param address in the storage
+     * @param data to write
+     * @param size amount of bytes to write
+     */
+    typedef void (*StorageWrite)(const uint32_t address, const uint8_t *data, const size_t size);
+
+#ifdef __AVR__
+    /**
+     * @brief Storage in the EEPROM of the microcontroller, only bytes which changed are written
+     *
+     */
+    void ReadEeprom(const uint32_t address, uint8_t *buffer, const size_t size);
+    void WriteEeprom(const uint32_t address, const uint8_t *data, const size_t size);
+#else
+    /**
+     * @brief Set the file used by ReadFile and WriteFile, it is created when it does not exist
+     *
+     * @param path of the file, must stay valid while the outbox is used
+     */
+    void SetFilePath(const char *path);
+
+    /**
+     * @brief Storage in a file on the host
+     *
+     */
+    void ReadFile(const uint32_t address, uint8_t *buffer, const size_t size);
+    void WriteFile(const uint32_t address, const uint8_t *data, const size_t size);
+#endif
+
+    /**
+     * @brief Read one message out of a batch delivered by the reliable layer
+     *
+     * @param batch payload received
+     * @param size of the payload
+     * @param offset position of the next message, start with 0
+     * @param buffer to store the message in
+     * @param buffer_size size of the buffer, a larger message is truncated
+     * @return size of the message, 0 when all messages are read
+     */
+    size_t ReadMessage(const uint8_t *batch, const size_t size, size_t &offset, uint8_t *buffer, const size_t buffer_size);
+
+    enum class ReplayOrder : uint8_t
+    {
+        kReplayOrderOldestFirst,
+        kReplayOrderPriorityFirst,
+    };
+
+    /**
+     * @brief Counters of the outbox
+     *
+     */
+    struct LoRaOutboxStatistics
+    {
+        unsigned long messages_added;
+        unsigned long messages_delivered;
+        unsigned long messages_dropped; // Storage was full
+        unsigned long batches_sent;
+        unsigned long failed_deliveries;
+    };
+
+    /**
+     * @brief Class used to keep messages through outages of the link
+     * Messages are kept in slots of kSlotSize bytes and sent in batches per destination through the reliable layer.
+     * The slots are used in turn, so every slot is written about as often, and a delivered message is marked in its
+     * slot which frees it right away. Messages are delivered at least once: when the power is lost after the
+     * acknowledgement but before the message is marked, it is sent again after the reboot.
+     * After a failed delivery the outbox waits kLoRaOutboxRetryInterval before it tries the link again.
+     *
+     */
+    class LoRaOutbox
+    {
+    public:
+        /**
+         * @brief Construct a new outbox
+         *
+         * @param reliable layer messages are sent with, pass its delivery callback on to HandleDelivery
+         * @param read function reading the storage
+         * @param write function writing the storage
+         * @param storage_size amount of bytes the outbox may use, a header of kStorageHeaderSize and whole slots
+         */
+        LoRaOutbox(LoRaReliable::LoRaReliable *const reliable, StorageRead read, StorageWrite write, const uint32_t storage_size);
+
+        /**
+         * @brief Read the messages kept in storage, formats the storage when it was not used by the outbox before
+         *
+         * @return kInvalidParameter if the storage is too small
+         */
+        LoRaErrorCode Begin(void);
+
+        void SetReplayOrder(const ReplayOrder order);
+
+        /**
+         * @brief Keep a message until it is delivered
+         *
+         * @param message data that needs to be send
+         * @param size of the data
+         * @param destination_address of the other module
+         * @param channel of the other module
+         * @param priority higher is sent first when the replay order is kReplayOrderPriorityFirst
+         * @return kQueueFull if the storage is full, kMessageTooLarge or kInvalidParameter when empty
+         */
+        LoRaErrorCode Add(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel, const uint8_t priority = 0);
+
+        /**
+         * @brief Send the next batch if the reliable layer has room, call this regularly
+         *
+         */
+        void Update(void);
+
+        /**
+         * @brief Mark the messages of a batch as delivered or try them again later, call it from the delivery callback
+         *
+         */
+        void HandleDelivery(const uint16_t destination_address, const uint8_t sequence_number, const bool delivered);
+
+        uint16_t GetAmountPending(void) const;
+
+        /**
+         * @brief Get the amount of messages which can still be added
+         *
+         */
+        uint16_t GetAmountFree(void) const;
+
+        const LoRaOutboxStatistics &GetStatistics(void) const;
+
+    private:
+        enum EntryState : uint8_t
+        {
+            kEntryStateFree = 0xFF, // Erased storage
+            kEntryStatePending = 0xA5,
+            kEntryStateDelivered = 0x00,
+        };
+
+        struct Entry
+        {
+            uint8_t state;
+            uint8_t priority;
+            uint16_t destination_address;
+            uint8_t channel;
+            uint8_t size;
+            uint32_t sequence_number;
+        };
+
+        struct Batch
+        {
+            bool in_use;
+            uint16_t destination_address;
+            uint8_t sequence_number;
+            uint8_t amount;
+            uint16_t slots[kLoRaOutboxBatchSize];
+        };
+
+        LoRaReliable::LoRaReliable *reliable_;
+        StorageRead read_;
+        StorageWrite write_;
+        uint32_t storage_size_;
+        ReplayOrder replay_order_;
+        uint16_t amount_of_slots_;
+        uint16_t next_slot_; // Slot after the one written last
+        uint32_t next_sequence_number_;
+        uint16_t amount_pending_;
+        bool failed_;
+        unsigned long failed_at_;
+        LoRaOutboxStatistics statistics_;
+
+        Batch batches_[kLoRaReliableWindowSize];
+
+        uint32_t GetAddress(const uint16_t slot) const;
+        bool ReadEntry(const uint16_t slot, Entry &entry) const;
+        bool IsInFlight(const uint16_t slot) const;
+        bool FindNext(uint16_t &slot, Entry &entry) const;
+        bool FindNewer(const Entry &first, const uint32_t sequence_number, uint16_t &slot, Entry &entry) const;
+    };
+} // namespace LoRaOutbox
+
+#endif // USR_LG206_P_OUTBOX_H_
@@ -0,0 +1,196 @@
+/**
+ * @file usr_lg206_p_ports.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Logical ports over one module, every port has its own queues and a share of the transmit time
+ * @version 0.1
+ * @date 2024-03-21
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_PORTS_H_
+#define USR_LG206_P_PORTS_H_
+
+#include "usr_lg206_p.h"
+#include "usr_lg206_p_frame_reader.h"
+
+/**
+ * @brief Amount of ports, at most 16 because the port is sent in the low nibble of the type
+ *
+ */
+#ifndef kLoRaPortsAmountOfPorts
+#define kLoRaPortsAmountOfPorts 4
+#endif
+
+/**
+ * @brief Amount of messages every port queues for sending and for receiving
+ *
+ */
+#ifndef kLoRaPortsQueueSize
+#define kLoRaPortsQueueSize 2
+#endif
+
+/**
+ * @brief Largest message sent over a port, without port header
+ *
+ */
+#ifndef kLoRaPortsMaximumMessageSize
+#define kLoRaPortsMaximumMessageSize 48
+#endif
+
+namespace LoRaPorts
+{
+    static_assert(kLoRaPortsAmountOfPorts <= 16, "The port is sent in four bits");
+    static_assert(kLoRaPortsMaximumMessageSize <= 255, "The size of a message is sent in one byte");
+
+    /**
+     * @brief Size of the header in front of every frame, the type with the port in its low nibble and the size of the message
+     *
+     */
+    const size_t kHeaderSize = 2;
+
+    const uint8_t kFrameTypePort = 0xB0;
+
+    /**
+     * @brief Counters of one port
+     *
+     */
+    struct LoRaPortStatistics
+    {
+        unsigned long sent;
+        unsigned long received;
+        unsigned long dropped; // Received while the receive queue of the port was full
+    };
+
+    /**
+     * @brief Class used to let independent parts of an application share one module
+     * Every port has its own receive queue, so a port which is not read does not block the others. Queued messages are sent
+     * round robin, a port with weight 3 sends up to three messages for every message of a port with weight 1.
+     *
+     */
+    class LoRaPorts
+    {
+    public:
+        LoRaPorts(UsrLg206P *const lora);
+
+        /**
+         * @brief Set the air rate level the module uses, a message is sent only after the previous one is on air
+         *
+         * @param level air rate level set on the module
+         */
+        void SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level);
+
+        /**
+         * @brief Open a port, frames for a closed port are dropped
+         *
+         * @param port number below kLoRaPortsAmountOfPorts
+         * @param weight amount of messages sent in a row before the next port gets its turn
+         * @return kInvalidParameter if the port or the weight is out of range
+         */
+        LoRaErrorCode Open(const uint8_t port, const uint8_t weight = 1);
+
+        /**
+         * @brief Close a port and remove its queued messages
+         *
+         */
+        void Close(const uint8_t port);
+
+        /**
+         * @brief Queue a message sent in transparent mode
+         *
+         * @return kQueueFull, kMessageTooLarge or kInvalidParameter for an empty message or a closed port
+         */
+        LoRaErrorCode Send(const uint8_t port, const uint8_t *message, const size_t size);
+
+        /**
+         * @brief Queue a message sent in fixed point mode
+         *
+         * @return kQueueFull, kMessageTooLarge or kInvalidParameter for an empty message or a closed port
+         */
+        LoRaErrorCode Send(const uint8_t port, const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel);
+
+        /**
+         * @brief Take the oldest message received on a port
+         *
+         * @param port to read
+         * @param buffer to store the message in
+         * @param buffer_size size of the buffer, a larger message is truncated
+         * @return size of the message, 0 if none was received
+         */
+        size_t Receive(const uint8_t port, uint8_t *buffer, const size_t buffer_size);
+
+        /**
+         * @brief Move received frames to the queues of their ports and send the next queued message, call this regularly
+         *
+         * @return true if a message was handed to the module
+         */
+        bool Update(void);
+
+        /**
+         * @brief Get the amount of messages queued for sending on a port
+         *
+         */
+        uint8_t GetAmountQueued(const uint8_t port) const;
+
+        /**
+         * @brief Get the amount of received messages waiting on a port
+         *
+         */
+        uint8_t GetAmountReceived(const uint8_t port) const;
+
+        /**
+         * @brief Get the counters of a port
+         *
+         * @return counters of the port, all 0 if the port is out of range
+         */
+        const LoRaPortStatistics &GetStatistics(const uint8_t port) const;
+
+    private:
+        struct Message
+        {
+            bool fixed_point;
+            uint16_t destination_address;
+            uint8_t channel;
+            size_t size;
+            uint8_t data[kHeaderSize + kLoRaPortsMaximumMessageSize];
+        };
+
+        /**
+         * @brief Ring buffer of messages
+         *
+         */
+        struct Queue
+        {
+            uint8_t head;
+            uint8_t count;
+            Message messages[kLoRaPortsQueueSize];
+        };
+
+        struct Port
+        {
+            bool open;
+            uint8_t weight;
+            uint8_t credit; // Messages the port may still send in its turn
+            Queue transmit;
+            Queue receive;
+            LoRaPortStatistics statistics;
+        };
+
+        UsrLg206P *lora_;
+        LoRaSettings::LoRaAirRateLevel air_rate_level_;
+        unsigned long sent_at_;
+        unsigned long busy_for_;
+        uint8_t current_port_;
+        Port ports_[kLoRaPortsAmountOfPorts];
+        LoRaFrameReader::LoRaFrameReader<2 * (kHeaderSize + kLoRaPortsMaximumMessageSize) + 1, kHeaderSize> receive_buffer_;
+
+        LoRaErrorCode Add(const uint8_t port, const uint8_t *message, const size_t size, const bool fixed_point, const uint16_t destination_address, const uint8_t channel);
+        void ReceiveFrames(void);
+        Port *NextPort(void);
+        static Message *Push(Queue &queue);
+        static Message *Front(Queue &queue);
+        static void Pop(Queue &queue);
+    };
+} // namespace LoRaPorts
+
+#endif // USR_LG206_P_PORTS_H_
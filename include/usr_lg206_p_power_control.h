@@ -0,0 +1,150 @@
+/**
+ * @file usr_lg206_p_power_control.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Transmission power control, lowers the power while messages are delivered and raises it on loss
+ * @version 0.1
+ * @date 2024-03-14
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_POWER_CONTROL_H_
+#define USR_LG206_P_POWER_CONTROL_H_
+
+#include "usr_lg206_p.h"
+
+/**
+ * @brief Amount of reported deliveries the delivery ratio is measured over
+ *
+ */
+#ifndef kLoRaPowerControlWindow
+#define kLoRaPowerControlWindow 16
+#endif
+
+/**
+ * @brief Delivery ratio in percent below which the power is raised
+ *
+ */
+#ifndef kLoRaPowerControlTargetRatio
+#define kLoRaPowerControlTargetRatio 90
+#endif
+
+/**
+ * @brief Time in milliseconds between two changes of the power, every change needs the AT mode
+ *
+ */
+#ifndef kLoRaPowerControlMinimumInterval
+#define kLoRaPowerControlMinimumInterval 60000
+#endif
+
+namespace LoRaPowerControl
+{
+    /**
+     * @brief Range of the module in dBm, see UsrLg206P::SetPowerTransmissionValue
+     *
+     */
+    const int kMinimumPower = 10;
+    const int kMaximumPower = 20;
+
+    /**
+     * @brief Step in dBm when lowering the power
+     *
+     */
+    const int kStepDown = 1;
+
+    /**
+     * @brief Step in dBm when raising the power, larger than the step down so the link recovers quickly
+     *
+     */
+    const int kStepUp = 2;
+
+    /**
+     * @brief Counters of the power control
+     *
+     */
+    struct LoRaPowerControlStatistics
+    {
+        unsigned long raises;
+        unsigned long reductions;
+        unsigned long deferred; // Changes that waited for the minimum interval
+        unsigned long errors;   // Power could not be set on the module
+    };
+
+    /**
+     * @brief Adjusts the transmission power of the module from the delivery ratio
+     * The power is lowered after a window in which the target ratio was met. It is raised as soon as the
+     * window can not meet the target anymore.
+     *
+     */
+    class LoRaPowerControl
+    {
+    public:
+        /**
+         * @brief Construct a new power control, starting at the highest power
+         *
+         * @param lora driver of the module
+         */
+        LoRaPowerControl(UsrLg206P *const lora);
+
+        /**
+         * @brief Read the power set on the module, so the first change starts from there
+         *
+         * @return error of the driver if the power could not be read, the highest power is assumed then
+         */
+        LoRaErrorCode Begin(void);
+
+        /**
+         * @brief Limit the power used
+         *
+         * @param minimum lowest power in dBm, at least 10
+         * @param maximum highest power in dBm, at most 20
+         * @return kInvalidParameter if out of range or the minimum is higher than the maximum
+         */
+        LoRaErrorCode SetPowerRange(const int minimum, const int maximum);
+
+        /**
+         * @brief Report the result of a message, for example from the delivery callback of the reliable layer
+         *
+         * @param delivered true if the message was acknowledged
+         */
+        void ReportDelivery(const bool delivered);
+
+        /**
+         * @brief Apply a change which waited for the minimum interval, call this regularly
+         *
+         */
+        void Update(void);
+
+        /**
+         * @brief Get the power set on the module
+         *
+         * @return power in dBm
+         */
+        int GetPower(void) const;
+
+        /**
+         * @brief Get the delivery ratio of the current window
+         *
+         * @return ratio in percent, 100 if nothing was reported yet
+         */
+        uint8_t GetDeliveryRatio(void) const;
+
+        const LoRaPowerControlStatistics &GetStatistics(void) const;
+
+    private:
+        UsrLg206P *lora_;
+        int minimum_power_;
+        int maximum_power_;
+        int power_;        // Power set on the module
+        int target_power_; // Power to set when the minimum interval passed
+        bool changed_;     // Power was changed at least once
+        unsigned long last_change_;
+        uint8_t sent_;
+        uint8_t delivered_;
+        LoRaPowerControlStatistics statistics_;
+
+        void Apply(void);
+    };
+} // namespace LoRaPowerControl
+
+#endif // USR_LG206_P_POWER_CONTROL_H_
@@ -0,0 +1,28 @@
+/**
+ * @file usr_lg206_p_random.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Small pseudo random generator for backoff and jitter, so no other library is needed
+ * @version 0.1
+ * @date 2024-03-28
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_RANDOM_H_
+#define USR_LG206_P_RANDOM_H_
+
+#include <Arduino.h>
+
+namespace LoRaRandom
+{
+    /**
+     * @brief Get the next pseudo random number of a linear congruential generator
+     * Give every module a different seed, e.g. its address, so they do not wait the same time.
+     *
+     * @param seed state of the generator, updated
+     * @return number from 0 to 32767
+     */
+    uint32_t Next(uint32_t &seed);
+} // namespace LoRaRandom
+
+#endif // USR_LG206_P_RANDOM_H_
@@ -0,0 +1,174 @@
+/**
+ * @file usr_lg206_p_relay.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Multi hop relay on top of fixed point mode, nodes forward frames using routes learned from received frames
+ * @version 0.1
+ * @date 2024-03-16
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_RELAY_H_
+#define USR_LG206_P_RELAY_H_
+
+#include "usr_lg206_p.h"
+#include "usr_lg206_p_frame_reader.h"
+#include "usr_lg206_p_deduplication.h"
+#include "usr_lg206_p_random.h"
+
+/**
+ * @brief Largest payload of one relayed message
+ *
+ */
+#ifndef kLoRaRelayMaximumPayloadSize
+#define kLoRaRelayMaximumPayloadSize 48
+#endif
+
+/**
+ * @brief Amount of destinations a route is remembered for
+ *
+ */
+#ifndef kLoRaRelayAmountOfRoutes
+#define kLoRaRelayAmountOfRoutes 8
+#endif
+
+/**
+ * @brief Time in milliseconds a route is used after it was last confirmed by a received frame
+ *
+ */
+#ifndef kLoRaRelayRouteLifetime
+#define kLoRaRelayRouteLifetime 600000
+#endif
+
+/**
+ * @brief Largest random wait in milliseconds before a frame is forwarded to all neighbours
+ * Neighbours that received the same frame would otherwise forward it at the same time.
+ *
+ */
+#ifndef kLoRaRelayForwardJitter
+#define kLoRaRelayForwardJitter 50
+#endif
+
+namespace LoRaRelay
+{
+    /**
+     * @brief Size of the header in front of every relayed frame
+     * type, payload length, origin (2 bytes), destination (2 bytes), previous hop (2 bytes), sequence number,
+     * hops travelled and hops left
+     *
+     */
+    const size_t kHeaderSize = 11;
+
+    const uint8_t kFrameTypeRelay = 0xA0;
+
+    /**
+     * @brief Destination received by every module in range, used when no route is known
+     *
+     */
+    const uint16_t kBroadcastAddress = 65535;
+
+    /**
+     * @brief Default amount of hops a frame may travel
+     *
+     */
+    const uint8_t kDefaultMaximumHops = 4;
+
+    /**
+     * @brief Counters of the relay layer
+     *
+     */
+    struct LoRaRelayStatistics
+    {
+        unsigned long originated;
+        unsigned long delivered;
+        unsigned long forwarded;
+        unsigned long duplicates; // Frames received before, not forwarded again
+        unsigned long expired;    // Frames that ran out of hops
+    };
+
+    /**
+     * @brief Sends messages to nodes out of direct range through other nodes running this layer
+     * A route to the origin of every received frame is learned through the node it came from. Frames to a
+     * destination without route are sent to all neighbours, which forward them once.
+     *
+     */
+    class LoRaRelay
+    {
+    public:
+        /**
+         * @brief Construct a new relay layer
+         *
+         * @param lora driver of the module, which must be in fixed point transmission mode
+         * @param local_address address of this module
+         * @param channel channel of the network
+         */
+        LoRaRelay(UsrLg206P *const lora, const uint16_t local_address, const uint8_t channel);
+
+        /**
+         * @brief Set the amount of hops messages of this node may travel
+         *
+         * @return kInvalidParameter if 0
+         */
+        LoRaErrorCode SetMaximumHops(const uint8_t hops);
+
+        /**
+         * @brief Send a message to a node, 65535 sends it to all nodes
+         *
+         * @return kMessageTooLarge, kInvalidParameter for an empty message or kWrongWorkMode if not in fixed point mode
+         */
+        LoRaErrorCode Send(const uint8_t *message, const size_t size, const uint16_t destination_address);
+
+        /**
+         * @brief Read frames from the module, forward those for other nodes and return the first one for this node
+         * Call this regularly, otherwise frames are not forwarded.
+         *
+         * @param buffer to store the payload in
+         * @param buffer_size size of the buffer
+         * @param source_address OUTPUT origin of the message
+         * @return size of the payload, 0 if no message for this node was received
+         */
+        size_t Receive(uint8_t *buffer, const size_t buffer_size, uint16_t &source_address);
+
+        /**
+         * @brief Get the route to a node
+         *
+         * @param destination_address address of the node
+         * @param next_hop OUTPUT neighbour frames are sent to
+         * @param hops OUTPUT amount of hops to the node
+         * @return true if a route which did not expire is known
+         */
+        bool GetRoute(const uint16_t destination_address, uint16_t &next_hop, uint8_t &hops) const;
+
+        const LoRaRelayStatistics &GetStatistics(void) const;
+
+    private:
+        struct Route
+        {
+            bool in_use;
+            uint16_t destination_address;
+            uint16_t next_hop;
+            uint8_t hops;
+            unsigned long updated_at;
+        };
+
+        UsrLg206P *lora_;
+        uint16_t local_address_;
+        uint8_t channel_;
+        uint8_t maximum_hops_;
+        uint8_t sequence_number_;
+        uint32_t seed_;
+        LoRaRelayStatistics statistics_;
+
+        Route routes_[kLoRaRelayAmountOfRoutes];
+        LoRaDeduplication::LoRaDeduplicationCache seen_;
+
+        LoRaFrameReader::LoRaFrameReader<2 * (kHeaderSize + kLoRaRelayMaximumPayloadSize) + 1, kHeaderSize> receive_buffer_;
+
+        size_t HandleFrame(uint8_t *frame, const size_t size, uint8_t *buffer, const size_t buffer_size, uint16_t &source_address);
+        bool Transmit(const uint8_t *frame, const size_t size, const uint16_t destination_address, const bool forwarding);
+        void LearnRoute(const uint16_t destination_address, const uint16_t next_hop, const uint8_t hops);
+        const Route *FindRoute(const uint16_t destination_address) const;
+    };
+} // namespace LoRaRelay
+
+#endif // USR_LG206_P_RELAY_H_
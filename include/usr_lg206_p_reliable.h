@@ -0,0 +1,262 @@
+/**
+ * @file usr_lg206_p_reliable.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Reliable delivery on top of fixed point mode, using sequence numbers, acknowledgements and a sliding window
+ * @version 0.1
+ * @date 2024-03-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_RELIABLE_H_
+#define USR_LG206_P_RELIABLE_H_
+
+#include "usr_lg206_p.h"
+#include "usr_lg206_p_frame_reader.h"
+
+/**
+ * @brief Amount of unacknowledged messages kept, shared by all peers
+ * The window of one peer, set with SetWindowSize, is at most this amount and never more than 8.
+ *
+ */
+#ifndef kLoRaReliableWindowSize
+#define kLoRaReliableWindowSize 4
+#endif
+
+/**
+ * @brief Largest payload of one reliable message
+ *
+ */
+#ifndef kLoRaReliableMaximumPayloadSize
+#define kLoRaReliableMaximumPayloadSize 64
+#endif
+
+/**
+ * @brief Amount of peers of which the sequence numbers are remembered
+ *
+ */
+#ifndef kLoRaReliableAmountOfPeers
+#define kLoRaReliableAmountOfPeers 4
+#endif
+
+/**
+ * @brief Time in milliseconds added to the retransmission timeout for UART transfers and processing on both sides
+ *
+ */
+#ifndef kLoRaReliableProcessingTime
+#define kLoRaReliableProcessingTime 200
+#endif
+
+namespace LoRaReliable
+{
+    /**
+     * @brief Size of the header in front of every reliable frame
+     * type, payload length, source address (2 bytes), source channel and sequence number
+     * The length is needed because frames received shortly after each other arrive as one block over UART.
+     *
+     */
+    const size_t kHeaderSize = 6;
+
+    /**
+     * @brief Size of an acknowledgement, header followed by a bitmap of the next 8 sequence numbers
+     *
+     */
+    const size_t kAcknowledgementSize = kHeaderSize + 1;
+
+    enum class FrameType : uint8_t
+    {
+        kFrameTypeData = 0x10,
+        kFrameTypeAcknowledgement = 0x20,
+        kFrameTypeNegativeAcknowledgement = 0x30,
+    };
+
+    /**
+     * @brief Flag set on data frames until the peer acknowledged one, so it can reset its sequence numbers
+     * The payload of such a frame starts with the session id of the sender.
+     *
+     */
+    const uint8_t kFlagSynchronise = 0x01;
+
+    /**
+     * @brief Size of the session id in front of the payload of a synchronising frame
+     *
+     */
+    const size_t kSessionIdSize = 1;
+
+    /**
+     * @brief Counters of the reliable layer
+     *
+     */
+    struct LoRaReliableStatistics
+    {
+        unsigned long messages_sent;
+        unsigned long retransmissions;
+        unsigned long messages_delivered;
+        unsigned long messages_failed;
+        unsigned long messages_received;
+        unsigned long duplicates_received;
+        unsigned long acknowledgements_sent;
+        unsigned long negative_acknowledgements_sent;
+    };
+
+    /**
+     * @brief Called when a message is acknowledged or when all retries failed
+     *
+     */
+    typedef void (*DeliveryCallback)(const uint16_t destination_address, const uint8_t sequence_number, const bool delivered);
+
+    /**
+     * @brief Class used to send messages in fixed point mode which are retransmitted until acknowledged
+     * Received messages are handed over as soon as they arrive, the order between messages is not restored.
+     *
+     */
+    class LoRaReliable
+    {
+    public:
+        /**
+         * @brief Construct a new reliable layer
+         *
+         * @param lora driver of the module, which must be in fixed point transmission mode
+         * @param local_address address of this module, set with SetDestinationAddress
+         * @param local_channel channel of this module
+         */
+        LoRaReliable(UsrLg206P *const lora, const uint16_t local_address, const uint8_t local_channel);
+
+        /**
+         * @brief Set the air rate level the module uses, the retransmission timeout is derived from it
+         *
+         * @param level air rate level set on the module
+         */
+        void SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level);
+
+        /**
+         * @brief Set the id which tells peers this side started over, use a different id every boot
+         * A peer only resets the sequence numbers it received when the id changes, a retransmitted first message looks the same otherwise.
+         * Defaults to a value derived from micros(), which can be equal every boot, so prefer e.g. a counter kept in EEPROM.
+         *
+         * @param session_id id of this boot
+         */
+        void SetSessionId(const uint8_t session_id);
+
+        /**
+         * @brief Set the amount of unacknowledged messages allowed per peer
+         *
+         * @param window_size between 1 and kLoRaReliableWindowSize, at most 8
+         * @return kInvalidParameter if out of range
+         */
+        LoRaErrorCode SetWindowSize(const uint8_t window_size);
+
+        /**
+         * @brief Set the amount of retransmissions before a message is given up
+         *
+         * @param retries amount of retransmissions
+         */
+        void SetMaximumRetries(const uint8_t retries);
+
+        void SetDeliveryCallback(DeliveryCallback callback);
+
+        /**
+         * @brief Send a message which is retransmitted until acknowledged
+         *
+         * @param message data that needs to be send
+         * @param size of the data
+         * @param destination_address of the other module
+         * @param channel of the other module
+         * @param sequence_number OUTPUT sequence number given to the message
+         * @return kWindowFull if the oldest unacknowledged message lies a window size or more behind or all peers have
+         * messages in flight, kMessageTooLarge, kInvalidParameter when empty or kWrongWorkMode
+         */
+        LoRaErrorCode Send(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel, uint8_t *sequence_number = nullptr);
+
+        /**
+         * @brief Read a frame from the module if one is available
+         * Acknowledgements are handled internally, a received message is acknowledged and returned.
+         *
+         * @param buffer to store the payload in
+         * @param buffer_size size of the buffer
+         * @param source_address OUTPUT address of the sender
+         * @return size of the payload, 0 if no new message was received
+         */
+        size_t Receive(uint8_t *buffer, const size_t buffer_size, uint16_t &source_address);
+
+        /**
+         * @brief Retransmit messages of which the timeout expired, call this regularly
+         *
+         */
+        void Update(void);
+
+        /**
+         * @brief Get the amount of messages which are not acknowledged yet
+         *
+         * @param destination_address peer, 65535 for all peers
+         * @return amount of messages
+         */
+        uint8_t GetAmountInFlight(const uint16_t destination_address = 65535) const;
+
+        /**
+         * @brief Get the retransmission timeout of the first transmission of a message
+         *
+         * @param size of the payload
+         * @return timeout in milliseconds
+         */
+        unsigned long GetRetransmissionTimeout(const size_t size) const;
+
+        const LoRaReliableStatistics &GetStatistics(void) const;
+
+    private:
+        struct Slot
+        {
+            bool in_use;
+            uint16_t destination_address;
+            uint8_t channel;
+            uint8_t sequence_number;
+            uint8_t retries;
+            unsigned long sent_at;
+            unsigned long timeout;
+            size_t size;
+            uint8_t frame[kHeaderSize + kSessionIdSize + kLoRaReliableMaximumPayloadSize];
+        };
+
+        struct Peer
+        {
+            bool in_use;
+            uint16_t address;
+            uint8_t next_sequence_number;
+            bool synchronised;         // Peer acknowledged a message of this side
+            bool receiving;            // Sequence numbers of the peer are known
+            bool session_known;        // A synchronising frame of the peer was received
+            uint8_t session_id;        // Session of the peer the received sequence numbers belong to
+            uint8_t receive_base;      // Lowest sequence number not received yet
+            uint8_t receive_bitmap;    // Bit i is set when receive_base + 1 + i is received
+            unsigned long last_active; // Used to replace the least recently used peer
+        };
+
+        UsrLg206P *lora_;
+        uint16_t local_address_;
+        uint8_t local_channel_;
+        uint8_t session_id_;
+        LoRaSettings::LoRaAirRateLevel air_rate_level_;
+        uint8_t window_size_;
+        uint8_t maximum_retries_;
+        DeliveryCallback delivery_callback_;
+        LoRaReliableStatistics statistics_;
+
+        Slot slots_[kLoRaReliableWindowSize];
+        Peer peers_[kLoRaReliableAmountOfPeers];
+        LoRaFrameReader::LoRaFrameReader<2 * (kHeaderSize + kSessionIdSize + kLoRaReliableMaximumPayloadSize) + 1, kHeaderSize> receive_buffer_;
+
+        Peer *FindPeer(const uint16_t address);
+        Peer *GetPeer(const uint16_t address);
+        uint8_t GetOldestInFlight(const Peer &peer) const;
+        void WriteHeader(uint8_t *frame, const uint8_t type, const uint8_t length, const uint8_t sequence_number) const;
+        size_t HandleFrame(const uint8_t *frame, const size_t size, uint8_t *buffer, const size_t buffer_size, uint16_t &source_address);
+        bool Transmit(Slot &slot);
+        void Release(Slot &slot, const bool delivered);
+        void HandleAcknowledgement(const uint16_t source_address, const uint8_t base, const uint8_t bitmap, const bool negative);
+        bool HandleData(Peer &peer, const uint8_t sequence_number, const bool synchronise, const uint8_t session_id, bool &gap);
+        void Advance(Peer &peer);
+        void SendAcknowledgement(const Peer &peer, const uint8_t channel, const bool negative);
+    };
+} // namespace LoRaReliable
+
+#endif // USR_LG206_P_RELIABLE_H_
@@ -0,0 +1,237 @@
+/**
+ * @file usr_lg206_p_remote_config.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Change settings of a module over the air, rolled back when the link is not re-established in time
+ * @version 0.1
+ * @date 2024-03-23
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_REMOTE_CONFIG_H_
+#define USR_LG206_P_REMOTE_CONFIG_H_
+
+#include "usr_lg206_p.h"
+#include "usr_lg206_p_frame_reader.h"
+
+namespace LoRaRemoteConfig
+{
+    /**
+     * @brief Size of the header in front of every frame
+     * type, sequence number (2 bytes), source address (2 bytes) and source channel
+     *
+     */
+    const size_t kHeaderSize = 6;
+
+    /**
+     * @brief Size of the tag behind every frame, a SipHash-2-4 of the frame with the shared key
+     *
+     */
+    const size_t kTagSize = 8;
+
+    const size_t kKeySize = 16;
+
+    /**
+     * @brief Amount of bytes of storage used to keep the sequence numbers through a reboot
+     * marker, whether a change was accepted, last sequence number accepted (2 bytes) and next one sent (2 bytes)
+     *
+     */
+    const size_t kStorageSize = 6;
+
+    enum class FrameType : uint8_t
+    {
+        kFrameTypeSettings = 0xE0,
+        kFrameTypeCommit = 0xE1,
+        kFrameTypeConfirm = 0xE2,
+    };
+
+    /**
+     * @brief Get the size of a remote config frame from its type
+     *
+     * @param frame start of the frame
+     * @return size of the frame, 0 when it is a frame of another layer
+     */
+    size_t GetFrameSize(const uint8_t *frame);
+
+    /**
+     * @brief Settings in a change, combine with | to change several at once
+     *
+     */
+    const uint8_t kFieldChannel = 0x01;
+    const uint8_t kFieldAirRateLevel = 0x02;
+    const uint8_t kFieldPowerTransmissionValue = 0x04;
+    const uint8_t kFieldForwardErrorCorrection = 0x08;
+
+    /**
+     * @brief Settings sent to a module, only the fields in the mask are changed
+     *
+     */
+    struct LoRaRemoteSettings
+    {
+        uint8_t fields;
+        uint8_t channel;
+        LoRaSettings::LoRaAirRateLevel air_rate_level;
+        uint8_t power_transmission_value;
+        LoRaSettings::ForwardErrorCorrection forward_error_correction;
+    };
+
+    /**
+     * @brief Counters of the remote config layer
+     *
+     */
+    struct LoRaRemoteConfigStatistics
+    {
+        unsigned long applied;
+        unsigned long committed;
+        unsigned long rolled_back;
+        unsigned long failed_rollbacks; // Old settings could not be restored yet, tried again later
+        unsigned long rejected;         // Frames with a wrong tag or an old sequence number
+    };
+
+    /**
+     * @brief Read from storage, bytes never written must read as 0xFF like erased EEPROM
+     *
+     * @param address in the storage
+     * @param buffer to store the data in
+     * @param size amount of bytes to read
+     */
+    typedef void (*StorageRead)(const uint32_t address, uint8_t *buffer, const size_t size);
+
+    /**
+     * @brief Write to storage
+     *
+     * @param address in the storage
+     * @param data to write
+     * @param size amount of bytes to write
+     */
+    typedef void (*StorageWrite)(const uint32_t address, const uint8_t *data, const size_t size);
+
+    /**
+     * @brief Called on the gateway when a module confirms a change
+     *
+     * @param source_address address of the module
+     * @param sequence_number of the change
+     * @param result kSucces if the change is committed, otherwise the error of applying it
+     */
+    typedef void (*ConfirmCallback)(const uint16_t source_address, const uint16_t sequence_number, const LoRaErrorCode result);
+
+    /**
+     * @brief Class used by the gateway to change settings of modules and by modules to apply them
+     * A module applies a change in one AT session and keeps it only when the gateway commits it before the deadline,
+     * which the gateway does after it moved to the new settings itself. Otherwise the old settings are restored, so a
+     * module never stays out of reach, a rollback which fails is tried again until it succeeds.
+     * Frames are signed with a shared key and only newer changes are accepted. Keep the sequence numbers in storage
+     * with SetStorage on both sides, otherwise a module accepts a recorded change again after it reboots.
+     *
+     */
+    class LoRaRemoteConfig
+    {
+    public:
+        /**
+         * @brief Construct a new remote config layer
+         *
+         * @param lora driver of the module, which must be in fixed point transmission mode
+         * @param local_address address of this module
+         * @param local_channel channel this module receives on, replies are sent to it
+         * @param key shared key of kKeySize bytes used to sign frames
+         */
+        LoRaRemoteConfig(UsrLg206P *const lora, const uint16_t local_address, const uint8_t local_channel, const uint8_t *key);
+
+        /**
+         * @brief Set the channel replies are sent to, call it after this module changed its own channel
+         *
+         */
+        void SetLocalChannel(const uint8_t channel);
+
+        void SetConfirmCallback(ConfirmCallback callback);
+
+        /**
+         * @brief Keep the sequence numbers in storage, so they survive a reboot
+         * The sequence numbers kept there are read right away.
+         *
+         * @param read function reading the storage
+         * @param write function writing the storage
+         * @param address of the kStorageSize bytes used in the storage
+         */
+        void SetStorage(StorageRead read, StorageWrite write, const uint32_t address);
+
+        /**
+         * @brief Send a change to a module, gateway side
+         *
+         * @param settings change to apply
+         * @param deadline time in seconds the module waits for the commit before rolling back
+         * @param destination_address of the module
+         * @param channel of the module
+         * @param sequence_number OUTPUT sequence number of the change, used to commit it
+         * @return kInvalidParameter if no field is set or the deadline is 0, kWrongWorkMode if not in fixed point mode
+         */
+        LoRaErrorCode SendSettings(const LoRaRemoteSettings &settings, const uint16_t deadline, const uint16_t destination_address, const uint8_t channel, uint16_t *sequence_number = nullptr);
+
+        /**
+         * @brief Commit a change once the module is reachable with the new settings, gateway side
+         * Send it again if no confirmation is received, a module confirms a commit more than once.
+         *
+         * @return kWrongWorkMode if not in fixed point mode
+         */
+        LoRaErrorCode Commit(const uint16_t sequence_number, const uint16_t destination_address, const uint8_t channel);
+
+        /**
+         * @brief Handle received frames and roll back a change of which the deadline expired, call this regularly
+         *
+         */
+        void Update(void);
+
+        /**
+         * @brief Check if a change is applied which is not committed yet, module side
+         *
+         */
+        bool IsPending(void) const;
+
+        const LoRaRemoteConfigStatistics &GetStatistics(void) const;
+
+        /**
+         * @brief Get the SipHash-2-4 of data
+         *
+         * @param key of kKeySize bytes
+         * @param data to hash
+         * @param size of the data
+         * @return hash of the data
+         */
+        static uint64_t SipHash(const uint8_t *key, const uint8_t *data, const size_t size);
+
+    private:
+        UsrLg206P *lora_;
+        uint16_t local_address_;
+        uint8_t local_channel_;
+        uint8_t key_[kKeySize];
+        ConfirmCallback confirm_callback_;
+        LoRaRemoteConfigStatistics statistics_;
+        StorageRead read_;
+        StorageWrite write_;
+        uint32_t storage_address_;
+
+        uint16_t next_sequence_number_;
+        bool accepted_any_;
+        uint16_t last_sequence_number_; // Last change accepted by this module
+
+        bool pending_;
+        bool committed_;
+        unsigned long applied_at_;
+        unsigned long deadline_;
+        LoRaRemoteSettings previous_settings_;
+
+        LoRaFrameReader::LoRaFrameReader<2 * (kHeaderSize + 7 + kTagSize), 1, 0, GetFrameSize> receive_buffer_;
+
+        void Save(void) const;
+        void WriteHeader(uint8_t *frame, const FrameType type, const uint16_t sequence_number) const;
+        bool Transmit(uint8_t *frame, const size_t size, const uint16_t destination_address, const uint8_t channel);
+        bool IsSigned(const uint8_t *frame, const size_t size) const;
+        void HandleFrame(const uint8_t *frame, const size_t size);
+        void HandleSettings(const uint8_t *frame, const uint16_t sequence_number, const uint16_t source_address, const uint8_t source_channel);
+        void HandleCommit(const uint16_t sequence_number, const uint16_t source_address, const uint8_t source_channel);
+        void SendConfirm(const uint16_t sequence_number, const LoRaErrorCode result, const uint16_t destination_address, const uint8_t channel);
+        LoRaErrorCode Apply(const LoRaRemoteSettings &settings, LoRaRemoteSettings *previous);
+    };
+} // namespace LoRaRemoteConfig
+
+#endif // USR_LG206_P_REMOTE_CONFIG_H_
@@ -0,0 +1,202 @@
+/**
+ * @file usr_lg206_p_rpc.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Requests and responses on top of fixed point mode, matched by correlation id so several can be outstanding
+ * @version 0.1
+ * @date 2024-03-22
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_RPC_H_
+#define USR_LG206_P_RPC_H_
+
+#include "usr_lg206_p.h"
+#include "usr_lg206_p_frame_reader.h"
+
+/**
+ * @brief Amount of requests waiting to be sent or for a response, for all peers together
+ * Every call keeps its request until it is sent, so each one takes kLoRaRpcMaximumPayloadSize bytes of RAM.
+ *
+ */
+#ifndef kLoRaRpcAmountOfPending
+#define kLoRaRpcAmountOfPending 8
+#endif
+
+/**
+ * @brief Largest payload of one request or response
+ *
+ */
+#ifndef kLoRaRpcMaximumPayloadSize
+#define kLoRaRpcMaximumPayloadSize 48
+#endif
+
+/**
+ * @brief Time in milliseconds added to the timeout for UART transfers and handling the request on the other side
+ *
+ */
+#ifndef kLoRaRpcProcessingTime
+#define kLoRaRpcProcessingTime 200
+#endif
+
+namespace LoRaRpc
+{
+    /**
+     * @brief Size of the header in front of every frame
+     * type, payload length, source address (2 bytes), source channel and correlation id
+     *
+     */
+    const size_t kHeaderSize = 6;
+
+    enum class FrameType : uint8_t
+    {
+        kFrameTypeRequest = 0xC0,
+        kFrameTypeResponse = 0xD0,
+    };
+
+    /**
+     * @brief Counters of the rpc layer
+     *
+     */
+    struct LoRaRpcStatistics
+    {
+        unsigned long calls;
+        unsigned long responses;
+        unsigned long timeouts;
+        unsigned long requests_handled;
+        unsigned long responses_unmatched; // Responses arriving after their timeout or without request
+    };
+
+    /**
+     * @brief Called for every received request, the response is sent when it returns
+     *
+     * @param request payload of the request
+     * @param size of the request
+     * @param source_address address of the module which sent the request
+     * @param response buffer to store the response in
+     * @param response_size size of the buffer
+     * @return size of the response, may be 0
+     */
+    typedef size_t (*RequestHandler)(const uint8_t *request, const size_t size, const uint16_t source_address, uint8_t *response, const size_t response_size);
+
+    /**
+     * @brief Called when the response to a call is received or when its timeout expired
+     *
+     * @param destination_address address the request was sent to
+     * @param correlation_id id given to the call
+     * @param response payload of the response, nullptr on timeout
+     * @param size of the response
+     */
+    typedef void (*ResponseCallback)(const uint16_t destination_address, const uint8_t correlation_id, const uint8_t *response, const size_t size);
+
+    /**
+     * @brief Class used to call other modules without waiting for each response before the next request
+     * Requests are not retransmitted, a call without response is reported to the callback once its timeout expired.
+     * The module can not receive while it transmits and the other side answers right away, so only one request is on the
+     * air at a time: the next one waits in the layer until the response to the previous one arrived or timed out.
+     * The timeout of a call starts when it is sent.
+     *
+     */
+    class LoRaRpc
+    {
+    public:
+        /**
+         * @brief Construct a new rpc layer
+         *
+         * @param lora driver of the module, which must be in fixed point transmission mode
+         * @param local_address address of this module, set with SetDestinationAddress
+         * @param local_channel channel of this module
+         */
+        LoRaRpc(UsrLg206P *const lora, const uint16_t local_address, const uint8_t local_channel);
+
+        /**
+         * @brief Set the air rate level the module uses, the timeouts are derived from it
+         *
+         * @param level air rate level set on the module
+         */
+        void SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level);
+
+        void SetRequestHandler(RequestHandler handler);
+
+        void SetResponseCallback(ResponseCallback callback);
+
+        /**
+         * @brief Send a request, or queue it while the response to another request is awaited
+         * The response is handed to the response callback by Update.
+         *
+         * @param request payload of the request
+         * @param size of the request
+         * @param destination_address of the other module
+         * @param channel of the other module
+         * @param correlation_id OUTPUT id given to the call
+         * @param response_size expected size of the response, used for the timeout
+         * @return kQueueFull if too many calls are pending, kMessageTooLarge, kInvalidParameter when empty or kWrongWorkMode
+         */
+        LoRaErrorCode Call(const uint8_t *request, const size_t size, const uint16_t destination_address, const uint8_t channel, uint8_t *correlation_id = nullptr, const size_t response_size = kLoRaRpcMaximumPayloadSize);
+
+        /**
+         * @brief Handle received requests and responses, expire calls and send the next queued request, call this regularly
+         *
+         */
+        void Update(void);
+
+        /**
+         * @brief Get the amount of calls waiting to be sent or for a response
+         *
+         * @param destination_address peer, 65535 for all peers
+         * @return amount of calls
+         */
+        uint8_t GetAmountPending(const uint16_t destination_address = 65535) const;
+
+        /**
+         * @brief Get the time a call waits for its response
+         *
+         * @param request_size size of the request
+         * @param response_size expected size of the response
+         * @return timeout in milliseconds
+         */
+        unsigned long GetTimeout(const size_t request_size, const size_t response_size) const;
+
+        const LoRaRpcStatistics &GetStatistics(void) const;
+
+    private:
+        struct Pending
+        {
+            bool in_use;
+            bool sent;
+            uint16_t destination_address;
+            uint8_t channel;
+            uint8_t correlation_id;
+            uint8_t order; // Calls are sent in the order they were made
+            unsigned long sent_at;
+            unsigned long timeout;
+            size_t response_size;
+            size_t request_size;
+            uint8_t request[kLoRaRpcMaximumPayloadSize];
+        };
+
+        UsrLg206P *lora_;
+        uint16_t local_address_;
+        uint8_t local_channel_;
+        LoRaSettings::LoRaAirRateLevel air_rate_level_;
+        uint8_t next_correlation_id_;
+        uint8_t next_order_;
+        unsigned long busy_until_; // Time the frames handed to the module are estimated to be sent
+        RequestHandler request_handler_;
+        ResponseCallback response_callback_;
+        LoRaRpcStatistics statistics_;
+
+        Pending pending_[kLoRaRpcAmountOfPending];
+        LoRaFrameReader::LoRaFrameReader<2 * (kHeaderSize + kLoRaRpcMaximumPayloadSize) + 1, kHeaderSize> receive_buffer_;
+
+        bool IsPending(const uint16_t destination_address, const uint8_t correlation_id) const;
+        unsigned long GetBusyFor(void) const;
+        void SendNext(void);
+        bool Transmit(const uint8_t type, const uint8_t correlation_id, const uint8_t *payload, const size_t size, const uint16_t destination_address, const uint8_t channel);
+        void HandleFrame(const uint8_t *frame, const size_t size);
+        void HandleRequest(const uint8_t *frame, const size_t size);
+        void HandleResponse(const uint8_t *frame, const size_t size);
+    };
+} // namespace LoRaRpc
+
+#endif // USR_LG206_P_RPC_H_
@@ -0,0 +1,210 @@
+/**
+ * @file usr_lg206_p_schema.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Compile time schema which packs the fields of a struct in as few bits as possible
+ * @version 0.1
+ * @date 2024-03-19
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_SCHEMA_H_
+#define USR_LG206_P_SCHEMA_H_
+
+#include <Arduino.h>
+
+namespace LoRaSchema
+{
+    /**
+     * @brief Write the lowest bits of a value, most significant bit first, into a zeroed buffer
+     *
+     * @param buffer to write in
+     * @param bit_offset position of the first bit
+     * @param bits amount of bits, at most 32
+     * @param value to write
+     */
+    void WriteBits(uint8_t *buffer, size_t bit_offset, uint8_t bits, const uint32_t value);
+
+    /**
+     * @brief Read bits written by WriteBits
+     *
+     * @param buffer to read from
+     * @param bit_offset position of the first bit
+     * @param bits amount of bits, at most 32
+     * @return value
+     */
+    uint32_t ReadBits(const uint8_t *buffer, size_t bit_offset, uint8_t bits);
+
+    /**
+     * @brief Description of one member of a struct, stored as (value * Multiplier / Divisor) - Minimum in Bits bits
+     * Values outside the range are stored as the nearest value which fits. Floating point values are rounded.
+     * Example, a temperature between -40.0 and 62.3 degrees with one decimal: Field<Reading, float, &Reading::temperature, 10, -400, 10>
+     *
+     * @tparam Struct type of the struct
+     * @tparam Type type of the member
+     * @tparam Member pointer to the member
+     * @tparam Bits amount of bits the value is stored in, 1 to 32
+     * @tparam Minimum lowest value after scaling
+     * @tparam Multiplier value is multiplied by before it is stored
+     * @tparam Divisor value is divided by before it is stored
+     */
+    template <typename Struct, typename Type, Type Struct::*Member, uint8_t Bits, long Minimum = 0, long Multiplier = 1, long Divisor = 1>
+    class Field
+    {
+        static_assert(Bits > 0 && Bits <= 32, "A field is stored in 1 to 32 bits");
+        static_assert(Multiplier != 0 && Divisor != 0, "Scale can not be 0");
+
+    public:
+        static const size_t kBits = Bits;
+        static const uint32_t kMaximum = (Bits == 32) ? 0xFFFFFFFFUL : ((1UL << (Bits % 32)) - 1);
+
+        static void Encode(const Struct &data, uint8_t *buffer, const size_t bit_offset)
+        {
+            const long scaled = Scale(data.*Member);
+            uint32_t raw = 0;
+            if (scaled > Minimum)
+            {
+                raw = static_cast<uint32_t>(scaled - Minimum);
+                raw = (raw > kMaximum) ? kMaximum : raw;
+            }
+            WriteBits(buffer, bit_offset, Bits, raw);
+        };
+
+        static void Decode(const uint8_t *buffer, const size_t bit_offset, Struct &data)
+        {
+            Unscale(static_cast<long>(ReadBits(buffer, bit_offset, Bits)) + Minimum, data.*Member);
+        };
+
+    private:
+        static long Scale(const float value)
+        {
+            const float scaled = value * Multiplier / Divisor;
+            return (scaled >= 0) ? static_cast<long>(scaled + 0.5f) : static_cast<long>(scaled - 0.5f);
+        };
+
+        static long Scale(const double value)
+        {
+            const double scaled = value * Multiplier / Divisor;
+            return (scaled >= 0) ? static_cast<long>(scaled + 0.5) : static_cast<long>(scaled - 0.5);
+        };
+
+        template <typename Integer>
+        static long Scale(const Integer value)
+        {
+            return static_cast<long>(value) * Multiplier / Divisor;
+        };
+
+        static void Unscale(const long value, float &result)
+        {
+            result = static_cast<float>(value) * Divisor / Multiplier;
+        };
+
+        static void Unscale(const long value, double &result)
+        {
+            result = static_cast<double>(value) * Divisor / Multiplier;
+        };
+
+        template <typename Integer>
+        static void Unscale(const long value, Integer &result)
+        {
+            result = static_cast<Integer>(value * Divisor / Multiplier);
+        };
+    };
+
+    /**
+     * @brief Fields packed one after the other, used by LoRaSchema
+     *
+     */
+    template <typename Struct, typename... Fields>
+    class FieldList;
+
+    template <typename Struct>
+    class FieldList<Struct>
+    {
+    public:
+        static const size_t kBits = 0;
+
+        static void Encode(const Struct &, uint8_t *, const size_t) {};
+        static void Decode(const uint8_t *, const size_t, Struct &) {};
+    };
+
+    template <typename Struct, typename First, typename... Rest>
+    class FieldList<Struct, First, Rest...>
+    {
+    public:
+        static const size_t kBits = First::kBits + FieldList<Struct, Rest...>::kBits;
+
+        static void Encode(const Struct &data, uint8_t *buffer, const size_t bit_offset)
+        {
+            First::Encode(data, buffer, bit_offset);
+            FieldList<Struct, Rest...>::Encode(data, buffer, bit_offset + First::kBits);
+        };
+
+        static void Decode(const uint8_t *buffer, const size_t bit_offset, Struct &data)
+        {
+            First::Decode(buffer, bit_offset, data);
+            FieldList<Struct, Rest...>::Decode(buffer, bit_offset + First::kBits, data);
+        };
+    };
+
+    /**
+     * @brief Packs a struct into the least amount of bytes and back, the layout is fixed at compile time
+     * Sender and receiver must use the same schema. Nothing is allocated, messages are built in and read from the caller's buffer.
+     *
+     * @tparam Struct type of the struct
+     * @tparam Fields a Field for every member which is sent, in the order they are packed
+     */
+    template <typename Struct, typename... Fields>
+    class LoRaSchema
+    {
+    public:
+        static const size_t kBits = FieldList<Struct, Fields...>::kBits;
+
+        /**
+         * @brief Size of an encoded message in bytes
+         *
+         */
+        static const size_t kSize = (kBits + 7) / 8;
+
+        /**
+         * @brief Pack the fields of a struct
+         *
+         * @param data struct to pack
+         * @param buffer to write the message in
+         * @param buffer_size size of the buffer
+         * @return size of the message, 0 if the buffer is smaller than kSize
+         */
+        static size_t Encode(const Struct &data, uint8_t *buffer, const size_t buffer_size)
+        {
+            if (buffer_size < kSize)
+            {
+                return 0;
+            }
+
+            memset(buffer, 0, kSize);
+            FieldList<Struct, Fields...>::Encode(data, buffer, 0);
+            return kSize;
+        };
+
+        /**
+         * @brief Unpack a received message into a struct, members without field are left untouched
+         *
+         * @param buffer holding the message
+         * @param size of the message
+         * @param data OUTPUT struct to fill
+         * @return false if the message is smaller than kSize
+         */
+        static bool Decode(const uint8_t *buffer, const size_t size, Struct &data)
+        {
+            if (size < kSize)
+            {
+                return false;
+            }
+
+            FieldList<Struct, Fields...>::Decode(buffer, 0, data);
+            return true;
+        };
+    };
+} // namespace LoRaSchema
+
+#endif // USR_LG206_P_SCHEMA_H_
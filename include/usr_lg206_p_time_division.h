@@ -0,0 +1,226 @@
+/**
+ * @file usr_lg206_p_time_division.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Time division multiple access, a gateway beacon synchronises the nodes and every node address gets its own slot
+ * @version 0.1
+ * @date 2024-03-12
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_TIME_DIVISION_H_
+#define USR_LG206_P_TIME_DIVISION_H_
+
+#include "usr_lg206_p.h"
+
+/**
+ * @brief Largest message a node can send in its slot
+ *
+ */
+#ifndef kLoRaTimeDivisionMaximumMessageSize
+#define kLoRaTimeDivisionMaximumMessageSize 32
+#endif
+
+/**
+ * @brief Time in milliseconds kept free at the end of every slot for clock differences
+ *
+ */
+#ifndef kLoRaTimeDivisionGuardTime
+#define kLoRaTimeDivisionGuardTime 50
+#endif
+
+/**
+ * @brief Amount of superframes a node stays synchronised without receiving a beacon
+ *
+ */
+#ifndef kLoRaTimeDivisionMissedBeacons
+#define kLoRaTimeDivisionMissedBeacons 3
+#endif
+
+namespace LoRaTimeDivision
+{
+    const uint8_t kFrameTypeBeacon = 0x50;
+
+    /**
+     * @brief Size of a beacon
+     * type, length, gateway address (2 bytes), network time (4 bytes), amount of slots and slot length (2 bytes)
+     *
+     */
+    const size_t kBeaconSize = 11;
+
+    /**
+     * @brief Time the UART of the driver waits before reading a frame, see UsrLg206P::ReceiveMessage
+     *
+     */
+    const unsigned long kReceiveDelay = 10;
+
+    /**
+     * @brief Get the length of a slot which fits one message and the guard time
+     *
+     * @param level air rate level of the network
+     * @param message_size largest message sent in a slot
+     * @return length in milliseconds
+     */
+    unsigned long GetSlotLength(const LoRaSettings::LoRaAirRateLevel level, const size_t message_size);
+
+    /**
+     * @brief Sends a beacon at the start of every superframe, in the first slot
+     * The superframe has one slot for the beacon followed by one slot per node.
+     *
+     */
+    class LoRaTimeDivisionGateway
+    {
+    public:
+        /**
+         * @brief Construct a new gateway
+         *
+         * @param lora driver of the module, which must be in fixed point transmission mode
+         * @param local_address address of this module
+         * @param channel channel of the network
+         */
+        LoRaTimeDivisionGateway(UsrLg206P *const lora, const uint16_t local_address, const uint8_t channel);
+
+        /**
+         * @brief Set the layout of the superframe
+         *
+         * @param amount_of_slots amount of node slots, at least 1
+         * @param slot_length length of every slot in milliseconds, see GetSlotLength
+         * @return kInvalidParameter if out of range
+         */
+        LoRaErrorCode Configure(const uint8_t amount_of_slots, const uint16_t slot_length);
+
+        /**
+         * @brief Send the beacon when a superframe starts, call this regularly
+         *
+         * @return true if a beacon was sent
+         */
+        bool Update(void);
+
+        /**
+         * @brief Get the length of a superframe, beacon slot included
+         *
+         * @return length in milliseconds
+         */
+        unsigned long GetSuperframeLength(void) const;
+
+    private:
+        UsrLg206P *lora_;
+        uint16_t local_address_;
+        uint8_t channel_;
+        uint8_t amount_of_slots_;
+        uint16_t slot_length_;
+        bool started_;
+        unsigned long superframe_start_;
+    };
+
+    /**
+     * @brief Synchronises to the beacon of the gateway and sends queued messages in the slot of its address
+     * Slot of a node is 1 + address % amount of slots, so addresses should be consecutive.
+     *
+     */
+    class LoRaTimeDivisionNode
+    {
+    public:
+        /**
+         * @brief Construct a new node
+         *
+         * @param lora driver of the module, which must be in fixed point transmission mode
+         * @param local_address address of this module, determines the slot
+         */
+        LoRaTimeDivisionNode(UsrLg206P *const lora, const uint16_t local_address);
+
+        /**
+         * @brief Set the air rate level of the network, used to correct for the time the beacon was on air
+         * and to check a message fits in the slot. The slowest level is assumed until it is set.
+         *
+         * @param level air rate level set on the module
+         */
+        void SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level);
+
+        /**
+         * @brief Queue a message for the next slot of this node
+         * A message queued before the first beacon which turns out not to fit in the slot is dropped on the next Update.
+         *
+         * @return kQueueFull if a message is waiting already, kMessageTooLarge if larger than
+         * kLoRaTimeDivisionMaximumMessageSize or longer on air than the slot, kInvalidParameter for an empty message
+         */
+        LoRaErrorCode Send(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel);
+
+        /**
+         * @brief Read a frame from the module, beacons are handled and not returned
+         *
+         * @param buffer to store other frames in
+         * @param buffer_size size of the buffer
+         * @return size of the frame, 0 if nothing or a beacon was received
+         */
+        size_t Receive(uint8_t *buffer, const size_t buffer_size);
+
+        /**
+         * @brief Handle a frame received by the sketch itself
+         *
+         * @return true if the frame was a beacon
+         */
+        bool HandleFrame(const uint8_t *frame, const size_t size);
+
+        /**
+         * @brief Send the queued message when the slot of this node started, call this regularly
+         * At most one message is sent per superframe.
+         *
+         * @return true if the message was sent
+         */
+        bool Update(void);
+
+        /**
+         * @brief Check if a recent beacon was received
+         *
+         */
+        bool IsSynchronised(void) const;
+
+        /**
+         * @brief Get the time of the gateway
+         *
+         * @return time in milliseconds
+         */
+        unsigned long GetNetworkTime(void) const;
+
+        /**
+         * @brief Get the slot this node transmits in
+         *
+         * @return index of the slot, 0 when not synchronised
+         */
+        uint8_t GetSlot(void) const;
+
+        /**
+         * @brief Get the time until the slot of this node starts
+         *
+         * @return time in milliseconds, 0 when the slot is running or when not synchronised
+         */
+        unsigned long GetTimeUntilSlot(void) const;
+
+        bool HasPendingMessage(void) const;
+
+    private:
+        UsrLg206P *lora_;
+        uint16_t local_address_;
+        LoRaSettings::LoRaAirRateLevel air_rate_level_;
+
+        bool synchronised_;
+        unsigned long offset_; // Added to millis() to get the network time
+        unsigned long last_beacon_received_at_;
+        uint8_t amount_of_slots_;
+        uint16_t slot_length_;
+
+        bool pending_;
+        unsigned long last_superframe_; // Superframe the last message was sent in plus one, 0 if none
+        uint16_t destination_address_;
+        uint8_t channel_;
+        size_t size_;
+        uint8_t message_[kLoRaTimeDivisionMaximumMessageSize];
+        uint8_t receive_buffer_[kLoRaTimeDivisionMaximumMessageSize + 1];
+
+        unsigned long GetSuperframeLength(void) const;
+        unsigned long GetTimeOnAir(const size_t size) const;
+    };
+} // namespace LoRaTimeDivision
+
+#endif // USR_LG206_P_TIME_DIVISION_H_
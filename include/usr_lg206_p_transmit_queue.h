@@ -0,0 +1,183 @@
+/**
+ * @file usr_lg206_p_transmit_queue.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Bounded transmit queue with priority classes, drained within the air time budget of the module
+ * @version 0.1
+ * @date 2024-03-10
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_TRANSMIT_QUEUE_H_
+#define USR_LG206_P_TRANSMIT_QUEUE_H_
+
+#include "usr_lg206_p.h"
+
+/**
+ * @brief Amount of messages the queue holds for all classes together
+ *
+ */
+#ifndef kLoRaTransmitQueueSize
+#define kLoRaTransmitQueueSize 8
+#endif
+
+/**
+ * @brief Largest message which can be queued
+ *
+ */
+#ifndef kLoRaTransmitQueueMaximumMessageSize
+#define kLoRaTransmitQueueMaximumMessageSize 64
+#endif
+
+namespace LoRaTransmitQueue
+{
+    /**
+     * @brief Priority class of a message, a lower value is sent first
+     *
+     */
+    enum class Priority : uint8_t
+    {
+        kPriorityAlarm = 0,
+        kPriorityNormal = 1,
+        kPriorityBulk = 2,
+    };
+
+    const size_t kAmountOfPriorities = 3;
+
+    /**
+     * @brief What happens when a message is queued in a class which reached its depth
+     *
+     */
+    enum class DropPolicy : uint8_t
+    {
+        kDropPolicyRejectNew = 0, // The new message is refused with kQueueFull
+        kDropPolicyDropOldest = 1, // The oldest message of the class makes room, e.g. for readings where only the latest counts
+    };
+
+    /**
+     * @brief Counters of one priority class
+     *
+     */
+    struct LoRaTransmitQueueStatistics
+    {
+        unsigned long enqueued;
+        unsigned long sent;
+        unsigned long dropped;
+        unsigned long maximum_latency; // Longest time in milliseconds between queueing and sending
+    };
+
+    /**
+     * @brief Class used to queue messages and send them by priority
+     * Update hands one message at a time to the module, only after the previous one is on air
+     * and the duty cycle allows it, so an alarm waits for at most one frame.
+     *
+     */
+    class LoRaTransmitQueue
+    {
+    public:
+        LoRaTransmitQueue(UsrLg206P *const lora);
+
+        /**
+         * @brief Set the air rate level the module uses, to know how long a message is on air
+         *
+         * @param level air rate level set on the module
+         */
+        void SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level);
+
+        /**
+         * @brief Limit the part of the time the module transmits
+         *
+         * @param per_mille share of time in 1/1000, e.g. 10 for a 1% duty cycle, 1000 for no limit
+         * @return kInvalidParameter if 0 or more than 1000
+         */
+        LoRaErrorCode SetDutyCycle(const uint16_t per_mille);
+
+        /**
+         * @brief Set the amount of messages a class may hold and what happens when it is full
+         *
+         * @param priority class to set
+         * @param depth between 1 and kLoRaTransmitQueueSize
+         * @param policy drop policy of the class
+         * @return kInvalidParameter if out of range
+         */
+        LoRaErrorCode SetClassLimit(const Priority priority, const uint8_t depth, const DropPolicy policy);
+
+        /**
+         * @brief Queue a message sent in transparent mode
+         *
+         * @return kQueueFull, kMessageTooLarge or kInvalidParameter for an empty message
+         */
+        LoRaErrorCode Enqueue(const uint8_t *message, const size_t size, const Priority priority);
+
+        /**
+         * @brief Queue a message sent in fixed point mode
+         *
+         * @return kQueueFull, kMessageTooLarge or kInvalidParameter for an empty message
+         */
+        LoRaErrorCode Enqueue(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel, const Priority priority);
+
+        /**
+         * @brief Send the most urgent message if the module is free, call this regularly
+         *
+         * @return true if a message was handed to the module
+         */
+        bool Update(void);
+
+        /**
+         * @brief Get the amount of messages queued in a class
+         *
+         */
+        uint8_t GetAmountQueued(const Priority priority) const;
+
+        /**
+         * @brief Get the amount of messages queued in all classes
+         *
+         */
+        uint8_t GetAmountQueued(void) const;
+
+        /**
+         * @brief Get the time in milliseconds before the module may transmit again
+         *
+         */
+        unsigned long GetTimeUntilFree(void) const;
+
+        /**
+         * @brief Remove all queued messages
+         *
+         */
+        void Clear(void);
+
+        const LoRaTransmitQueueStatistics &GetStatistics(const Priority priority) const;
+
+    private:
+        struct Entry
+        {
+            bool in_use;
+            Priority priority;
+            bool fixed_point;
+            uint16_t destination_address;
+            uint8_t channel;
+            unsigned long order; // Messages of a class are sent in the order they were queued
+            unsigned long enqueued_at;
+            size_t size;
+            uint8_t data[kLoRaTransmitQueueMaximumMessageSize];
+        };
+
+        UsrLg206P *lora_;
+        LoRaSettings::LoRaAirRateLevel air_rate_level_;
+        uint16_t duty_cycle_;
+        unsigned long next_order_;
+        unsigned long sent_at_;
+        unsigned long blocked_for_;
+        uint8_t depths_[kAmountOfPriorities];
+        DropPolicy policies_[kAmountOfPriorities];
+        LoRaTransmitQueueStatistics statistics_[kAmountOfPriorities];
+
+        Entry entries_[kLoRaTransmitQueueSize];
+
+        LoRaErrorCode Add(const uint8_t *message, const size_t size, const bool fixed_point, const uint16_t destination_address, const uint8_t channel, const Priority priority);
+        Entry *GetOldest(const Priority priority);
+    };
+} // namespace LoRaTransmitQueue
+
+#endif // USR_LG206_P_TRANSMIT_QUEUE_H_
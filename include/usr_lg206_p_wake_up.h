@@ -0,0 +1,260 @@
+/**
+ * @file usr_lg206_p_wake_up.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Batches messages for modules in wake up mode, packed in as few frames as possible
+ * @version 0.1
+ * @date 2024-03-26
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_WAKE_UP_H_
+#define USR_LG206_P_WAKE_UP_H_
+
+#include "usr_lg206_p.h"
+#include "usr_lg206_p_frame_reader.h"
+
+/**
+ * @brief Largest frame sent in a burst
+ *
+ */
+#ifndef kLoRaWakeUpFrameSize
+#define kLoRaWakeUpFrameSize 64
+#endif
+
+/**
+ * @brief Amount of bytes queued per module in wake up mode, at most one burst
+ *
+ */
+#ifndef kLoRaWakeUpQueueSize
+#define kLoRaWakeUpQueueSize 128
+#endif
+
+/**
+ * @brief Amount of modules in wake up mode messages can be queued for
+ *
+ */
+#ifndef kLoRaWakeUpAmountOfPeers
+#define kLoRaWakeUpAmountOfPeers 4
+#endif
+
+/**
+ * @brief Default time in milliseconds a message may wait before its burst is sent
+ *
+ */
+#ifndef kLoRaWakeUpMaximumLatency
+#define kLoRaWakeUpMaximumLatency 10000
+#endif
+
+/**
+ * @brief Time in milliseconds between checks for received data while draining
+ *
+ */
+#ifndef kLoRaWakeUpPollInterval
+#define kLoRaWakeUpPollInterval 5
+#endif
+
+/**
+ * @brief Time in milliseconds the module needs to pass on a frame, added to the time the receiver waits for the next one
+ *
+ */
+#ifndef kLoRaWakeUpProcessingTime
+#define kLoRaWakeUpProcessingTime 200
+#endif
+
+namespace LoRaWakeUp
+{
+    /**
+     * @brief Size of the header in front of every frame
+     * amount of frames following in the same burst and length of the records
+     *
+     */
+    const size_t kHeaderSize = 2;
+
+    /**
+     * @brief Every message in a frame is preceded by one byte holding its length
+     *
+     */
+    const size_t kRecordHeaderSize = 1;
+
+    /**
+     * @brief Largest message which can be sent
+     *
+     */
+    const size_t kMaximumMessageSize = kLoRaWakeUpFrameSize - kHeaderSize - kRecordHeaderSize < 255 ? kLoRaWakeUpFrameSize - kHeaderSize - kRecordHeaderSize : 255;
+
+    static_assert(kLoRaWakeUpQueueSize >= kLoRaWakeUpFrameSize - kHeaderSize, "The queue must hold the largest message");
+
+    /**
+     * @brief Get the size of a frame from its header
+     *
+     * @param frame start of the frame
+     * @return size of the frame, 0 when it is larger than a frame can be
+     */
+    size_t GetFrameSize(const uint8_t *frame);
+
+    /**
+     * @brief Called for every message received while draining
+     *
+     * @param message data of the message
+     * @param size of the message
+     */
+    typedef void (*MessageCallback)(const uint8_t *message, const size_t size);
+
+    /**
+     * @brief Counters of the sender
+     *
+     */
+    struct LoRaWakeUpSenderStatistics
+    {
+        unsigned long messages_queued;
+        unsigned long messages_sent_directly; // Destination is not in wake up mode
+        unsigned long bursts;                 // Queued messages sent together, the destination drains them at once
+        unsigned long frames_sent;
+    };
+
+    /**
+     * @brief Counters of the receiver
+     *
+     */
+    struct LoRaWakeUpReceiverStatistics
+    {
+        unsigned long messages_received;
+        unsigned long frames_received;
+        unsigned long drains;
+        unsigned long incomplete_drains; // The last frame of the burst did not arrive in time
+    };
+
+    /**
+     * @brief Class used to send messages to modules in wake up mode
+     * A module in wake up mode only listens once every wake up interval, so every frame sent to it pays a long
+     * preamble, also the frames of a burst. Messages for such a module are queued and packed as records in as few
+     * frames as possible, which saves the preambles of the messages sharing a frame. The frames of a burst are sent
+     * back to back, so the destination reads them all with LoRaWakeUpReceiver::Drain before it sleeps again.
+     * A burst is sent when the oldest message reaches the maximum latency of the destination, when the next
+     * message does not fit or when Flush is called. Messages to other modules are sent right away.
+     *
+     */
+    class LoRaWakeUpSender
+    {
+    public:
+        LoRaWakeUpSender(UsrLg206P *const lora);
+
+        /**
+         * @brief Queue the messages for a module in wake up mode
+         *
+         * @param destination_address of the other module
+         * @param channel of the other module
+         * @param maximum_latency time in milliseconds a message may wait
+         * @return kQueueFull if kLoRaWakeUpAmountOfPeers modules are added already
+         */
+        LoRaErrorCode AddPeer(const uint16_t destination_address, const uint8_t channel, const unsigned long maximum_latency = kLoRaWakeUpMaximumLatency);
+
+        /**
+         * @brief Send the queued messages of a module and send its next messages right away
+         *
+         * @return kInvalidParameter if the module was not added, otherwise the result of sending the burst
+         */
+        LoRaErrorCode RemovePeer(const uint16_t destination_address, const uint8_t channel);
+
+        /**
+         * @brief Send a message, or queue it when the destination is in wake up mode
+         *
+         * @param message data that needs to be send
+         * @param size of the data, at most kMaximumMessageSize
+         * @param destination_address of the other module
+         * @param channel of the other module
+         * @return kMessageTooLarge, kInvalidParameter for an empty message or kWrongWorkMode if not in fixed point mode
+         */
+        LoRaErrorCode Send(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel);
+
+        /**
+         * @brief Send the bursts of all modules
+         *
+         * @return kWrongWorkMode if a burst could not be sent
+         */
+        LoRaErrorCode Flush(void);
+
+        /**
+         * @brief Send the bursts of which the oldest message reached the maximum latency, call this regularly
+         *
+         * @return kWrongWorkMode if a burst could not be sent
+         */
+        LoRaErrorCode Update(void);
+
+        /**
+         * @brief Get the amount of messages waiting for a module
+         *
+         * @param destination_address of the module, 65535 counts all modules
+         */
+        size_t GetAmountQueued(const uint16_t destination_address = 65535) const;
+
+        const LoRaWakeUpSenderStatistics &GetStatistics(void) const;
+
+    private:
+        struct Peer
+        {
+            bool in_use;
+            uint16_t destination_address;
+            uint8_t channel;
+            unsigned long maximum_latency;
+            unsigned long oldest_at;
+            size_t amount;
+            size_t size;
+            uint8_t queue[kLoRaWakeUpQueueSize];
+        };
+
+        UsrLg206P *lora_;
+        LoRaWakeUpSenderStatistics statistics_;
+
+        Peer peers_[kLoRaWakeUpAmountOfPeers];
+
+        Peer *FindPeer(const uint16_t destination_address, const uint8_t channel);
+        LoRaErrorCode SendBurst(Peer &peer);
+    };
+
+    /**
+     * @brief Class used by a module in wake up mode to read a whole burst before it sleeps again
+     *
+     */
+    class LoRaWakeUpReceiver
+    {
+    public:
+        LoRaWakeUpReceiver(UsrLg206P *const lora);
+
+        /**
+         * @brief Set the air rate level the module uses, the time waited for the next frame is derived from it
+         *
+         * @param level air rate level set on the module
+         */
+        void SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level);
+
+        /**
+         * @brief Read frames until the last frame of the burst arrived or no frame arrived for the drain timeout
+         * Call this when the module received data, afterwards the microcontroller can sleep.
+         *
+         * @param callback called for every message
+         * @return amount of messages received
+         */
+        size_t Drain(MessageCallback callback);
+
+        /**
+         * @brief Get the time in milliseconds waited for the next frame of a burst
+         *
+         */
+        unsigned long GetDrainTimeout(void) const;
+
+        const LoRaWakeUpReceiverStatistics &GetStatistics(void) const;
+
+    private:
+        UsrLg206P *lora_;
+        LoRaSettings::LoRaAirRateLevel air_rate_level_;
+        LoRaWakeUpReceiverStatistics statistics_;
+
+        LoRaFrameReader::LoRaFrameReader<2 * kLoRaWakeUpFrameSize + 1, kHeaderSize, 1, GetFrameSize> receive_buffer_;
+
+        size_t HandleFrame(const uint8_t *frame, const size_t size, MessageCallback callback);
+    };
+} // namespace LoRaWakeUp
+
+#endif // USR_LG206_P_WAKE_UP_H_
@@ -0,0 +1,256 @@
+/**
+ * @file usr_lg206_p_wake_up_control.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Adapts the wake up interval of a module in wake up mode to the traffic it receives
+ * @version 0.1
+ * @date 2024-03-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef USR_LG206_P_WAKE_UP_CONTROL_H_
+#define USR_LG206_P_WAKE_UP_CONTROL_H_
+
+#include "usr_lg206_p.h"
+
+/**
+ * @brief Time in milliseconds the module listens for a preamble every time it wakes up
+ *
+ */
+#ifndef kLoRaWakeUpControlListenTime
+#define kLoRaWakeUpControlListenTime 30
+#endif
+
+/**
+ * @brief Weight of a new inter arrival time in the mean, as a shift, 3 gives every new time 1/8 of the weight
+ *
+ */
+#ifndef kLoRaWakeUpControlSmoothing
+#define kLoRaWakeUpControlSmoothing 3
+#endif
+
+/**
+ * @brief Difference in percent between the best and the current interval before the interval is changed
+ *
+ */
+#ifndef kLoRaWakeUpControlHysteresis
+#define kLoRaWakeUpControlHysteresis 20
+#endif
+
+/**
+ * @brief Time in milliseconds between two changes of the interval, every change needs the AT mode
+ *
+ */
+#ifndef kLoRaWakeUpControlMinimumInterval
+#define kLoRaWakeUpControlMinimumInterval 60000
+#endif
+
+/**
+ * @brief Amount of times a request to change the interval is sent before giving up
+ *
+ */
+#ifndef kLoRaWakeUpControlMaximumRequests
+#define kLoRaWakeUpControlMaximumRequests 3
+#endif
+
+namespace LoRaWakeUpControl
+{
+    /**
+     * @brief Range of the module in milliseconds, see UsrLg206P::SetWakingUpInterval
+     *
+     */
+    const int kMinimumInterval = 500;
+    const int kMaximumInterval = 4000;
+
+    /**
+     * @brief Interval set on a module which was not configured yet
+     *
+     */
+    const int kDefaultInterval = 2000;
+
+    /**
+     * @brief Intervals are rounded to this amount of milliseconds
+     *
+     */
+    const int kIntervalStep = 100;
+
+    /**
+     * @brief Size of a request or acknowledgement
+     * type, length, source address (2 bytes) and the new interval (2 bytes)
+     *
+     */
+    const size_t kFrameSize = 6;
+
+    enum class FrameType : uint8_t
+    {
+        kFrameTypeRequest = 0xE8,
+        kFrameTypeAcknowledgement = 0xE9,
+    };
+
+    /**
+     * @brief Side of the link the wake up control runs on
+     *
+     */
+    enum class Role : uint8_t
+    {
+        kRoleNode = 0,   // Module in wake up mode, measures the traffic and asks the sender to change the interval
+        kRoleSender = 1, // Module sending to the node, follows the requests with the length of its preamble
+    };
+
+    /**
+     * @brief Time in milliseconds added to the request timeout for UART transfers and setting the interval
+     *
+     */
+    const unsigned long kProcessingTime = 200;
+
+    /**
+     * @brief Get the wake up interval which costs the least energy
+     * Every wake up costs kLoRaWakeUpControlListenTime of listening, every message costs on average half an interval
+     * of receiving its preamble. The sum is lowest at the square root of 2 * listen time * inter arrival time.
+     *
+     * @param inter_arrival_time mean time in milliseconds between messages
+     * @param latency_target longest time in milliseconds a message may need to wake the module
+     * @return interval in milliseconds, between kMinimumInterval and kMaximumInterval
+     */
+    int CalculateInterval(const unsigned long inter_arrival_time, const unsigned long latency_target);
+
+    /**
+     * @brief Counters of the wake up control
+     *
+     */
+    struct LoRaWakeUpControlStatistics
+    {
+        unsigned long arrivals;
+        unsigned long increases;
+        unsigned long decreases;
+        unsigned long errors;            // Interval could not be set on the module
+        unsigned long failed_requests;   // Sender did not acknowledge a change
+        unsigned long rejected_requests; // Node was asked for a longer interval than its sender agreed on
+    };
+
+    /**
+     * @brief Sets the wake up interval of the module from the measured time between received messages
+     * Modules that receive rarely sleep longer, busy modules wake up more often, as long as the latency target
+     * is met. The sending module needs a preamble as long as the interval, so both sides change it together:
+     * a shorter interval is set here before the sender is asked to follow, a longer one only after the sender
+     * acknowledged it. The preamble of the sender therefore always covers the sleep of this module, also when a
+     * request or acknowledgement is lost.
+     * The sender runs the same class with the sender role and passes its frames to HandleFrame. It only follows
+     * requests, Update does nothing there. A node only accepts requests for a shorter interval, a longer one could
+     * let it sleep through the preamble of its sender.
+     *
+     */
+    class LoRaWakeUpControl
+    {
+    public:
+        /**
+         * @brief Construct a new wake up control, call Begin before using it
+         *
+         * @param lora driver of the module, in fixed point mode
+         * @param local_address address of this module
+         * @param peer_address address of the module on the other side of the link
+         * @param channel channel of the network
+         * @param role side of the link this module is on
+         * @param latency_target longest time in milliseconds a message may need to wake the module
+         */
+        LoRaWakeUpControl(UsrLg206P *const lora, const uint16_t local_address, const uint16_t peer_address, const uint8_t channel, const Role role, const unsigned long latency_target = kMaximumInterval);
+
+        /**
+         * @brief Read the interval set on the module
+         *
+         * @return error of the driver if the interval could not be read, kDefaultInterval is assumed then
+         */
+        LoRaErrorCode Begin(void);
+
+        /**
+         * @brief Set the air rate level the module uses, the request timeout is derived from it
+         *
+         * @param level air rate level set on the module
+         */
+        void SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level);
+
+        /**
+         * @brief Set the longest time a message may need to wake the module
+         *
+         * @param latency_target in milliseconds, at least kMinimumInterval
+         * @return kInvalidParameter if too short
+         */
+        LoRaErrorCode SetLatencyTarget(const unsigned long latency_target);
+
+        /**
+         * @brief Report that the module was woken up by a message, report a burst only once
+         *
+         */
+        void ReportArrival(void);
+
+        /**
+         * @brief Change the interval when a better one is found and the minimum interval passed, call this regularly
+         * Also sends the requests to the sender again until they are acknowledged. Does nothing on the sender.
+         *
+         */
+        void Update(void);
+
+        /**
+         * @brief Read a frame from the module, requests and acknowledgements are handled and not returned
+         *
+         * @param buffer to store other frames in
+         * @param buffer_size size of the buffer
+         * @return size of the frame, 0 if nothing or a frame of this layer was received
+         */
+        size_t Receive(uint8_t *buffer, const size_t buffer_size);
+
+        /**
+         * @brief Handle a frame received by the sketch itself
+         * A request sets the interval on this module before it is acknowledged, a node ignores requests for a longer interval.
+         *
+         * @return true if the frame was a request or acknowledgement
+         */
+        bool HandleFrame(const uint8_t *frame, const size_t size);
+
+        /**
+         * @brief Get the interval set on the module
+         *
+         * @return interval in milliseconds
+         */
+        int GetInterval(void) const;
+
+        /**
+         * @brief Check if a change of the interval waits for an acknowledgement of the sender
+         *
+         */
+        bool HasPendingChange(void) const;
+
+        /**
+         * @brief Get the mean time between reported arrivals
+         *
+         * @return time in milliseconds, 0 if less than two arrivals were reported
+         */
+        unsigned long GetMeanInterArrivalTime(void) const;
+
+        const LoRaWakeUpControlStatistics &GetStatistics(void) const;
+
+    private:
+        UsrLg206P *lora_;
+        uint16_t local_address_;
+        uint16_t peer_address_;
+        uint8_t channel_;
+        Role role_;
+        LoRaSettings::LoRaAirRateLevel air_rate_level_;
+        unsigned long latency_target_;
+        int interval_;           // Interval set on the module
+        int requested_interval_; // Interval the sender is asked to use, 0 when no change is pending
+        uint8_t requests_;       // Amount of times the request was sent
+        unsigned long requested_at_;
+        bool changed_;           // Interval was changed at least once
+        unsigned long last_change_;
+        unsigned long last_arrival_;
+        unsigned long mean_inter_arrival_time_;
+        LoRaWakeUpControlStatistics statistics_;
+
+        LoRaErrorCode Apply(const int interval);
+        bool SendFrame(const FrameType type, const int interval);
+        unsigned long GetRequestTimeout(void) const;
+    };
+} // namespace LoRaWakeUpControl
+
+#endif // USR_LG206_P_WAKE_UP_CONTROL_H_
@@ -23,6 +23,8 @@ UsrLg206P::UsrLg206P(RS485 *const serial)
 {
     this->serial_ = serial;
     this->settings_ = LoRaSettings::LoRaSettings(false);
+    this->checksum_ = false;
+    this->checksum_errors_ = 0;
 };
 
 UsrLg206P::~UsrLg206P(void)
@@ -63,7 +65,7 @@ LoRaErrorCode UsrLg206P::BeginAtMode(void)
 
     const size_t buffer_size = 128;
     uint8_t buffer[buffer_size];
-    size_t size = ReceiveMessage(buffer, buffer_size);
+    size_t size = ReceiveResponse(buffer, buffer_size);
     String received_data = String((char *)buffer);
     if (received_data.length() < 1)
     {
@@ -79,7 +81,7 @@ LoRaErrorCode UsrLg206P::BeginAtMode(void)
     sent_data = "a";
     bytes_written = SendCommand(sent_data);
 
-    size = ReceiveMessage(buffer, buffer_size);
+    size = ReceiveResponse(buffer, buffer_size);
     received_data = String((char *)buffer);
     if (received_data.length() < 1)
     {
@@ -301,6 +303,11 @@ LoRaErrorCode UsrLg206P::GetWorkMode(LoRaSettings::WorkMode &setting)
     return response_code;
 };
 
+LoRaSettings::WorkMode UsrLg206P::GetKnownWorkMode(void) const
+{
+    return settings_.work_mode;
+};
+
 LoRaErrorCode UsrLg206P::SetUartSettings(const LoRaUartSettings::LoRaUartSettings &setting)
 {
     String command = "+UART=";
@@ -722,7 +729,7 @@ LoRaErrorCode UsrLg206P::QueryTransmissionInterval()
 
     const size_t buffer_size = 128;
     uint8_t buffer[buffer_size];
-    size_t size = ReceiveMessage(buffer, buffer_size);
+    size_t size = ReceiveResponse(buffer, buffer_size);
     String received_data = String((char *)buffer);
 
     // If echo is enabled check for the repeated command
@@ -765,6 +772,16 @@ LoRaErrorCode UsrLg206P::SetKey(String key)
 
     return response_code;
 }
+void UsrLg206P::SetChecksum(const bool enabled)
+{
+    this->checksum_ = enabled;
+};
+
+unsigned long UsrLg206P::GetChecksumErrors(void) const
+{
+    return checksum_errors_;
+};
+
 int UsrLg206P::Available(void)
 {
     return serial_->available();
@@ -772,31 +789,11 @@ int UsrLg206P::Available(void)
 
 size_t UsrLg206P::ReceiveMessage(uint8_t *buffer, size_t buffer_size)
 {
-    // Wait for data to be received
-    serial_->WaitForInput();
-    int cursor = 0;
-    while (serial_->available())
+    if (checksum_)
     {
-        // TODO: Check if wait is necessary
-        delay(10);
-
-        size_t length = serial_->available();
-
-        // Control for overflow
-        if (cursor + length > buffer_size - 1)
-        {
-            return cursor;
-        }
-
-        for (size_t i = 0; i < length; i++)
-        {
-            buffer[cursor + i] = serial_->read();
-        }
-        cursor += length;
-        buffer[cursor + 1] = '\0';
+        return ReceiveCheckedMessage(buffer, buffer_size);
     }
-
-    return cursor;
+    return ReceiveResponse(buffer, buffer_size);
 };
 
 int UsrLg206P::SendMessage(const uint8_t *message, const size_t length)
@@ -811,8 +808,13 @@ int UsrLg206P::SendMessage(const char *const message, const size_t length)
     //     return -2;
     // }
 
+    if (checksum_ && length > kMaximumCheckedMessageSize)
+    {
+        return -1;
+    }
+
     serial_->SetMode(OUTPUT);
-    int amountOfBytesWritten = serial_->write(message, length);
+    int amountOfBytesWritten = WriteFrame(message, length);
     serial_->flush();
     serial_->SetMode(INPUT);
 
@@ -826,25 +828,22 @@ int UsrLg206P::SendMessage(const char *message, const size_t message_size, const
         return -2;
     }
 
-    const size_t destination_address_size = sizeof(destination_address);
-    const size_t channel_size = sizeof(channel);
-
-    const size_t total_message_size = (destination_address_size + channel_size + message_size);
+    if (checksum_ && message_size > kMaximumCheckedMessageSize)
+    {
+        return -1;
+    }
 
-    char message_buffer[total_message_size];
-    // Copy destination address into message buffer
-    message_buffer[0] = (destination_address & 0xFF00) >> 8;
-    message_buffer[1] = (destination_address & 0xFF);
-    // TODO: Check id memcpy is also working
-    //  memcpy(message_buffer, &destination_address, destination_address_size);
-    // Copy channel into message buffer
-    memcpy(message_buffer + destination_address_size, &channel, channel_size);
-    // Copy message into message buffer
-    memcpy(message_buffer + destination_address_size + channel_size, message, message_size);
+    // Destination address and channel in front of the frame
+    const uint8_t header[] = {
+        static_cast<uint8_t>((destination_address & 0xFF00) >> 8),
+        static_cast<uint8_t>(destination_address & 0xFF),
+        channel,
+    };
 
     serial_->SetMode(OUTPUT);
     delay(kDelayTimeAfterSwitch);
-    int bytes = serial_->write(message_buffer, total_message_size);
+    int bytes = serial_->write(header, sizeof(header));
+    bytes += WriteFrame(message, message_size);
 
     serial_->flush();
     serial_->SetMode(INPUT);
@@ -871,7 +870,7 @@ LoRaErrorCode UsrLg206P::SetCommand(String command, String succesfullResponse)
 
     const size_t buffer_size = 128;
     uint8_t buffer[buffer_size];
-    size_t size = ReceiveMessage(buffer, buffer_size);
+    size_t size = ReceiveResponse(buffer, buffer_size);
     String received_data = String((char *)buffer);
 
     // If echo is enabled check for the repeated command
@@ -914,13 +913,13 @@ LoRaErrorCode UsrLg206P::GetCommand(String command, OUT String &value, bool usin
 
     const size_t buffer_size = 128;
     uint8_t buffer[buffer_size];
-    size_t size = ReceiveMessage(buffer, buffer_size);
+    size_t size = ReceiveResponse(buffer, buffer_size);
     String received_data = String((char *)buffer);
 
     // If echo is enabled check for the repeated command
     if (this->settings_.command_echo_function == LoRaSettings::CommandEchoFunction::kCommandEchoFunctionIsOn)
     {
-        String returned_command = received_data.substring(0, command.length());
+        String returned_command = received_data.substring(0, querry.length());
         if (returned_command != querry)
         {
             return LoRaErrorCode::kCommandEchoNotReceived;
@@ -969,4 +968,122 @@ LoRaErrorCode UsrLg206P::GetCommand(String command, OUT String &value, bool usin
     return LoRaErrorCode::kSucces;
 };
 
+size_t UsrLg206P::ReceiveResponse(uint8_t *buffer, size_t buffer_size)
+{
+    // Make sure the buffer is a valid string when nothing is received
+    if (buffer_size > 0)
+    {
+        buffer[0] = '\0';
+    }
+
+    // Wait for data to be received
+    serial_->WaitForInput();
+    size_t cursor = 0;
+    while (serial_->available())
+    {
+        // TODO: Check if wait is necessary
+        delay(10);
+
+        size_t length = serial_->available();
+
+        // Control for overflow, what does not fit is left for the next call
+        if (cursor + length > buffer_size - 1)
+        {
+            length = buffer_size - 1 - cursor;
+        }
+
+        for (size_t i = 0; i < length; i++)
+        {
+            buffer[cursor + i] = serial_->read();
+        }
+        cursor += length;
+        buffer[cursor] = '\0';
+
+        if (cursor == buffer_size - 1)
+        {
+            return cursor;
+        }
+    }
+
+    return cursor;
+};
+
+size_t UsrLg206P::ReceiveCheckedMessage(uint8_t *buffer, size_t buffer_size)
+{
+    if (buffer_size == 0)
+    {
+        return 0;
+    }
+    // Make sure the buffer is a valid string when nothing is received
+    buffer[0] = '\0';
+
+    serial_->WaitForInput();
+    const int length = ReadByte();
+    if (length < 0)
+    {
+        return 0;
+    }
+
+    const uint8_t length_byte = length;
+    const size_t size = (static_cast<size_t>(length) < buffer_size) ? length : buffer_size - 1;
+    bool complete = true;
+    for (size_t i = 0; i < size && complete; i++)
+    {
+        const int value = ReadByte();
+        complete = value >= 0;
+        buffer[i] = value;
+    }
+    uint16_t crc = LoRaCrc::Crc16(buffer, size, LoRaCrc::Crc16(&length_byte, 1));
+
+    // Bytes which do not fit in the buffer and the CRC, sent most significant byte first so the result becomes 0
+    for (size_t i = size; i < static_cast<size_t>(length) + 2 && complete; i++)
+    {
+        const int value = ReadByte();
+        complete = value >= 0;
+        const uint8_t data = value;
+        crc = LoRaCrc::Crc16(&data, 1, crc);
+    }
+
+    if (!complete || crc != 0)
+    {
+        checksum_errors_++;
+        buffer[0] = '\0';
+        return 0;
+    }
+
+    buffer[size] = '\0';
+    return size;
+};
+
+int UsrLg206P::ReadByte(void)
+{
+    if (!serial_->available())
+    {
+        // The next byte can still be on its way from the module
+        delay(kDelayTimeBetweenChars);
+    }
+    return serial_->read();
+};
+
+size_t UsrLg206P::WriteFrame(const char *message, const size_t message_size)
+{
+    if (!checksum_)
+    {
+        return serial_->write(message, message_size);
+    }
+
+    // Length, data and checksum are written one after another, so the message is not copied
+    const uint8_t length_byte = message_size;
+    const uint16_t crc = LoRaCrc::Crc16(reinterpret_cast<const uint8_t *>(message), message_size, LoRaCrc::Crc16(&length_byte, 1));
+    const uint8_t crc_bytes[] = {
+        static_cast<uint8_t>((crc & 0xFF00) >> 8),
+        static_cast<uint8_t>(crc & 0xFF),
+    };
+
+    size_t bytes = serial_->write(length_byte);
+    bytes += serial_->write(message, message_size);
+    bytes += serial_->write(crc_bytes, sizeof(crc_bytes));
+    return bytes;
+};
+
 #pragma endregion
\ No newline at end of file
@@ -0,0 +1,339 @@
+/**
+ * @file usr_lg206_p_adaptive_rate.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Adaptive air rate level per peer, based on the delivery results reported by the sketch
+ * @version 0.1
+ * @date 2024-03-13
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_adaptive_rate.h"
+
+LoRaAdaptiveRate::LoRaAdaptiveRate::LoRaAdaptiveRate(UsrLg206P *const lora, const uint16_t local_address, const uint8_t channel)
+{
+    this->lora_ = lora;
+    this->local_address_ = local_address;
+    this->channel_ = channel;
+    this->minimum_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268;
+    this->maximum_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875;
+    this->module_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevelUndefined;
+    this->selected_address_ = 0;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+    memset(this->peers_, 0, sizeof(this->peers_));
+};
+
+LoRaErrorCode LoRaAdaptiveRate::LoRaAdaptiveRate::SetLevelRange(const LoRaSettings::LoRaAirRateLevel minimum, const LoRaSettings::LoRaAirRateLevel maximum)
+{
+    if (minimum == LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevelUndefined || minimum > maximum)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    this->minimum_level_ = minimum;
+    this->maximum_level_ = maximum;
+    memset(this->peers_, 0, sizeof(this->peers_));
+    return LoRaErrorCode::kSucces;
+};
+
+LoRaErrorCode LoRaAdaptiveRate::LoRaAdaptiveRate::Select(const uint16_t address)
+{
+    selected_address_ = address;
+    return ApplyLevel(GetPeer(address)->level);
+};
+
+void LoRaAdaptiveRate::LoRaAdaptiveRate::ReportDelivery(const uint16_t address, const bool delivered)
+{
+    Peer &peer = *GetPeer(address);
+    const bool pending = peer.requested_level != LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevelUndefined;
+
+    if (delivered)
+    {
+        peer.last_heard = millis();
+        peer.failures = 0;
+        peer.probing = false;
+        if (peer.successes < UINT8_MAX)
+        {
+            peer.successes++;
+        }
+
+        if (!pending && peer.level < maximum_level_ && peer.successes >= kLoRaAdaptiveRateStepUpThreshold * peer.backoff_factor)
+        {
+            Request(peer, static_cast<LoRaSettings::LoRaAirRateLevel>(static_cast<int>(peer.level) + 1));
+        }
+        return;
+    }
+
+    peer.successes = 0;
+    if (peer.failures < UINT8_MAX)
+    {
+        peer.failures++;
+    }
+
+    if (pending || peer.level <= minimum_level_)
+    {
+        return;
+    }
+
+    if (peer.probing)
+    {
+        // First message on the faster level failed, wait longer before trying again
+        peer.backoff_factor = (peer.backoff_factor * 2 < kMaximumBackoffFactor) ? peer.backoff_factor * 2 : kMaximumBackoffFactor;
+    }
+    else if (peer.failures >= kLoRaAdaptiveRateStepDownThreshold)
+    {
+        peer.backoff_factor = 1;
+    }
+    else
+    {
+        return;
+    }
+
+    Request(peer, static_cast<LoRaSettings::LoRaAirRateLevel>(static_cast<int>(peer.level) - 1));
+};
+
+void LoRaAdaptiveRate::LoRaAdaptiveRate::ReportReception(const uint16_t address)
+{
+    GetPeer(address)->last_heard = millis();
+};
+
+void LoRaAdaptiveRate::LoRaAdaptiveRate::Update(void)
+{
+    for (size_t i = 0; i < kLoRaAdaptiveRateAmountOfPeers; i++)
+    {
+        Peer &peer = peers_[i];
+        if (!peer.in_use)
+        {
+            continue;
+        }
+
+        if (peer.level != minimum_level_ && millis() - peer.last_heard >= kLoRaAdaptiveRateSilenceTimeout)
+        {
+            // Peer may have switched while this side did not, the slowest level is the one both sides return to
+            peer.requested_level = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevelUndefined;
+            peer.backoff_factor = 1;
+            ChangeLevel(peer, minimum_level_);
+            statistics_.fallbacks++;
+            continue;
+        }
+
+        if (peer.requested_level == LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevelUndefined ||
+            (peer.requests > 0 && millis() - peer.requested_at < GetRequestTimeout(peer.level)))
+        {
+            continue;
+        }
+
+        if (peer.requests >= kLoRaAdaptiveRateMaximumRequests)
+        {
+            peer.requested_level = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevelUndefined;
+            peer.successes = 0;
+            peer.failures = 0;
+            statistics_.failed_requests++;
+            continue;
+        }
+
+        // Request is sent on the current level, the module has to listen on it for the acknowledgement
+        selected_address_ = peer.address;
+        if (ApplyLevel(peer.level) == LoRaErrorCode::kSucces)
+        {
+            SendFrame(FrameType::kFrameTypeRequest, peer.address, peer.requested_level);
+        }
+        peer.requests++;
+        peer.requested_at = millis();
+    }
+};
+
+size_t LoRaAdaptiveRate::LoRaAdaptiveRate::Receive(uint8_t *buffer, const size_t buffer_size)
+{
+    if (lora_->Available() <= 0)
+    {
+        return 0;
+    }
+
+    const size_t size = lora_->ReceiveMessage(buffer, buffer_size);
+    if (size == 0 || HandleFrame(buffer, size))
+    {
+        return 0;
+    }
+    return size;
+};
+
+bool LoRaAdaptiveRate::LoRaAdaptiveRate::HandleFrame(const uint8_t *frame, const size_t size)
+{
+    if (size < kFrameSize || frame[1] != kFrameSize - 2)
+    {
+        return false;
+    }
+
+    const FrameType type = static_cast<FrameType>(frame[0]);
+    if (type != FrameType::kFrameTypeRequest && type != FrameType::kFrameTypeAcknowledgement)
+    {
+        return false;
+    }
+
+    const uint16_t source_address = (frame[2] << 8) | frame[3];
+    const LoRaSettings::LoRaAirRateLevel level = static_cast<LoRaSettings::LoRaAirRateLevel>(frame[4]);
+    if (level < minimum_level_ || level > maximum_level_)
+    {
+        return true;
+    }
+
+    Peer &peer = *GetPeer(source_address);
+    peer.last_heard = millis();
+
+    if (type == FrameType::kFrameTypeRequest)
+    {
+        // Acknowledge on the old level and wait until it left the module before switching
+        SendFrame(FrameType::kFrameTypeAcknowledgement, source_address, level);
+        delay(LoRaAirTime::GetTimeOnAir(peer.level, kFrameSize + 3) / 1000 + 1);
+    }
+    else if (peer.requested_level != level)
+    {
+        return true;
+    }
+
+    peer.requested_level = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevelUndefined;
+    selected_address_ = source_address;
+    ChangeLevel(peer, level);
+    return true;
+};
+
+LoRaSettings::LoRaAirRateLevel LoRaAdaptiveRate::LoRaAdaptiveRate::GetLevel(const uint16_t address) const
+{
+    const Peer *peer = FindPeer(address);
+    return (peer != nullptr) ? peer->level : minimum_level_;
+};
+
+bool LoRaAdaptiveRate::LoRaAdaptiveRate::HasPendingChange(const uint16_t address) const
+{
+    const Peer *peer = FindPeer(address);
+    return peer != nullptr && peer->requested_level != LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevelUndefined;
+};
+
+const LoRaAdaptiveRate::LoRaAdaptiveRateStatistics &LoRaAdaptiveRate::LoRaAdaptiveRate::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+LoRaAdaptiveRate::LoRaAdaptiveRate::Peer *LoRaAdaptiveRate::LoRaAdaptiveRate::GetPeer(const uint16_t address)
+{
+    Peer *replace = &peers_[0];
+    for (size_t i = 0; i < kLoRaAdaptiveRateAmountOfPeers; i++)
+    {
+        Peer &peer = peers_[i];
+        if (peer.in_use && peer.address == address)
+        {
+            return &peer;
+        }
+
+        // Prefer an unused peer, otherwise the one not heard for the longest time
+        if (replace->in_use && (!peer.in_use || peer.last_heard < replace->last_heard))
+        {
+            replace = &peer;
+        }
+    }
+
+    replace->in_use = true;
+    replace->address = address;
+    replace->level = minimum_level_;
+    replace->requested_level = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevelUndefined;
+    replace->requests = 0;
+    replace->requested_at = 0;
+    replace->successes = 0;
+    replace->failures = 0;
+    replace->backoff_factor = 1;
+    replace->probing = false;
+    replace->last_heard = millis();
+    return replace;
+};
+
+const LoRaAdaptiveRate::LoRaAdaptiveRate::Peer *LoRaAdaptiveRate::LoRaAdaptiveRate::FindPeer(const uint16_t address) const
+{
+    for (size_t i = 0; i < kLoRaAdaptiveRateAmountOfPeers; i++)
+    {
+        if (peers_[i].in_use && peers_[i].address == address)
+        {
+            return &peers_[i];
+        }
+    }
+    return nullptr;
+};
+
+void LoRaAdaptiveRate::LoRaAdaptiveRate::Request(Peer &peer, const LoRaSettings::LoRaAirRateLevel level)
+{
+    peer.requested_level = level;
+    peer.requests = 0;
+};
+
+void LoRaAdaptiveRate::LoRaAdaptiveRate::ChangeLevel(Peer &peer, const LoRaSettings::LoRaAirRateLevel level)
+{
+    if (level > peer.level)
+    {
+        statistics_.steps_up++;
+    }
+    else if (level < peer.level)
+    {
+        statistics_.steps_down++;
+    }
+
+    peer.probing = level > peer.level;
+    peer.level = level;
+    peer.successes = 0;
+    peer.failures = 0;
+    // Give the new level a full period before it counts as silent
+    peer.last_heard = millis();
+
+    if (selected_address_ == peer.address)
+    {
+        ApplyLevel(level);
+    }
+};
+
+LoRaErrorCode LoRaAdaptiveRate::LoRaAdaptiveRate::ApplyLevel(const LoRaSettings::LoRaAirRateLevel level)
+{
+    if (level == module_level_)
+    {
+        return LoRaErrorCode::kSucces;
+    }
+
+    LoRaErrorCode error_code = lora_->BeginAtMode();
+    if (error_code != LoRaErrorCode::kSucces)
+    {
+        return error_code;
+    }
+
+    error_code = lora_->SetAirRateLevel(level);
+    const LoRaErrorCode end_error_code = lora_->EndAtMode();
+    if (error_code == LoRaErrorCode::kSucces)
+    {
+        error_code = end_error_code;
+    }
+
+    if (error_code == LoRaErrorCode::kSucces)
+    {
+        module_level_ = level;
+    }
+    return error_code;
+};
+
+bool LoRaAdaptiveRate::LoRaAdaptiveRate::SendFrame(const FrameType type, const uint16_t destination_address, const LoRaSettings::LoRaAirRateLevel level)
+{
+    uint8_t frame[kFrameSize];
+    frame[0] = static_cast<uint8_t>(type);
+    frame[1] = kFrameSize - 2;
+    frame[2] = (local_address_ & 0xFF00) >> 8;
+    frame[3] = (local_address_ & 0xFF);
+    frame[4] = static_cast<uint8_t>(level);
+    return lora_->SendMessage(reinterpret_cast<const char *>(frame), kFrameSize, destination_address, channel_) >= 0;
+};
+
+unsigned long LoRaAdaptiveRate::LoRaAdaptiveRate::GetRequestTimeout(const LoRaSettings::LoRaAirRateLevel level) const
+{
+    // Request and acknowledgement on air with a margin, fixed point header of 3 bytes included
+    const unsigned long round_trip = 2 * LoRaAirTime::GetTimeOnAir(level, kFrameSize + 3) / 1000;
+    return round_trip * 3 / 2 + kProcessingTime;
+};
+
+#pragma endregion
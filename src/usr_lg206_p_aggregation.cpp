@@ -0,0 +1,235 @@
+/**
+ * @file usr_lg206_p_aggregation.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Coalesces small records per destination into one frame, so the overhead of a transmission is shared
+ * @version 0.1
+ * @date 2024-03-09
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_aggregation.h"
+
+LoRaAggregation::LoRaAggregator::LoRaAggregator(UsrLg206P *const lora)
+{
+    this->lora_ = lora;
+    this->flush_threshold_ = kLoRaAggregationFrameSize - kFrameHeaderSize;
+    this->maximum_age_ = kLoRaAggregationMaximumAge;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+    this->frame_ = nullptr;
+    this->frame_size_ = 0;
+    this->record_position_ = 0;
+
+    for (size_t i = 0; i < kLoRaAggregationAmountOfBuffers; i++)
+    {
+        batches_[i].in_use = false;
+        batches_[i].size = 0;
+    }
+};
+
+LoRaErrorCode LoRaAggregation::LoRaAggregator::SetFlushThreshold(const size_t threshold)
+{
+    if (threshold <= kRecordHeaderSize || threshold > kLoRaAggregationFrameSize - kFrameHeaderSize)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    this->flush_threshold_ = threshold;
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaAggregation::LoRaAggregator::SetMaximumAge(const unsigned long maximum_age)
+{
+    this->maximum_age_ = maximum_age;
+};
+
+LoRaErrorCode LoRaAggregation::LoRaAggregator::Write(const uint8_t *record, const size_t size)
+{
+    return Add(record, size, false, 0, 0);
+};
+
+LoRaErrorCode LoRaAggregation::LoRaAggregator::Write(const uint8_t *record, const size_t size, const uint16_t destination_address, const uint8_t channel)
+{
+    return Add(record, size, true, destination_address, channel);
+};
+
+LoRaErrorCode LoRaAggregation::LoRaAggregator::Flush(void)
+{
+    LoRaErrorCode result = LoRaErrorCode::kSucces;
+    for (size_t i = 0; i < kLoRaAggregationAmountOfBuffers; i++)
+    {
+        if (batches_[i].in_use && Send(batches_[i]) != LoRaErrorCode::kSucces)
+        {
+            result = LoRaErrorCode::kWrongWorkMode;
+        }
+    }
+    return result;
+};
+
+LoRaErrorCode LoRaAggregation::LoRaAggregator::Update(void)
+{
+    const unsigned long now = millis();
+    LoRaErrorCode result = LoRaErrorCode::kSucces;
+    for (size_t i = 0; i < kLoRaAggregationAmountOfBuffers; i++)
+    {
+        if (batches_[i].in_use && now - batches_[i].started_at >= maximum_age_ && Send(batches_[i]) != LoRaErrorCode::kSucces)
+        {
+            result = LoRaErrorCode::kWrongWorkMode;
+        }
+    }
+    return result;
+};
+
+size_t LoRaAggregation::LoRaAggregator::GetAmountPending(void) const
+{
+    size_t amount = 0;
+    for (size_t i = 0; i < kLoRaAggregationAmountOfBuffers; i++)
+    {
+        amount += batches_[i].size;
+    }
+    return amount;
+};
+
+size_t LoRaAggregation::LoRaAggregator::ReceiveRecord(uint8_t *buffer, const size_t buffer_size)
+{
+    while (true)
+    {
+        if (record_position_ >= frame_size_)
+        {
+            frame_size_ = receive_buffer_.Receive(lora_, frame_);
+            if (frame_size_ == 0)
+            {
+                return 0;
+            }
+            statistics_.frames_received++;
+            record_position_ = kFrameHeaderSize;
+        }
+
+        const size_t record_size = frame_[record_position_];
+        if (record_size == 0 || record_position_ + kRecordHeaderSize + record_size > frame_size_)
+        {
+            // Corrupt record, there is no way to find the start of the next record in this frame
+            record_position_ = frame_size_;
+            continue;
+        }
+
+        const size_t copy_size = (record_size < buffer_size) ? record_size : buffer_size;
+        memcpy(buffer, frame_ + record_position_ + kRecordHeaderSize, copy_size);
+        record_position_ += kRecordHeaderSize + record_size;
+        statistics_.records_received++;
+        return copy_size;
+    }
+};
+
+const LoRaAggregation::LoRaAggregationStatistics &LoRaAggregation::LoRaAggregator::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+LoRaErrorCode LoRaAggregation::LoRaAggregator::Add(const uint8_t *record, const size_t size, const bool fixed_point, const uint16_t destination_address, const uint8_t channel)
+{
+    if (size == 0)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    if (size > kMaximumRecordSize)
+    {
+        return LoRaErrorCode::kMessageTooLarge;
+    }
+
+    LoRaErrorCode result = LoRaErrorCode::kSucces;
+    Batch *batch = GetBatch(fixed_point, destination_address, channel, result);
+
+    if (kFrameHeaderSize + batch->size + kRecordHeaderSize + size > kLoRaAggregationFrameSize)
+    {
+        // Keep the first error, a later successful send does not undo it
+        const LoRaErrorCode sent = Send(*batch);
+        if (result == LoRaErrorCode::kSucces)
+        {
+            result = sent;
+        }
+        batch->in_use = true;
+        batch->started_at = millis();
+    }
+
+    uint8_t *end = batch->data + kFrameHeaderSize + batch->size;
+    end[0] = size;
+    memcpy(end + kRecordHeaderSize, record, size);
+    batch->size += kRecordHeaderSize + size;
+    statistics_.records_written++;
+
+    if (batch->size >= flush_threshold_)
+    {
+        const LoRaErrorCode sent = Send(*batch);
+        if (result == LoRaErrorCode::kSucces)
+        {
+            result = sent;
+        }
+    }
+    return result;
+};
+
+LoRaAggregation::LoRaAggregator::Batch *LoRaAggregation::LoRaAggregator::GetBatch(const bool fixed_point, const uint16_t destination_address, const uint8_t channel, LoRaErrorCode &result)
+{
+    Batch *replace = &batches_[0];
+    for (size_t i = 0; i < kLoRaAggregationAmountOfBuffers; i++)
+    {
+        Batch &batch = batches_[i];
+        if (batch.in_use && batch.fixed_point == fixed_point &&
+            (!fixed_point || (batch.destination_address == destination_address && batch.channel == channel)))
+        {
+            return &batch;
+        }
+
+        // Prefer an unused batch, otherwise the oldest one is sent to make room
+        if (replace->in_use && (!batch.in_use || batch.started_at < replace->started_at))
+        {
+            replace = &batch;
+        }
+    }
+
+    if (replace->in_use)
+    {
+        result = Send(*replace);
+    }
+
+    replace->in_use = true;
+    replace->fixed_point = fixed_point;
+    replace->destination_address = destination_address;
+    replace->channel = channel;
+    replace->started_at = millis();
+    replace->size = 0;
+    return replace;
+};
+
+LoRaErrorCode LoRaAggregation::LoRaAggregator::Send(Batch &batch)
+{
+    batch.data[0] = batch.size;
+    const size_t frame_size = kFrameHeaderSize + batch.size;
+    int bytes;
+    if (batch.fixed_point)
+    {
+        bytes = lora_->SendMessage(reinterpret_cast<const char *>(batch.data), frame_size, batch.destination_address, batch.channel);
+    }
+    else
+    {
+        bytes = lora_->SendMessage(reinterpret_cast<const char *>(batch.data), frame_size);
+    }
+
+    // The batch is dropped when it could not be sent, the caller is told by the result
+    batch.in_use = false;
+    batch.size = 0;
+
+    if (bytes < 0)
+    {
+        return LoRaErrorCode::kWrongWorkMode;
+    }
+
+    statistics_.frames_sent++;
+    return LoRaErrorCode::kSucces;
+};
+
+#pragma endregion
@@ -0,0 +1,127 @@
+#include "usr_lg206_p_air_time.h"
+
+bool LoRaAirTime::GetModulation(const LoRaSettings::LoRaAirRateLevel level, LoRaModulation &modulation)
+{
+    // Every level uses coding rate 4/5, the nominal bit rate follows from SF * BW / 2^SF * 4/5
+    modulation.coding_rate = 1;
+    switch (level)
+    {
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268:
+        modulation.spreading_factor = 11;
+        modulation.bandwidth = 62500;
+        return true;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel488:
+        modulation.spreading_factor = 10;
+        modulation.bandwidth = 62500;
+        return true;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel537:
+        modulation.spreading_factor = 11;
+        modulation.bandwidth = 125000;
+        return true;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel878:
+        modulation.spreading_factor = 9;
+        modulation.bandwidth = 62500;
+        return true;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel977:
+        modulation.spreading_factor = 10;
+        modulation.bandwidth = 125000;
+        return true;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel1758:
+        modulation.spreading_factor = 9;
+        modulation.bandwidth = 125000;
+        return true;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel3125:
+        modulation.spreading_factor = 8;
+        modulation.bandwidth = 125000;
+        return true;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel6250:
+        modulation.spreading_factor = 8;
+        modulation.bandwidth = 250000;
+        return true;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel10937:
+        modulation.spreading_factor = 7;
+        modulation.bandwidth = 250000;
+        return true;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875:
+        modulation.spreading_factor = 7;
+        modulation.bandwidth = 500000;
+        return true;
+    default:
+        return false;
+    }
+};
+
+uint16_t LoRaAirTime::GetAirRate(const LoRaSettings::LoRaAirRateLevel level)
+{
+    switch (level)
+    {
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268:
+        return 268;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel488:
+        return 488;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel537:
+        return 537;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel878:
+        return 878;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel977:
+        return 977;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel1758:
+        return 1758;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel3125:
+        return 3125;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel6250:
+        return 6250;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel10937:
+        return 10937;
+    case LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875:
+        return 21875;
+    default:
+        return 0;
+    }
+};
+
+unsigned long LoRaAirTime::GetTimeOnAir(const LoRaSettings::LoRaAirRateLevel level, const size_t payload_size)
+{
+    LoRaModulation modulation;
+    if (!GetModulation(level, modulation))
+    {
+        return 0;
+    }
+
+    const unsigned long symbol_time = (1UL << modulation.spreading_factor) * 1000000UL / modulation.bandwidth;
+    // Low data rate optimisation is enabled when a symbol lasts 16 ms or longer
+    const long low_data_rate_optimisation = symbol_time >= 16000 ? 1 : 0;
+
+    // Preamble lasts kLoRaPreambleLength + 4.25 symbols
+    const unsigned long preamble_time = ((4UL * kLoRaPreambleLength + 17UL) * symbol_time) / 4UL;
+
+    const long numerator = 8L * payload_size - 4L * modulation.spreading_factor + 28L + 16L;
+    const long denominator = 4L * (modulation.spreading_factor - 2L * low_data_rate_optimisation);
+    long payload_symbols = 8;
+    if (numerator > 0)
+    {
+        payload_symbols += ((numerator + denominator - 1) / denominator) * (modulation.coding_rate + 4);
+    }
+
+    return preamble_time + payload_symbols * symbol_time;
+};
+
+unsigned long LoRaAirTime::GetUartTime(const LoRaUartSettings::LoRaUartSettings &settings, const size_t size)
+{
+    const unsigned long baudrate = static_cast<unsigned long>(settings.buadrate);
+    if (baudrate == 0)
+    {
+        return 0;
+    }
+
+    // Start bit, data bits, parity bit and stop bits
+    unsigned long bits_per_byte = 1UL + settings.dataBits + settings.stopBits;
+    if (settings.parity == LoRaUartSettings::Parity::parity_even || settings.parity == LoRaUartSettings::Parity::parity_odd)
+    {
+        bits_per_byte++;
+    }
+
+    // Split the division so the multiplication does not overflow 32 bits on AVR
+    const unsigned long bits = size * bits_per_byte;
+    return bits * (1000000UL / baudrate) + (bits * (1000000UL % baudrate)) / baudrate;
+};
@@ -0,0 +1,536 @@
+/**
+ * @file usr_lg206_p_bulk_transfer.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Transfer of files larger than memory over fixed point mode
+ * @version 0.1
+ * @date 2024-03-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_bulk_transfer.h"
+#include "usr_lg206_p_crc.h"
+
+static void WriteUint16(uint8_t *data, const uint16_t value)
+{
+    data[0] = (value & 0xFF00) >> 8;
+    data[1] = (value & 0xFF);
+}
+
+static uint16_t ReadUint16(const uint8_t *data)
+{
+    return (data[0] << 8) | data[1];
+}
+
+static void WriteUint32(uint8_t *data, const uint32_t value)
+{
+    WriteUint16(data, value >> 16);
+    WriteUint16(data + 2, value & 0xFFFF);
+}
+
+static uint32_t ReadUint32(const uint8_t *data)
+{
+    return (static_cast<uint32_t>(ReadUint16(data)) << 16) | ReadUint16(data + 2);
+}
+
+LoRaBulkTransfer::LoRaBulkTransfer::LoRaBulkTransfer(UsrLg206P *const lora, const uint16_t local_address, const uint8_t local_channel)
+{
+    this->lora_ = lora;
+    this->local_address_ = local_address;
+    this->local_channel_ = local_channel;
+    // Slowest level, so the timeout is never too short when the level is not set
+    this->air_rate_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268;
+    this->chunk_size_ = kLoRaBulkTransferMaximumChunkSize;
+    this->window_size_ = kLoRaBulkTransferWindowSize;
+    this->maximum_retries_ = 5;
+    this->read_callback_ = nullptr;
+    this->write_callback_ = nullptr;
+    this->progress_callback_ = nullptr;
+    this->complete_callback_ = nullptr;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+    memset(&this->outgoing_, 0, sizeof(this->outgoing_));
+    this->outgoing_.state = State::kIdle;
+    memset(&this->incoming_, 0, sizeof(this->incoming_));
+    this->next_transfer_id_ = 0;
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level)
+{
+    this->air_rate_level_ = level;
+};
+
+LoRaErrorCode LoRaBulkTransfer::LoRaBulkTransfer::SetChunkSize(const size_t chunk_size)
+{
+    if (chunk_size == 0 || chunk_size > kLoRaBulkTransferMaximumChunkSize)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    this->chunk_size_ = chunk_size;
+    return LoRaErrorCode::kSucces;
+};
+
+LoRaErrorCode LoRaBulkTransfer::LoRaBulkTransfer::SetWindowSize(const uint8_t window_size)
+{
+    if (window_size == 0 || window_size > kLoRaBulkTransferWindowSize)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    this->window_size_ = window_size;
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::SetMaximumRetries(const uint8_t retries)
+{
+    this->maximum_retries_ = retries;
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::SetReadCallback(ReadCallback callback)
+{
+    this->read_callback_ = callback;
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::SetWriteCallback(WriteCallback callback)
+{
+    this->write_callback_ = callback;
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::SetProgressCallback(ProgressCallback callback)
+{
+    this->progress_callback_ = callback;
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::SetCompleteCallback(CompleteCallback callback)
+{
+    this->complete_callback_ = callback;
+};
+
+LoRaErrorCode LoRaBulkTransfer::LoRaBulkTransfer::Send(const uint32_t size, const uint16_t destination_address, const uint8_t channel)
+{
+    if (size == 0 || read_callback_ == nullptr)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    if (outgoing_.state != State::kIdle)
+    {
+        return LoRaErrorCode::kQueueFull;
+    }
+
+    const uint32_t amount_of_chunks = (size + chunk_size_ - 1) / chunk_size_;
+    if (amount_of_chunks > kMaximumAmountOfChunks)
+    {
+        return LoRaErrorCode::kMessageTooLarge;
+    }
+
+    if (lora_->GetKnownWorkMode() != LoRaSettings::WorkMode::kWorkModeFixedPoint)
+    {
+        return LoRaErrorCode::kWrongWorkMode;
+    }
+
+    // Receiver checks the file as a whole, chunks are read again when sent
+    uint8_t chunk[kLoRaBulkTransferMaximumChunkSize];
+    uint32_t crc = 0;
+    for (uint32_t offset = 0; offset < size; offset += chunk_size_)
+    {
+        const size_t chunk_size = (size - offset < chunk_size_) ? size - offset : chunk_size_;
+        crc = LoRaCrc::Crc32(chunk, read_callback_(offset, chunk, chunk_size), crc);
+    }
+
+    memset(&outgoing_, 0, sizeof(outgoing_));
+    outgoing_.state = State::kStarting;
+    outgoing_.transfer_id = next_transfer_id_++;
+    outgoing_.destination_address = destination_address;
+    outgoing_.channel = channel;
+    outgoing_.size = size;
+    outgoing_.crc = crc;
+    outgoing_.amount_of_chunks = amount_of_chunks;
+    SendStart();
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::Abort(void)
+{
+    outgoing_.state = State::kIdle;
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::Update(void)
+{
+    uint8_t *frame;
+    size_t frame_size;
+    while ((frame_size = receive_buffer_.Receive(lora_, frame)) > 0)
+    {
+        HandleFrame(frame, frame_size);
+    }
+
+    if (outgoing_.state == State::kIdle)
+    {
+        return;
+    }
+
+    const unsigned long now = millis();
+    if (outgoing_.state == State::kStarting || outgoing_.waiting)
+    {
+        if (now - outgoing_.sent_at < GetAcknowledgementTimeout())
+        {
+            return;
+        }
+
+        if (outgoing_.retries >= maximum_retries_)
+        {
+            Finish(LoRaErrorCode::kNoResponse);
+            return;
+        }
+
+        outgoing_.retries++;
+        if (outgoing_.state == State::kStarting)
+        {
+            statistics_.retransmissions++;
+            SendStart();
+            return;
+        }
+
+        // Ask again with the oldest chunk, the acknowledgement tells which others are missing
+        outgoing_.waiting = false;
+        outgoing_.resend |= 1;
+    }
+
+    if (now - outgoing_.sent_at < outgoing_.busy_for)
+    {
+        return;
+    }
+
+    SendChunk();
+};
+
+bool LoRaBulkTransfer::LoRaBulkTransfer::IsSending(void) const
+{
+    return outgoing_.state != State::kIdle;
+};
+
+unsigned long LoRaBulkTransfer::LoRaBulkTransfer::GetAcknowledgementTimeout(void) const
+{
+    // Fixed point header of 3 bytes is sent by the module as well
+    const unsigned long data_time = LoRaAirTime::GetTimeOnAir(air_rate_level_, kHeaderSize + kChunkIndexSize + chunk_size_ + 3) / 1000;
+    const unsigned long acknowledgement_time = LoRaAirTime::GetTimeOnAir(air_rate_level_, kHeaderSize + kAcknowledgementSize + 3) / 1000;
+    return (data_time + acknowledgement_time) * 3 / 2 + kLoRaBulkTransferProcessingTime;
+};
+
+const LoRaBulkTransfer::LoRaBulkTransferStatistics &LoRaBulkTransfer::LoRaBulkTransfer::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+void LoRaBulkTransfer::LoRaBulkTransfer::WriteHeader(uint8_t *frame, const FrameType type, const uint8_t length, const uint8_t transfer_id) const
+{
+    frame[0] = static_cast<uint8_t>(type);
+    frame[1] = length;
+    frame[2] = transfer_id;
+    WriteUint16(frame + 3, local_address_);
+    frame[5] = local_channel_;
+};
+
+bool LoRaBulkTransfer::LoRaBulkTransfer::Transmit(const uint8_t *frame, const size_t size, const uint16_t destination_address, const uint8_t channel)
+{
+    int bytes = lora_->SendMessage(reinterpret_cast<const char *>(frame), size, destination_address, channel);
+    return bytes >= 0;
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::SendStart(void)
+{
+    uint8_t frame[kHeaderSize + kStartSize];
+    WriteHeader(frame, FrameType::kFrameTypeStart, kStartSize, outgoing_.transfer_id);
+    WriteUint32(frame + kHeaderSize, outgoing_.size);
+    WriteUint32(frame + kHeaderSize + 4, outgoing_.crc);
+    frame[kHeaderSize + 8] = chunk_size_;
+
+    Transmit(frame, sizeof(frame), outgoing_.destination_address, outgoing_.channel);
+    outgoing_.sent_at = millis();
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::SendChunk(void)
+{
+    Outgoing &out = outgoing_;
+    uint16_t index;
+    if (out.resend != 0)
+    {
+        // Missing chunks go first, the receiver can only write in order
+        uint8_t offset = 0;
+        while (!(out.resend & (1 << offset)))
+        {
+            offset++;
+        }
+        out.resend &= ~(1 << offset);
+        index = out.base + offset;
+        statistics_.retransmissions++;
+    }
+    else if (out.next < out.amount_of_chunks && out.next < out.base + window_size_)
+    {
+        index = out.next++;
+        statistics_.chunks_sent++;
+    }
+    else
+    {
+        return;
+    }
+
+    // Last chunk of the window asks for an acknowledgement, the sender is silent while it is on its way
+    const bool more = out.resend != 0 || (out.next < out.amount_of_chunks && out.next < out.base + window_size_);
+    const uint32_t offset = static_cast<uint32_t>(index) * chunk_size_;
+    const size_t chunk_size = (out.size - offset < chunk_size_) ? out.size - offset : chunk_size_;
+
+    uint8_t frame[kHeaderSize + kChunkIndexSize + kLoRaBulkTransferMaximumChunkSize];
+    WriteHeader(frame, FrameType::kFrameTypeData, kChunkIndexSize + chunk_size, out.transfer_id);
+    WriteUint16(frame + kHeaderSize, index | (more ? 0 : kFlagAcknowledge));
+    read_callback_(offset, frame + kHeaderSize + kChunkIndexSize, chunk_size);
+
+    const size_t frame_size = kHeaderSize + kChunkIndexSize + chunk_size;
+    Transmit(frame, frame_size, out.destination_address, out.channel);
+    out.sent_at = millis();
+    out.busy_for = LoRaAirTime::GetTimeOnAir(air_rate_level_, frame_size + 3) / 1000;
+    out.waiting = !more;
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::SendAcknowledgement(const LoRaErrorCode status)
+{
+    // Bit i of the bitmap tells chunk base + 1 + i is received
+    uint8_t frame[kHeaderSize + kAcknowledgementSize];
+    WriteHeader(frame, FrameType::kFrameTypeAcknowledgement, kAcknowledgementSize, incoming_.transfer_id);
+    WriteUint16(frame + kHeaderSize, incoming_.base);
+    WriteUint16(frame + kHeaderSize + 2, incoming_.received >> 1);
+    frame[kHeaderSize + 4] = static_cast<uint8_t>(status);
+    Transmit(frame, sizeof(frame), incoming_.source_address, incoming_.channel);
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::Finish(const LoRaErrorCode result)
+{
+    outgoing_.state = State::kIdle;
+    if (result == LoRaErrorCode::kSucces)
+    {
+        statistics_.transfers_completed++;
+    }
+    else
+    {
+        statistics_.transfers_failed++;
+    }
+
+    if (complete_callback_ != nullptr)
+    {
+        complete_callback_(outgoing_.destination_address, true, result);
+    }
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::HandleFrame(const uint8_t *frame, const size_t size)
+{
+    const uint16_t source_address = ReadUint16(frame + 3);
+    const uint8_t source_channel = frame[5];
+    switch (static_cast<FrameType>(frame[0]))
+    {
+    case FrameType::kFrameTypeStart:
+        if (size == kHeaderSize + kStartSize)
+        {
+            HandleStart(frame, source_address, source_channel);
+        }
+        break;
+    case FrameType::kFrameTypeData:
+        if (size > kHeaderSize + kChunkIndexSize)
+        {
+            HandleData(frame, size, source_address);
+        }
+        break;
+    case FrameType::kFrameTypeAcknowledgement:
+        if (size == kHeaderSize + kAcknowledgementSize)
+        {
+            HandleAcknowledgement(frame, source_address);
+        }
+        break;
+    default:
+        break;
+    }
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::HandleStart(const uint8_t *frame, const uint16_t source_address, const uint8_t source_channel)
+{
+    const uint8_t transfer_id = frame[2];
+    const uint32_t size = ReadUint32(frame + kHeaderSize);
+    const uint32_t crc = ReadUint32(frame + kHeaderSize + 4);
+    const uint8_t chunk_size = frame[kHeaderSize + 8];
+
+    Incoming &in = incoming_;
+    const bool same_file = in.active && in.source_address == source_address && in.size == size && in.crc == crc && in.chunk_size == chunk_size;
+    if (!same_file)
+    {
+        // Resume information of another file is lost
+        memset(&in, 0, sizeof(in));
+        in.size = size;
+        in.crc = crc;
+        in.chunk_size = chunk_size;
+    }
+    in.transfer_id = transfer_id;
+    in.source_address = source_address;
+    in.channel = source_channel;
+
+    LoRaErrorCode status = LoRaErrorCode::kSucces;
+    if (write_callback_ == nullptr || size == 0 || chunk_size == 0)
+    {
+        status = LoRaErrorCode::kInvalidParameter;
+    }
+    else if (chunk_size > kLoRaBulkTransferMaximumChunkSize || (size + chunk_size - 1) / chunk_size > kMaximumAmountOfChunks)
+    {
+        status = LoRaErrorCode::kMessageTooLarge;
+    }
+    else if (in.complete && in.received_crc != crc)
+    {
+        status = LoRaErrorCode::kChecksumMismatch;
+    }
+
+    if (status != LoRaErrorCode::kSucces)
+    {
+        SendAcknowledgement(status);
+        in.active = false;
+        return;
+    }
+
+    // The base tells the sender where to continue
+    in.active = true;
+    in.amount_of_chunks = (size + chunk_size - 1) / chunk_size;
+    SendAcknowledgement(LoRaErrorCode::kSucces);
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::HandleData(const uint8_t *frame, const size_t size, const uint16_t source_address)
+{
+    Incoming &in = incoming_;
+    if (!in.active || in.source_address != source_address || in.transfer_id != frame[2])
+    {
+        return;
+    }
+
+    const uint16_t value = ReadUint16(frame + kHeaderSize);
+    const uint16_t index = value & ~kFlagAcknowledge;
+    const uint16_t offset = index - in.base;
+    const size_t chunk_size = size - kHeaderSize - kChunkIndexSize;
+
+    if (index < in.base || in.complete || (offset < kLoRaBulkTransferWindowSize && (in.received & (1 << offset))))
+    {
+        statistics_.duplicate_chunks++;
+    }
+    else if (offset < kLoRaBulkTransferWindowSize && index < in.amount_of_chunks && chunk_size <= in.chunk_size)
+    {
+        const uint8_t slot = index % kLoRaBulkTransferWindowSize;
+        in.sizes[slot] = chunk_size;
+        memcpy(in.chunks[slot], frame + kHeaderSize + kChunkIndexSize, chunk_size);
+        in.received |= 1 << offset;
+        statistics_.chunks_received++;
+    }
+
+    // Write the chunks which are in order
+    const uint16_t previous_base = in.base;
+    while (in.received & 1)
+    {
+        const uint8_t slot = in.base % kLoRaBulkTransferWindowSize;
+        const uint32_t file_offset = static_cast<uint32_t>(in.base) * in.chunk_size;
+        write_callback_(file_offset, in.chunks[slot], in.sizes[slot]);
+        in.received_crc = LoRaCrc::Crc32(in.chunks[slot], in.sizes[slot], in.received_crc);
+        in.received >>= 1;
+        in.base++;
+    }
+
+    if (in.base != previous_base && progress_callback_ != nullptr)
+    {
+        const uint32_t bytes_done = static_cast<uint32_t>(in.base) * in.chunk_size;
+        progress_callback_(source_address, bytes_done < in.size ? bytes_done : in.size, in.size);
+    }
+
+    const bool completed = !in.complete && in.base >= in.amount_of_chunks;
+    LoRaErrorCode status = LoRaErrorCode::kSucces;
+    if (in.base >= in.amount_of_chunks && in.received_crc != in.crc)
+    {
+        status = LoRaErrorCode::kChecksumMismatch;
+    }
+
+    if (completed)
+    {
+        in.complete = true;
+        if (status == LoRaErrorCode::kSucces)
+        {
+            statistics_.transfers_completed++;
+        }
+        else
+        {
+            statistics_.transfers_failed++;
+        }
+
+        if (complete_callback_ != nullptr)
+        {
+            complete_callback_(source_address, false, status);
+        }
+    }
+
+    if ((value & kFlagAcknowledge) || completed)
+    {
+        SendAcknowledgement(status);
+    }
+};
+
+void LoRaBulkTransfer::LoRaBulkTransfer::HandleAcknowledgement(const uint8_t *frame, const uint16_t source_address)
+{
+    Outgoing &out = outgoing_;
+    if (out.state == State::kIdle || out.destination_address != source_address || out.transfer_id != frame[2])
+    {
+        return;
+    }
+
+    const uint16_t base = ReadUint16(frame + kHeaderSize);
+    const uint16_t bitmap = ReadUint16(frame + kHeaderSize + 2);
+    const LoRaErrorCode status = static_cast<LoRaErrorCode>(frame[kHeaderSize + 4]);
+
+    if (status != LoRaErrorCode::kSucces)
+    {
+        Finish(status);
+        return;
+    }
+
+    const bool progress = out.state == State::kStarting || base != out.base;
+    if (out.state == State::kStarting)
+    {
+        // Receiver may already have part of the file from an earlier attempt
+        out.state = State::kSending;
+        out.next = base;
+    }
+    else if (base < out.base || base > out.next)
+    {
+        // Acknowledgement of an older window
+        return;
+    }
+
+    out.base = base;
+    out.retries = 0;
+    out.waiting = false;
+
+    if (progress && progress_callback_ != nullptr)
+    {
+        const uint32_t bytes_done = static_cast<uint32_t>(out.base) * chunk_size_;
+        progress_callback_(source_address, bytes_done < out.size ? bytes_done : out.size, out.size);
+    }
+
+    if (out.base >= out.amount_of_chunks)
+    {
+        Finish(LoRaErrorCode::kSucces);
+        return;
+    }
+
+    // Chunks sent before the acknowledgement which are not received are sent again
+    out.resend = 0;
+    for (uint16_t i = 0; out.base + i < out.next; i++)
+    {
+        if (i == 0 || !(bitmap & (1 << (i - 1))))
+        {
+            out.resend |= 1 << i;
+        }
+    }
+};
+
+#pragma endregion
@@ -0,0 +1,129 @@
+/**
+ * @file usr_lg206_p_channel_access.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Listen before talk with randomised exponential backoff, based on activity seen on the UART of the module
+ * @version 0.1
+ * @date 2024-03-11
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_channel_access.h"
+
+LoRaChannelAccess::LoRaChannelAccess::LoRaChannelAccess(UsrLg206P *const lora)
+{
+    this->lora_ = lora;
+    this->air_rate_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevelUndefined;
+    this->maximum_attempts_ = kLoRaChannelAccessMaximumAttempts;
+    this->seed_ = 1;
+    this->last_available_ = 0;
+    this->last_activity_ = 0;
+    this->activity_seen_ = false;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+};
+
+void LoRaChannelAccess::LoRaChannelAccess::SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level)
+{
+    this->air_rate_level_ = level;
+};
+
+LoRaErrorCode LoRaChannelAccess::LoRaChannelAccess::SetMaximumAttempts(const uint8_t attempts)
+{
+    if (attempts == 0)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    this->maximum_attempts_ = attempts;
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaChannelAccess::LoRaChannelAccess::SetRandomSeed(const uint32_t seed)
+{
+    this->seed_ = seed;
+};
+
+bool LoRaChannelAccess::LoRaChannelAccess::IsChannelClear(void)
+{
+    // Any change in the amount of bytes waiting means a frame was received, also when the sketch read it meanwhile
+    const int available = lora_->Available();
+    if (available != last_available_)
+    {
+        last_available_ = available;
+        last_activity_ = millis();
+        activity_seen_ = true;
+    }
+
+    return !activity_seen_ || millis() - last_activity_ >= GetSlotTime();
+};
+
+LoRaErrorCode LoRaChannelAccess::LoRaChannelAccess::SendMessage(const uint8_t *message, const size_t size)
+{
+    if (!WaitForClearChannel())
+    {
+        return LoRaErrorCode::kChannelBusy;
+    }
+
+    if (lora_->SendMessage(message, size) < 0)
+    {
+        return LoRaErrorCode::kWrongWorkMode;
+    }
+    statistics_.transmissions++;
+    return LoRaErrorCode::kSucces;
+};
+
+LoRaErrorCode LoRaChannelAccess::LoRaChannelAccess::SendMessage(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel)
+{
+    if (!WaitForClearChannel())
+    {
+        return LoRaErrorCode::kChannelBusy;
+    }
+
+    if (lora_->SendMessage(reinterpret_cast<const char *>(message), size, destination_address, channel) < 0)
+    {
+        return LoRaErrorCode::kWrongWorkMode;
+    }
+    statistics_.transmissions++;
+    return LoRaErrorCode::kSucces;
+};
+
+unsigned long LoRaChannelAccess::LoRaChannelAccess::GetSlotTime(void) const
+{
+    // Time on air of the shortest frame, with fixed point header
+    const unsigned long time_on_air = LoRaAirTime::GetTimeOnAir(air_rate_level_, 4) / 1000;
+    return time_on_air > 0 ? time_on_air : kLoRaChannelAccessSlotTime;
+};
+
+const LoRaChannelAccess::LoRaChannelAccessStatistics &LoRaChannelAccess::LoRaChannelAccess::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+bool LoRaChannelAccess::LoRaChannelAccess::WaitForClearChannel(void)
+{
+    for (uint8_t attempt = 0; attempt < maximum_attempts_; attempt++)
+    {
+        if (IsChannelClear())
+        {
+            return true;
+        }
+        statistics_.deferrals++;
+
+        if (attempt + 1 < maximum_attempts_)
+        {
+            // Wait a random amount of slots, the window doubles after every busy attempt
+            const uint8_t exponent = (attempt + 1 < kMaximumBackoffExponent) ? attempt + 1 : kMaximumBackoffExponent;
+            const unsigned long slots = 1 + LoRaRandom::Next(seed_) % (1UL << exponent);
+            const unsigned long backoff = slots * GetSlotTime();
+            statistics_.backoff_time += backoff;
+            delay(backoff);
+        }
+    }
+
+    statistics_.failures++;
+    return false;
+};
+
+#pragma endregion
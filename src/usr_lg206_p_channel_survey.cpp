@@ -0,0 +1,282 @@
+/**
+ * @file usr_lg206_p_channel_survey.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Survey of a range of channels and moving a pair of modules to another channel together
+ * @version 0.1
+ * @date 2024-03-15
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_channel_survey.h"
+
+LoRaChannelSurvey::LoRaChannelSurvey::LoRaChannelSurvey(UsrLg206P *const lora, const uint16_t local_address, const uint8_t channel)
+{
+    this->lora_ = lora;
+    this->local_address_ = local_address;
+    this->channel_ = channel;
+    // Slowest level, so a busy channel never looks free and probes wait long enough when the level is not set
+    this->air_rate_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268;
+    this->amount_of_results_ = 0;
+};
+
+void LoRaChannelSurvey::LoRaChannelSurvey::SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level)
+{
+    this->air_rate_level_ = level;
+};
+
+LoRaErrorCode LoRaChannelSurvey::LoRaChannelSurvey::Survey(const uint8_t first_channel, const uint8_t last_channel, const unsigned long dwell_time)
+{
+    if (first_channel > last_channel || last_channel > 127 || dwell_time == 0 ||
+        last_channel - first_channel + 1 > kLoRaChannelSurveyMaximumChannels)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    LoRaSettings::WorkMode work_mode;
+    LoRaErrorCode error_code = lora_->GetWorkMode(work_mode);
+    if (error_code != LoRaErrorCode::kSucces)
+    {
+        return error_code;
+    }
+
+    const uint8_t own_channel = channel_;
+    amount_of_results_ = 0;
+    for (uint8_t channel = first_channel; channel <= last_channel; channel++)
+    {
+        error_code = SwitchChannel(channel, LoRaSettings::WorkMode::kWorkModeTransparent);
+        if (error_code != LoRaErrorCode::kSucces)
+        {
+            break;
+        }
+
+        ChannelResult &result = results_[amount_of_results_++];
+        result.channel = channel;
+        result.frames = 0;
+        result.bytes = 0;
+
+        unsigned long time_on_air = 0;
+        const unsigned long start = millis();
+        while (millis() - start < dwell_time)
+        {
+            if (lora_->Available() <= 0)
+            {
+                delay(kLoRaChannelSurveyPollInterval);
+                continue;
+            }
+
+            uint8_t buffer[64];
+            const size_t size = lora_->ReceiveMessage(buffer, sizeof(buffer));
+            result.frames++;
+            result.bytes += size;
+            time_on_air += LoRaAirTime::GetTimeOnAir(air_rate_level_, size);
+        }
+
+        // Time on air is in microseconds, so this is per mille of the dwell time
+        const unsigned long occupancy = time_on_air / dwell_time;
+        result.occupancy = (occupancy < 1000) ? occupancy : 1000;
+    }
+
+    const LoRaErrorCode restore_error_code = SwitchChannel(own_channel, work_mode);
+    return (error_code != LoRaErrorCode::kSucces) ? error_code : restore_error_code;
+};
+
+size_t LoRaChannelSurvey::LoRaChannelSurvey::GetRanking(ChannelResult *results, const size_t size) const
+{
+    // Insertion sort, there are only a few channels
+    ChannelResult sorted[kLoRaChannelSurveyMaximumChannels];
+    for (size_t i = 0; i < amount_of_results_; i++)
+    {
+        size_t position = i;
+        while (position > 0 && IsBetter(results_[i], sorted[position - 1]))
+        {
+            sorted[position] = sorted[position - 1];
+            position--;
+        }
+        sorted[position] = results_[i];
+    }
+
+    const size_t amount = (amount_of_results_ < size) ? amount_of_results_ : size;
+    memcpy(results, sorted, amount * sizeof(ChannelResult));
+    return amount;
+};
+
+LoRaErrorCode LoRaChannelSurvey::LoRaChannelSurvey::MovePair(const uint16_t peer_address, const uint8_t channel)
+{
+    if (channel > 127)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    if (channel == channel_)
+    {
+        return LoRaErrorCode::kSucces;
+    }
+
+    const uint8_t old_channel = channel_;
+    for (uint8_t request = 0; request < kLoRaChannelSurveyMaximumRequests; request++)
+    {
+        if (!SendFrame(FrameType::kFrameTypeMove, peer_address, channel))
+        {
+            return LoRaErrorCode::kWrongWorkMode;
+        }
+
+        if (WaitForAcknowledgement(peer_address, channel))
+        {
+            return SwitchChannel(channel, LoRaSettings::WorkMode::kWorkModeFixedPoint);
+        }
+    }
+
+    // Acknowledgement may have been lost after the peer moved, ask once more on the new channel
+    LoRaErrorCode error_code = SwitchChannel(channel, LoRaSettings::WorkMode::kWorkModeFixedPoint);
+    if (error_code != LoRaErrorCode::kSucces)
+    {
+        return error_code;
+    }
+
+    SendFrame(FrameType::kFrameTypeMove, peer_address, channel);
+    if (WaitForAcknowledgement(peer_address, channel))
+    {
+        return LoRaErrorCode::kSucces;
+    }
+
+    error_code = SwitchChannel(old_channel, LoRaSettings::WorkMode::kWorkModeFixedPoint);
+    return (error_code != LoRaErrorCode::kSucces) ? error_code : LoRaErrorCode::kNoResponse;
+};
+
+size_t LoRaChannelSurvey::LoRaChannelSurvey::Receive(uint8_t *buffer, const size_t buffer_size)
+{
+    if (lora_->Available() <= 0)
+    {
+        return 0;
+    }
+
+    const size_t size = lora_->ReceiveMessage(buffer, buffer_size);
+    if (size == 0 || HandleFrame(buffer, size))
+    {
+        return 0;
+    }
+    return size;
+};
+
+bool LoRaChannelSurvey::LoRaChannelSurvey::HandleFrame(const uint8_t *frame, const size_t size)
+{
+    if (size < kFrameSize || frame[1] != kFrameSize - 2)
+    {
+        return false;
+    }
+
+    const FrameType type = static_cast<FrameType>(frame[0]);
+    if (type != FrameType::kFrameTypeMove && type != FrameType::kFrameTypeMoveAcknowledgement)
+    {
+        return false;
+    }
+
+    const uint8_t channel = frame[4];
+    if (type == FrameType::kFrameTypeMoveAcknowledgement || channel > 127)
+    {
+        return true;
+    }
+
+    // Acknowledge on the old channel and wait until it left the module before switching
+    const uint16_t source_address = (frame[2] << 8) | frame[3];
+    SendFrame(FrameType::kFrameTypeMoveAcknowledgement, source_address, channel);
+    delay(LoRaAirTime::GetTimeOnAir(air_rate_level_, kFrameSize + 3) / 1000 + 1);
+    SwitchChannel(channel, LoRaSettings::WorkMode::kWorkModeFixedPoint);
+    return true;
+};
+
+uint8_t LoRaChannelSurvey::LoRaChannelSurvey::GetChannel(void) const
+{
+    return channel_;
+};
+
+#pragma region private functions
+
+LoRaErrorCode LoRaChannelSurvey::LoRaChannelSurvey::SwitchChannel(const uint8_t channel, const LoRaSettings::WorkMode work_mode)
+{
+    // Received data would be taken for the response to entering the AT mode
+    while (lora_->Available() > 0)
+    {
+        uint8_t buffer[64];
+        lora_->ReceiveMessage(buffer, sizeof(buffer));
+    }
+
+    LoRaErrorCode error_code = lora_->BeginAtMode();
+    if (error_code != LoRaErrorCode::kSucces)
+    {
+        return error_code;
+    }
+
+    error_code = lora_->SetWorkMode(work_mode);
+    if (error_code == LoRaErrorCode::kSucces)
+    {
+        error_code = lora_->SetChannel(channel);
+    }
+
+    const LoRaErrorCode end_error_code = lora_->EndAtMode();
+    if (error_code == LoRaErrorCode::kSucces)
+    {
+        error_code = end_error_code;
+    }
+
+    if (error_code == LoRaErrorCode::kSucces)
+    {
+        channel_ = channel;
+    }
+    return error_code;
+};
+
+bool LoRaChannelSurvey::LoRaChannelSurvey::SendFrame(const FrameType type, const uint16_t destination_address, const uint8_t channel)
+{
+    uint8_t frame[kFrameSize];
+    frame[0] = static_cast<uint8_t>(type);
+    frame[1] = kFrameSize - 2;
+    frame[2] = (local_address_ & 0xFF00) >> 8;
+    frame[3] = (local_address_ & 0xFF);
+    frame[4] = channel;
+    return lora_->SendMessage(reinterpret_cast<const char *>(frame), kFrameSize, destination_address, channel_) >= 0;
+};
+
+bool LoRaChannelSurvey::LoRaChannelSurvey::WaitForAcknowledgement(const uint16_t peer_address, const uint8_t channel)
+{
+    // Request and acknowledgement on air with a margin, fixed point header of 3 bytes included
+    const unsigned long round_trip = 2 * LoRaAirTime::GetTimeOnAir(air_rate_level_, kFrameSize + 3) / 1000;
+    const unsigned long timeout = round_trip * 3 / 2 + kProcessingTime;
+
+    const unsigned long start = millis();
+    while (millis() - start < timeout)
+    {
+        if (lora_->Available() <= 0)
+        {
+            delay(kLoRaChannelSurveyPollInterval);
+            continue;
+        }
+
+        // Other frames received while waiting are dropped
+        uint8_t frame[kFrameSize + 1];
+        const size_t size = lora_->ReceiveMessage(frame, sizeof(frame));
+        if (size < kFrameSize || frame[0] != static_cast<uint8_t>(FrameType::kFrameTypeMoveAcknowledgement) || frame[1] != kFrameSize - 2)
+        {
+            continue;
+        }
+
+        const uint16_t source_address = (frame[2] << 8) | frame[3];
+        if (source_address == peer_address && frame[4] == channel)
+        {
+            return true;
+        }
+    }
+    return false;
+};
+
+bool LoRaChannelSurvey::LoRaChannelSurvey::IsBetter(const ChannelResult &a, const ChannelResult &b)
+{
+    if (a.occupancy != b.occupancy)
+    {
+        return a.occupancy < b.occupancy;
+    }
+    return a.frames < b.frames;
+};
+
+#pragma endregion
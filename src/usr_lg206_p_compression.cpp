@@ -0,0 +1,369 @@
+/**
+ * @file usr_lg206_p_compression.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Small RAM compression of payloads, with varint and delta helpers for series of integers
+ * @version 0.1
+ * @date 2024-03-08
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_compression.h"
+
+#pragma region compression
+
+/**
+ * @brief Get a byte of the window made of the dictionary followed by the data
+ *
+ * @param position in the data, negative positions lie in the dictionary
+ */
+static uint8_t GetWindowByte(const uint8_t *data, const uint8_t *dictionary, const size_t dictionary_size, const long position)
+{
+    return position < 0 ? dictionary[dictionary_size + position] : data[position];
+}
+
+/**
+ * @brief Get the hash of the 3 bytes of the window at a position, the shortest match
+ *
+ */
+static size_t Hash(const uint8_t *data, const uint8_t *dictionary, const size_t dictionary_size, const long position)
+{
+    const unsigned int first = GetWindowByte(data, dictionary, dictionary_size, position);
+    const unsigned int second = GetWindowByte(data, dictionary, dictionary_size, position + 1);
+    const unsigned int third = GetWindowByte(data, dictionary, dictionary_size, position + 2);
+    return ((first << 5) ^ (second << 2) ^ (first >> 3) ^ third) % kLoRaCompressionHashSize;
+}
+
+size_t LoRaCompression::Compress(const uint8_t *input, const size_t input_size, uint8_t *output, const size_t output_size,
+                                 const uint8_t *dictionary, size_t dictionary_size)
+{
+    if (dictionary == nullptr)
+    {
+        dictionary_size = 0;
+    }
+    else if (dictionary_size > kMaximumOffset)
+    {
+        dictionary += dictionary_size - kMaximumOffset;
+        dictionary_size = kMaximumOffset;
+    }
+
+    // Last position of every hash, the initial value lies out of reach of every position
+    long last_position[kLoRaCompressionHashSize];
+    for (size_t i = 0; i < kLoRaCompressionHashSize; i++)
+    {
+        last_position[i] = -static_cast<long>(kMaximumOffset) - 1;
+    }
+    long inserted = -static_cast<long>(dictionary_size);
+
+    size_t out = 0;
+    size_t flag_position = 0;
+    uint8_t flag_bit = 8;
+    size_t position = 0;
+    while (position < input_size)
+    {
+        if (flag_bit == 8)
+        {
+            if (out >= output_size)
+            {
+                return 0;
+            }
+            flag_position = out++;
+            output[flag_position] = 0;
+            flag_bit = 0;
+        }
+
+        // Add the positions passed since the last search, a match needs 3 bytes so the last 2 are never added
+        for (; inserted < static_cast<long>(position) && inserted + 2 < static_cast<long>(input_size); inserted++)
+        {
+            last_position[Hash(input, dictionary, dictionary_size, inserted)] = inserted;
+        }
+
+        // Only the last position with the same hash is tried, searching the whole window takes too long
+        size_t best_length = 0;
+        size_t best_offset = 0;
+        if (position + 2 < input_size)
+        {
+            const long start = last_position[Hash(input, dictionary, dictionary_size, position)];
+            const long offset = static_cast<long>(position) - start;
+            if (offset >= 1 && offset <= static_cast<long>(kMaximumOffset))
+            {
+                while (best_length < kMaximumMatchLength && position + best_length < input_size &&
+                       GetWindowByte(input, dictionary, dictionary_size, start + best_length) == input[position + best_length])
+                {
+                    best_length++;
+                }
+                best_offset = offset;
+            }
+        }
+
+        if (best_length >= kMinimumMatchLength)
+        {
+            if (out + 2 > output_size)
+            {
+                return 0;
+            }
+            output[out++] = ((best_offset >> 8) << 4) | (best_length - kMinimumMatchLength);
+            output[out++] = best_offset & 0xFF;
+            output[flag_position] |= 1 << flag_bit;
+            position += best_length;
+        }
+        else
+        {
+            if (out >= output_size)
+            {
+                return 0;
+            }
+            output[out++] = input[position++];
+        }
+        flag_bit++;
+    }
+
+    return out;
+};
+
+size_t LoRaCompression::Decompress(const uint8_t *input, const size_t input_size, uint8_t *output, const size_t output_size,
+                                   const uint8_t *dictionary, size_t dictionary_size)
+{
+    if (dictionary == nullptr)
+    {
+        dictionary_size = 0;
+    }
+    else if (dictionary_size > kMaximumOffset)
+    {
+        dictionary += dictionary_size - kMaximumOffset;
+        dictionary_size = kMaximumOffset;
+    }
+
+    size_t in = 0;
+    size_t out = 0;
+    while (in < input_size)
+    {
+        const uint8_t flags = input[in++];
+        for (uint8_t bit = 0; bit < 8 && in < input_size; bit++)
+        {
+            if (!(flags & (1 << bit)))
+            {
+                if (out >= output_size)
+                {
+                    return 0;
+                }
+                output[out++] = input[in++];
+                continue;
+            }
+
+            if (in + 2 > input_size)
+            {
+                return 0;
+            }
+            const size_t offset = ((input[in] >> 4) << 8) | input[in + 1];
+            const size_t length = (input[in] & 0x0F) + kMinimumMatchLength;
+            in += 2;
+
+            if (offset == 0 || offset > out + dictionary_size || out + length > output_size)
+            {
+                return 0;
+            }
+
+            for (size_t i = 0; i < length; i++)
+            {
+                output[out] = GetWindowByte(output, dictionary, dictionary_size, static_cast<long>(out) - static_cast<long>(offset));
+                out++;
+            }
+        }
+    }
+
+    return out;
+};
+
+#pragma endregion
+
+#pragma region integers
+
+size_t LoRaCompression::EncodeVarint(uint32_t value, uint8_t *buffer, const size_t buffer_size)
+{
+    size_t size = 0;
+    do
+    {
+        if (size >= buffer_size)
+        {
+            return 0;
+        }
+
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if (value != 0)
+        {
+            byte |= 0x80;
+        }
+        buffer[size++] = byte;
+    } while (value != 0);
+
+    return size;
+};
+
+size_t LoRaCompression::DecodeVarint(const uint8_t *buffer, const size_t buffer_size, uint32_t &value)
+{
+    value = 0;
+    for (size_t i = 0; i < buffer_size && i < 5; i++)
+    {
+        value |= static_cast<uint32_t>(buffer[i] & 0x7F) << (7 * i);
+        if (!(buffer[i] & 0x80))
+        {
+            return i + 1;
+        }
+    }
+
+    return 0;
+};
+
+uint32_t LoRaCompression::EncodeZigZag(const int32_t value)
+{
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+};
+
+int32_t LoRaCompression::DecodeZigZag(const uint32_t value)
+{
+    return static_cast<int32_t>((value >> 1) ^ (~(value & 1) + 1));
+};
+
+size_t LoRaCompression::EncodeDeltas(const int32_t *values, const size_t amount, uint8_t *buffer, const size_t buffer_size)
+{
+    size_t size = 0;
+    uint32_t previous = 0;
+    for (size_t i = 0; i < amount; i++)
+    {
+        // Unsigned subtraction wraps instead of overflowing
+        const int32_t delta = static_cast<int32_t>(static_cast<uint32_t>(values[i]) - previous);
+        const size_t written = EncodeVarint(EncodeZigZag(delta), buffer + size, buffer_size - size);
+        if (written == 0)
+        {
+            return 0;
+        }
+        size += written;
+        previous = static_cast<uint32_t>(values[i]);
+    }
+
+    return size;
+};
+
+size_t LoRaCompression::DecodeDeltas(const uint8_t *buffer, const size_t buffer_size, int32_t *values, const size_t maximum_amount)
+{
+    size_t position = 0;
+    size_t amount = 0;
+    uint32_t previous = 0;
+    while (position < buffer_size && amount < maximum_amount)
+    {
+        uint32_t value;
+        const size_t read = DecodeVarint(buffer + position, buffer_size - position, value);
+        if (read == 0)
+        {
+            break;
+        }
+        position += read;
+
+        previous += static_cast<uint32_t>(DecodeZigZag(value));
+        values[amount++] = static_cast<int32_t>(previous);
+    }
+
+    return amount;
+};
+
+#pragma endregion
+
+#pragma region codec
+
+LoRaCompression::LoRaCompression::LoRaCompression(UsrLg206P *const lora)
+{
+    this->lora_ = lora;
+    this->dictionary_ = nullptr;
+    this->dictionary_size_ = 0;
+    this->bytes_in_ = 0;
+    this->bytes_out_ = 0;
+};
+
+void LoRaCompression::LoRaCompression::SetDictionary(const uint8_t *dictionary, const size_t size)
+{
+    this->dictionary_ = dictionary;
+    this->dictionary_size_ = size;
+};
+
+int LoRaCompression::LoRaCompression::SendMessage(const uint8_t *message, const size_t size)
+{
+    if (size > kLoRaCompressionMaximumMessageSize)
+    {
+        return -1;
+    }
+
+    const size_t frame_size = Encode(message, size);
+    return lora_->SendMessage(reinterpret_cast<const char *>(buffer_), frame_size);
+};
+
+int LoRaCompression::LoRaCompression::SendMessage(const uint8_t *message, const size_t size, const uint16_t address, const uint8_t channel)
+{
+    if (size > kLoRaCompressionMaximumMessageSize)
+    {
+        return -1;
+    }
+
+    const size_t frame_size = Encode(message, size);
+    return lora_->SendMessage(reinterpret_cast<const char *>(buffer_), frame_size, address, channel);
+};
+
+size_t LoRaCompression::LoRaCompression::ReceiveMessage(uint8_t *buffer, const size_t buffer_size)
+{
+    uint8_t *frame;
+    size_t frame_size;
+    while ((frame_size = receive_buffer_.Receive(lora_, frame)) > 0)
+    {
+        const uint8_t *payload = frame + kHeaderSize;
+        const size_t payload_size = frame_size - kHeaderSize;
+        if (frame[0] == static_cast<uint8_t>(Method::kMethodCompressed))
+        {
+            const size_t size = Decompress(payload, payload_size, buffer, buffer_size, dictionary_, dictionary_size_);
+            if (size > 0)
+            {
+                return size;
+            }
+        }
+        else if (frame[0] == static_cast<uint8_t>(Method::kMethodRaw) && payload_size > 0 && payload_size <= buffer_size)
+        {
+            memcpy(buffer, payload, payload_size);
+            return payload_size;
+        }
+    }
+
+    return 0;
+};
+
+unsigned long LoRaCompression::LoRaCompression::GetBytesIn(void) const
+{
+    return bytes_in_;
+};
+
+unsigned long LoRaCompression::LoRaCompression::GetBytesOut(void) const
+{
+    return bytes_out_;
+};
+
+size_t LoRaCompression::LoRaCompression::Encode(const uint8_t *message, const size_t size)
+{
+    // Only use the compressed data when it is smaller than the message itself
+    size_t encoded_size = Compress(message, size, buffer_ + kHeaderSize, size > 0 ? size - 1 : 0, dictionary_, dictionary_size_);
+    if (encoded_size > 0)
+    {
+        buffer_[0] = static_cast<uint8_t>(Method::kMethodCompressed);
+    }
+    else
+    {
+        buffer_[0] = static_cast<uint8_t>(Method::kMethodRaw);
+        memcpy(buffer_ + kHeaderSize, message, size);
+        encoded_size = size;
+    }
+    buffer_[1] = encoded_size;
+
+    bytes_in_ += size;
+    bytes_out_ += kHeaderSize + encoded_size;
+    return kHeaderSize + encoded_size;
+};
+
+#pragma endregion
@@ -0,0 +1,140 @@
+/**
+ * @file usr_lg206_p_crc.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Table driven CRC-16 and CRC-32 to detect corrupted frames
+ * @version 0.1
+ * @date 2024-03-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_crc.h"
+
+const uint16_t kCrc16Polynomial = 0x1021;
+const uint32_t kCrc32Polynomial = 0xEDB88320UL; // Reflected
+
+#if kLoRaCrcSmallTables
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#define CRC_TABLE_ATTRIBUTE PROGMEM
+#define CRC_READ_16(table, index) pgm_read_word(&table[index])
+#define CRC_READ_32(table, index) pgm_read_dword(&table[index])
+#else
+#define CRC_TABLE_ATTRIBUTE
+#define CRC_READ_16(table, index) table[index]
+#define CRC_READ_32(table, index) table[index]
+#endif
+
+/**
+ * @brief CRC of every nibble, every byte takes two lookups
+ *
+ */
+const uint16_t kCrc16Table[16] CRC_TABLE_ATTRIBUTE = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF};
+
+const uint32_t kCrc32Table[16] CRC_TABLE_ATTRIBUTE = {
+    0x00000000UL, 0x1DB71064UL, 0x3B6E20C8UL, 0x26D930ACUL, 0x76DC4190UL, 0x6B6B51F4UL, 0x4DB26158UL, 0x5005713CUL,
+    0xEDB88320UL, 0xF00F9344UL, 0xD6D6A3E8UL, 0xCB61B38CUL, 0x9B64C2B0UL, 0x86D3D2D4UL, 0xA00AE278UL, 0xBDBDF21CUL};
+
+uint16_t LoRaCrc::Crc16(const uint8_t *data, const size_t size, uint16_t crc)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = (crc << 4) ^ CRC_READ_16(kCrc16Table, (crc >> 12) ^ (data[i] >> 4));
+        crc = (crc << 4) ^ CRC_READ_16(kCrc16Table, (crc >> 12) ^ (data[i] & 0x0F));
+    }
+    return crc;
+};
+
+uint32_t LoRaCrc::Crc32(const uint8_t *data, const size_t size, uint32_t crc)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = (crc >> 4) ^ CRC_READ_32(kCrc32Table, (crc ^ data[i]) & 0x0F);
+        crc = (crc >> 4) ^ CRC_READ_32(kCrc32Table, (crc ^ (data[i] >> 4)) & 0x0F);
+    }
+    return ~crc;
+};
+
+#else
+
+/**
+ * @brief Tables are filled on first use, CRC-16 is processed two bytes and CRC-32 four bytes per step (slicing)
+ *
+ */
+static uint16_t crc16_table[2][256];
+static uint32_t crc32_table[4][256];
+static bool tables_filled = false;
+
+static void FillTables(void)
+{
+    for (uint16_t i = 0; i < 256; i++)
+    {
+        uint16_t crc16 = i << 8;
+        uint32_t crc32 = i;
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc16 = (crc16 & 0x8000) ? (crc16 << 1) ^ kCrc16Polynomial : crc16 << 1;
+            crc32 = (crc32 & 1) ? (crc32 >> 1) ^ kCrc32Polynomial : crc32 >> 1;
+        }
+        crc16_table[0][i] = crc16;
+        crc32_table[0][i] = crc32;
+    }
+
+    for (uint16_t i = 0; i < 256; i++)
+    {
+        crc16_table[1][i] = (crc16_table[0][i] << 8) ^ crc16_table[0][crc16_table[0][i] >> 8];
+        for (uint8_t slice = 1; slice < 4; slice++)
+        {
+            const uint32_t previous = crc32_table[slice - 1][i];
+            crc32_table[slice][i] = (previous >> 8) ^ crc32_table[0][previous & 0xFF];
+        }
+    }
+    tables_filled = true;
+}
+
+uint16_t LoRaCrc::Crc16(const uint8_t *data, const size_t size, uint16_t crc)
+{
+    if (!tables_filled)
+    {
+        FillTables();
+    }
+
+    size_t i = 0;
+    for (; i + 2 <= size; i += 2)
+    {
+        crc ^= (data[i] << 8) | data[i + 1];
+        crc = crc16_table[1][crc >> 8] ^ crc16_table[0][crc & 0xFF];
+    }
+    for (; i < size; i++)
+    {
+        crc = (crc << 8) ^ crc16_table[0][(crc >> 8) ^ data[i]];
+    }
+    return crc;
+};
+
+uint32_t LoRaCrc::Crc32(const uint8_t *data, const size_t size, uint32_t crc)
+{
+    if (!tables_filled)
+    {
+        FillTables();
+    }
+
+    crc = ~crc;
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+    {
+        crc ^= data[i] | (data[i + 1] << 8) | (static_cast<uint32_t>(data[i + 2]) << 16) | (static_cast<uint32_t>(data[i + 3]) << 24);
+        crc = crc32_table[3][crc & 0xFF] ^ crc32_table[2][(crc >> 8) & 0xFF] ^ crc32_table[1][(crc >> 16) & 0xFF] ^ crc32_table[0][crc >> 24];
+    }
+    for (; i < size; i++)
+    {
+        crc = (crc >> 8) ^ crc32_table[0][(crc ^ data[i]) & 0xFF];
+    }
+    return ~crc;
+};
+
+#endif
@@ -0,0 +1,121 @@
+/**
+ * @file usr_lg206_p_deduplication.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Cache of recently received frames, to hand every message to the application only once
+ * @version 0.1
+ * @date 2024-03-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_deduplication.h"
+
+/**
+ * @brief First byte hashed, so a sequence number and a payload with the same bytes get different keys
+ *
+ */
+const uint8_t kKeyTypeSequence = 0x01;
+const uint8_t kKeyTypePayload = 0x02;
+
+static uint32_t GetSequenceKey(const uint16_t source_address, const uint8_t sequence_number)
+{
+    const uint8_t key[] = {kKeyTypeSequence, static_cast<uint8_t>((source_address & 0xFF00) >> 8), static_cast<uint8_t>(source_address & 0xFF), sequence_number};
+    return LoRaDeduplication::Hash(key, sizeof(key));
+}
+
+uint32_t LoRaDeduplication::Hash(const uint8_t *data, const size_t size, uint32_t hash)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+};
+
+LoRaDeduplication::LoRaDeduplicationCache::LoRaDeduplicationCache(void)
+{
+    Clear();
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+};
+
+bool LoRaDeduplication::LoRaDeduplicationCache::IsDuplicate(const uint16_t source_address, const uint8_t sequence_number)
+{
+    return Lookup(GetSequenceKey(source_address, sequence_number));
+};
+
+bool LoRaDeduplication::LoRaDeduplicationCache::IsDuplicate(const uint8_t *payload, const size_t size)
+{
+    return Lookup(Hash(payload, size, Hash(&kKeyTypePayload, 1)));
+};
+
+void LoRaDeduplication::LoRaDeduplicationCache::Remember(const uint16_t source_address, const uint8_t sequence_number)
+{
+    const uint32_t key = GetSequenceKey(source_address, sequence_number);
+    if (!Find(key))
+    {
+        Insert(key);
+    }
+};
+
+void LoRaDeduplication::LoRaDeduplicationCache::Clear(void)
+{
+    this->amount_of_entries_ = 0;
+    this->next_entry_ = 0;
+};
+
+uint8_t LoRaDeduplication::LoRaDeduplicationCache::GetHitRate(void) const
+{
+    if (statistics_.lookups == 0)
+    {
+        return 0;
+    }
+    return statistics_.hits * 100 / statistics_.lookups;
+};
+
+const LoRaDeduplication::LoRaDeduplicationStatistics &LoRaDeduplication::LoRaDeduplicationCache::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+bool LoRaDeduplication::LoRaDeduplicationCache::Lookup(const uint32_t key)
+{
+    statistics_.lookups++;
+    if (Find(key))
+    {
+        statistics_.hits++;
+        return true;
+    }
+
+    Insert(key);
+    return false;
+};
+
+bool LoRaDeduplication::LoRaDeduplicationCache::Find(const uint32_t key) const
+{
+    const unsigned long now = millis();
+    for (size_t i = 0; i < amount_of_entries_; i++)
+    {
+        if (entries_[i].key == key && now - entries_[i].seen_at < kLoRaDeduplicationLifetime)
+        {
+            return true;
+        }
+    }
+    return false;
+};
+
+void LoRaDeduplication::LoRaDeduplicationCache::Insert(const uint32_t key)
+{
+    // Ring buffer, the oldest frame is forgotten first
+    entries_[next_entry_].key = key;
+    entries_[next_entry_].seen_at = millis();
+    next_entry_ = (next_entry_ + 1) % kLoRaDeduplicationCacheSize;
+    if (amount_of_entries_ < kLoRaDeduplicationCacheSize)
+    {
+        amount_of_entries_++;
+    }
+};
+
+#pragma endregion
@@ -0,0 +1,162 @@
+/**
+ * @file usr_lg206_p_dispatcher.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Hands received frames to handlers registered per work mode and source address
+ * @version 0.1
+ * @date 2024-03-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_dispatcher.h"
+
+LoRaDispatcher::LoRaDispatcher::LoRaDispatcher(UsrLg206P *const lora)
+{
+    this->lora_ = lora;
+    this->has_source_address_offset_ = false;
+    this->source_address_offset_ = 0;
+    this->has_sequence_number_offset_ = false;
+    this->sequence_number_offset_ = 0;
+    this->cache_ = nullptr;
+    memset(this->registrations_, 0, sizeof(this->registrations_));
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+};
+
+LoRaErrorCode LoRaDispatcher::LoRaDispatcher::Register(const LoRaSettings::WorkMode work_mode, MessageHandler handler, const uint16_t source_address)
+{
+    const bool fixed_point = work_mode == LoRaSettings::WorkMode::kWorkModeFixedPoint;
+    const bool known_work_mode = fixed_point || work_mode == LoRaSettings::WorkMode::kWorkModeTransparent || work_mode == kAnyWorkMode;
+    if (handler == nullptr || !known_work_mode || (!fixed_point && source_address != kAnySource))
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    for (size_t i = 0; i < kLoRaDispatcherAmountOfHandlers; i++)
+    {
+        Registration &registration = registrations_[i];
+        if (registration.handler == nullptr)
+        {
+            registration.handler = handler;
+            registration.work_mode = work_mode;
+            registration.source_address = source_address;
+            return LoRaErrorCode::kSucces;
+        }
+    }
+    return LoRaErrorCode::kQueueFull;
+};
+
+void LoRaDispatcher::LoRaDispatcher::Unregister(MessageHandler handler)
+{
+    for (size_t i = 0; i < kLoRaDispatcherAmountOfHandlers; i++)
+    {
+        if (registrations_[i].handler == handler)
+        {
+            registrations_[i].handler = nullptr;
+        }
+    }
+};
+
+void LoRaDispatcher::LoRaDispatcher::SetSourceAddressOffset(const size_t offset)
+{
+    this->has_source_address_offset_ = true;
+    this->source_address_offset_ = offset;
+};
+
+void LoRaDispatcher::LoRaDispatcher::SetSequenceNumberOffset(const size_t offset)
+{
+    this->has_sequence_number_offset_ = true;
+    this->sequence_number_offset_ = offset;
+};
+
+void LoRaDispatcher::LoRaDispatcher::SetDeduplicationCache(LoRaDeduplication::LoRaDeduplicationCache *cache)
+{
+    this->cache_ = cache;
+};
+
+size_t LoRaDispatcher::LoRaDispatcher::Poll(void)
+{
+    size_t amount_of_frames = 0;
+    while (lora_->Available() > 0)
+    {
+        const size_t size = lora_->ReceiveMessage(buffer_, sizeof(buffer_));
+        if (size == 0)
+        {
+            // Dropped by the checksum of the driver
+            continue;
+        }
+        amount_of_frames++;
+        statistics_.frames_received++;
+
+        // Asked every frame, layers like the channel survey switch the work mode in between
+        const LoRaSettings::WorkMode work_mode = lora_->GetKnownWorkMode();
+        uint16_t source_address = kAnySource;
+        if (work_mode == LoRaSettings::WorkMode::kWorkModeFixedPoint && has_source_address_offset_ && source_address_offset_ + 2 <= size)
+        {
+            source_address = (buffer_[source_address_offset_] << 8) | buffer_[source_address_offset_ + 1];
+        }
+
+        if (cache_ != nullptr)
+        {
+            // A relay may change other bytes of a frame it repeats, the sequence number stays the same
+            const bool sequenced = source_address != kAnySource && has_sequence_number_offset_ && sequence_number_offset_ < size;
+            const bool duplicate = sequenced ? cache_->IsDuplicate(source_address, buffer_[sequence_number_offset_])
+                                             : cache_->IsDuplicate(buffer_, size);
+            if (duplicate)
+            {
+                statistics_.frames_duplicate++;
+                continue;
+            }
+        }
+
+        size_t handlers = 0;
+        if (source_address != kAnySource)
+        {
+            handlers = Dispatch(work_mode, buffer_, size, source_address, false);
+        }
+        if (handlers == 0)
+        {
+            handlers = Dispatch(work_mode, buffer_, size, source_address, true);
+        }
+
+        if (handlers > 0)
+        {
+            statistics_.frames_dispatched++;
+        }
+        else
+        {
+            statistics_.frames_unhandled++;
+        }
+    }
+    return amount_of_frames;
+};
+
+const LoRaDispatcher::LoRaDispatcherStatistics &LoRaDispatcher::LoRaDispatcher::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+size_t LoRaDispatcher::LoRaDispatcher::Dispatch(const LoRaSettings::WorkMode work_mode, const uint8_t *frame, const size_t size, const uint16_t source_address, const bool any_source)
+{
+    size_t handlers = 0;
+    for (size_t i = 0; i < kLoRaDispatcherAmountOfHandlers; i++)
+    {
+        // Copied, a handler may unregister itself
+        const Registration registration = registrations_[i];
+        if (registration.handler == nullptr || (registration.work_mode != work_mode && registration.work_mode != kAnyWorkMode))
+        {
+            continue;
+        }
+
+        const bool matches = any_source ? registration.source_address == kAnySource : registration.source_address == source_address;
+        if (matches)
+        {
+            registration.handler(frame, size, source_address);
+            handlers++;
+        }
+    }
+    return handlers;
+};
+
+#pragma endregion
@@ -0,0 +1,398 @@
+/**
+ * @file usr_lg206_p_fragmentation.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Splits messages larger than one frame into fragments and reassembles them on the receiving side
+ * @version 0.1
+ * @date 2024-03-07
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_fragmentation.h"
+
+LoRaFragmentation::LoRaFragmentation::LoRaFragmentation(UsrLg206P *const lora, const uint16_t local_address)
+{
+    this->lora_ = lora;
+    this->local_address_ = local_address;
+    this->frame_size_ = kLoRaFragmentationMaximumFrameSize;
+    this->parity_group_size_ = 0;
+    // Slowest level, so the fragments are never spaced too closely when the level is not set
+    this->air_rate_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268;
+    this->reassembly_timeout_ = kLoRaFragmentationReassemblyTimeout;
+    this->next_message_id_ = 0;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+
+    for (size_t i = 0; i < kLoRaFragmentationAmountOfBuffers; i++)
+    {
+        buffers_[i].in_use = false;
+    }
+};
+
+LoRaErrorCode LoRaFragmentation::LoRaFragmentation::SetFrameSize(const size_t frame_size)
+{
+    if (frame_size <= kHeaderSize || frame_size > kLoRaFragmentationMaximumFrameSize)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    this->frame_size_ = frame_size;
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaFragmentation::LoRaFragmentation::SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level)
+{
+    this->air_rate_level_ = level;
+};
+
+LoRaErrorCode LoRaFragmentation::LoRaFragmentation::SetParityGroupSize(const uint8_t group_size)
+{
+    if (group_size > kMaximumParityGroupSize)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    this->parity_group_size_ = group_size;
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaFragmentation::LoRaFragmentation::SetReassemblyTimeout(const unsigned long timeout)
+{
+    this->reassembly_timeout_ = timeout;
+};
+
+LoRaErrorCode LoRaFragmentation::LoRaFragmentation::Send(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel)
+{
+    if (size == 0)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    const size_t amount_of_fragments = GetAmountOfFragments(size);
+    if (size > kLoRaFragmentationMaximumMessageSize || amount_of_fragments > kMaximumAmountOfFragments)
+    {
+        return LoRaErrorCode::kMessageTooLarge;
+    }
+
+    const size_t payload_size = frame_size_ - kHeaderSize;
+    const uint8_t message_id = next_message_id_++;
+    const bool parity_on = parity_group_size_ > 0 && amount_of_fragments > 1;
+    uint8_t frame[kLoRaFragmentationMaximumFrameSize];
+    uint8_t parity[kLoRaFragmentationMaximumFrameSize];
+    size_t parity_length = 0;
+    size_t previous_size = 0;
+
+    frame[2] = (local_address_ & 0xFF00) >> 8;
+    frame[3] = (local_address_ & 0xFF);
+    frame[4] = message_id;
+    frame[6] = amount_of_fragments;
+    frame[7] = (size & 0xFF00) >> 8;
+    frame[8] = (size & 0xFF);
+
+    for (size_t i = 0; i < amount_of_fragments; i++)
+    {
+        const size_t offset = i * payload_size;
+        const size_t length = (size - offset < payload_size) ? size - offset : payload_size;
+
+        frame[0] = kFrameTypeFragment;
+        frame[1] = length;
+        frame[5] = i;
+        memcpy(frame + kHeaderSize, message + offset, length);
+
+        if (!Transmit(frame, kHeaderSize + length, destination_address, channel, previous_size))
+        {
+            return LoRaErrorCode::kWrongWorkMode;
+        }
+        statistics_.fragments_sent++;
+        previous_size = kHeaderSize + length;
+
+        if (!parity_on)
+        {
+            continue;
+        }
+
+        // The first fragment of a group is the longest, shorter ones are XORed as if padded with zeros
+        const size_t position_in_group = i % parity_group_size_;
+        if (position_in_group == 0)
+        {
+            memset(parity + kHeaderSize, 0, length);
+            parity_length = length;
+        }
+        for (size_t j = 0; j < length; j++)
+        {
+            parity[kHeaderSize + j] ^= frame[kHeaderSize + j];
+        }
+
+        if (position_in_group + 1 == parity_group_size_ || i + 1 == amount_of_fragments)
+        {
+            memcpy(parity, frame, kHeaderSize);
+            parity[0] = kFrameTypeFragment | parity_group_size_;
+            parity[1] = parity_length;
+            parity[5] = i - position_in_group;
+
+            if (!Transmit(parity, kHeaderSize + parity_length, destination_address, channel, previous_size))
+            {
+                return LoRaErrorCode::kWrongWorkMode;
+            }
+            statistics_.parity_sent++;
+            previous_size = kHeaderSize + parity_length;
+        }
+    }
+
+    statistics_.messages_sent++;
+    return LoRaErrorCode::kSucces;
+};
+
+size_t LoRaFragmentation::LoRaFragmentation::Receive(uint8_t *buffer, const size_t buffer_size, uint16_t &source_address)
+{
+    Update();
+
+    uint8_t *frame;
+    size_t frame_size;
+    while ((frame_size = receive_buffer_.Receive(lora_, frame)) > 0)
+    {
+        const size_t size = HandleFragment(frame, frame_size, buffer, buffer_size, source_address);
+        if (size > 0)
+        {
+            return size;
+        }
+    }
+    return 0;
+};
+
+void LoRaFragmentation::LoRaFragmentation::Update(void)
+{
+    const unsigned long now = millis();
+    for (size_t i = 0; i < kLoRaFragmentationAmountOfBuffers; i++)
+    {
+        if (buffers_[i].in_use && now - buffers_[i].last_fragment_at >= reassembly_timeout_)
+        {
+            buffers_[i].in_use = false;
+            statistics_.messages_timed_out++;
+        }
+    }
+};
+
+size_t LoRaFragmentation::LoRaFragmentation::GetAmountOfFragments(const size_t size) const
+{
+    const size_t payload_size = frame_size_ - kHeaderSize;
+    return (size + payload_size - 1) / payload_size;
+};
+
+const LoRaFragmentation::LoRaFragmentationStatistics &LoRaFragmentation::LoRaFragmentation::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+LoRaFragmentation::LoRaFragmentation::ReassemblyBuffer *LoRaFragmentation::LoRaFragmentation::FindBuffer(const uint16_t source_address, const uint8_t message_id, const uint8_t amount_of_fragments, const size_t size)
+{
+    for (size_t i = 0; i < kLoRaFragmentationAmountOfBuffers; i++)
+    {
+        ReassemblyBuffer &reassembly_buffer = buffers_[i];
+        if (reassembly_buffer.in_use && reassembly_buffer.source_address == source_address && reassembly_buffer.message_id == message_id &&
+            reassembly_buffer.amount_of_fragments == amount_of_fragments && reassembly_buffer.size == size)
+        {
+            return &reassembly_buffer;
+        }
+    }
+    return nullptr;
+};
+
+LoRaFragmentation::LoRaFragmentation::ReassemblyBuffer *LoRaFragmentation::LoRaFragmentation::GetBuffer(const uint16_t source_address, const uint8_t message_id, const uint8_t amount_of_fragments, const size_t size)
+{
+    ReassemblyBuffer *found = FindBuffer(source_address, message_id, amount_of_fragments, size);
+    if (found != nullptr)
+    {
+        return found;
+    }
+
+    ReassemblyBuffer *replace = &buffers_[0];
+    for (size_t i = 0; i < kLoRaFragmentationAmountOfBuffers; i++)
+    {
+        ReassemblyBuffer &reassembly_buffer = buffers_[i];
+        // Prefer an unused buffer, otherwise the one which waited longest for a fragment
+        if (replace->in_use && (!reassembly_buffer.in_use || reassembly_buffer.last_fragment_at < replace->last_fragment_at))
+        {
+            replace = &reassembly_buffer;
+        }
+    }
+
+    if (replace->in_use)
+    {
+        statistics_.messages_dropped++;
+    }
+
+    replace->in_use = true;
+    replace->source_address = source_address;
+    replace->message_id = message_id;
+    replace->amount_of_fragments = amount_of_fragments;
+    replace->fragments_received = 0;
+    replace->size = size;
+    replace->last_fragment_at = millis();
+    memset(replace->received, 0, sizeof(replace->received));
+    return replace;
+};
+
+size_t LoRaFragmentation::LoRaFragmentation::HandleFragment(const uint8_t *frame, const size_t size, uint8_t *buffer, const size_t buffer_size, uint16_t &source_address)
+{
+    if (size < kHeaderSize || (frame[0] & 0xF0) != kFrameTypeFragment)
+    {
+        return 0;
+    }
+
+    const size_t length = frame[1];
+    if (kHeaderSize + length > size)
+    {
+        // Payload cut off
+        return 0;
+    }
+    const uint16_t source = (frame[2] << 8) | frame[3];
+    const uint8_t message_id = frame[4];
+    const uint8_t index = frame[5];
+    const uint8_t amount_of_fragments = frame[6];
+    const size_t message_size = (frame[7] << 8) | frame[8];
+    const uint8_t *payload = frame + kHeaderSize;
+    const uint8_t parity_group_size = frame[0] & 0x0F;
+
+    if (parity_group_size > 0)
+    {
+        // Only a message which is being reassembled can be completed, a parity fragment arriving after the message is ignored
+        ReassemblyBuffer *reassembly_buffer = FindBuffer(source, message_id, amount_of_fragments, message_size);
+        if (reassembly_buffer == nullptr || length == 0 || index >= amount_of_fragments || index % parity_group_size != 0 ||
+            !HandleParity(reassembly_buffer, parity_group_size, index, payload, length))
+        {
+            return 0;
+        }
+        reassembly_buffer->last_fragment_at = millis();
+        return CompleteMessage(reassembly_buffer, buffer, buffer_size, source_address);
+    }
+
+    // All fragments have the same length except the last one, which ends the message
+    const size_t offset = (index + 1 == amount_of_fragments) ? message_size - length : index * length;
+    if (length == 0 || index >= amount_of_fragments || length > message_size || offset + length > message_size)
+    {
+        return 0;
+    }
+    statistics_.fragments_received++;
+
+    if (message_size > kLoRaFragmentationMaximumMessageSize)
+    {
+        if (index == 0)
+        {
+            statistics_.messages_dropped++;
+        }
+        return 0;
+    }
+
+    // A message of one fragment does not need a reassembly buffer
+    if (amount_of_fragments == 1)
+    {
+        const size_t copy_size = (length < buffer_size) ? length : buffer_size;
+        memcpy(buffer, payload, copy_size);
+        source_address = source;
+        statistics_.messages_received++;
+        return copy_size;
+    }
+
+    ReassemblyBuffer *reassembly_buffer = GetBuffer(source, message_id, amount_of_fragments, message_size);
+    const uint8_t bit = 1 << (index % 8);
+    if (reassembly_buffer->received[index / 8] & bit)
+    {
+        statistics_.duplicate_fragments++;
+        return 0;
+    }
+
+    memcpy(reassembly_buffer->data + offset, payload, length);
+    reassembly_buffer->received[index / 8] |= bit;
+    reassembly_buffer->fragments_received++;
+    reassembly_buffer->last_fragment_at = millis();
+
+    return CompleteMessage(reassembly_buffer, buffer, buffer_size, source_address);
+};
+
+size_t LoRaFragmentation::LoRaFragmentation::CompleteMessage(ReassemblyBuffer *reassembly_buffer, uint8_t *buffer, const size_t buffer_size, uint16_t &source_address)
+{
+    if (reassembly_buffer->fragments_received < reassembly_buffer->amount_of_fragments)
+    {
+        return 0;
+    }
+
+    const size_t copy_size = (reassembly_buffer->size < buffer_size) ? reassembly_buffer->size : buffer_size;
+    memcpy(buffer, reassembly_buffer->data, copy_size);
+    reassembly_buffer->in_use = false;
+    source_address = reassembly_buffer->source_address;
+    statistics_.messages_received++;
+    return copy_size;
+};
+
+bool LoRaFragmentation::LoRaFragmentation::HandleParity(ReassemblyBuffer *reassembly_buffer, const uint8_t group_size, const uint8_t first_index, const uint8_t *parity, const size_t length)
+{
+    const size_t amount_of_fragments = reassembly_buffer->amount_of_fragments;
+    const size_t end_index = (first_index + group_size < amount_of_fragments) ? first_index + group_size : amount_of_fragments;
+
+    // XOR parity can rebuild exactly one lost fragment
+    size_t missing = end_index;
+    for (size_t i = first_index; i < end_index; i++)
+    {
+        if (!(reassembly_buffer->received[i / 8] & (1 << (i % 8))))
+        {
+            if (missing != end_index)
+            {
+                return false;
+            }
+            missing = i;
+        }
+    }
+    if (missing == end_index)
+    {
+        return false;
+    }
+
+    // The parity is as long as the first fragment of the group, which is a full fragment unless the group only holds the last one
+    const size_t last_index = amount_of_fragments - 1;
+    const size_t message_size = reassembly_buffer->size;
+    const size_t last_offset = (first_index == last_index) ? message_size - length : last_index * length;
+    if (length > message_size || last_offset >= message_size || message_size - last_offset > length || length > kLoRaFragmentationMaximumFrameSize)
+    {
+        return false;
+    }
+
+    uint8_t rebuilt[kLoRaFragmentationMaximumFrameSize];
+    memcpy(rebuilt, parity, length);
+    for (size_t i = first_index; i < end_index; i++)
+    {
+        if (i == missing)
+        {
+            continue;
+        }
+
+        const size_t offset = (i == last_index) ? last_offset : i * length;
+        const size_t fragment_length = (i == last_index) ? message_size - last_offset : length;
+        for (size_t j = 0; j < fragment_length; j++)
+        {
+            rebuilt[j] ^= reassembly_buffer->data[offset + j];
+        }
+    }
+
+    const size_t offset = (missing == last_index) ? last_offset : missing * length;
+    const size_t fragment_length = (missing == last_index) ? message_size - last_offset : length;
+    memcpy(reassembly_buffer->data + offset, rebuilt, fragment_length);
+    reassembly_buffer->received[missing / 8] |= 1 << (missing % 8);
+    reassembly_buffer->fragments_received++;
+    statistics_.fragments_recovered++;
+    return true;
+};
+
+bool LoRaFragmentation::LoRaFragmentation::Transmit(const uint8_t *frame, const size_t size, const uint16_t destination_address, const uint8_t channel, const size_t previous_size)
+{
+    // Give the module time to send the previous frame before the next one is handed over
+    if (previous_size > 0)
+    {
+        delay(LoRaAirTime::GetTimeOnAir(air_rate_level_, previous_size + 3) / 1000);
+    }
+
+    return lora_->SendMessage(reinterpret_cast<const char *>(frame), size, destination_address, channel) >= 0;
+};
+
+#pragma endregion
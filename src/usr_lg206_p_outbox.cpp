@@ -0,0 +1,423 @@
+/**
+ * @file usr_lg206_p_outbox.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Persistent outbox which keeps messages in EEPROM or a file until the reliable layer delivered them
+ * @version 0.1
+ * @date 2024-03-25
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_outbox.h"
+
+#ifdef __AVR__
+#include <avr/eeprom.h>
+#else
+#include <stdio.h>
+#endif
+
+/**
+ * @brief Start of the storage, the last byte is the version of the layout
+ *
+ */
+static const uint8_t kStorageHeader[LoRaOutbox::kStorageHeaderSize] = {'L', 'O', 2};
+
+#ifdef __AVR__
+void LoRaOutbox::ReadEeprom(const uint32_t address, uint8_t *buffer, const size_t size)
+{
+    eeprom_read_block(buffer, reinterpret_cast<const void *>(address), size);
+};
+
+void LoRaOutbox::WriteEeprom(const uint32_t address, const uint8_t *data, const size_t size)
+{
+    // Update skips bytes which already hold the value, which saves wear
+    eeprom_update_block(data, reinterpret_cast<void *>(address), size);
+};
+#else
+static const char *file_path = "lora_outbox.bin";
+
+void LoRaOutbox::SetFilePath(const char *path)
+{
+    file_path = path;
+};
+
+void LoRaOutbox::ReadFile(const uint32_t address, uint8_t *buffer, const size_t size)
+{
+    memset(buffer, 0xFF, size);
+    FILE *file = fopen(file_path, "rb");
+    if (file == nullptr)
+    {
+        return;
+    }
+
+    if (fseek(file, address, SEEK_SET) == 0)
+    {
+        fread(buffer, 1, size, file);
+    }
+    fclose(file);
+};
+
+void LoRaOutbox::WriteFile(const uint32_t address, const uint8_t *data, const size_t size)
+{
+    FILE *file = fopen(file_path, "r+b");
+    if (file == nullptr)
+    {
+        file = fopen(file_path, "w+b");
+    }
+    if (file == nullptr)
+    {
+        return;
+    }
+
+    // Fill a gap with erased bytes, so it reads the same as unused EEPROM
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    while (file_size >= 0 && static_cast<uint32_t>(file_size) < address)
+    {
+        fputc(0xFF, file);
+        file_size++;
+    }
+
+    fseek(file, address, SEEK_SET);
+    fwrite(data, 1, size, file);
+    fclose(file);
+};
+#endif
+
+size_t LoRaOutbox::ReadMessage(const uint8_t *batch, const size_t size, size_t &offset, uint8_t *buffer, const size_t buffer_size)
+{
+    if (offset + kRecordHeaderSize > size)
+    {
+        return 0;
+    }
+
+    const size_t message_size = batch[offset];
+    if (message_size == 0 || offset + kRecordHeaderSize + message_size > size)
+    {
+        // Corrupt batch, stop reading
+        offset = size;
+        return 0;
+    }
+
+    const size_t copy_size = (message_size < buffer_size) ? message_size : buffer_size;
+    memcpy(buffer, batch + offset + kRecordHeaderSize, copy_size);
+    offset += kRecordHeaderSize + message_size;
+    return copy_size;
+};
+
+LoRaOutbox::LoRaOutbox::LoRaOutbox(LoRaReliable::LoRaReliable *const reliable, StorageRead read, StorageWrite write, const uint32_t storage_size)
+{
+    this->reliable_ = reliable;
+    this->read_ = read;
+    this->write_ = write;
+    this->storage_size_ = storage_size;
+    this->replay_order_ = ReplayOrder::kReplayOrderOldestFirst;
+    this->amount_of_slots_ = 0;
+    this->next_slot_ = 0;
+    this->next_sequence_number_ = 0;
+    this->amount_pending_ = 0;
+    this->failed_ = false;
+    this->failed_at_ = 0;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+    memset(this->batches_, 0, sizeof(this->batches_));
+};
+
+LoRaErrorCode LoRaOutbox::LoRaOutbox::Begin(void)
+{
+    if (storage_size_ < kStorageHeaderSize + kSlotSize)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    const uint32_t amount_of_slots = (storage_size_ - kStorageHeaderSize) / kSlotSize;
+    amount_of_slots_ = (amount_of_slots < 65535) ? amount_of_slots : 65535;
+    amount_pending_ = 0;
+    next_slot_ = 0;
+    next_sequence_number_ = 0;
+
+    uint8_t header[kStorageHeaderSize];
+    read_(0, header, sizeof(header));
+    if (memcmp(header, kStorageHeader, kStorageHeaderSize) != 0)
+    {
+        // Free every slot before the header is written, so a format cut off by a power loss is done again
+        const uint8_t state = kEntryStateFree;
+        for (uint16_t slot = 0; slot < amount_of_slots_; slot++)
+        {
+            write_(GetAddress(slot), &state, 1);
+        }
+        write_(0, kStorageHeader, kStorageHeaderSize);
+        return LoRaErrorCode::kSucces;
+    }
+
+    // Continue after the slot written last, an entry cut off by a power loss still holds its old state
+    bool found = false;
+    Entry entry;
+    for (uint16_t slot = 0; slot < amount_of_slots_; slot++)
+    {
+        if (!ReadEntry(slot, entry))
+        {
+            continue;
+        }
+
+        if (entry.state == kEntryStatePending)
+        {
+            amount_pending_++;
+        }
+
+        if (!found || entry.sequence_number >= next_sequence_number_)
+        {
+            found = true;
+            next_slot_ = (slot + 1) % amount_of_slots_;
+            next_sequence_number_ = entry.sequence_number + 1;
+        }
+    }
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaOutbox::LoRaOutbox::SetReplayOrder(const ReplayOrder order)
+{
+    this->replay_order_ = order;
+};
+
+LoRaErrorCode LoRaOutbox::LoRaOutbox::Add(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel, const uint8_t priority)
+{
+    if (size == 0)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    if (size > kLoRaOutboxMaximumMessageSize)
+    {
+        return LoRaErrorCode::kMessageTooLarge;
+    }
+
+    if (GetAmountFree() == 0)
+    {
+        statistics_.messages_dropped++;
+        return LoRaErrorCode::kQueueFull;
+    }
+
+    // Take the slots in turn, skipping the ones still pending
+    uint16_t slot = next_slot_;
+    Entry old;
+    while (ReadEntry(slot, old) && old.state == kEntryStatePending)
+    {
+        slot = (slot + 1) % amount_of_slots_;
+    }
+
+    uint8_t entry[kSlotSize];
+    entry[0] = kEntryStatePending;
+    entry[1] = priority;
+    entry[2] = (destination_address & 0xFF00) >> 8;
+    entry[3] = (destination_address & 0xFF);
+    entry[4] = channel;
+    entry[5] = size;
+    entry[6] = (next_sequence_number_ >> 24) & 0xFF;
+    entry[7] = (next_sequence_number_ >> 16) & 0xFF;
+    entry[8] = (next_sequence_number_ >> 8) & 0xFF;
+    entry[9] = next_sequence_number_ & 0xFF;
+    memcpy(entry + kEntryHeaderSize, message, size);
+
+    // The state is written last, until then the slot keeps its free or delivered state
+    const uint32_t address = GetAddress(slot);
+    write_(address + 1, entry + 1, kEntryHeaderSize - 1 + size);
+    write_(address, entry, 1);
+
+    next_slot_ = (slot + 1) % amount_of_slots_;
+    next_sequence_number_++;
+    amount_pending_++;
+    statistics_.messages_added++;
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaOutbox::LoRaOutbox::Update(void)
+{
+    if (amount_pending_ == 0 || (failed_ && millis() - failed_at_ < kLoRaOutboxRetryInterval))
+    {
+        return;
+    }
+
+    Batch *batch = nullptr;
+    for (size_t i = 0; i < kLoRaReliableWindowSize && batch == nullptr; i++)
+    {
+        if (!batches_[i].in_use)
+        {
+            batch = &batches_[i];
+        }
+    }
+
+    uint16_t slot;
+    Entry first;
+    if (batch == nullptr || !FindNext(slot, first))
+    {
+        return;
+    }
+
+    // Fill the batch with the next messages to the same destination, in the order they were added
+    uint8_t message[kLoRaReliableMaximumPayloadSize];
+    size_t size = 0;
+    batch->amount = 0;
+    Entry entry = first;
+    do
+    {
+        if (size + kRecordHeaderSize + entry.size > sizeof(message))
+        {
+            break;
+        }
+
+        message[size] = entry.size;
+        read_(GetAddress(slot) + kEntryHeaderSize, message + size + kRecordHeaderSize, entry.size);
+        size += kRecordHeaderSize + entry.size;
+        batch->slots[batch->amount++] = slot;
+    } while (batch->amount < kLoRaOutboxBatchSize && FindNewer(first, entry.sequence_number, slot, entry));
+
+    if (reliable_->Send(message, size, first.destination_address, first.channel, &batch->sequence_number) != LoRaErrorCode::kSucces)
+    {
+        // Window of the reliable layer is full, try again on the next update
+        return;
+    }
+
+    batch->in_use = true;
+    batch->destination_address = first.destination_address;
+    statistics_.batches_sent++;
+};
+
+void LoRaOutbox::LoRaOutbox::HandleDelivery(const uint16_t destination_address, const uint8_t sequence_number, const bool delivered)
+{
+    for (size_t i = 0; i < kLoRaReliableWindowSize; i++)
+    {
+        Batch &batch = batches_[i];
+        if (!batch.in_use || batch.destination_address != destination_address || batch.sequence_number != sequence_number)
+        {
+            continue;
+        }
+
+        batch.in_use = false;
+        if (!delivered)
+        {
+            // Messages stay pending, the link is tried again after the retry interval
+            failed_ = true;
+            failed_at_ = millis();
+            statistics_.failed_deliveries++;
+            return;
+        }
+
+        const uint8_t state = kEntryStateDelivered;
+        for (uint8_t j = 0; j < batch.amount; j++)
+        {
+            write_(GetAddress(batch.slots[j]), &state, 1);
+        }
+        failed_ = false;
+        amount_pending_ -= batch.amount;
+        statistics_.messages_delivered += batch.amount;
+        return;
+    }
+};
+
+uint16_t LoRaOutbox::LoRaOutbox::GetAmountPending(void) const
+{
+    return amount_pending_;
+};
+
+uint16_t LoRaOutbox::LoRaOutbox::GetAmountFree(void) const
+{
+    return amount_of_slots_ - amount_pending_;
+};
+
+const LoRaOutbox::LoRaOutboxStatistics &LoRaOutbox::LoRaOutbox::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+uint32_t LoRaOutbox::LoRaOutbox::GetAddress(const uint16_t slot) const
+{
+    return kStorageHeaderSize + static_cast<uint32_t>(slot) * kSlotSize;
+};
+
+bool LoRaOutbox::LoRaOutbox::ReadEntry(const uint16_t slot, Entry &entry) const
+{
+    uint8_t header[kEntryHeaderSize];
+    read_(GetAddress(slot), header, kEntryHeaderSize);
+    entry.state = header[0];
+    entry.priority = header[1];
+    entry.destination_address = (header[2] << 8) | header[3];
+    entry.channel = header[4];
+    entry.size = header[5];
+    entry.sequence_number = (static_cast<uint32_t>(header[6]) << 24) | (static_cast<uint32_t>(header[7]) << 16) |
+                            (static_cast<uint32_t>(header[8]) << 8) | header[9];
+
+    const bool known_state = entry.state == kEntryStatePending || entry.state == kEntryStateDelivered;
+    return known_state && entry.size > 0 && entry.size <= kLoRaOutboxMaximumMessageSize;
+};
+
+bool LoRaOutbox::LoRaOutbox::IsInFlight(const uint16_t slot) const
+{
+    for (size_t i = 0; i < kLoRaReliableWindowSize; i++)
+    {
+        for (uint8_t j = 0; batches_[i].in_use && j < batches_[i].amount; j++)
+        {
+            if (batches_[i].slots[j] == slot)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+};
+
+bool LoRaOutbox::LoRaOutbox::FindNext(uint16_t &slot, Entry &entry) const
+{
+    bool found = false;
+    Entry candidate;
+    for (uint16_t next = 0; next < amount_of_slots_; next++)
+    {
+        if (!ReadEntry(next, candidate) || candidate.state != kEntryStatePending || IsInFlight(next))
+        {
+            continue;
+        }
+
+        if (found)
+        {
+            // Sequence numbers give the order the entries were added in
+            const bool older = candidate.sequence_number < entry.sequence_number;
+            const bool higher = replay_order_ == ReplayOrder::kReplayOrderPriorityFirst && candidate.priority > entry.priority;
+            const bool same = replay_order_ == ReplayOrder::kReplayOrderOldestFirst || candidate.priority == entry.priority;
+            if (!higher && !(same && older))
+            {
+                continue;
+            }
+        }
+
+        found = true;
+        slot = next;
+        entry = candidate;
+    }
+    return found;
+};
+
+bool LoRaOutbox::LoRaOutbox::FindNewer(const Entry &first, const uint32_t sequence_number, uint16_t &slot, Entry &entry) const
+{
+    bool found = false;
+    Entry candidate;
+    for (uint16_t next = 0; next < amount_of_slots_; next++)
+    {
+        if (!ReadEntry(next, candidate) || candidate.state != kEntryStatePending || IsInFlight(next) ||
+            candidate.destination_address != first.destination_address || candidate.channel != first.channel ||
+            candidate.sequence_number <= sequence_number)
+        {
+            continue;
+        }
+
+        if (!found || candidate.sequence_number < entry.sequence_number)
+        {
+            found = true;
+            slot = next;
+            entry = candidate;
+        }
+    }
+    return found;
+};
+
+#pragma endregion
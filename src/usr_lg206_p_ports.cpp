@@ -0,0 +1,261 @@
+/**
+ * @file usr_lg206_p_ports.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Logical ports over one module, every port has its own queues and a share of the transmit time
+ * @version 0.1
+ * @date 2024-03-21
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_ports.h"
+
+/**
+ * @brief Returned for ports out of range
+ *
+ */
+static const LoRaPorts::LoRaPortStatistics kNoStatistics = {0, 0, 0};
+
+LoRaPorts::LoRaPorts::LoRaPorts(UsrLg206P *const lora)
+{
+    this->lora_ = lora;
+    // Slowest level, so the next message never follows too soon when the level is not set
+    this->air_rate_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268;
+    this->sent_at_ = 0;
+    this->busy_for_ = 0;
+    this->current_port_ = 0;
+    memset(this->ports_, 0, sizeof(this->ports_));
+};
+
+void LoRaPorts::LoRaPorts::SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level)
+{
+    this->air_rate_level_ = level;
+};
+
+LoRaErrorCode LoRaPorts::LoRaPorts::Open(const uint8_t port, const uint8_t weight)
+{
+    if (port >= kLoRaPortsAmountOfPorts || weight == 0)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    Port &open_port = ports_[port];
+    open_port.open = true;
+    open_port.weight = weight;
+    open_port.credit = weight;
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaPorts::LoRaPorts::Close(const uint8_t port)
+{
+    if (port >= kLoRaPortsAmountOfPorts)
+    {
+        return;
+    }
+
+    Port &closed_port = ports_[port];
+    closed_port.open = false;
+    closed_port.transmit.count = 0;
+    closed_port.receive.count = 0;
+};
+
+LoRaErrorCode LoRaPorts::LoRaPorts::Send(const uint8_t port, const uint8_t *message, const size_t size)
+{
+    return Add(port, message, size, false, 0, 0);
+};
+
+LoRaErrorCode LoRaPorts::LoRaPorts::Send(const uint8_t port, const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel)
+{
+    return Add(port, message, size, true, destination_address, channel);
+};
+
+size_t LoRaPorts::LoRaPorts::Receive(const uint8_t port, uint8_t *buffer, const size_t buffer_size)
+{
+    if (port >= kLoRaPortsAmountOfPorts)
+    {
+        return 0;
+    }
+
+    Message *message = Front(ports_[port].receive);
+    if (message == nullptr)
+    {
+        return 0;
+    }
+
+    const size_t copy_size = (message->size < buffer_size) ? message->size : buffer_size;
+    memcpy(buffer, message->data, copy_size);
+    Pop(ports_[port].receive);
+    return copy_size;
+};
+
+bool LoRaPorts::LoRaPorts::Update(void)
+{
+    ReceiveFrames();
+
+    if (millis() - sent_at_ < busy_for_)
+    {
+        return false;
+    }
+
+    Port *port = NextPort();
+    if (port == nullptr)
+    {
+        return false;
+    }
+
+    Message *message = Front(port->transmit);
+    int bytes;
+    if (message->fixed_point)
+    {
+        bytes = lora_->SendMessage(reinterpret_cast<const char *>(message->data), message->size, message->destination_address, message->channel);
+    }
+    else
+    {
+        bytes = lora_->SendMessage(reinterpret_cast<const char *>(message->data), message->size);
+    }
+    const size_t frame_size = message->size + (message->fixed_point ? 3 : 0);
+    Pop(port->transmit);
+    port->credit--;
+
+    if (bytes < 0)
+    {
+        // Message can not be sent in the current work mode, keeping it would block the port
+        return false;
+    }
+
+    port->statistics.sent++;
+    sent_at_ = millis();
+    busy_for_ = LoRaAirTime::GetTimeOnAir(air_rate_level_, frame_size) / 1000;
+    return true;
+};
+
+uint8_t LoRaPorts::LoRaPorts::GetAmountQueued(const uint8_t port) const
+{
+    return (port < kLoRaPortsAmountOfPorts) ? ports_[port].transmit.count : 0;
+};
+
+uint8_t LoRaPorts::LoRaPorts::GetAmountReceived(const uint8_t port) const
+{
+    return (port < kLoRaPortsAmountOfPorts) ? ports_[port].receive.count : 0;
+};
+
+const LoRaPorts::LoRaPortStatistics &LoRaPorts::LoRaPorts::GetStatistics(const uint8_t port) const
+{
+    return (port < kLoRaPortsAmountOfPorts) ? ports_[port].statistics : kNoStatistics;
+};
+
+#pragma region private functions
+
+LoRaErrorCode LoRaPorts::LoRaPorts::Add(const uint8_t port, const uint8_t *message, const size_t size, const bool fixed_point, const uint16_t destination_address, const uint8_t channel)
+{
+    if (size == 0 || port >= kLoRaPortsAmountOfPorts || !ports_[port].open)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    if (size > kLoRaPortsMaximumMessageSize)
+    {
+        return LoRaErrorCode::kMessageTooLarge;
+    }
+
+    Message *entry = Push(ports_[port].transmit);
+    if (entry == nullptr)
+    {
+        return LoRaErrorCode::kQueueFull;
+    }
+
+    entry->fixed_point = fixed_point;
+    entry->destination_address = destination_address;
+    entry->channel = channel;
+    entry->size = kHeaderSize + size;
+    entry->data[0] = kFrameTypePort | port;
+    entry->data[1] = size;
+    memcpy(entry->data + kHeaderSize, message, size);
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaPorts::LoRaPorts::ReceiveFrames(void)
+{
+    uint8_t *frame;
+    size_t size;
+    while ((size = receive_buffer_.Receive(lora_, frame)) > 0)
+    {
+        if (size <= kHeaderSize || (frame[0] & 0xF0) != kFrameTypePort)
+        {
+            continue;
+        }
+
+        const uint8_t port = frame[0] & 0x0F;
+        if (port >= kLoRaPortsAmountOfPorts || !ports_[port].open)
+        {
+            continue;
+        }
+
+        Port &receiving_port = ports_[port];
+        Message *message = Push(receiving_port.receive);
+        if (message == nullptr)
+        {
+            receiving_port.statistics.dropped++;
+            continue;
+        }
+
+        const size_t message_size = size - kHeaderSize;
+        message->size = (message_size < kLoRaPortsMaximumMessageSize) ? message_size : kLoRaPortsMaximumMessageSize;
+        memcpy(message->data, frame + kHeaderSize, message->size);
+        receiving_port.statistics.received++;
+    }
+};
+
+LoRaPorts::LoRaPorts::Port *LoRaPorts::LoRaPorts::NextPort(void)
+{
+    // Weighted round robin, the current port keeps its turn until its credit is used up
+    for (uint8_t round = 0; round < 2; round++)
+    {
+        for (uint8_t i = 0; i < kLoRaPortsAmountOfPorts; i++)
+        {
+            const uint8_t index = (current_port_ + i) % kLoRaPortsAmountOfPorts;
+            Port &port = ports_[index];
+            if (port.open && port.transmit.count > 0 && port.credit > 0)
+            {
+                current_port_ = index;
+                return &port;
+            }
+        }
+
+        // Every port with messages used its credit, start a new round
+        for (uint8_t i = 0; i < kLoRaPortsAmountOfPorts; i++)
+        {
+            ports_[i].credit = ports_[i].weight;
+        }
+        current_port_ = (current_port_ + 1) % kLoRaPortsAmountOfPorts;
+    }
+    return nullptr;
+};
+
+LoRaPorts::LoRaPorts::Message *LoRaPorts::LoRaPorts::Push(Queue &queue)
+{
+    if (queue.count >= kLoRaPortsQueueSize)
+    {
+        return nullptr;
+    }
+
+    Message *message = &queue.messages[(queue.head + queue.count) % kLoRaPortsQueueSize];
+    queue.count++;
+    return message;
+};
+
+LoRaPorts::LoRaPorts::Message *LoRaPorts::LoRaPorts::Front(Queue &queue)
+{
+    return (queue.count > 0) ? &queue.messages[queue.head] : nullptr;
+};
+
+void LoRaPorts::LoRaPorts::Pop(Queue &queue)
+{
+    if (queue.count > 0)
+    {
+        queue.head = (queue.head + 1) % kLoRaPortsQueueSize;
+        queue.count--;
+    }
+}
+
+#pragma endregion
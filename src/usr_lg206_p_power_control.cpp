@@ -0,0 +1,172 @@
+/**
+ * @file usr_lg206_p_power_control.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Transmission power control, lowers the power while messages are delivered and raises it on loss
+ * @version 0.1
+ * @date 2024-03-14
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_power_control.h"
+
+LoRaPowerControl::LoRaPowerControl::LoRaPowerControl(UsrLg206P *const lora)
+{
+    this->lora_ = lora;
+    this->minimum_power_ = kMinimumPower;
+    this->maximum_power_ = kMaximumPower;
+    this->power_ = kMaximumPower;
+    this->target_power_ = kMaximumPower;
+    this->changed_ = false;
+    this->last_change_ = 0;
+    this->sent_ = 0;
+    this->delivered_ = 0;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+};
+
+LoRaErrorCode LoRaPowerControl::LoRaPowerControl::Begin(void)
+{
+    LoRaErrorCode error_code = lora_->BeginAtMode();
+    if (error_code != LoRaErrorCode::kSucces)
+    {
+        return error_code;
+    }
+
+    int power = kMaximumPower;
+    error_code = lora_->GetPowerTransmissionValue(power);
+    const LoRaErrorCode end_error_code = lora_->EndAtMode();
+    if (error_code == LoRaErrorCode::kSucces)
+    {
+        error_code = end_error_code;
+    }
+
+    if (error_code == LoRaErrorCode::kSucces && kMinimumPower <= power && power <= kMaximumPower)
+    {
+        power_ = power;
+        // A power outside the range is changed right away
+        target_power_ = (power < minimum_power_) ? minimum_power_ : ((power > maximum_power_) ? maximum_power_ : power);
+        Apply();
+    }
+    return error_code;
+};
+
+LoRaErrorCode LoRaPowerControl::LoRaPowerControl::SetPowerRange(const int minimum, const int maximum)
+{
+    if (minimum < kMinimumPower || maximum > kMaximumPower || minimum > maximum)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    this->minimum_power_ = minimum;
+    this->maximum_power_ = maximum;
+    this->target_power_ = (power_ < minimum) ? minimum : ((power_ > maximum) ? maximum : power_);
+    Apply();
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaPowerControl::LoRaPowerControl::ReportDelivery(const bool delivered)
+{
+    sent_++;
+    if (delivered)
+    {
+        delivered_++;
+    }
+
+    // Raise as soon as the target can not be met in this window anymore
+    const uint8_t allowed_losses = kLoRaPowerControlWindow * (100 - kLoRaPowerControlTargetRatio) / 100;
+    if (sent_ - delivered_ > allowed_losses)
+    {
+        target_power_ = (power_ + kStepUp < maximum_power_) ? power_ + kStepUp : maximum_power_;
+    }
+    else if (sent_ >= kLoRaPowerControlWindow)
+    {
+        // A raise waiting for the minimum interval goes first
+        if (target_power_ <= power_)
+        {
+            target_power_ = (power_ - kStepDown > minimum_power_) ? power_ - kStepDown : minimum_power_;
+        }
+    }
+    else
+    {
+        return;
+    }
+
+    sent_ = 0;
+    delivered_ = 0;
+    Apply();
+    if (power_ != target_power_)
+    {
+        statistics_.deferred++;
+    }
+};
+
+void LoRaPowerControl::LoRaPowerControl::Update(void)
+{
+    Apply();
+};
+
+int LoRaPowerControl::LoRaPowerControl::GetPower(void) const
+{
+    return power_;
+};
+
+uint8_t LoRaPowerControl::LoRaPowerControl::GetDeliveryRatio(void) const
+{
+    if (sent_ == 0)
+    {
+        return 100;
+    }
+    return static_cast<uint16_t>(delivered_) * 100 / sent_;
+};
+
+const LoRaPowerControl::LoRaPowerControlStatistics &LoRaPowerControl::LoRaPowerControl::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+void LoRaPowerControl::LoRaPowerControl::Apply(void)
+{
+    if (target_power_ == power_)
+    {
+        return;
+    }
+
+    if (changed_ && millis() - last_change_ < kLoRaPowerControlMinimumInterval)
+    {
+        return;
+    }
+
+    LoRaErrorCode error_code = lora_->BeginAtMode();
+    if (error_code == LoRaErrorCode::kSucces)
+    {
+        error_code = lora_->SetPowerTransmissionValue(target_power_);
+        const LoRaErrorCode end_error_code = lora_->EndAtMode();
+        if (error_code == LoRaErrorCode::kSucces)
+        {
+            error_code = end_error_code;
+        }
+    }
+
+    // Both the change and a failed attempt count for the interval, so the AT mode is not entered over and over
+    changed_ = true;
+    last_change_ = millis();
+    if (error_code != LoRaErrorCode::kSucces)
+    {
+        statistics_.errors++;
+        return;
+    }
+
+    if (target_power_ > power_)
+    {
+        statistics_.raises++;
+    }
+    else
+    {
+        statistics_.reductions++;
+    }
+    power_ = target_power_;
+};
+
+#pragma endregion
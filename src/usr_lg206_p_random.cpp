@@ -0,0 +1,17 @@
+/**
+ * @file usr_lg206_p_random.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Small pseudo random generator for backoff and jitter, so no other library is needed
+ * @version 0.1
+ * @date 2024-03-28
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_random.h"
+
+uint32_t LoRaRandom::Next(uint32_t &seed)
+{
+    seed = seed * 1103515245UL + 12345UL;
+    return (seed >> 16) & 0x7FFF;
+};
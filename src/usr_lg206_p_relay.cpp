@@ -0,0 +1,246 @@
+/**
+ * @file usr_lg206_p_relay.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Multi hop relay on top of fixed point mode, nodes forward frames using routes learned from received frames
+ * @version 0.1
+ * @date 2024-03-16
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_relay.h"
+
+LoRaRelay::LoRaRelay::LoRaRelay(UsrLg206P *const lora, const uint16_t local_address, const uint8_t channel)
+{
+    this->lora_ = lora;
+    this->local_address_ = local_address;
+    this->channel_ = channel;
+    this->maximum_hops_ = kDefaultMaximumHops;
+    this->sequence_number_ = 0;
+    // Different nodes wait different times before forwarding the same frame
+    this->seed_ = local_address + 1;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+    memset(this->routes_, 0, sizeof(this->routes_));
+};
+
+LoRaErrorCode LoRaRelay::LoRaRelay::SetMaximumHops(const uint8_t hops)
+{
+    if (hops == 0)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    this->maximum_hops_ = hops;
+    return LoRaErrorCode::kSucces;
+};
+
+LoRaErrorCode LoRaRelay::LoRaRelay::Send(const uint8_t *message, const size_t size, const uint16_t destination_address)
+{
+    if (size == 0)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    if (size > kLoRaRelayMaximumPayloadSize)
+    {
+        return LoRaErrorCode::kMessageTooLarge;
+    }
+
+    // Checked before a sequence number is used, a frame which is never sent would still be remembered
+    if (lora_->GetKnownWorkMode() != LoRaSettings::WorkMode::kWorkModeFixedPoint)
+    {
+        return LoRaErrorCode::kWrongWorkMode;
+    }
+
+    uint8_t frame[kHeaderSize + kLoRaRelayMaximumPayloadSize];
+    frame[0] = kFrameTypeRelay;
+    frame[1] = size;
+    frame[2] = (local_address_ & 0xFF00) >> 8;
+    frame[3] = (local_address_ & 0xFF);
+    frame[4] = (destination_address & 0xFF00) >> 8;
+    frame[5] = (destination_address & 0xFF);
+    frame[6] = (local_address_ & 0xFF00) >> 8;
+    frame[7] = (local_address_ & 0xFF);
+    frame[8] = sequence_number_;
+    frame[9] = 1;
+    frame[10] = maximum_hops_;
+    memcpy(frame + kHeaderSize, message, size);
+
+    // Copies sent back by neighbours are not forwarded again
+    seen_.Remember(local_address_, sequence_number_);
+    sequence_number_++;
+
+    if (!Transmit(frame, kHeaderSize + size, destination_address, false))
+    {
+        return LoRaErrorCode::kWrongWorkMode;
+    }
+    statistics_.originated++;
+    return LoRaErrorCode::kSucces;
+};
+
+size_t LoRaRelay::LoRaRelay::Receive(uint8_t *buffer, const size_t buffer_size, uint16_t &source_address)
+{
+    uint8_t *frame;
+    size_t frame_size;
+    while ((frame_size = receive_buffer_.Receive(lora_, frame)) > 0)
+    {
+        if (frame[0] != kFrameTypeRelay)
+        {
+            // Corrupt frame, there is no way to find the start of the next one
+            receive_buffer_.Clear();
+            return 0;
+        }
+
+        const size_t size = HandleFrame(frame, frame_size, buffer, buffer_size, source_address);
+        if (size > 0)
+        {
+            return size;
+        }
+    }
+    return 0;
+};
+
+bool LoRaRelay::LoRaRelay::GetRoute(const uint16_t destination_address, uint16_t &next_hop, uint8_t &hops) const
+{
+    const Route *route = FindRoute(destination_address);
+    if (route == nullptr)
+    {
+        return false;
+    }
+
+    next_hop = route->next_hop;
+    hops = route->hops;
+    return true;
+};
+
+const LoRaRelay::LoRaRelayStatistics &LoRaRelay::LoRaRelay::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+size_t LoRaRelay::LoRaRelay::HandleFrame(uint8_t *frame, const size_t size, uint8_t *buffer, const size_t buffer_size, uint16_t &source_address)
+{
+    const uint16_t origin = (frame[2] << 8) | frame[3];
+    const uint16_t destination_address = (frame[4] << 8) | frame[5];
+    const uint16_t previous_hop = (frame[6] << 8) | frame[7];
+    const uint8_t sequence_number = frame[8];
+    const uint8_t hops = frame[9];
+    const uint8_t hops_left = frame[10];
+
+    // The way back to the origin goes through the node this frame came from
+    LearnRoute(previous_hop, previous_hop, 1);
+    if (origin != local_address_)
+    {
+        LearnRoute(origin, previous_hop, hops);
+    }
+
+    if (seen_.IsDuplicate(origin, sequence_number))
+    {
+        statistics_.duplicates++;
+        return 0;
+    }
+
+    const bool for_this_node = destination_address == local_address_ || destination_address == kBroadcastAddress;
+    if (destination_address != local_address_)
+    {
+        if (hops_left <= 1)
+        {
+            statistics_.expired++;
+        }
+        else
+        {
+            frame[6] = (local_address_ & 0xFF00) >> 8;
+            frame[7] = (local_address_ & 0xFF);
+            frame[9] = hops + 1;
+            frame[10] = hops_left - 1;
+            if (Transmit(frame, size, destination_address, true))
+            {
+                statistics_.forwarded++;
+            }
+        }
+    }
+
+    if (!for_this_node)
+    {
+        return 0;
+    }
+
+    statistics_.delivered++;
+    source_address = origin;
+    const size_t payload_size = size - kHeaderSize;
+    const size_t copy_size = (payload_size < buffer_size) ? payload_size : buffer_size;
+    memcpy(buffer, frame + kHeaderSize, copy_size);
+    return copy_size;
+};
+
+bool LoRaRelay::LoRaRelay::Transmit(const uint8_t *frame, const size_t size, const uint16_t destination_address, const bool forwarding)
+{
+    uint16_t next_hop = kBroadcastAddress;
+    const Route *route = (destination_address != kBroadcastAddress) ? FindRoute(destination_address) : nullptr;
+    if (route != nullptr)
+    {
+        next_hop = route->next_hop;
+    }
+    else if (forwarding)
+    {
+        // Neighbours that received the same frame forward it as well, so do not start at the same time
+        delay(LoRaRandom::Next(seed_) % (kLoRaRelayForwardJitter + 1));
+    }
+
+    return lora_->SendMessage(reinterpret_cast<const char *>(frame), size, next_hop, channel_) >= 0;
+};
+
+void LoRaRelay::LoRaRelay::LearnRoute(const uint16_t destination_address, const uint16_t next_hop, const uint8_t hops)
+{
+    if (destination_address == local_address_ || destination_address == kBroadcastAddress)
+    {
+        return;
+    }
+
+    const unsigned long now = millis();
+    Route *replace = &routes_[0];
+    for (size_t i = 0; i < kLoRaRelayAmountOfRoutes; i++)
+    {
+        Route &route = routes_[i];
+        if (route.in_use && route.destination_address == destination_address)
+        {
+            // Keep a shorter route which is still valid, a longer one through the same neighbour replaces it
+            const bool expired = now - route.updated_at >= kLoRaRelayRouteLifetime;
+            if (!expired && hops > route.hops && next_hop != route.next_hop)
+            {
+                return;
+            }
+            replace = &route;
+            break;
+        }
+
+        // Prefer an unused route, otherwise the one confirmed longest ago
+        if (replace->in_use && (!route.in_use || route.updated_at < replace->updated_at))
+        {
+            replace = &route;
+        }
+    }
+
+    replace->in_use = true;
+    replace->destination_address = destination_address;
+    replace->next_hop = next_hop;
+    replace->hops = hops;
+    replace->updated_at = now;
+};
+
+const LoRaRelay::LoRaRelay::Route *LoRaRelay::LoRaRelay::FindRoute(const uint16_t destination_address) const
+{
+    for (size_t i = 0; i < kLoRaRelayAmountOfRoutes; i++)
+    {
+        const Route &route = routes_[i];
+        if (route.in_use && route.destination_address == destination_address)
+        {
+            return (millis() - route.updated_at < kLoRaRelayRouteLifetime) ? &route : nullptr;
+        }
+    }
+    return nullptr;
+};
+
+#pragma endregion
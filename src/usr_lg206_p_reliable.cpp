@@ -0,0 +1,487 @@
+/**
+ * @file usr_lg206_p_reliable.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Reliable delivery on top of fixed point mode
+ * @version 0.1
+ * @date 2024-03-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_reliable.h"
+
+LoRaReliable::LoRaReliable::LoRaReliable(UsrLg206P *const lora, const uint16_t local_address, const uint8_t local_channel)
+{
+    this->lora_ = lora;
+    this->local_address_ = local_address;
+    this->local_channel_ = local_channel;
+    this->session_id_ = micros();
+    // Slowest level, so the timeout is never too short when the level is not set
+    this->air_rate_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268;
+    // The acknowledgement bitmap covers 8 sequence numbers
+    this->window_size_ = (kLoRaReliableWindowSize < 8) ? kLoRaReliableWindowSize : 8;
+    this->maximum_retries_ = 3;
+    this->delivery_callback_ = nullptr;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+
+    for (size_t i = 0; i < kLoRaReliableWindowSize; i++)
+    {
+        slots_[i].in_use = false;
+    }
+    for (size_t i = 0; i < kLoRaReliableAmountOfPeers; i++)
+    {
+        peers_[i].in_use = false;
+    }
+};
+
+void LoRaReliable::LoRaReliable::SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level)
+{
+    this->air_rate_level_ = level;
+};
+
+void LoRaReliable::LoRaReliable::SetSessionId(const uint8_t session_id)
+{
+    this->session_id_ = session_id;
+};
+
+LoRaErrorCode LoRaReliable::LoRaReliable::SetWindowSize(const uint8_t window_size)
+{
+    if (window_size < 1 || window_size > kLoRaReliableWindowSize || window_size > 8)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    this->window_size_ = window_size;
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaReliable::LoRaReliable::SetMaximumRetries(const uint8_t retries)
+{
+    this->maximum_retries_ = retries;
+};
+
+void LoRaReliable::LoRaReliable::SetDeliveryCallback(DeliveryCallback callback)
+{
+    this->delivery_callback_ = callback;
+};
+
+LoRaErrorCode LoRaReliable::LoRaReliable::Send(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel, uint8_t *sequence_number)
+{
+    if (size == 0)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    if (size > kLoRaReliableMaximumPayloadSize)
+    {
+        return LoRaErrorCode::kMessageTooLarge;
+    }
+
+    Slot *slot = nullptr;
+    for (size_t i = 0; i < kLoRaReliableWindowSize && slot == nullptr; i++)
+    {
+        if (!slots_[i].in_use)
+        {
+            slot = &slots_[i];
+        }
+    }
+    if (slot == nullptr)
+    {
+        return LoRaErrorCode::kWindowFull;
+    }
+
+    Peer *peer = GetPeer(destination_address);
+    if (peer == nullptr)
+    {
+        return LoRaErrorCode::kWindowFull;
+    }
+
+    // The window slides with the oldest unacknowledged message, so the peer never has to skip a sequence number it
+    // could still receive
+    if (static_cast<uint8_t>(peer->next_sequence_number - GetOldestInFlight(*peer)) >= window_size_)
+    {
+        return LoRaErrorCode::kWindowFull;
+    }
+
+    // Until the peer acknowledged a message it is told which session the sequence numbers belong to
+    const size_t session_size = peer->synchronised ? 0 : kSessionIdSize;
+    const uint8_t type = static_cast<uint8_t>(FrameType::kFrameTypeData) | (peer->synchronised ? 0 : kFlagSynchronise);
+
+    slot->destination_address = destination_address;
+    slot->channel = channel;
+    slot->sequence_number = peer->next_sequence_number;
+    slot->retries = 0;
+    slot->timeout = GetRetransmissionTimeout(session_size + size);
+    slot->size = kHeaderSize + session_size + size;
+    WriteHeader(slot->frame, type, session_size + size, slot->sequence_number);
+    slot->frame[kHeaderSize] = session_id_;
+    memcpy(slot->frame + kHeaderSize + session_size, message, size);
+
+    if (!Transmit(*slot))
+    {
+        return LoRaErrorCode::kWrongWorkMode;
+    }
+
+    slot->in_use = true;
+    peer->next_sequence_number++;
+    statistics_.messages_sent++;
+
+    if (sequence_number != nullptr)
+    {
+        *sequence_number = slot->sequence_number;
+    }
+    return LoRaErrorCode::kSucces;
+};
+
+size_t LoRaReliable::LoRaReliable::Receive(uint8_t *buffer, const size_t buffer_size, uint16_t &source_address)
+{
+    uint8_t *frame;
+    size_t frame_size;
+    while ((frame_size = receive_buffer_.Receive(lora_, frame)) > 0)
+    {
+        const size_t size = HandleFrame(frame, frame_size, buffer, buffer_size, source_address);
+        if (size > 0)
+        {
+            return size;
+        }
+    }
+    return 0;
+};
+
+void LoRaReliable::LoRaReliable::Update(void)
+{
+    const unsigned long now = millis();
+    for (size_t i = 0; i < kLoRaReliableWindowSize; i++)
+    {
+        Slot &slot = slots_[i];
+        if (!slot.in_use || now - slot.sent_at < slot.timeout)
+        {
+            continue;
+        }
+
+        if (slot.retries >= maximum_retries_)
+        {
+            Release(slot, false);
+            continue;
+        }
+
+        // Exponential backoff, so a congested channel is not flooded with retransmissions
+        slot.retries++;
+        slot.timeout *= 2;
+        statistics_.retransmissions++;
+        Transmit(slot);
+    }
+};
+
+uint8_t LoRaReliable::LoRaReliable::GetAmountInFlight(const uint16_t destination_address) const
+{
+    uint8_t amount = 0;
+    for (size_t i = 0; i < kLoRaReliableWindowSize; i++)
+    {
+        if (slots_[i].in_use && (destination_address == 65535 || slots_[i].destination_address == destination_address))
+        {
+            amount++;
+        }
+    }
+    return amount;
+};
+
+unsigned long LoRaReliable::LoRaReliable::GetRetransmissionTimeout(const size_t size) const
+{
+    // Fixed point header of 3 bytes is sent by the module as well
+    const unsigned long data_time = LoRaAirTime::GetTimeOnAir(air_rate_level_, kHeaderSize + size + 3) / 1000;
+    const unsigned long acknowledgement_time = LoRaAirTime::GetTimeOnAir(air_rate_level_, kAcknowledgementSize + 3) / 1000;
+    return (data_time + acknowledgement_time) * 3 / 2 + kLoRaReliableProcessingTime;
+};
+
+const LoRaReliable::LoRaReliableStatistics &LoRaReliable::LoRaReliable::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+LoRaReliable::LoRaReliable::Peer *LoRaReliable::LoRaReliable::FindPeer(const uint16_t address)
+{
+    for (size_t i = 0; i < kLoRaReliableAmountOfPeers; i++)
+    {
+        if (peers_[i].in_use && peers_[i].address == address)
+        {
+            return &peers_[i];
+        }
+    }
+    return nullptr;
+};
+
+LoRaReliable::LoRaReliable::Peer *LoRaReliable::LoRaReliable::GetPeer(const uint16_t address)
+{
+    Peer *peer = FindPeer(address);
+    if (peer != nullptr)
+    {
+        peer->last_active = millis();
+        return peer;
+    }
+
+    // Prefer an unused peer, otherwise the least recently used one without messages in flight
+    Peer *replace = nullptr;
+    for (size_t i = 0; i < kLoRaReliableAmountOfPeers; i++)
+    {
+        Peer &candidate = peers_[i];
+        if (candidate.in_use && GetAmountInFlight(candidate.address) > 0)
+        {
+            // Forgetting the sequence numbers would make the acknowledgements of these messages unrecognisable
+            continue;
+        }
+
+        if (replace == nullptr || (replace->in_use && (!candidate.in_use || candidate.last_active < replace->last_active)))
+        {
+            replace = &candidate;
+        }
+    }
+
+    if (replace == nullptr)
+    {
+        return nullptr;
+    }
+
+    replace->in_use = true;
+    replace->address = address;
+    replace->next_sequence_number = 0;
+    replace->synchronised = false;
+    replace->receiving = false;
+    replace->session_known = false;
+    replace->session_id = 0;
+    replace->receive_base = 0;
+    replace->receive_bitmap = 0;
+    replace->last_active = millis();
+    return replace;
+};
+
+uint8_t LoRaReliable::LoRaReliable::GetOldestInFlight(const Peer &peer) const
+{
+    uint8_t oldest = peer.next_sequence_number;
+    for (size_t i = 0; i < kLoRaReliableWindowSize; i++)
+    {
+        const Slot &slot = slots_[i];
+        // Compared by distance to the next sequence number, they wrap around
+        if (slot.in_use && slot.destination_address == peer.address &&
+            static_cast<uint8_t>(peer.next_sequence_number - slot.sequence_number) > static_cast<uint8_t>(peer.next_sequence_number - oldest))
+        {
+            oldest = slot.sequence_number;
+        }
+    }
+    return oldest;
+};
+
+void LoRaReliable::LoRaReliable::WriteHeader(uint8_t *frame, const uint8_t type, const uint8_t length, const uint8_t sequence_number) const
+{
+    frame[0] = type;
+    frame[1] = length;
+    frame[2] = (local_address_ & 0xFF00) >> 8;
+    frame[3] = (local_address_ & 0xFF);
+    frame[4] = local_channel_;
+    frame[5] = sequence_number;
+};
+
+bool LoRaReliable::LoRaReliable::Transmit(Slot &slot)
+{
+    slot.sent_at = millis();
+    int bytes = lora_->SendMessage(reinterpret_cast<const char *>(slot.frame), slot.size, slot.destination_address, slot.channel);
+    return bytes >= 0;
+};
+
+size_t LoRaReliable::LoRaReliable::HandleFrame(const uint8_t *frame, const size_t size, uint8_t *buffer, const size_t buffer_size, uint16_t &source_address)
+{
+    const uint8_t type = frame[0] & 0xF0;
+    const uint8_t flags = frame[0] & 0x0F;
+    const uint16_t source = (frame[2] << 8) | frame[3];
+    const uint8_t channel = frame[4];
+    const uint8_t sequence_number = frame[5];
+
+    if (type == static_cast<uint8_t>(FrameType::kFrameTypeAcknowledgement) ||
+        type == static_cast<uint8_t>(FrameType::kFrameTypeNegativeAcknowledgement))
+    {
+        if (size >= kAcknowledgementSize)
+        {
+            const bool negative = type == static_cast<uint8_t>(FrameType::kFrameTypeNegativeAcknowledgement);
+            HandleAcknowledgement(source, sequence_number, frame[kHeaderSize], negative);
+        }
+        return 0;
+    }
+
+    if (type != static_cast<uint8_t>(FrameType::kFrameTypeData) || size == kHeaderSize)
+    {
+        return 0;
+    }
+
+    const bool synchronise = flags & kFlagSynchronise;
+    const size_t session_size = synchronise ? kSessionIdSize : 0;
+    if (size <= kHeaderSize + session_size)
+    {
+        return 0;
+    }
+
+    Peer *peer = GetPeer(source);
+    if (peer == nullptr)
+    {
+        // No room to remember the peer, the sender retransmits the frame later
+        return 0;
+    }
+
+    bool gap = false;
+    const bool is_new = HandleData(*peer, sequence_number, synchronise, frame[kHeaderSize], gap);
+
+    // Duplicates are acknowledged again, the previous acknowledgement might have been lost
+    SendAcknowledgement(*peer, channel, gap);
+
+    if (!is_new)
+    {
+        statistics_.duplicates_received++;
+        return 0;
+    }
+
+    size_t payload_size = size - kHeaderSize - session_size;
+    if (payload_size > buffer_size)
+    {
+        payload_size = buffer_size;
+    }
+    memcpy(buffer, frame + kHeaderSize + session_size, payload_size);
+    source_address = source;
+    statistics_.messages_received++;
+    return payload_size;
+};
+
+void LoRaReliable::LoRaReliable::Release(Slot &slot, const bool delivered)
+{
+    slot.in_use = false;
+    if (delivered)
+    {
+        statistics_.messages_delivered++;
+    }
+    else
+    {
+        statistics_.messages_failed++;
+    }
+
+    if (delivery_callback_ != nullptr)
+    {
+        delivery_callback_(slot.destination_address, slot.sequence_number, delivered);
+    }
+};
+
+void LoRaReliable::LoRaReliable::HandleAcknowledgement(const uint16_t source_address, const uint8_t base, const uint8_t bitmap, const bool negative)
+{
+    Peer *peer = FindPeer(source_address);
+    if (peer == nullptr)
+    {
+        return;
+    }
+    peer->synchronised = true;
+
+    for (size_t i = 0; i < kLoRaReliableWindowSize; i++)
+    {
+        Slot &slot = slots_[i];
+        if (!slot.in_use || slot.destination_address != source_address)
+        {
+            continue;
+        }
+
+        const uint8_t offset = slot.sequence_number - base;
+        if (offset >= 128)
+        {
+            // Sequence number lies before the base, so it is received
+            Release(slot, true);
+        }
+        else if (offset >= 1 && offset <= 8 && (bitmap & (1 << (offset - 1))))
+        {
+            Release(slot, true);
+        }
+        else if (offset == 0 && negative && slot.retries < maximum_retries_)
+        {
+            // Peer received later messages but misses this one, retransmit without waiting for the timeout
+            slot.retries++;
+            statistics_.retransmissions++;
+            Transmit(slot);
+        }
+    }
+};
+
+bool LoRaReliable::LoRaReliable::HandleData(Peer &peer, const uint8_t sequence_number, const bool synchronise, const uint8_t session_id, bool &gap)
+{
+    // A sender numbers from 0 in a new session, so start over when the session changed
+    // Sequence numbers picked up halfway, after this side started over, belong to the first session seen
+    if (!peer.receiving || (synchronise && peer.session_known && session_id != peer.session_id))
+    {
+        peer.receiving = true;
+        peer.session_known = false;
+        peer.receive_base = synchronise ? 0 : sequence_number;
+        peer.receive_bitmap = 0;
+    }
+    if (synchronise && !peer.session_known)
+    {
+        peer.session_known = true;
+        peer.session_id = session_id;
+    }
+
+    uint8_t offset = sequence_number - peer.receive_base;
+    bool is_new = true;
+    if (offset >= 128)
+    {
+        is_new = false;
+    }
+    else
+    {
+        // The sender only sends a message more than 8 ahead when it gave up the ones in front of the window, slide
+        // just far enough so the bitmap covers it
+        while (offset > 8)
+        {
+            Advance(peer);
+            offset = sequence_number - peer.receive_base;
+        }
+
+        if (offset == 0)
+        {
+            Advance(peer);
+        }
+        else
+        {
+            const uint8_t bit = 1 << (offset - 1);
+            is_new = !(peer.receive_bitmap & bit);
+            peer.receive_bitmap |= bit;
+        }
+    }
+
+    gap = peer.receive_bitmap != 0;
+    return is_new;
+};
+
+void LoRaReliable::LoRaReliable::Advance(Peer &peer)
+{
+    peer.receive_base++;
+    while (peer.receive_bitmap & 1)
+    {
+        peer.receive_bitmap >>= 1;
+        peer.receive_base++;
+    }
+    peer.receive_bitmap >>= 1;
+};
+
+void LoRaReliable::LoRaReliable::SendAcknowledgement(const Peer &peer, const uint8_t channel, const bool negative)
+{
+    uint8_t frame[kAcknowledgementSize];
+    const FrameType type = negative ? FrameType::kFrameTypeNegativeAcknowledgement : FrameType::kFrameTypeAcknowledgement;
+    WriteHeader(frame, static_cast<uint8_t>(type), kAcknowledgementSize - kHeaderSize, peer.receive_base);
+    frame[kHeaderSize] = peer.receive_bitmap;
+
+    lora_->SendMessage(reinterpret_cast<const char *>(frame), kAcknowledgementSize, peer.address, channel);
+    if (negative)
+    {
+        statistics_.negative_acknowledgements_sent++;
+    }
+    else
+    {
+        statistics_.acknowledgements_sent++;
+    }
+};
+
+#pragma endregion
@@ -0,0 +1,475 @@
+/**
+ * @file usr_lg206_p_remote_config.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Change settings of a module over the air
+ * @version 0.1
+ * @date 2024-03-23
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_remote_config.h"
+
+/**
+ * @brief Size of the payload of each frame type, between header and tag
+ *
+ */
+const size_t kSettingsSize = 7;
+const size_t kConfirmSize = 1;
+
+/**
+ * @brief First byte of the storage once the sequence numbers are written
+ *
+ */
+const uint8_t kStorageMarker = 0xC5;
+
+/**
+ * @brief Time in milliseconds between attempts to restore the old settings
+ *
+ */
+const unsigned long kRollbackRetryInterval = 1000;
+
+static uint64_t Rotate(const uint64_t value, const uint8_t bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t ReadLittleEndian(const uint8_t *data)
+{
+    uint64_t value = 0;
+    for (int8_t i = 7; i >= 0; i--)
+    {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+static void SipRound(uint64_t *v)
+{
+    v[0] += v[1];
+    v[1] = Rotate(v[1], 13);
+    v[1] ^= v[0];
+    v[0] = Rotate(v[0], 32);
+    v[2] += v[3];
+    v[3] = Rotate(v[3], 16);
+    v[3] ^= v[2];
+    v[0] += v[3];
+    v[3] = Rotate(v[3], 21);
+    v[3] ^= v[0];
+    v[2] += v[1];
+    v[1] = Rotate(v[1], 17);
+    v[1] ^= v[2];
+    v[2] = Rotate(v[2], 32);
+}
+
+LoRaRemoteConfig::LoRaRemoteConfig::LoRaRemoteConfig(UsrLg206P *const lora, const uint16_t local_address, const uint8_t local_channel, const uint8_t *key)
+{
+    this->lora_ = lora;
+    this->local_address_ = local_address;
+    this->local_channel_ = local_channel;
+    memcpy(this->key_, key, kKeySize);
+    this->confirm_callback_ = nullptr;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+    this->read_ = nullptr;
+    this->write_ = nullptr;
+    this->storage_address_ = 0;
+    this->next_sequence_number_ = 0;
+    this->accepted_any_ = false;
+    this->last_sequence_number_ = 0;
+    this->pending_ = false;
+    this->committed_ = false;
+    this->applied_at_ = 0;
+    this->deadline_ = 0;
+    memset(&this->previous_settings_, 0, sizeof(this->previous_settings_));
+};
+
+void LoRaRemoteConfig::LoRaRemoteConfig::SetLocalChannel(const uint8_t channel)
+{
+    this->local_channel_ = channel;
+};
+
+void LoRaRemoteConfig::LoRaRemoteConfig::SetConfirmCallback(ConfirmCallback callback)
+{
+    this->confirm_callback_ = callback;
+};
+
+void LoRaRemoteConfig::LoRaRemoteConfig::SetStorage(StorageRead read, StorageWrite write, const uint32_t address)
+{
+    this->read_ = read;
+    this->write_ = write;
+    this->storage_address_ = address;
+
+    uint8_t data[kStorageSize];
+    read_(storage_address_, data, sizeof(data));
+    if (data[0] != kStorageMarker)
+    {
+        return;
+    }
+
+    accepted_any_ = data[1] != 0;
+    last_sequence_number_ = (data[2] << 8) | data[3];
+    next_sequence_number_ = (data[4] << 8) | data[5];
+};
+
+LoRaErrorCode LoRaRemoteConfig::LoRaRemoteConfig::SendSettings(const LoRaRemoteSettings &settings, const uint16_t deadline, const uint16_t destination_address, const uint8_t channel, uint16_t *sequence_number)
+{
+    if (settings.fields == 0 || deadline == 0)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    uint8_t frame[kHeaderSize + kSettingsSize + kTagSize];
+    WriteHeader(frame, FrameType::kFrameTypeSettings, next_sequence_number_);
+    uint8_t *payload = frame + kHeaderSize;
+    payload[0] = settings.fields;
+    payload[1] = settings.channel;
+    payload[2] = static_cast<uint8_t>(settings.air_rate_level);
+    payload[3] = settings.power_transmission_value;
+    payload[4] = static_cast<uint8_t>(settings.forward_error_correction);
+    payload[5] = (deadline & 0xFF00) >> 8;
+    payload[6] = (deadline & 0xFF);
+
+    if (!Transmit(frame, sizeof(frame), destination_address, channel))
+    {
+        return LoRaErrorCode::kWrongWorkMode;
+    }
+
+    if (sequence_number != nullptr)
+    {
+        *sequence_number = next_sequence_number_;
+    }
+    next_sequence_number_++;
+    Save();
+    return LoRaErrorCode::kSucces;
+};
+
+LoRaErrorCode LoRaRemoteConfig::LoRaRemoteConfig::Commit(const uint16_t sequence_number, const uint16_t destination_address, const uint8_t channel)
+{
+    uint8_t frame[kHeaderSize + kTagSize];
+    WriteHeader(frame, FrameType::kFrameTypeCommit, sequence_number);
+    if (!Transmit(frame, sizeof(frame), destination_address, channel))
+    {
+        return LoRaErrorCode::kWrongWorkMode;
+    }
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaRemoteConfig::LoRaRemoteConfig::Update(void)
+{
+    uint8_t *frame;
+    size_t frame_size;
+    while ((frame_size = receive_buffer_.Receive(lora_, frame)) > 0)
+    {
+        HandleFrame(frame, frame_size);
+    }
+
+    if (pending_ && millis() - applied_at_ >= deadline_)
+    {
+        // Gateway did not reach this module with the new settings, go back to where it can
+        if (Apply(previous_settings_, nullptr) != LoRaErrorCode::kSucces)
+        {
+            // Stay pending, the module is not reachable on the new settings either
+            applied_at_ = millis();
+            deadline_ = kRollbackRetryInterval;
+            statistics_.failed_rollbacks++;
+            return;
+        }
+        pending_ = false;
+        statistics_.rolled_back++;
+    }
+};
+
+bool LoRaRemoteConfig::LoRaRemoteConfig::IsPending(void) const
+{
+    return pending_;
+};
+
+const LoRaRemoteConfig::LoRaRemoteConfigStatistics &LoRaRemoteConfig::LoRaRemoteConfig::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+uint64_t LoRaRemoteConfig::LoRaRemoteConfig::SipHash(const uint8_t *key, const uint8_t *data, const size_t size)
+{
+    const uint64_t k0 = ReadLittleEndian(key);
+    const uint64_t k1 = ReadLittleEndian(key + 8);
+    uint64_t v[4] = {
+        k0 ^ 0x736f6d6570736575ULL,
+        k1 ^ 0x646f72616e646f6dULL,
+        k0 ^ 0x6c7967656e657261ULL,
+        k1 ^ 0x7465646279746573ULL,
+    };
+
+    const size_t full_size = size - (size % 8);
+    for (size_t i = 0; i < full_size; i += 8)
+    {
+        const uint64_t m = ReadLittleEndian(data + i);
+        v[3] ^= m;
+        SipRound(v);
+        SipRound(v);
+        v[0] ^= m;
+    }
+
+    // Last block holds the remaining bytes and the size in its most significant byte
+    uint64_t m = static_cast<uint64_t>(size & 0xFF) << 56;
+    for (size_t i = full_size; i < size; i++)
+    {
+        m |= static_cast<uint64_t>(data[i]) << (8 * (i - full_size));
+    }
+    v[3] ^= m;
+    SipRound(v);
+    SipRound(v);
+    v[0] ^= m;
+
+    v[2] ^= 0xFF;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        SipRound(v);
+    }
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+};
+
+#pragma region private functions
+
+void LoRaRemoteConfig::LoRaRemoteConfig::Save(void) const
+{
+    if (write_ == nullptr)
+    {
+        return;
+    }
+
+    const uint8_t data[kStorageSize] = {
+        kStorageMarker,
+        accepted_any_,
+        static_cast<uint8_t>((last_sequence_number_ & 0xFF00) >> 8),
+        static_cast<uint8_t>(last_sequence_number_ & 0xFF),
+        static_cast<uint8_t>((next_sequence_number_ & 0xFF00) >> 8),
+        static_cast<uint8_t>(next_sequence_number_ & 0xFF),
+    };
+    write_(storage_address_, data, sizeof(data));
+};
+
+size_t LoRaRemoteConfig::GetFrameSize(const uint8_t *frame)
+{
+    switch (static_cast<FrameType>(frame[0]))
+    {
+    case FrameType::kFrameTypeSettings:
+        return kHeaderSize + kSettingsSize + kTagSize;
+    case FrameType::kFrameTypeCommit:
+        return kHeaderSize + kTagSize;
+    case FrameType::kFrameTypeConfirm:
+        return kHeaderSize + kConfirmSize + kTagSize;
+    default:
+        return 0;
+    }
+};
+
+void LoRaRemoteConfig::LoRaRemoteConfig::WriteHeader(uint8_t *frame, const FrameType type, const uint16_t sequence_number) const
+{
+    frame[0] = static_cast<uint8_t>(type);
+    frame[1] = (sequence_number & 0xFF00) >> 8;
+    frame[2] = (sequence_number & 0xFF);
+    frame[3] = (local_address_ & 0xFF00) >> 8;
+    frame[4] = (local_address_ & 0xFF);
+    frame[5] = local_channel_;
+};
+
+bool LoRaRemoteConfig::LoRaRemoteConfig::Transmit(uint8_t *frame, const size_t size, const uint16_t destination_address, const uint8_t channel)
+{
+    const uint64_t tag = SipHash(key_, frame, size - kTagSize);
+    for (size_t i = 0; i < kTagSize; i++)
+    {
+        frame[size - kTagSize + i] = (tag >> (8 * i)) & 0xFF;
+    }
+
+    int bytes = lora_->SendMessage(reinterpret_cast<const char *>(frame), size, destination_address, channel);
+    return bytes >= 0;
+};
+
+bool LoRaRemoteConfig::LoRaRemoteConfig::IsSigned(const uint8_t *frame, const size_t size) const
+{
+    const uint64_t tag = SipHash(key_, frame, size - kTagSize);
+    uint8_t difference = 0;
+    for (size_t i = 0; i < kTagSize; i++)
+    {
+        difference |= frame[size - kTagSize + i] ^ ((tag >> (8 * i)) & 0xFF);
+    }
+    return difference == 0;
+};
+
+void LoRaRemoteConfig::LoRaRemoteConfig::HandleFrame(const uint8_t *frame, const size_t size)
+{
+    if (!IsSigned(frame, size))
+    {
+        statistics_.rejected++;
+        return;
+    }
+
+    const uint16_t sequence_number = (frame[1] << 8) | frame[2];
+    const uint16_t source_address = (frame[3] << 8) | frame[4];
+    const uint8_t source_channel = frame[5];
+
+    switch (static_cast<FrameType>(frame[0]))
+    {
+    case FrameType::kFrameTypeSettings:
+        HandleSettings(frame + kHeaderSize, sequence_number, source_address, source_channel);
+        break;
+    case FrameType::kFrameTypeCommit:
+        HandleCommit(sequence_number, source_address, source_channel);
+        break;
+    case FrameType::kFrameTypeConfirm:
+        if (confirm_callback_ != nullptr)
+        {
+            confirm_callback_(source_address, sequence_number, static_cast<LoRaErrorCode>(frame[kHeaderSize]));
+        }
+        break;
+    }
+};
+
+void LoRaRemoteConfig::LoRaRemoteConfig::HandleSettings(const uint8_t *payload, const uint16_t sequence_number, const uint16_t source_address, const uint8_t source_channel)
+{
+    // Only newer changes are accepted, so a recorded frame can not be replayed
+    const bool newer = !accepted_any_ || static_cast<int16_t>(sequence_number - last_sequence_number_) > 0;
+    if (!newer || pending_)
+    {
+        statistics_.rejected++;
+        return;
+    }
+
+    // Stored before anything is applied, so the frame can not be replayed after a reboot halfway
+    accepted_any_ = true;
+    last_sequence_number_ = sequence_number;
+    committed_ = false;
+    Save();
+
+    LoRaRemoteSettings settings;
+    settings.fields = payload[0];
+    settings.channel = payload[1];
+    settings.air_rate_level = static_cast<LoRaSettings::LoRaAirRateLevel>(payload[2]);
+    settings.power_transmission_value = payload[3];
+    settings.forward_error_correction = static_cast<LoRaSettings::ForwardErrorCorrection>(payload[4]);
+    const uint16_t deadline = (payload[5] << 8) | payload[6];
+
+    const LoRaErrorCode result = Apply(settings, &previous_settings_);
+    if (result != LoRaErrorCode::kSucces)
+    {
+        // Part of the change might be applied, put back what was read so the gateway can still reach this module
+        if (previous_settings_.fields != 0 && Apply(previous_settings_, nullptr) != LoRaErrorCode::kSucces)
+        {
+            // Update keeps retrying the rollback
+            pending_ = true;
+            applied_at_ = millis();
+            deadline_ = kRollbackRetryInterval;
+            statistics_.failed_rollbacks++;
+        }
+        SendConfirm(sequence_number, result, source_address, source_channel);
+        return;
+    }
+
+    pending_ = true;
+    applied_at_ = millis();
+    deadline_ = deadline * 1000UL;
+    statistics_.applied++;
+};
+
+void LoRaRemoteConfig::LoRaRemoteConfig::HandleCommit(const uint16_t sequence_number, const uint16_t source_address, const uint8_t source_channel)
+{
+    // A change which is rolled back can not be committed anymore
+    if (!accepted_any_ || sequence_number != last_sequence_number_ || !(pending_ || committed_))
+    {
+        statistics_.rejected++;
+        return;
+    }
+
+    if (pending_)
+    {
+        pending_ = false;
+        committed_ = true;
+        statistics_.committed++;
+    }
+
+    // Confirmed again when the commit is repeated, the previous confirmation might have been lost
+    SendConfirm(sequence_number, LoRaErrorCode::kSucces, source_address, source_channel);
+};
+
+void LoRaRemoteConfig::LoRaRemoteConfig::SendConfirm(const uint16_t sequence_number, const LoRaErrorCode result, const uint16_t destination_address, const uint8_t channel)
+{
+    uint8_t frame[kHeaderSize + kConfirmSize + kTagSize];
+    WriteHeader(frame, FrameType::kFrameTypeConfirm, sequence_number);
+    frame[kHeaderSize] = static_cast<uint8_t>(result);
+    Transmit(frame, sizeof(frame), destination_address, channel);
+};
+
+LoRaErrorCode LoRaRemoteConfig::LoRaRemoteConfig::Apply(const LoRaRemoteSettings &settings, LoRaRemoteSettings *previous)
+{
+    if (previous != nullptr)
+    {
+        // No fields to restore until the current values are read
+        memset(previous, 0, sizeof(*previous));
+    }
+
+    LoRaErrorCode response_code = lora_->BeginAtMode();
+    if (response_code != LoRaErrorCode::kSucces)
+    {
+        return response_code;
+    }
+
+    if (previous != nullptr)
+    {
+        // Read the current values first, the driver knows most of them without a command
+        int channel = 0;
+        int power = 0;
+        if (response_code == LoRaErrorCode::kSucces && (settings.fields & kFieldChannel))
+        {
+            response_code = lora_->GetChannel(channel);
+            previous->channel = channel;
+        }
+        if (response_code == LoRaErrorCode::kSucces && (settings.fields & kFieldAirRateLevel))
+        {
+            response_code = lora_->GetAirRateLevel(previous->air_rate_level);
+        }
+        if (response_code == LoRaErrorCode::kSucces && (settings.fields & kFieldPowerTransmissionValue))
+        {
+            response_code = lora_->GetPowerTransmissionValue(power);
+            previous->power_transmission_value = power;
+        }
+        if (response_code == LoRaErrorCode::kSucces && (settings.fields & kFieldForwardErrorCorrection))
+        {
+            response_code = lora_->GetForwardErrorCorrection(previous->forward_error_correction);
+        }
+
+        if (response_code != LoRaErrorCode::kSucces)
+        {
+            lora_->EndAtMode();
+            return response_code;
+        }
+        previous->fields = settings.fields;
+    }
+
+    if (response_code == LoRaErrorCode::kSucces && (settings.fields & kFieldChannel))
+    {
+        response_code = lora_->SetChannel(settings.channel);
+    }
+    if (response_code == LoRaErrorCode::kSucces && (settings.fields & kFieldAirRateLevel))
+    {
+        response_code = lora_->SetAirRateLevel(settings.air_rate_level);
+    }
+    if (response_code == LoRaErrorCode::kSucces && (settings.fields & kFieldPowerTransmissionValue))
+    {
+        response_code = lora_->SetPowerTransmissionValue(settings.power_transmission_value);
+    }
+    if (response_code == LoRaErrorCode::kSucces && (settings.fields & kFieldForwardErrorCorrection))
+    {
+        response_code = lora_->SetForwardErrorCorrection(settings.forward_error_correction);
+    }
+
+    if (response_code == LoRaErrorCode::kSucces && (settings.fields & kFieldChannel))
+    {
+        local_channel_ = settings.channel;
+    }
+
+    const LoRaErrorCode end_code = lora_->EndAtMode();
+    return (response_code != LoRaErrorCode::kSucces) ? response_code : end_code;
+};
+
+#pragma endregion
@@ -0,0 +1,305 @@
+/**
+ * @file usr_lg206_p_rpc.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Requests and responses on top of fixed point mode
+ * @version 0.1
+ * @date 2024-03-22
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_rpc.h"
+
+LoRaRpc::LoRaRpc::LoRaRpc(UsrLg206P *const lora, const uint16_t local_address, const uint8_t local_channel)
+{
+    this->lora_ = lora;
+    this->local_address_ = local_address;
+    this->local_channel_ = local_channel;
+    // Slowest level, so the timeout is never too short when the level is not set
+    this->air_rate_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268;
+    this->next_correlation_id_ = 0;
+    this->next_order_ = 0;
+    this->busy_until_ = 0;
+    this->request_handler_ = nullptr;
+    this->response_callback_ = nullptr;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+
+    for (size_t i = 0; i < kLoRaRpcAmountOfPending; i++)
+    {
+        pending_[i].in_use = false;
+    }
+};
+
+void LoRaRpc::LoRaRpc::SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level)
+{
+    this->air_rate_level_ = level;
+};
+
+void LoRaRpc::LoRaRpc::SetRequestHandler(RequestHandler handler)
+{
+    this->request_handler_ = handler;
+};
+
+void LoRaRpc::LoRaRpc::SetResponseCallback(ResponseCallback callback)
+{
+    this->response_callback_ = callback;
+};
+
+LoRaErrorCode LoRaRpc::LoRaRpc::Call(const uint8_t *request, const size_t size, const uint16_t destination_address, const uint8_t channel, uint8_t *correlation_id, const size_t response_size)
+{
+    if (size == 0)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    if (size > kLoRaRpcMaximumPayloadSize)
+    {
+        return LoRaErrorCode::kMessageTooLarge;
+    }
+
+    if (lora_->GetKnownWorkMode() != LoRaSettings::WorkMode::kWorkModeFixedPoint)
+    {
+        return LoRaErrorCode::kWrongWorkMode;
+    }
+
+    Pending *pending = nullptr;
+    for (size_t i = 0; i < kLoRaRpcAmountOfPending && pending == nullptr; i++)
+    {
+        if (!pending_[i].in_use)
+        {
+            pending = &pending_[i];
+        }
+    }
+    if (pending == nullptr)
+    {
+        return LoRaErrorCode::kQueueFull;
+    }
+
+    // Skip ids still waiting for a response of the same peer
+    while (IsPending(destination_address, next_correlation_id_))
+    {
+        next_correlation_id_++;
+    }
+
+    pending->in_use = true;
+    pending->sent = false;
+    pending->destination_address = destination_address;
+    pending->channel = channel;
+    pending->correlation_id = next_correlation_id_;
+    pending->order = next_order_++;
+    pending->response_size = response_size;
+    pending->request_size = size;
+    memcpy(pending->request, request, size);
+    statistics_.calls++;
+
+    if (correlation_id != nullptr)
+    {
+        *correlation_id = next_correlation_id_;
+    }
+    next_correlation_id_++;
+
+    SendNext();
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaRpc::LoRaRpc::Update(void)
+{
+    uint8_t *frame;
+    size_t frame_size;
+    while ((frame_size = receive_buffer_.Receive(lora_, frame)) > 0)
+    {
+        HandleFrame(frame, frame_size);
+    }
+
+    const unsigned long now = millis();
+    for (size_t i = 0; i < kLoRaRpcAmountOfPending; i++)
+    {
+        Pending &pending = pending_[i];
+        if (!pending.in_use || !pending.sent || now - pending.sent_at < pending.timeout)
+        {
+            continue;
+        }
+
+        pending.in_use = false;
+        statistics_.timeouts++;
+        if (response_callback_ != nullptr)
+        {
+            response_callback_(pending.destination_address, pending.correlation_id, nullptr, 0);
+        }
+    }
+
+    SendNext();
+};
+
+uint8_t LoRaRpc::LoRaRpc::GetAmountPending(const uint16_t destination_address) const
+{
+    uint8_t amount = 0;
+    for (size_t i = 0; i < kLoRaRpcAmountOfPending; i++)
+    {
+        if (pending_[i].in_use && (destination_address == 65535 || pending_[i].destination_address == destination_address))
+        {
+            amount++;
+        }
+    }
+    return amount;
+};
+
+unsigned long LoRaRpc::LoRaRpc::GetTimeout(const size_t request_size, const size_t response_size) const
+{
+    // Fixed point header of 3 bytes is sent by the module as well
+    const unsigned long request_time = LoRaAirTime::GetTimeOnAir(air_rate_level_, kHeaderSize + request_size + 3) / 1000;
+    const unsigned long response_time = LoRaAirTime::GetTimeOnAir(air_rate_level_, kHeaderSize + response_size + 3) / 1000;
+    return (request_time + response_time) * 3 / 2 + kLoRaRpcProcessingTime;
+};
+
+const LoRaRpc::LoRaRpcStatistics &LoRaRpc::LoRaRpc::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+bool LoRaRpc::LoRaRpc::IsPending(const uint16_t destination_address, const uint8_t correlation_id) const
+{
+    for (size_t i = 0; i < kLoRaRpcAmountOfPending; i++)
+    {
+        if (pending_[i].in_use && pending_[i].destination_address == destination_address && pending_[i].correlation_id == correlation_id)
+        {
+            return true;
+        }
+    }
+    return false;
+};
+
+unsigned long LoRaRpc::LoRaRpc::GetBusyFor(void) const
+{
+    const long busy_for = static_cast<long>(busy_until_ - millis());
+    return (busy_for > 0) ? busy_for : 0;
+};
+
+void LoRaRpc::LoRaRpc::SendNext(void)
+{
+    // Nothing is sent while a response may still arrive, the module would miss it while transmitting
+    Pending *next = nullptr;
+    for (size_t i = 0; i < kLoRaRpcAmountOfPending; i++)
+    {
+        Pending &pending = pending_[i];
+        if (!pending.in_use)
+        {
+            continue;
+        }
+
+        if (pending.sent)
+        {
+            return;
+        }
+
+        // Oldest call first, the order wraps around
+        if (next == nullptr || static_cast<uint8_t>(next_order_ - pending.order) > static_cast<uint8_t>(next_order_ - next->order))
+        {
+            next = &pending;
+        }
+    }
+
+    if (next == nullptr)
+    {
+        return;
+    }
+
+    // The request waits in the module until the frames sent before it, like responses, are on the air
+    const unsigned long wait = GetBusyFor();
+    if (!Transmit(static_cast<uint8_t>(FrameType::kFrameTypeRequest), next->correlation_id, next->request, next->request_size, next->destination_address, next->channel))
+    {
+        // Work mode changed since the call, report it like a call without response
+        next->in_use = false;
+        if (response_callback_ != nullptr)
+        {
+            response_callback_(next->destination_address, next->correlation_id, nullptr, 0);
+        }
+        return;
+    }
+
+    next->sent = true;
+    next->sent_at = millis();
+    next->timeout = wait + GetTimeout(next->request_size, next->response_size);
+};
+
+bool LoRaRpc::LoRaRpc::Transmit(const uint8_t type, const uint8_t correlation_id, const uint8_t *payload, const size_t size, const uint16_t destination_address, const uint8_t channel)
+{
+    uint8_t frame[kHeaderSize + kLoRaRpcMaximumPayloadSize];
+    frame[0] = type;
+    frame[1] = size;
+    frame[2] = (local_address_ & 0xFF00) >> 8;
+    frame[3] = (local_address_ & 0xFF);
+    frame[4] = local_channel_;
+    frame[5] = correlation_id;
+    memcpy(frame + kHeaderSize, payload, size);
+
+    int bytes = lora_->SendMessage(reinterpret_cast<const char *>(frame), kHeaderSize + size, destination_address, channel);
+    if (bytes < 0)
+    {
+        return false;
+    }
+
+    // Fixed point header of 3 bytes is sent by the module as well
+    busy_until_ = millis() + GetBusyFor() + LoRaAirTime::GetTimeOnAir(air_rate_level_, kHeaderSize + size + 3) / 1000;
+    return true;
+};
+
+void LoRaRpc::LoRaRpc::HandleFrame(const uint8_t *frame, const size_t size)
+{
+    const uint8_t type = frame[0] & 0xF0;
+    if (type == static_cast<uint8_t>(FrameType::kFrameTypeRequest))
+    {
+        HandleRequest(frame, size);
+    }
+    else if (type == static_cast<uint8_t>(FrameType::kFrameTypeResponse))
+    {
+        HandleResponse(frame, size);
+    }
+};
+
+void LoRaRpc::LoRaRpc::HandleRequest(const uint8_t *frame, const size_t size)
+{
+    if (request_handler_ == nullptr)
+    {
+        return;
+    }
+
+    const uint16_t source = (frame[2] << 8) | frame[3];
+    uint8_t response[kLoRaRpcMaximumPayloadSize];
+    size_t response_size = request_handler_(frame + kHeaderSize, size - kHeaderSize, source, response, sizeof(response));
+    if (response_size > sizeof(response))
+    {
+        response_size = sizeof(response);
+    }
+
+    Transmit(static_cast<uint8_t>(FrameType::kFrameTypeResponse), frame[5], response, response_size, source, frame[4]);
+    statistics_.requests_handled++;
+};
+
+void LoRaRpc::LoRaRpc::HandleResponse(const uint8_t *frame, const size_t size)
+{
+    const uint16_t source = (frame[2] << 8) | frame[3];
+    const uint8_t correlation_id = frame[5];
+    for (size_t i = 0; i < kLoRaRpcAmountOfPending; i++)
+    {
+        Pending &pending = pending_[i];
+        if (!pending.in_use || !pending.sent || pending.destination_address != source || pending.correlation_id != correlation_id)
+        {
+            continue;
+        }
+
+        pending.in_use = false;
+        statistics_.responses++;
+        if (response_callback_ != nullptr)
+        {
+            response_callback_(source, correlation_id, frame + kHeaderSize, size - kHeaderSize);
+        }
+        return;
+    }
+
+    statistics_.responses_unmatched++;
+};
+
+#pragma endregion
@@ -0,0 +1,40 @@
+/**
+ * @file usr_lg206_p_schema.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Compile time schema which packs the fields of a struct in as few bits as possible
+ * @version 0.1
+ * @date 2024-03-19
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_schema.h"
+
+void LoRaSchema::WriteBits(uint8_t *buffer, size_t bit_offset, uint8_t bits, const uint32_t value)
+{
+    // Fill the rest of the current byte every step, instead of writing bit by bit
+    while (bits > 0)
+    {
+        const uint8_t free_bits = 8 - (bit_offset % 8);
+        const uint8_t length = (bits < free_bits) ? bits : free_bits;
+        const uint8_t chunk = (value >> (bits - length)) & ((1 << length) - 1);
+        buffer[bit_offset / 8] |= chunk << (free_bits - length);
+        bits -= length;
+        bit_offset += length;
+    }
+};
+
+uint32_t LoRaSchema::ReadBits(const uint8_t *buffer, size_t bit_offset, uint8_t bits)
+{
+    uint32_t value = 0;
+    while (bits > 0)
+    {
+        const uint8_t free_bits = 8 - (bit_offset % 8);
+        const uint8_t length = (bits < free_bits) ? bits : free_bits;
+        const uint8_t chunk = (buffer[bit_offset / 8] >> (free_bits - length)) & ((1 << length) - 1);
+        value = (value << length) | chunk;
+        bits -= length;
+        bit_offset += length;
+    }
+    return value;
+};
@@ -0,0 +1,277 @@
+/**
+ * @file usr_lg206_p_time_division.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Time division multiple access, a gateway beacon synchronises the nodes and every node address gets its own slot
+ * @version 0.1
+ * @date 2024-03-12
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_time_division.h"
+
+unsigned long LoRaTimeDivision::GetSlotLength(const LoRaSettings::LoRaAirRateLevel level, const size_t message_size)
+{
+    // Fixed point header of 3 bytes is sent by the module as well, round the time on air up
+    return (LoRaAirTime::GetTimeOnAir(level, message_size + 3) + 999) / 1000 + kLoRaTimeDivisionGuardTime;
+};
+
+#pragma region gateway
+
+LoRaTimeDivision::LoRaTimeDivisionGateway::LoRaTimeDivisionGateway(UsrLg206P *const lora, const uint16_t local_address, const uint8_t channel)
+{
+    this->lora_ = lora;
+    this->local_address_ = local_address;
+    this->channel_ = channel;
+    this->amount_of_slots_ = 8;
+    this->slot_length_ = 1000;
+    this->started_ = false;
+    this->superframe_start_ = 0;
+};
+
+LoRaErrorCode LoRaTimeDivision::LoRaTimeDivisionGateway::Configure(const uint8_t amount_of_slots, const uint16_t slot_length)
+{
+    if (amount_of_slots == 0 || slot_length == 0)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    this->amount_of_slots_ = amount_of_slots;
+    this->slot_length_ = slot_length;
+    this->started_ = false;
+    return LoRaErrorCode::kSucces;
+};
+
+bool LoRaTimeDivision::LoRaTimeDivisionGateway::Update(void)
+{
+    // Superframes start at multiples of the superframe length, so nodes only need the time to find their slot
+    const unsigned long now = millis();
+    const unsigned long superframe_start = now - now % GetSuperframeLength();
+    if (started_ && superframe_start == superframe_start_)
+    {
+        return false;
+    }
+
+    started_ = true;
+    superframe_start_ = superframe_start;
+    if (now - superframe_start >= slot_length_)
+    {
+        // Too late for this superframe, a beacon now would fall in the slot of a node
+        return false;
+    }
+
+    uint8_t beacon[kBeaconSize];
+    beacon[0] = kFrameTypeBeacon;
+    beacon[1] = kBeaconSize - 2;
+    beacon[2] = (local_address_ & 0xFF00) >> 8;
+    beacon[3] = (local_address_ & 0xFF);
+    beacon[4] = (now >> 24) & 0xFF;
+    beacon[5] = (now >> 16) & 0xFF;
+    beacon[6] = (now >> 8) & 0xFF;
+    beacon[7] = now & 0xFF;
+    beacon[8] = amount_of_slots_;
+    beacon[9] = (slot_length_ & 0xFF00) >> 8;
+    beacon[10] = (slot_length_ & 0xFF);
+
+    return lora_->SendMessage(reinterpret_cast<const char *>(beacon), kBeaconSize, 65535, channel_) >= 0;
+};
+
+unsigned long LoRaTimeDivision::LoRaTimeDivisionGateway::GetSuperframeLength(void) const
+{
+    return static_cast<unsigned long>(amount_of_slots_ + 1) * slot_length_;
+};
+
+unsigned long LoRaTimeDivision::LoRaTimeDivisionNode::GetTimeOnAir(const size_t size) const
+{
+    // Fixed point header of 3 bytes is sent by the module as well, round up
+    return (LoRaAirTime::GetTimeOnAir(air_rate_level_, size + 3) + 999) / 1000;
+};
+
+#pragma endregion
+
+#pragma region node
+
+LoRaTimeDivision::LoRaTimeDivisionNode::LoRaTimeDivisionNode(UsrLg206P *const lora, const uint16_t local_address)
+{
+    this->lora_ = lora;
+    this->local_address_ = local_address;
+    // Slowest level, so a message never runs past the end of the slot when the level is not set
+    this->air_rate_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268;
+    this->synchronised_ = false;
+    this->offset_ = 0;
+    this->last_beacon_received_at_ = 0;
+    this->amount_of_slots_ = 0;
+    this->slot_length_ = 0;
+    this->pending_ = false;
+    this->last_superframe_ = 0;
+    this->destination_address_ = 0;
+    this->channel_ = 0;
+    this->size_ = 0;
+};
+
+void LoRaTimeDivision::LoRaTimeDivisionNode::SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level)
+{
+    this->air_rate_level_ = level;
+};
+
+LoRaErrorCode LoRaTimeDivision::LoRaTimeDivisionNode::Send(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel)
+{
+    if (size == 0)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    if (size > kLoRaTimeDivisionMaximumMessageSize || (synchronised_ && GetTimeOnAir(size) > slot_length_))
+    {
+        return LoRaErrorCode::kMessageTooLarge;
+    }
+
+    if (pending_)
+    {
+        return LoRaErrorCode::kQueueFull;
+    }
+
+    memcpy(message_, message, size);
+    size_ = size;
+    destination_address_ = destination_address;
+    channel_ = channel;
+    pending_ = true;
+    return LoRaErrorCode::kSucces;
+};
+
+size_t LoRaTimeDivision::LoRaTimeDivisionNode::Receive(uint8_t *buffer, const size_t buffer_size)
+{
+    if (lora_->Available() <= 0)
+    {
+        return 0;
+    }
+
+    const size_t size = lora_->ReceiveMessage(receive_buffer_, sizeof(receive_buffer_));
+    if (size == 0 || HandleFrame(receive_buffer_, size))
+    {
+        return 0;
+    }
+
+    const size_t copy_size = (size < buffer_size) ? size : buffer_size;
+    memcpy(buffer, receive_buffer_, copy_size);
+    return copy_size;
+};
+
+bool LoRaTimeDivision::LoRaTimeDivisionNode::HandleFrame(const uint8_t *frame, const size_t size)
+{
+    if (size < kBeaconSize || frame[0] != kFrameTypeBeacon || frame[1] != kBeaconSize - 2)
+    {
+        return false;
+    }
+
+    const unsigned long time = (static_cast<unsigned long>(frame[4]) << 24) | (static_cast<unsigned long>(frame[5]) << 16) |
+                               (static_cast<unsigned long>(frame[6]) << 8) | frame[7];
+    const uint8_t amount_of_slots = frame[8];
+    const uint16_t slot_length = (frame[9] << 8) | frame[10];
+    if (amount_of_slots == 0 || slot_length == 0)
+    {
+        return true;
+    }
+
+    // Beacon was sent its time on air ago, plus the time the driver waited before reading it
+    const unsigned long correction = LoRaAirTime::GetTimeOnAir(air_rate_level_, kBeaconSize + 3) / 1000 + kReceiveDelay;
+    const unsigned long now = millis();
+    offset_ = time + correction - now;
+    last_beacon_received_at_ = now;
+    amount_of_slots_ = amount_of_slots;
+    slot_length_ = slot_length;
+    synchronised_ = true;
+    return true;
+};
+
+bool LoRaTimeDivision::LoRaTimeDivisionNode::Update(void)
+{
+    if (!pending_ || !IsSynchronised())
+    {
+        return false;
+    }
+
+    if (GetTimeOnAir(size_) > slot_length_)
+    {
+        // Queued before the slot length was known, it would wait for a slot forever
+        pending_ = false;
+        return false;
+    }
+
+    if (GetTimeUntilSlot() > 0)
+    {
+        return false;
+    }
+
+    // A slot fits one message, the next one waits for the next superframe
+    const unsigned long network_time = GetNetworkTime();
+    const unsigned long superframe = network_time / GetSuperframeLength() + 1;
+    if (superframe == last_superframe_)
+    {
+        return false;
+    }
+
+    // Only start when the message ends before the slot does
+    const unsigned long slot_start = static_cast<unsigned long>(GetSlot()) * slot_length_;
+    const unsigned long position = network_time % GetSuperframeLength() - slot_start;
+    if (position + GetTimeOnAir(size_) > slot_length_)
+    {
+        return false;
+    }
+
+    pending_ = false;
+    last_superframe_ = superframe;
+    return lora_->SendMessage(reinterpret_cast<const char *>(message_), size_, destination_address_, channel_) >= 0;
+};
+
+bool LoRaTimeDivision::LoRaTimeDivisionNode::IsSynchronised(void) const
+{
+    return synchronised_ && millis() - last_beacon_received_at_ < kLoRaTimeDivisionMissedBeacons * GetSuperframeLength();
+};
+
+unsigned long LoRaTimeDivision::LoRaTimeDivisionNode::GetNetworkTime(void) const
+{
+    return millis() + offset_;
+};
+
+uint8_t LoRaTimeDivision::LoRaTimeDivisionNode::GetSlot(void) const
+{
+    if (!synchronised_)
+    {
+        return 0;
+    }
+    return 1 + local_address_ % amount_of_slots_;
+};
+
+unsigned long LoRaTimeDivision::LoRaTimeDivisionNode::GetTimeUntilSlot(void) const
+{
+    if (!synchronised_)
+    {
+        return 0;
+    }
+
+    const unsigned long superframe_length = GetSuperframeLength();
+    const unsigned long position = GetNetworkTime() % superframe_length;
+    const unsigned long slot_start = static_cast<unsigned long>(GetSlot()) * slot_length_;
+    if (position < slot_start)
+    {
+        return slot_start - position;
+    }
+    if (position < slot_start + slot_length_)
+    {
+        return 0;
+    }
+    return superframe_length - position + slot_start;
+};
+
+bool LoRaTimeDivision::LoRaTimeDivisionNode::HasPendingMessage(void) const
+{
+    return pending_;
+};
+
+unsigned long LoRaTimeDivision::LoRaTimeDivisionNode::GetSuperframeLength(void) const
+{
+    return static_cast<unsigned long>(amount_of_slots_ + 1) * slot_length_;
+};
+
+#pragma endregion
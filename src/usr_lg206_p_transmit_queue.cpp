@@ -0,0 +1,261 @@
+/**
+ * @file usr_lg206_p_transmit_queue.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Bounded transmit queue with priority classes, drained within the air time budget of the module
+ * @version 0.1
+ * @date 2024-03-10
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_transmit_queue.h"
+
+LoRaTransmitQueue::LoRaTransmitQueue::LoRaTransmitQueue(UsrLg206P *const lora)
+{
+    this->lora_ = lora;
+    // Slowest level, so the module is never assumed free too early when the level is not set
+    this->air_rate_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268;
+    this->duty_cycle_ = 1000;
+    this->next_order_ = 0;
+    this->sent_at_ = 0;
+    this->blocked_for_ = 0;
+
+    for (size_t i = 0; i < kAmountOfPriorities; i++)
+    {
+        depths_[i] = kLoRaTransmitQueueSize;
+        policies_[i] = DropPolicy::kDropPolicyRejectNew;
+    }
+    memset(statistics_, 0, sizeof(statistics_));
+    Clear();
+};
+
+void LoRaTransmitQueue::LoRaTransmitQueue::SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level)
+{
+    this->air_rate_level_ = level;
+};
+
+LoRaErrorCode LoRaTransmitQueue::LoRaTransmitQueue::SetDutyCycle(const uint16_t per_mille)
+{
+    if (per_mille == 0 || per_mille > 1000)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    this->duty_cycle_ = per_mille;
+    return LoRaErrorCode::kSucces;
+};
+
+LoRaErrorCode LoRaTransmitQueue::LoRaTransmitQueue::SetClassLimit(const Priority priority, const uint8_t depth, const DropPolicy policy)
+{
+    const size_t index = static_cast<size_t>(priority);
+    if (index >= kAmountOfPriorities || depth == 0 || depth > kLoRaTransmitQueueSize)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    depths_[index] = depth;
+    policies_[index] = policy;
+    return LoRaErrorCode::kSucces;
+};
+
+LoRaErrorCode LoRaTransmitQueue::LoRaTransmitQueue::Enqueue(const uint8_t *message, const size_t size, const Priority priority)
+{
+    return Add(message, size, false, 0, 0, priority);
+};
+
+LoRaErrorCode LoRaTransmitQueue::LoRaTransmitQueue::Enqueue(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel, const Priority priority)
+{
+    return Add(message, size, true, destination_address, channel, priority);
+};
+
+bool LoRaTransmitQueue::LoRaTransmitQueue::Update(void)
+{
+    if (GetTimeUntilFree() > 0)
+    {
+        return false;
+    }
+
+    Entry *entry = nullptr;
+    for (size_t i = 0; i < kAmountOfPriorities && entry == nullptr; i++)
+    {
+        entry = GetOldest(static_cast<Priority>(i));
+    }
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    int bytes;
+    if (entry->fixed_point)
+    {
+        bytes = lora_->SendMessage(reinterpret_cast<const char *>(entry->data), entry->size, entry->destination_address, entry->channel);
+    }
+    else
+    {
+        bytes = lora_->SendMessage(reinterpret_cast<const char *>(entry->data), entry->size);
+    }
+
+    LoRaTransmitQueueStatistics &statistics = statistics_[static_cast<size_t>(entry->priority)];
+    entry->in_use = false;
+    if (bytes < 0)
+    {
+        // Message can not be sent in the current work mode, keeping it would block the queue
+        statistics.dropped++;
+        return false;
+    }
+
+    const unsigned long now = millis();
+    if (now - entry->enqueued_at > statistics.maximum_latency)
+    {
+        statistics.maximum_latency = now - entry->enqueued_at;
+    }
+    statistics.sent++;
+
+    // Module is busy while the message is on air, the duty cycle stretches that to the silence needed afterwards
+    const unsigned long time_on_air = LoRaAirTime::GetTimeOnAir(air_rate_level_, entry->size + (entry->fixed_point ? 3 : 0)) / 1000;
+    sent_at_ = now;
+    blocked_for_ = time_on_air * 1000 / duty_cycle_;
+    return true;
+};
+
+uint8_t LoRaTransmitQueue::LoRaTransmitQueue::GetAmountQueued(const Priority priority) const
+{
+    uint8_t amount = 0;
+    for (size_t i = 0; i < kLoRaTransmitQueueSize; i++)
+    {
+        if (entries_[i].in_use && entries_[i].priority == priority)
+        {
+            amount++;
+        }
+    }
+    return amount;
+};
+
+uint8_t LoRaTransmitQueue::LoRaTransmitQueue::GetAmountQueued(void) const
+{
+    uint8_t amount = 0;
+    for (size_t i = 0; i < kLoRaTransmitQueueSize; i++)
+    {
+        if (entries_[i].in_use)
+        {
+            amount++;
+        }
+    }
+    return amount;
+};
+
+unsigned long LoRaTransmitQueue::LoRaTransmitQueue::GetTimeUntilFree(void) const
+{
+    const unsigned long elapsed = millis() - sent_at_;
+    return elapsed >= blocked_for_ ? 0 : blocked_for_ - elapsed;
+};
+
+void LoRaTransmitQueue::LoRaTransmitQueue::Clear(void)
+{
+    for (size_t i = 0; i < kLoRaTransmitQueueSize; i++)
+    {
+        entries_[i].in_use = false;
+    }
+};
+
+const LoRaTransmitQueue::LoRaTransmitQueueStatistics &LoRaTransmitQueue::LoRaTransmitQueue::GetStatistics(const Priority priority) const
+{
+    return statistics_[static_cast<size_t>(priority)];
+};
+
+#pragma region private functions
+
+LoRaErrorCode LoRaTransmitQueue::LoRaTransmitQueue::Add(const uint8_t *message, const size_t size, const bool fixed_point, const uint16_t destination_address, const uint8_t channel, const Priority priority)
+{
+    const size_t index = static_cast<size_t>(priority);
+    if (size == 0 || index >= kAmountOfPriorities)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    if (size > kLoRaTransmitQueueMaximumMessageSize)
+    {
+        return LoRaErrorCode::kMessageTooLarge;
+    }
+
+    Entry *entry = nullptr;
+    if (GetAmountQueued(priority) >= depths_[index])
+    {
+        if (policies_[index] == DropPolicy::kDropPolicyRejectNew)
+        {
+            statistics_[index].dropped++;
+            return LoRaErrorCode::kQueueFull;
+        }
+        entry = GetOldest(priority);
+        statistics_[index].dropped++;
+    }
+
+    for (size_t i = 0; i < kLoRaTransmitQueueSize && entry == nullptr; i++)
+    {
+        if (!entries_[i].in_use)
+        {
+            entry = &entries_[i];
+        }
+    }
+
+    // Queue is full, a more urgent message pushes out the newest message of the least urgent class
+    for (size_t i = kAmountOfPriorities - 1; i > index && entry == nullptr; i--)
+    {
+        for (size_t j = 0; j < kLoRaTransmitQueueSize; j++)
+        {
+            Entry &candidate = entries_[j];
+            if (candidate.in_use && candidate.priority == static_cast<Priority>(i) && (entry == nullptr || candidate.order > entry->order))
+            {
+                entry = &candidate;
+            }
+        }
+
+        if (entry != nullptr)
+        {
+            statistics_[i].dropped++;
+        }
+    }
+
+    if (entry == nullptr && policies_[index] == DropPolicy::kDropPolicyDropOldest)
+    {
+        entry = GetOldest(priority);
+        if (entry != nullptr)
+        {
+            statistics_[index].dropped++;
+        }
+    }
+
+    if (entry == nullptr)
+    {
+        statistics_[index].dropped++;
+        return LoRaErrorCode::kQueueFull;
+    }
+
+    entry->in_use = true;
+    entry->priority = priority;
+    entry->fixed_point = fixed_point;
+    entry->destination_address = destination_address;
+    entry->channel = channel;
+    entry->order = next_order_++;
+    entry->enqueued_at = millis();
+    entry->size = size;
+    memcpy(entry->data, message, size);
+    statistics_[index].enqueued++;
+    return LoRaErrorCode::kSucces;
+};
+
+LoRaTransmitQueue::LoRaTransmitQueue::Entry *LoRaTransmitQueue::LoRaTransmitQueue::GetOldest(const Priority priority)
+{
+    Entry *oldest = nullptr;
+    for (size_t i = 0; i < kLoRaTransmitQueueSize; i++)
+    {
+        Entry &entry = entries_[i];
+        if (entry.in_use && entry.priority == priority && (oldest == nullptr || entry.order < oldest->order))
+        {
+            oldest = &entry;
+        }
+    }
+    return oldest;
+};
+
+#pragma endregion
@@ -0,0 +1,309 @@
+/**
+ * @file usr_lg206_p_wake_up.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Batches messages for modules in wake up mode, so they are woken once for a burst of frames
+ * @version 0.1
+ * @date 2024-03-26
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_wake_up.h"
+
+LoRaWakeUp::LoRaWakeUpSender::LoRaWakeUpSender(UsrLg206P *const lora)
+{
+    this->lora_ = lora;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+    memset(this->peers_, 0, sizeof(this->peers_));
+};
+
+LoRaErrorCode LoRaWakeUp::LoRaWakeUpSender::AddPeer(const uint16_t destination_address, const uint8_t channel, const unsigned long maximum_latency)
+{
+    Peer *peer = FindPeer(destination_address, channel);
+    if (peer != nullptr)
+    {
+        peer->maximum_latency = maximum_latency;
+        return LoRaErrorCode::kSucces;
+    }
+
+    for (size_t i = 0; i < kLoRaWakeUpAmountOfPeers; i++)
+    {
+        if (!peers_[i].in_use)
+        {
+            peers_[i].in_use = true;
+            peers_[i].destination_address = destination_address;
+            peers_[i].channel = channel;
+            peers_[i].maximum_latency = maximum_latency;
+            peers_[i].amount = 0;
+            peers_[i].size = 0;
+            return LoRaErrorCode::kSucces;
+        }
+    }
+    return LoRaErrorCode::kQueueFull;
+};
+
+LoRaErrorCode LoRaWakeUp::LoRaWakeUpSender::RemovePeer(const uint16_t destination_address, const uint8_t channel)
+{
+    Peer *peer = FindPeer(destination_address, channel);
+    if (peer == nullptr)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    const LoRaErrorCode result = SendBurst(*peer);
+    peer->in_use = false;
+    return result;
+};
+
+LoRaErrorCode LoRaWakeUp::LoRaWakeUpSender::Send(const uint8_t *message, const size_t size, const uint16_t destination_address, const uint8_t channel)
+{
+    if (size == 0)
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    if (size > kMaximumMessageSize)
+    {
+        return LoRaErrorCode::kMessageTooLarge;
+    }
+
+    Peer *peer = FindPeer(destination_address, channel);
+    if (peer == nullptr)
+    {
+        if (lora_->SendMessage(reinterpret_cast<const char *>(message), size, destination_address, channel) < 0)
+        {
+            return LoRaErrorCode::kWrongWorkMode;
+        }
+        statistics_.messages_sent_directly++;
+        return LoRaErrorCode::kSucces;
+    }
+
+    LoRaErrorCode result = LoRaErrorCode::kSucces;
+    if (peer->size + kRecordHeaderSize + size > kLoRaWakeUpQueueSize)
+    {
+        result = SendBurst(*peer);
+    }
+
+    if (peer->amount == 0)
+    {
+        peer->oldest_at = millis();
+    }
+    peer->queue[peer->size] = size;
+    memcpy(peer->queue + peer->size + kRecordHeaderSize, message, size);
+    peer->size += kRecordHeaderSize + size;
+    peer->amount++;
+    statistics_.messages_queued++;
+    return result;
+};
+
+LoRaErrorCode LoRaWakeUp::LoRaWakeUpSender::Flush(void)
+{
+    LoRaErrorCode result = LoRaErrorCode::kSucces;
+    for (size_t i = 0; i < kLoRaWakeUpAmountOfPeers; i++)
+    {
+        if (peers_[i].in_use && peers_[i].amount > 0 && SendBurst(peers_[i]) != LoRaErrorCode::kSucces)
+        {
+            result = LoRaErrorCode::kWrongWorkMode;
+        }
+    }
+    return result;
+};
+
+LoRaErrorCode LoRaWakeUp::LoRaWakeUpSender::Update(void)
+{
+    const unsigned long now = millis();
+    LoRaErrorCode result = LoRaErrorCode::kSucces;
+    for (size_t i = 0; i < kLoRaWakeUpAmountOfPeers; i++)
+    {
+        Peer &peer = peers_[i];
+        if (peer.in_use && peer.amount > 0 && now - peer.oldest_at >= peer.maximum_latency && SendBurst(peer) != LoRaErrorCode::kSucces)
+        {
+            result = LoRaErrorCode::kWrongWorkMode;
+        }
+    }
+    return result;
+};
+
+size_t LoRaWakeUp::LoRaWakeUpSender::GetAmountQueued(const uint16_t destination_address) const
+{
+    size_t amount = 0;
+    for (size_t i = 0; i < kLoRaWakeUpAmountOfPeers; i++)
+    {
+        if (peers_[i].in_use && (destination_address == 65535 || peers_[i].destination_address == destination_address))
+        {
+            amount += peers_[i].amount;
+        }
+    }
+    return amount;
+};
+
+const LoRaWakeUp::LoRaWakeUpSenderStatistics &LoRaWakeUp::LoRaWakeUpSender::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+LoRaWakeUp::LoRaWakeUpReceiver::LoRaWakeUpReceiver(UsrLg206P *const lora)
+{
+    this->lora_ = lora;
+    this->air_rate_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+};
+
+void LoRaWakeUp::LoRaWakeUpReceiver::SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level)
+{
+    this->air_rate_level_ = level;
+};
+
+size_t LoRaWakeUp::LoRaWakeUpReceiver::Drain(MessageCallback callback)
+{
+    const unsigned long timeout = GetDrainTimeout();
+    size_t amount = 0;
+    bool last_frame = false;
+    unsigned long received_at = millis();
+    while (!last_frame && millis() - received_at < timeout)
+    {
+        if (receive_buffer_.Read(lora_) == 0)
+        {
+            delay(kLoRaWakeUpPollInterval);
+            continue;
+        }
+        received_at = millis();
+
+        // Handle every complete frame, a frame can be split over two reads
+        uint8_t *frame;
+        size_t frame_size;
+        while ((frame_size = receive_buffer_.Next(frame)) > 0)
+        {
+            amount += HandleFrame(frame, frame_size, callback);
+            last_frame = frame[0] == 0;
+        }
+    }
+
+    if (!last_frame)
+    {
+        statistics_.incomplete_drains++;
+    }
+
+    // What is left belongs to a burst which did not arrive completely
+    receive_buffer_.Clear();
+    statistics_.drains++;
+    return amount;
+};
+
+size_t LoRaWakeUp::GetFrameSize(const uint8_t *frame)
+{
+    const size_t frame_size = kHeaderSize + frame[1];
+    return (frame_size > kLoRaWakeUpFrameSize) ? 0 : frame_size;
+};
+
+unsigned long LoRaWakeUp::LoRaWakeUpReceiver::GetDrainTimeout(void) const
+{
+    // Fixed point header of 3 bytes is sent by the module as well
+    const unsigned long frame_time = LoRaAirTime::GetTimeOnAir(air_rate_level_, kLoRaWakeUpFrameSize + 3) / 1000;
+    return frame_time * 3 / 2 + kLoRaWakeUpProcessingTime;
+};
+
+const LoRaWakeUp::LoRaWakeUpReceiverStatistics &LoRaWakeUp::LoRaWakeUpReceiver::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+LoRaWakeUp::LoRaWakeUpSender::Peer *LoRaWakeUp::LoRaWakeUpSender::FindPeer(const uint16_t destination_address, const uint8_t channel)
+{
+    for (size_t i = 0; i < kLoRaWakeUpAmountOfPeers; i++)
+    {
+        if (peers_[i].in_use && peers_[i].destination_address == destination_address && peers_[i].channel == channel)
+        {
+            return &peers_[i];
+        }
+    }
+    return nullptr;
+};
+
+LoRaErrorCode LoRaWakeUp::LoRaWakeUpSender::SendBurst(Peer &peer)
+{
+    if (peer.amount == 0)
+    {
+        return LoRaErrorCode::kSucces;
+    }
+
+    // Count the frames first, every frame tells how many follow so the receiver knows when it can sleep
+    size_t amount_of_frames = 0;
+    size_t frame_size = kLoRaWakeUpFrameSize;
+    for (size_t offset = 0; offset < peer.size; offset += kRecordHeaderSize + peer.queue[offset])
+    {
+        const size_t record_size = kRecordHeaderSize + peer.queue[offset];
+        if (frame_size + record_size > kLoRaWakeUpFrameSize)
+        {
+            amount_of_frames++;
+            frame_size = kHeaderSize;
+        }
+        frame_size += record_size;
+    }
+
+    uint8_t frame[kLoRaWakeUpFrameSize];
+    size_t offset = 0;
+    bool sent = true;
+    for (size_t i = 0; i < amount_of_frames; i++)
+    {
+        size_t size = kHeaderSize;
+        while (offset < peer.size && size + kRecordHeaderSize + peer.queue[offset] <= kLoRaWakeUpFrameSize)
+        {
+            const size_t record_size = kRecordHeaderSize + peer.queue[offset];
+            memcpy(frame + size, peer.queue + offset, record_size);
+            size += record_size;
+            offset += record_size;
+        }
+        frame[0] = amount_of_frames - 1 - i;
+        frame[1] = size - kHeaderSize;
+
+        // Every frame pays the preamble, they are sent back to back so the destination drains them while it is awake
+        if (lora_->SendMessage(reinterpret_cast<const char *>(frame), size, peer.destination_address, peer.channel) < 0)
+        {
+            sent = false;
+            break;
+        }
+        statistics_.frames_sent++;
+    }
+
+    // The messages are dropped when they could not be sent, the caller is told by the result
+    peer.amount = 0;
+    peer.size = 0;
+
+    if (!sent)
+    {
+        return LoRaErrorCode::kWrongWorkMode;
+    }
+
+    statistics_.bursts++;
+    return LoRaErrorCode::kSucces;
+};
+
+size_t LoRaWakeUp::LoRaWakeUpReceiver::HandleFrame(const uint8_t *frame, const size_t size, MessageCallback callback)
+{
+    statistics_.frames_received++;
+    size_t amount = 0;
+    size_t offset = kHeaderSize;
+    while (offset + kRecordHeaderSize <= size)
+    {
+        const size_t record_size = frame[offset];
+        if (record_size == 0 || offset + kRecordHeaderSize + record_size > size)
+        {
+            // Corrupt frame, the rest of it is dropped
+            break;
+        }
+
+        if (callback != nullptr)
+        {
+            callback(frame + offset + kRecordHeaderSize, record_size);
+        }
+        offset += kRecordHeaderSize + record_size;
+        amount++;
+    }
+    statistics_.messages_received += amount;
+    return amount;
+};
+
+#pragma endregion
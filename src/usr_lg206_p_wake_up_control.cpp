@@ -0,0 +1,370 @@
+/**
+ * @file usr_lg206_p_wake_up_control.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Adapts the wake up interval of a module in wake up mode to the traffic it receives
+ * @version 0.1
+ * @date 2024-03-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "usr_lg206_p_wake_up_control.h"
+
+/**
+ * @brief Get the integer square root, rounded down
+ *
+ */
+static uint32_t SquareRoot(uint32_t value)
+{
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > value)
+    {
+        bit >>= 2;
+    }
+
+    while (bit != 0)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+};
+
+int LoRaWakeUpControl::CalculateInterval(const unsigned long inter_arrival_time, const unsigned long latency_target)
+{
+    // Beyond this time between messages the best interval is longer than the module allows, which also prevents overflow
+    const unsigned long longest_time = static_cast<unsigned long>(kMaximumInterval) * kMaximumInterval / (2UL * kLoRaWakeUpControlListenTime);
+    unsigned long interval = kMaximumInterval;
+    if (inter_arrival_time < longest_time)
+    {
+        interval = SquareRoot(2UL * kLoRaWakeUpControlListenTime * inter_arrival_time);
+    }
+
+    interval = (interval + kIntervalStep / 2) / kIntervalStep * kIntervalStep;
+
+    // A message waits up to a whole interval for the module to wake up
+    if (interval > latency_target)
+    {
+        interval = latency_target;
+    }
+
+    if (interval < static_cast<unsigned long>(kMinimumInterval))
+    {
+        return kMinimumInterval;
+    }
+    if (interval > static_cast<unsigned long>(kMaximumInterval))
+    {
+        return kMaximumInterval;
+    }
+    return interval;
+};
+
+LoRaWakeUpControl::LoRaWakeUpControl::LoRaWakeUpControl(UsrLg206P *const lora, const uint16_t local_address, const uint16_t peer_address, const uint8_t channel, const Role role, const unsigned long latency_target)
+{
+    this->lora_ = lora;
+    this->local_address_ = local_address;
+    this->peer_address_ = peer_address;
+    this->channel_ = channel;
+    this->role_ = role;
+    // Slowest level, so the timeout is never too short when the level is not set
+    this->air_rate_level_ = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268;
+    this->latency_target_ = (latency_target < static_cast<unsigned long>(kMinimumInterval)) ? kMinimumInterval : latency_target;
+    this->interval_ = kDefaultInterval;
+    this->requested_interval_ = 0;
+    this->requests_ = 0;
+    this->requested_at_ = 0;
+    this->changed_ = false;
+    this->last_change_ = 0;
+    this->last_arrival_ = millis();
+    this->mean_inter_arrival_time_ = 0;
+    memset(&this->statistics_, 0, sizeof(this->statistics_));
+};
+
+LoRaErrorCode LoRaWakeUpControl::LoRaWakeUpControl::Begin(void)
+{
+    LoRaErrorCode error_code = lora_->BeginAtMode();
+    if (error_code != LoRaErrorCode::kSucces)
+    {
+        return error_code;
+    }
+
+    int interval = kDefaultInterval;
+    error_code = lora_->GetWakingUpInterval(interval);
+    const LoRaErrorCode end_error_code = lora_->EndAtMode();
+    if (error_code == LoRaErrorCode::kSucces)
+    {
+        error_code = end_error_code;
+    }
+
+    if (error_code == LoRaErrorCode::kSucces && kMinimumInterval <= interval && interval <= kMaximumInterval)
+    {
+        interval_ = interval;
+    }
+    return error_code;
+};
+
+void LoRaWakeUpControl::LoRaWakeUpControl::SetAirRateLevel(const LoRaSettings::LoRaAirRateLevel level)
+{
+    this->air_rate_level_ = level;
+};
+
+LoRaErrorCode LoRaWakeUpControl::LoRaWakeUpControl::SetLatencyTarget(const unsigned long latency_target)
+{
+    if (latency_target < static_cast<unsigned long>(kMinimumInterval))
+    {
+        return LoRaErrorCode::kInvalidParameter;
+    }
+
+    this->latency_target_ = latency_target;
+    return LoRaErrorCode::kSucces;
+};
+
+void LoRaWakeUpControl::LoRaWakeUpControl::ReportArrival(void)
+{
+    const unsigned long now = millis();
+    const unsigned long inter_arrival_time = now - last_arrival_;
+    last_arrival_ = now;
+
+    // The time before the first arrival is not a time between messages
+    if (statistics_.arrivals++ == 0)
+    {
+        return;
+    }
+
+    if (mean_inter_arrival_time_ == 0)
+    {
+        mean_inter_arrival_time_ = inter_arrival_time;
+    }
+    else if (inter_arrival_time > mean_inter_arrival_time_)
+    {
+        mean_inter_arrival_time_ += (inter_arrival_time - mean_inter_arrival_time_) >> kLoRaWakeUpControlSmoothing;
+    }
+    else
+    {
+        mean_inter_arrival_time_ -= (mean_inter_arrival_time_ - inter_arrival_time) >> kLoRaWakeUpControlSmoothing;
+    }
+};
+
+void LoRaWakeUpControl::LoRaWakeUpControl::Update(void)
+{
+    // The sender follows the node, it never starts a change itself
+    if (role_ == Role::kRoleSender)
+    {
+        return;
+    }
+
+    const unsigned long now = millis();
+    if (requested_interval_ != 0)
+    {
+        if (now - requested_at_ < GetRequestTimeout())
+        {
+            return;
+        }
+
+        if (requests_ >= kLoRaWakeUpControlMaximumRequests)
+        {
+            // A longer interval was not set here yet and a shorter one is safe, so this side stays as it is
+            requested_interval_ = 0;
+            statistics_.failed_requests++;
+            return;
+        }
+
+        SendFrame(FrameType::kFrameTypeRequest, requested_interval_);
+        requests_++;
+        requested_at_ = now;
+        return;
+    }
+
+    if (changed_ && now - last_change_ < kLoRaWakeUpControlMinimumInterval)
+    {
+        return;
+    }
+
+    // A silence longer than the mean shows traffic slowed down before the next arrival can tell
+    unsigned long inter_arrival_time = mean_inter_arrival_time_;
+    const unsigned long silence = now - last_arrival_;
+    if (silence > inter_arrival_time)
+    {
+        inter_arrival_time = silence;
+    }
+
+    // Nothing is known about the traffic yet
+    if (mean_inter_arrival_time_ == 0 && silence < kLoRaWakeUpControlMinimumInterval)
+    {
+        return;
+    }
+
+    const int interval = CalculateInterval(inter_arrival_time, latency_target_);
+    const int difference = (interval > interval_) ? interval - interval_ : interval_ - interval;
+    // The latency target is always met, even by a small change
+    const bool too_slow = static_cast<unsigned long>(interval_) > latency_target_;
+    if (difference * 100L < static_cast<long>(interval_) * kLoRaWakeUpControlHysteresis && !(too_slow && difference > 0))
+    {
+        return;
+    }
+
+    // A module waking up more often still hears the longer preamble of the sender, so it goes first
+    const bool applied = interval > interval_ || Apply(interval) == LoRaErrorCode::kSucces;
+
+    // Both the change and a failed attempt count for the minimum interval, so the AT mode is not entered over and over
+    changed_ = true;
+    last_change_ = millis();
+    if (!applied)
+    {
+        return;
+    }
+
+    requested_interval_ = interval;
+    requests_ = 1;
+    requested_at_ = millis();
+    SendFrame(FrameType::kFrameTypeRequest, interval);
+};
+
+size_t LoRaWakeUpControl::LoRaWakeUpControl::Receive(uint8_t *buffer, const size_t buffer_size)
+{
+    if (lora_->Available() <= 0)
+    {
+        return 0;
+    }
+
+    const size_t size = lora_->ReceiveMessage(buffer, buffer_size);
+    if (size == 0 || HandleFrame(buffer, size))
+    {
+        return 0;
+    }
+    return size;
+};
+
+bool LoRaWakeUpControl::LoRaWakeUpControl::HandleFrame(const uint8_t *frame, const size_t size)
+{
+    if (size < kFrameSize || frame[1] != kFrameSize - 2)
+    {
+        return false;
+    }
+
+    const FrameType type = static_cast<FrameType>(frame[0]);
+    if (type != FrameType::kFrameTypeRequest && type != FrameType::kFrameTypeAcknowledgement)
+    {
+        return false;
+    }
+
+    const uint16_t source_address = (frame[2] << 8) | frame[3];
+    const int interval = (frame[4] << 8) | frame[5];
+    if (source_address != peer_address_ || interval < kMinimumInterval || interval > kMaximumInterval)
+    {
+        return true;
+    }
+
+    if (type == FrameType::kFrameTypeRequest)
+    {
+        // A node sleeping longer than the preamble of its sender misses messages, only the node decides to do that
+        if (role_ == Role::kRoleNode && interval > interval_)
+        {
+            statistics_.rejected_requests++;
+            return true;
+        }
+
+        // The preamble has the requested length before the peer is told it can sleep that long
+        if (Apply(interval) == LoRaErrorCode::kSucces)
+        {
+            SendFrame(FrameType::kFrameTypeAcknowledgement, interval);
+        }
+        return true;
+    }
+
+    if (role_ == Role::kRoleSender || interval != requested_interval_)
+    {
+        return true;
+    }
+
+    requested_interval_ = 0;
+    if (interval > interval_)
+    {
+        Apply(interval);
+    }
+    return true;
+};
+
+int LoRaWakeUpControl::LoRaWakeUpControl::GetInterval(void) const
+{
+    return interval_;
+};
+
+bool LoRaWakeUpControl::LoRaWakeUpControl::HasPendingChange(void) const
+{
+    return requested_interval_ != 0;
+};
+
+unsigned long LoRaWakeUpControl::LoRaWakeUpControl::GetMeanInterArrivalTime(void) const
+{
+    return mean_inter_arrival_time_;
+};
+
+const LoRaWakeUpControl::LoRaWakeUpControlStatistics &LoRaWakeUpControl::LoRaWakeUpControl::GetStatistics(void) const
+{
+    return statistics_;
+};
+
+#pragma region private functions
+
+LoRaErrorCode LoRaWakeUpControl::LoRaWakeUpControl::Apply(const int interval)
+{
+    LoRaErrorCode error_code = lora_->BeginAtMode();
+    if (error_code == LoRaErrorCode::kSucces)
+    {
+        error_code = lora_->SetWakingUpInterval(interval);
+        const LoRaErrorCode end_error_code = lora_->EndAtMode();
+        if (error_code == LoRaErrorCode::kSucces)
+        {
+            error_code = end_error_code;
+        }
+    }
+
+    if (error_code != LoRaErrorCode::kSucces)
+    {
+        statistics_.errors++;
+        return error_code;
+    }
+
+    if (interval > interval_)
+    {
+        statistics_.increases++;
+    }
+    else if (interval < interval_)
+    {
+        statistics_.decreases++;
+    }
+    interval_ = interval;
+    return error_code;
+};
+
+bool LoRaWakeUpControl::LoRaWakeUpControl::SendFrame(const FrameType type, const int interval)
+{
+    uint8_t frame[kFrameSize];
+    frame[0] = static_cast<uint8_t>(type);
+    frame[1] = kFrameSize - 2;
+    frame[2] = (local_address_ & 0xFF00) >> 8;
+    frame[3] = (local_address_ & 0xFF);
+    frame[4] = (interval & 0xFF00) >> 8;
+    frame[5] = (interval & 0xFF);
+    return lora_->SendMessage(reinterpret_cast<const char *>(frame), kFrameSize, peer_address_, channel_) >= 0;
+};
+
+unsigned long LoRaWakeUpControl::LoRaWakeUpControl::GetRequestTimeout(void) const
+{
+    // Request and acknowledgement on air with a margin, both may need a preamble of the longest interval to wake the other side
+    const unsigned long time_on_air = LoRaAirTime::GetTimeOnAir(air_rate_level_, kFrameSize + 3) / 1000;
+    const unsigned long round_trip = 2 * (time_on_air + kMaximumInterval);
+    return round_trip * 3 / 2 + kProcessingTime;
+};
+
+#pragma endregion
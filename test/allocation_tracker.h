@@ -0,0 +1,194 @@
+/**
+ * @file allocation_tracker.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Counts heap allocations and peak heap use on the native build by replacing malloc and operator new
+ * Include this file in exactly one source file of a test suite.
+ * Peak heap use is only tracked on glibc, where the size of a released block is known.
+ * @version 0.1
+ * @date 2024-03-04
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef ALLOCATION_TRACKER_H_
+#define ALLOCATION_TRACKER_H_
+
+#ifndef ARDUINO
+
+#include <stdlib.h>
+#include <new>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+/**
+ * @brief Counters of the heap use while tracking is enabled
+ *
+ */
+struct AllocationCounters
+{
+    unsigned long allocations;   // Calls to malloc, calloc, realloc and operator new
+    unsigned long deallocations; // Calls to free and operator delete
+    unsigned long bytes;         // Total amount of bytes requested
+    long current_bytes;          // Bytes in use compared to the moment tracking was reset
+    long peak_bytes;             // Highest value of current_bytes
+};
+
+namespace AllocationTracker
+{
+    static AllocationCounters counters = {0, 0, 0, 0, 0};
+    static bool enabled = false;
+
+    inline void Reset(void)
+    {
+        counters.allocations = 0;
+        counters.deallocations = 0;
+        counters.bytes = 0;
+        counters.current_bytes = 0;
+        counters.peak_bytes = 0;
+    }
+
+    inline void Enable(void)
+    {
+        enabled = true;
+    }
+
+    inline void Disable(void)
+    {
+        enabled = false;
+    }
+
+    inline AllocationCounters Get(void)
+    {
+        return counters;
+    }
+
+    inline void CountAllocation(const size_t size)
+    {
+        if (enabled)
+        {
+            counters.allocations++;
+            counters.bytes += size;
+        }
+    }
+
+    inline void CountDeallocation(void)
+    {
+        if (enabled)
+        {
+            counters.deallocations++;
+        }
+    }
+
+    /**
+     * @brief Keep track of the bytes in use, sizes are the usable sizes of the blocks
+     *
+     * @param allocated bytes of the block which was handed out
+     * @param released bytes of the block which was given back
+     */
+    inline void CountUsage(const size_t allocated, const size_t released)
+    {
+        if (enabled)
+        {
+            counters.current_bytes += static_cast<long>(allocated) - static_cast<long>(released);
+            if (counters.current_bytes > counters.peak_bytes)
+            {
+                counters.peak_bytes = counters.current_bytes;
+            }
+        }
+    }
+} // namespace AllocationTracker
+
+#if defined(__GLIBC__)
+// The Arduino String class uses malloc, realloc and free directly
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t amount, size_t size);
+    void *__libc_realloc(void *pointer, size_t size);
+    void __libc_free(void *pointer);
+
+    void *malloc(size_t size)
+    {
+        AllocationTracker::CountAllocation(size);
+        void *pointer = __libc_malloc(size);
+        AllocationTracker::CountUsage(malloc_usable_size(pointer), 0);
+        return pointer;
+    }
+
+    void *calloc(size_t amount, size_t size)
+    {
+        AllocationTracker::CountAllocation(amount * size);
+        void *pointer = __libc_calloc(amount, size);
+        AllocationTracker::CountUsage(malloc_usable_size(pointer), 0);
+        return pointer;
+    }
+
+    void *realloc(void *pointer, size_t size)
+    {
+        AllocationTracker::CountAllocation(size);
+        const size_t released = malloc_usable_size(pointer);
+        void *new_pointer = __libc_realloc(pointer, size);
+        AllocationTracker::CountUsage(malloc_usable_size(new_pointer), released);
+        return new_pointer;
+    }
+
+    void free(void *pointer)
+    {
+        if (pointer != nullptr)
+        {
+            AllocationTracker::CountDeallocation();
+            AllocationTracker::CountUsage(0, malloc_usable_size(pointer));
+        }
+        __libc_free(pointer);
+    }
+}
+#endif // __GLIBC__
+
+void *operator new(size_t size)
+{
+#if !defined(__GLIBC__)
+    AllocationTracker::CountAllocation(size);
+#endif
+    void *pointer = malloc(size);
+    if (pointer == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+#if !defined(__GLIBC__)
+    if (pointer != nullptr)
+    {
+        AllocationTracker::CountDeallocation();
+    }
+#endif
+    free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+#endif // ARDUINO
+
+#endif // ALLOCATION_TRACKER_H_
@@ -0,0 +1,75 @@
+/**
+ * @file emulated_network.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Emulated modules on a shared air with the driver in front of them, the setup of the tests of the layers
+ * @version 0.1
+ * @date 2024-03-26
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef EMULATED_NETWORK_H_
+#define EMULATED_NETWORK_H_
+
+#include <unity.h>
+
+#include "usr_lg206_p.h"
+#include "emulated_usr_lg206_p.h"
+
+/**
+ * @brief Pin used for both enable pins of the RS485 serial, the emulator ignores it
+ *
+ */
+const uint8_t kEmulatedEnablePin = 2;
+
+/**
+ * @brief Put a module in fixed point transmission mode
+ *
+ * @param lora driver of the module
+ * @param address of the module
+ * @param channel of the module
+ */
+inline void ConfigureFixedPoint(UsrLg206P *lora, const uint16_t address, const uint8_t channel)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->BeginAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->SetWorkMode(LoRaSettings::WorkMode::kWorkModeFixedPoint));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->SetDestinationAddress(address));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->SetChannel(channel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->EndAtMode());
+}
+
+/**
+ * @brief Emulated module with the serial and the driver talking to it
+ *
+ */
+struct EmulatedRadio
+{
+    EmulatedUsrLg206P *module;
+    RS485 *rs;
+    UsrLg206P *lora;
+
+    /**
+     * @brief Create the module on the air and put it in fixed point transmission mode
+     *
+     * @param air the module sends and receives over
+     * @param address of the module
+     * @param channel of the module
+     */
+    void Create(EmulatedAir *air, const uint16_t address, const uint8_t channel)
+    {
+        module = new EmulatedUsrLg206P();
+        air->Attach(module);
+        rs = new RS485(kEmulatedEnablePin, kEmulatedEnablePin, module, false);
+        lora = new UsrLg206P(rs);
+        ConfigureFixedPoint(lora, address, channel);
+    }
+
+    void Destroy(void)
+    {
+        delete lora;
+        delete rs;
+        delete module;
+    }
+};
+
+#endif // EMULATED_NETWORK_H_
@@ -0,0 +1,846 @@
+/**
+ * @file emulated_usr_lg206_p.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Stream that behaves like a USR-LG206-P module, used to test and benchmark the driver without hardware
+ * @version 0.1
+ * @date 2024-03-04
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef EMULATED_USR_LG206_P_H_
+#define EMULATED_USR_LG206_P_H_
+
+#include <Arduino.h>
+#include "usr_lg206_p_air_time.h"
+
+#ifndef kEmulatorBufferSize
+#define kEmulatorBufferSize 512
+#endif
+
+#ifndef kEmulatorAmountOfRegisters
+#define kEmulatorAmountOfRegisters 16
+#endif
+
+#ifndef kEmulatorAmountOfModules
+#define kEmulatorAmountOfModules 8
+#endif
+
+/**
+ * @brief Amount of frames which can be on the air at the same time when the air is timed
+ *
+ */
+#ifndef kEmulatorAmountOfTransmissions
+#define kEmulatorAmountOfTransmissions 32
+#endif
+
+class EmulatedAir;
+
+/**
+ * @brief Counters kept by the emulator to model the traffic caused by the driver
+ *
+ */
+struct EmulatorCounters
+{
+    unsigned long bytes_from_host;     // Bytes written by the microcontroller to the module
+    unsigned long bytes_to_host;       // Bytes read by the microcontroller from the module
+    unsigned long commands;            // AT commands handled
+    unsigned long frames_transmitted;  // Frames sent over the air
+    unsigned long frames_received;     // Frames received over the air
+    unsigned long bytes_transmitted;   // Bytes sent over the air
+    unsigned long air_time;            // Time on air of all transmitted frames in microseconds
+};
+
+/**
+ * @brief Emulation of the USR-LG206-P
+ * Handles +++ / a handshake, AT commands with and without echo and frames sent in transparent and fixed point mode.
+ * A flush of the stream marks the end of a frame, which is how the driver writes every message.
+ *
+ */
+class EmulatedUsrLg206P : public Stream
+{
+public:
+    EmulatedUsrLg206P(void)
+    {
+        at_mode_ = false;
+        waiting_for_confirmation_ = false;
+        echo_ = true;
+        loopback_ = false;
+        responding_ = true;
+        air_ = nullptr;
+        output_head_ = 0;
+        output_tail_ = 0;
+        input_size_ = 0;
+        last_frame_size_ = 0;
+        amount_of_registers_ = 0;
+
+        SetRegister("WMODE", "TRANS");
+        SetRegister("UART", "115200,8,1,NONE,485");
+        SetRegister("PMODE", "RUN");
+        SetRegister("WTM", "2000");
+        SetRegister("SPD", "10");
+        SetRegister("ADDR", "0");
+        SetRegister("CH", "65");
+        SetRegister("FEC", "OFF");
+        SetRegister("PWR", "20");
+        SetRegister("SQT", "0");
+        SetRegister("KEY", "FFFFFFFFFFFFFFFF");
+        SetRegister("NID", "FFFFFFFF");
+        SetRegister("VER", "1.1.1");
+
+        ResetCounters();
+    }
+
+#pragma region stream
+    int available(void) override
+    {
+        PollAir();
+        return output_tail_ - output_head_;
+    }
+
+    int read(void) override
+    {
+        PollAir();
+        if (output_head_ == output_tail_)
+        {
+            return -1;
+        }
+
+        counters_.bytes_to_host++;
+        uint8_t value = output_[output_head_++];
+        if (output_head_ == output_tail_)
+        {
+            output_head_ = 0;
+            output_tail_ = 0;
+        }
+        return value;
+    }
+
+    int peek(void) override
+    {
+        PollAir();
+        if (output_head_ == output_tail_)
+        {
+            return -1;
+        }
+        return output_[output_head_];
+    }
+
+    size_t write(uint8_t value) override
+    {
+        return write(&value, 1);
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        counters_.bytes_from_host += size;
+        if (!responding_)
+        {
+            return size;
+        }
+
+        for (size_t i = 0; i < size; i++)
+        {
+            if (input_size_ < kEmulatorBufferSize)
+            {
+                input_[input_size_++] = buffer[i];
+            }
+
+            // AT commands end with a carriage return and newline
+            if (at_mode_ && input_size_ >= 2 && input_[input_size_ - 2] == '\r' && input_[input_size_ - 1] == '\n')
+            {
+                HandleCommand();
+                input_size_ = 0;
+            }
+        }
+        return size;
+    }
+
+    void flush(void) override
+    {
+        if (input_size_ == 0)
+        {
+            return;
+        }
+
+        if (!at_mode_)
+        {
+            HandleFrame();
+        }
+        input_size_ = 0;
+    }
+#pragma endregion
+
+    /**
+     * @brief Let the module receive a frame over the air, it is available to the microcontroller afterwards
+     *
+     * @param frame data received
+     * @param size of the data
+     */
+    void InjectFrame(const uint8_t *frame, const size_t size)
+    {
+        counters_.frames_received++;
+        QueueOutput(reinterpret_cast<const char *>(frame), size);
+    }
+
+    /**
+     * @brief Every frame sent is received back by the module itself, used to benchmark receiving
+     *
+     * @param loopback true to turn loopback on
+     */
+    void SetLoopback(const bool loopback)
+    {
+        loopback_ = loopback;
+    }
+
+    /**
+     * @brief A module which does not respond ignores everything written to it, like a module which hangs
+     *
+     * @param responding false to ignore the microcontroller
+     */
+    void SetResponding(const bool responding)
+    {
+        responding_ = responding;
+    }
+
+    /**
+     * @brief Connect the module to an air medium shared with other modules, done by EmulatedAir::Attach
+     *
+     * @param air medium frames are sent over
+     */
+    void SetAir(EmulatedAir *air)
+    {
+        air_ = air;
+    }
+
+    /**
+     * @brief Get the payload of the last frame sent over the air, without fixed point header
+     *
+     * @param size OUTPUT size of the payload
+     * @return pointer to the payload
+     */
+    const uint8_t *GetLastFrame(size_t &size) const
+    {
+        size = last_frame_size_;
+        return last_frame_;
+    }
+
+    const EmulatorCounters &GetCounters(void) const
+    {
+        return counters_;
+    }
+
+    void ResetCounters(void)
+    {
+        memset(&counters_, 0, sizeof(counters_));
+    }
+
+    bool IsAtMode(void) const
+    {
+        return at_mode_;
+    }
+
+    bool IsFixedPoint(void) const
+    {
+        return strcmp(GetRegister("WMODE"), "FP") == 0;
+    }
+
+    int GetChannel(void) const
+    {
+        return atoi(GetRegister("CH"));
+    }
+
+    uint16_t GetAddress(void) const
+    {
+        return atol(GetRegister("ADDR"));
+    }
+
+    LoRaSettings::LoRaAirRateLevel GetAirRateLevel(void) const
+    {
+        return LoRaSettings::LoRaAirRateLevel(atoi(GetRegister("SPD")));
+    }
+
+    /**
+     * @brief Get the value of a register as it would be returned by a query
+     *
+     * @param name of the register without AT+
+     * @return value, empty when the register does not exist
+     */
+    const char *GetRegister(const char *name) const
+    {
+        for (size_t i = 0; i < amount_of_registers_; i++)
+        {
+            if (strcmp(registers_[i].name, name) == 0)
+            {
+                return registers_[i].value;
+            }
+        }
+        return "";
+    }
+
+    void SetRegister(const char *name, const char *value)
+    {
+        size_t i = 0;
+        while (i < amount_of_registers_ && strcmp(registers_[i].name, name) != 0)
+        {
+            i++;
+        }
+
+        if (i == amount_of_registers_)
+        {
+            if (amount_of_registers_ == kEmulatorAmountOfRegisters)
+            {
+                return;
+            }
+            amount_of_registers_++;
+            strncpy(registers_[i].name, name, sizeof(registers_[i].name) - 1);
+            registers_[i].name[sizeof(registers_[i].name) - 1] = '\0';
+        }
+
+        strncpy(registers_[i].value, value, sizeof(registers_[i].value) - 1);
+        registers_[i].value[sizeof(registers_[i].value) - 1] = '\0';
+    }
+
+private:
+    struct Register
+    {
+        char name[8];
+        char value[24];
+    };
+
+    bool at_mode_;
+    bool waiting_for_confirmation_;
+    bool echo_;
+    bool loopback_;
+    bool responding_;
+    EmulatedAir *air_;
+
+    uint8_t output_[kEmulatorBufferSize];
+    size_t output_head_;
+    size_t output_tail_;
+
+    uint8_t input_[kEmulatorBufferSize + 1];
+    size_t input_size_;
+
+    uint8_t last_frame_[kEmulatorBufferSize];
+    size_t last_frame_size_;
+
+    Register registers_[kEmulatorAmountOfRegisters];
+    size_t amount_of_registers_;
+
+    EmulatorCounters counters_;
+
+    void QueueOutput(const char *data, const size_t size)
+    {
+        for (size_t i = 0; i < size && output_tail_ < kEmulatorBufferSize; i++)
+        {
+            output_[output_tail_++] = data[i];
+        }
+    }
+
+    void QueueOutput(const char *data)
+    {
+        QueueOutput(data, strlen(data));
+    }
+
+    /**
+     * @brief Handle the data written while not in AT mode
+     *
+     */
+    void HandleFrame(void)
+    {
+        if (input_size_ == 3 && memcmp(input_, "+++", 3) == 0)
+        {
+            waiting_for_confirmation_ = true;
+            QueueOutput("a");
+            return;
+        }
+
+        if (waiting_for_confirmation_ && input_size_ == 1 && input_[0] == 'a')
+        {
+            waiting_for_confirmation_ = false;
+            at_mode_ = true;
+            QueueOutput("+OK");
+            return;
+        }
+        waiting_for_confirmation_ = false;
+
+        // In fixed point mode the first three bytes contain the destination address and channel
+        size_t header_size = IsFixedPoint() ? 3 : 0;
+        if (input_size_ <= header_size)
+        {
+            return;
+        }
+
+        uint16_t destination_address = 65535;
+        int channel = GetChannel();
+        if (header_size)
+        {
+            destination_address = (input_[0] << 8) | input_[1];
+            channel = input_[2];
+        }
+
+        last_frame_size_ = input_size_ - header_size;
+        memcpy(last_frame_, input_ + header_size, last_frame_size_);
+
+        const unsigned long air_time = LoRaAirTime::GetTimeOnAir(GetAirRateLevel(), input_size_);
+        counters_.frames_transmitted++;
+        counters_.bytes_transmitted += last_frame_size_;
+        counters_.air_time += air_time;
+
+        if (loopback_)
+        {
+            InjectFrame(last_frame_, last_frame_size_);
+        }
+
+        SendToAir(destination_address, channel, air_time);
+    }
+
+    void SendToAir(const uint16_t destination_address, const int channel, const unsigned long air_time);
+    void PollAir(void);
+
+    /**
+     * @brief Handle one AT command which is stored in the input buffer
+     *
+     */
+    void HandleCommand(void)
+    {
+        counters_.commands++;
+        input_[input_size_] = '\0';
+        char *line = reinterpret_cast<char *>(input_);
+
+        if (echo_)
+        {
+            QueueOutput(line, input_size_);
+        }
+
+        if (strncmp(line, "AT+", 3) != 0)
+        {
+            QueueOutput("\r\nERR:1\r\n");
+            return;
+        }
+
+        // Strip AT+ and the line ending
+        char *name = line + 3;
+        line[input_size_ - 2] = '\0';
+        char *value = strchr(name, '=');
+        if (value != nullptr)
+        {
+            *value = '\0';
+            value++;
+        }
+
+        if (strcmp(name, "E") == 0)
+        {
+            if (value == nullptr)
+            {
+                QueueOutput(echo_ ? "\r\nOK=ON\r\n" : "\r\nOK=OFF\r\n");
+                return;
+            }
+            echo_ = strcmp(value, "ON") == 0;
+            QueueOutput("\r\nOK\r\n");
+            return;
+        }
+
+        if (strcmp(name, "ENTM") == 0 || strcmp(name, "Z") == 0)
+        {
+            at_mode_ = false;
+            QueueOutput("\r\nOK\r\n");
+            return;
+        }
+
+        if (strcmp(name, "CFGTF") == 0)
+        {
+            QueueOutput("\r\n+CFGTF:SAVED\r\n\r\nOK\r\n");
+            return;
+        }
+
+        if (strcmp(name, "RELD") == 0)
+        {
+            at_mode_ = false;
+            QueueOutput("\r\nREBOOTING\r\n");
+            return;
+        }
+
+        const char *current = GetRegister(name);
+        if (current[0] == '\0')
+        {
+            QueueOutput("\r\nERR:2\r\n");
+            return;
+        }
+
+        if (value != nullptr)
+        {
+            SetRegister(name, value);
+            QueueOutput("\r\nOK\r\n");
+            return;
+        }
+
+        QueueOutput("\r\n+");
+        QueueOutput(name);
+        QueueOutput(":");
+        QueueOutput(current);
+        QueueOutput("\r\n\r\nOK\r\n");
+    }
+};
+
+/**
+ * @brief Air medium shared by emulated modules
+ * A frame is received by every attached module in transmission mode on the same channel and air rate level.
+ * In fixed point mode the address of the receiver must match the destination, 65535 is received by all.
+ * All modules are in range of each other unless set otherwise, to build multi hop topologies.
+ * By default a frame arrives the moment it is sent. When the air is timed a module sends its frames one after another,
+ * each frame arrives after its time on air and is missed by a module which transmits meanwhile or hears another frame
+ * at the same time.
+ *
+ */
+class EmulatedAir
+{
+public:
+    EmulatedAir(void)
+    {
+        amount_of_modules_ = 0;
+        loss_rate_ = 0;
+        drop_next_ = 0;
+        seed_ = 1;
+        transmissions_ = 0;
+        deliveries_ = 0;
+        drops_ = 0;
+        collisions_ = 0;
+        timed_ = false;
+        amount_of_flights_ = 0;
+        memset(out_of_range_, 0, sizeof(out_of_range_));
+        memset(busy_until_, 0, sizeof(busy_until_));
+    }
+
+    void Attach(EmulatedUsrLg206P *module)
+    {
+        if (amount_of_modules_ < kEmulatorAmountOfModules)
+        {
+            modules_[amount_of_modules_++] = module;
+            module->SetAir(this);
+        }
+    }
+
+    /**
+     * @brief Set the chance a frame is lost, the same seed gives the same losses every run
+     *
+     * @param percentage chance in percent between 0 and 100
+     * @param seed of the pseudo random generator
+     */
+    void SetLossRate(const uint8_t percentage, const uint32_t seed = 1)
+    {
+        loss_rate_ = percentage;
+        seed_ = seed;
+    }
+
+    /**
+     * @brief Set if two attached modules can hear each other
+     *
+     * @param a first module
+     * @param b second module
+     * @param in_range false if frames of one module never reach the other
+     */
+    void SetInRange(const EmulatedUsrLg206P *a, const EmulatedUsrLg206P *b, const bool in_range)
+    {
+        const size_t index_a = IndexOf(a);
+        const size_t index_b = IndexOf(b);
+        if (index_a < amount_of_modules_ && index_b < amount_of_modules_)
+        {
+            out_of_range_[index_a][index_b] = !in_range;
+            out_of_range_[index_b][index_a] = !in_range;
+        }
+    }
+
+    /**
+     * @brief Let frames take their time on air, with the virtual clock, so modules which talk at once miss frames
+     *
+     * @param timed true to model time on air and half duplex modules
+     */
+    void SetTimed(const bool timed)
+    {
+        timed_ = timed;
+    }
+
+    /**
+     * @brief Lose the next transmissions regardless of the loss rate
+     *
+     * @param amount of transmissions to lose
+     */
+    void DropNext(const size_t amount)
+    {
+        drop_next_ = amount;
+    }
+
+    void Transmit(EmulatedUsrLg206P *sender, const uint16_t destination_address, const int channel, const uint8_t *frame, const size_t size, const unsigned long air_time)
+    {
+        transmissions_++;
+        bool lost = false;
+        if (drop_next_ > 0)
+        {
+            drop_next_--;
+            lost = true;
+        }
+        else if (loss_rate_ > 0 && NextRandom() % 100 < loss_rate_)
+        {
+            lost = true;
+        }
+
+        if (lost)
+        {
+            drops_++;
+        }
+
+        Flight flight;
+        flight.sender = sender;
+        flight.destination_address = destination_address;
+        flight.channel = channel;
+        flight.lost = lost;
+        flight.delivered = false;
+        flight.size = (size < kEmulatorBufferSize) ? size : kEmulatorBufferSize;
+        memcpy(flight.frame, frame, flight.size);
+
+        if (!timed_)
+        {
+            if (!lost)
+            {
+                Deliver(flight);
+            }
+            return;
+        }
+
+        // The module sends its frames one after another, a lost frame still takes its time on air
+        Poll();
+        const size_t index_sender = IndexOf(sender);
+        const unsigned long now = micros();
+        unsigned long &busy_until = busy_until_[index_sender < kEmulatorAmountOfModules ? index_sender : 0];
+        flight.start = (static_cast<long>(busy_until - now) > 0) ? busy_until : now;
+        flight.end = flight.start + air_time;
+        busy_until = flight.end;
+
+        if (amount_of_flights_ == kEmulatorAmountOfTransmissions)
+        {
+            drops_++;
+            return;
+        }
+        flights_[amount_of_flights_++] = flight;
+    }
+
+    /**
+     * @brief Deliver the frames of which the time on air ended, called by the modules when they are read
+     *
+     */
+    void Poll(void)
+    {
+        if (!timed_)
+        {
+            return;
+        }
+
+        const unsigned long now = micros();
+        while (true)
+        {
+            // Frames arrive in the order their transmission ends
+            Flight *next = nullptr;
+            for (size_t i = 0; i < amount_of_flights_; i++)
+            {
+                Flight &flight = flights_[i];
+                if (!flight.delivered && static_cast<long>(now - flight.end) >= 0 && (next == nullptr || static_cast<long>(next->end - flight.end) > 0))
+                {
+                    next = &flight;
+                }
+            }
+            if (next == nullptr)
+            {
+                break;
+            }
+
+            next->delivered = true;
+            if (!next->lost)
+            {
+                Deliver(*next);
+            }
+        }
+
+        // Keep delivered frames as long as a frame still on the air overlaps them, later frames start after now
+        size_t kept = 0;
+        for (size_t i = 0; i < amount_of_flights_; i++)
+        {
+            bool keep = !flights_[i].delivered;
+            for (size_t j = 0; j < amount_of_flights_ && !keep; j++)
+            {
+                keep = !flights_[j].delivered && Overlaps(flights_[i], flights_[j]);
+            }
+            if (keep)
+            {
+                flights_[kept++] = flights_[i];
+            }
+        }
+        amount_of_flights_ = kept;
+    }
+
+    unsigned long GetTransmissions(void) const
+    {
+        return transmissions_;
+    }
+
+    unsigned long GetDeliveries(void) const
+    {
+        return deliveries_;
+    }
+
+    unsigned long GetDrops(void) const
+    {
+        return drops_;
+    }
+
+    /**
+     * @brief Get the amount of frames missed by a module because it transmitted or heard another frame at the same time
+     *
+     */
+    unsigned long GetCollisions(void) const
+    {
+        return collisions_;
+    }
+
+private:
+    /**
+     * @brief Frame on the air, start and end in microseconds of the virtual clock
+     *
+     */
+    struct Flight
+    {
+        EmulatedUsrLg206P *sender;
+        uint16_t destination_address;
+        int channel;
+        bool lost;
+        bool delivered;
+        unsigned long start;
+        unsigned long end;
+        size_t size;
+        uint8_t frame[kEmulatorBufferSize];
+    };
+
+    EmulatedUsrLg206P *modules_[kEmulatorAmountOfModules];
+    size_t amount_of_modules_;
+    bool out_of_range_[kEmulatorAmountOfModules][kEmulatorAmountOfModules];
+    uint8_t loss_rate_;
+    size_t drop_next_;
+    uint32_t seed_;
+    unsigned long transmissions_;
+    unsigned long deliveries_;
+    unsigned long drops_;
+    unsigned long collisions_;
+    bool timed_;
+    unsigned long busy_until_[kEmulatorAmountOfModules];
+    Flight flights_[kEmulatorAmountOfTransmissions];
+    size_t amount_of_flights_;
+
+    static bool Overlaps(const Flight &a, const Flight &b)
+    {
+        return static_cast<long>(b.end - a.start) > 0 && static_cast<long>(a.end - b.start) > 0;
+    }
+
+    bool InRange(const EmulatedUsrLg206P *sender, const size_t index_receiver) const
+    {
+        const size_t index_sender = IndexOf(sender);
+        return index_sender >= amount_of_modules_ || !out_of_range_[index_sender][index_receiver];
+    }
+
+    /**
+     * @brief Check if a module misses a frame, because it transmitted meanwhile or another frame reached it at the same time
+     *
+     */
+    bool Collides(const Flight &flight, const EmulatedUsrLg206P *receiver, const size_t index_receiver) const
+    {
+        if (!timed_)
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < amount_of_flights_; i++)
+        {
+            const Flight &other = flights_[i];
+            if (&other == &flight || other.sender == flight.sender || !Overlaps(flight, other))
+            {
+                continue;
+            }
+
+            if (other.sender == receiver ||
+                (other.channel == flight.channel && other.sender->GetAirRateLevel() == flight.sender->GetAirRateLevel() && InRange(other.sender, index_receiver)))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Deliver(const Flight &flight)
+    {
+        EmulatedUsrLg206P *sender = flight.sender;
+        for (size_t i = 0; i < amount_of_modules_; i++)
+        {
+            EmulatedUsrLg206P *receiver = modules_[i];
+            if (receiver == sender || receiver->IsAtMode() || receiver->GetChannel() != flight.channel || receiver->GetAirRateLevel() != sender->GetAirRateLevel())
+            {
+                continue;
+            }
+
+            if (!InRange(sender, i))
+            {
+                continue;
+            }
+
+            if (receiver->IsFixedPoint() && flight.destination_address != 65535 && flight.destination_address != receiver->GetAddress())
+            {
+                continue;
+            }
+
+            if (Collides(flight, receiver, i))
+            {
+                collisions_++;
+                continue;
+            }
+
+            deliveries_++;
+            receiver->InjectFrame(flight.frame, flight.size);
+        }
+    }
+
+    uint32_t NextRandom(void)
+    {
+        // Linear congruential generator, so runs are reproducible
+        seed_ = seed_ * 1103515245UL + 12345UL;
+        return (seed_ >> 16) & 0x7FFF;
+    }
+
+    size_t IndexOf(const EmulatedUsrLg206P *module) const
+    {
+        for (size_t i = 0; i < amount_of_modules_; i++)
+        {
+            if (modules_[i] == module)
+            {
+                return i;
+            }
+        }
+        return amount_of_modules_;
+    }
+};
+
+inline void EmulatedUsrLg206P::SendToAir(const uint16_t destination_address, const int channel, const unsigned long air_time)
+{
+    if (air_ != nullptr)
+    {
+        air_->Transmit(this, destination_address, channel, last_frame_, last_frame_size_, air_time);
+    }
+}
+
+inline void EmulatedUsrLg206P::PollAir(void)
+{
+    if (air_ != nullptr)
+    {
+        air_->Poll();
+    }
+}
+
+#endif // EMULATED_USR_LG206_P_H_
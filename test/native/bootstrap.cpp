@@ -13,7 +13,6 @@ void tearDown(void)
 void RUN_UNITY_TESTS()
 {
     UNITY_BEGIN();
-    // RUN_TEST(test_Crc32);
     UNITY_END();
 }
 
@@ -0,0 +1,209 @@
+/**
+ * @file test_adaptive_rate.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the adaptive air rate level
+ * @version 0.1
+ * @date 2024-03-13
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_network.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_adaptive_rate.h"
+
+const uint16_t kAddressA = 1;
+const uint16_t kAddressB = 2;
+const uint8_t kChannel = 40;
+const LoRaSettings::LoRaAirRateLevel kSlowest = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268;
+const LoRaSettings::LoRaAirRateLevel kSlow = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel488;
+
+EmulatedAir *air;
+EmulatedRadio radio_a;
+EmulatedRadio radio_b;
+LoRaAdaptiveRate::LoRaAdaptiveRate *rate_a;
+LoRaAdaptiveRate::LoRaAdaptiveRate *rate_b;
+
+uint8_t buffer[32];
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    air = new EmulatedAir();
+    radio_a.Create(air, kAddressA, kChannel);
+    radio_b.Create(air, kAddressB, kChannel);
+
+    rate_a = new LoRaAdaptiveRate::LoRaAdaptiveRate(radio_a.lora, kAddressA, kChannel);
+    rate_b = new LoRaAdaptiveRate::LoRaAdaptiveRate(radio_b.lora, kAddressB, kChannel);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, rate_a->Select(kAddressB));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, rate_b->Select(kAddressA));
+}
+
+void tearDown(void)
+{
+    delete rate_a;
+    delete rate_b;
+    radio_a.Destroy();
+    radio_b.Destroy();
+    delete air;
+}
+
+/**
+ * @brief Let both sides handle requests and acknowledgements
+ *
+ */
+void Exchange(void)
+{
+    for (size_t i = 0; i < 4; i++)
+    {
+        rate_a->Update();
+        rate_b->Update();
+        TEST_ASSERT_EQUAL(0, rate_b->Receive(buffer, sizeof(buffer)));
+        TEST_ASSERT_EQUAL(0, rate_a->Receive(buffer, sizeof(buffer)));
+    }
+}
+
+void Deliver(const size_t amount, const bool delivered)
+{
+    for (size_t i = 0; i < amount; i++)
+    {
+        rate_a->ReportDelivery(kAddressB, delivered);
+    }
+}
+
+/**
+ * @brief Raise the level of the link from the slowest to the next one
+ *
+ */
+void StepUp(void)
+{
+    Deliver(kLoRaAdaptiveRateStepUpThreshold, true);
+    TEST_ASSERT_TRUE(rate_a->HasPendingChange(kAddressB));
+    Exchange();
+    TEST_ASSERT_FALSE(rate_a->HasPendingChange(kAddressB));
+    TEST_ASSERT_EQUAL(kSlow, rate_a->GetLevel(kAddressB));
+}
+
+void test_both_sides_step_up(void)
+{
+    TEST_ASSERT_EQUAL(kSlowest, radio_a.module->GetAirRateLevel());
+    TEST_ASSERT_EQUAL(kSlowest, radio_b.module->GetAirRateLevel());
+
+    Deliver(kLoRaAdaptiveRateStepUpThreshold - 1, true);
+    TEST_ASSERT_FALSE(rate_a->HasPendingChange(kAddressB));
+    StepUp();
+
+    TEST_ASSERT_EQUAL(kSlow, rate_b->GetLevel(kAddressA));
+    TEST_ASSERT_EQUAL(kSlow, radio_a.module->GetAirRateLevel());
+    TEST_ASSERT_EQUAL(kSlow, radio_b.module->GetAirRateLevel());
+    TEST_ASSERT_EQUAL(1, rate_a->GetStatistics().steps_up);
+    TEST_ASSERT_EQUAL(1, rate_b->GetStatistics().steps_up);
+}
+
+void test_failed_probe_steps_down_and_backs_off(void)
+{
+    StepUp();
+
+    // First message on the faster level fails
+    Deliver(1, false);
+    Exchange();
+    TEST_ASSERT_EQUAL(kSlowest, rate_a->GetLevel(kAddressB));
+    TEST_ASSERT_EQUAL(kSlowest, radio_a.module->GetAirRateLevel());
+    TEST_ASSERT_EQUAL(kSlowest, radio_b.module->GetAirRateLevel());
+
+    // Next attempt needs twice as many deliveries
+    Deliver(kLoRaAdaptiveRateStepUpThreshold, true);
+    TEST_ASSERT_FALSE(rate_a->HasPendingChange(kAddressB));
+    Deliver(kLoRaAdaptiveRateStepUpThreshold, true);
+    TEST_ASSERT_TRUE(rate_a->HasPendingChange(kAddressB));
+}
+
+void test_failures_in_a_row_step_down(void)
+{
+    StepUp();
+    Deliver(1, true);
+
+    // Hysteresis, a single failure after a delivery keeps the level
+    Deliver(kLoRaAdaptiveRateStepDownThreshold - 1, false);
+    Deliver(1, true);
+    Deliver(kLoRaAdaptiveRateStepDownThreshold - 1, false);
+    TEST_ASSERT_FALSE(rate_a->HasPendingChange(kAddressB));
+
+    Deliver(1, false);
+    TEST_ASSERT_TRUE(rate_a->HasPendingChange(kAddressB));
+    Exchange();
+    TEST_ASSERT_EQUAL(kSlowest, rate_a->GetLevel(kAddressB));
+    TEST_ASSERT_EQUAL(kSlowest, rate_b->GetLevel(kAddressA));
+    TEST_ASSERT_EQUAL(1, rate_a->GetStatistics().steps_down);
+
+    // Slowest level is the lower limit
+    Deliver(2 * kLoRaAdaptiveRateStepDownThreshold, false);
+    TEST_ASSERT_FALSE(rate_a->HasPendingChange(kAddressB));
+}
+
+void test_lost_acknowledgement_falls_back(void)
+{
+    Deliver(kLoRaAdaptiveRateStepUpThreshold, true);
+    rate_a->Update();
+    // Acknowledgement of B is lost, B switched while A did not
+    air->DropNext(1);
+    rate_b->Receive(buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL(kSlow, radio_b.module->GetAirRateLevel());
+
+    // A repeats the request on the old level, which B does not hear anymore
+    for (size_t i = 0; i < kLoRaAdaptiveRateMaximumRequests; i++)
+    {
+        VirtualClock::Advance(5000);
+        Exchange();
+    }
+    TEST_ASSERT_FALSE(rate_a->HasPendingChange(kAddressB));
+    TEST_ASSERT_EQUAL(1, rate_a->GetStatistics().failed_requests);
+    TEST_ASSERT_EQUAL(kSlowest, radio_a.module->GetAirRateLevel());
+
+    VirtualClock::Advance(kLoRaAdaptiveRateSilenceTimeout);
+    Exchange();
+    TEST_ASSERT_EQUAL(1, rate_b->GetStatistics().fallbacks);
+    TEST_ASSERT_EQUAL(kSlowest, radio_b.module->GetAirRateLevel());
+
+    // Link works again
+    StepUp();
+    TEST_ASSERT_EQUAL(kSlow, radio_b.module->GetAirRateLevel());
+}
+
+void test_level_range(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, rate_a->SetLevelRange(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevelUndefined, kSlow));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, rate_a->SetLevelRange(kSlow, kSlowest));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, rate_a->SetLevelRange(kSlowest, kSlowest));
+
+    // Already at the fastest level
+    Deliver(kLoRaAdaptiveRateStepUpThreshold, true);
+    TEST_ASSERT_FALSE(rate_a->HasPendingChange(kAddressB));
+
+    // Requests outside the range are ignored
+    const uint8_t request[LoRaAdaptiveRate::kFrameSize] = {0x60, LoRaAdaptiveRate::kFrameSize - 2, 0, kAddressB, 5};
+    TEST_ASSERT_TRUE(rate_a->HandleFrame(request, sizeof(request)));
+    TEST_ASSERT_EQUAL(kSlowest, rate_a->GetLevel(kAddressB));
+    TEST_ASSERT_EQUAL(0, radio_b.module->GetCounters().frames_received);
+
+    const uint8_t data[] = {1, 2, 3, 4, 5, 6};
+    TEST_ASSERT_FALSE(rate_a->HandleFrame(data, sizeof(data)));
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_both_sides_step_up);
+    RUN_TEST(test_failed_probe_steps_down_and_backs_off);
+    RUN_TEST(test_failures_in_a_row_step_down);
+    RUN_TEST(test_lost_acknowledgement_falls_back);
+    RUN_TEST(test_level_range);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,200 @@
+/**
+ * @file test_aggregation.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the aggregator which coalesces records into one frame
+ * @version 0.1
+ * @date 2024-03-09
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_network.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_aggregation.h"
+
+const uint16_t kAddressA = 1;
+const uint16_t kAddressB = 2;
+const uint8_t kChannel = 40;
+
+EmulatedAir *air;
+EmulatedRadio radio_a;
+EmulatedRadio radio_b;
+LoRaAggregation::LoRaAggregator *aggregator_a;
+LoRaAggregation::LoRaAggregator *aggregator_b;
+
+const uint8_t kReading[] = {0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC};
+uint8_t buffer[64];
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    air = new EmulatedAir();
+    radio_a.Create(air, kAddressA, kChannel);
+    radio_b.Create(air, kAddressB, kChannel);
+
+    aggregator_a = new LoRaAggregation::LoRaAggregator(radio_a.lora);
+    aggregator_b = new LoRaAggregation::LoRaAggregator(radio_b.lora);
+}
+
+void tearDown(void)
+{
+    delete aggregator_a;
+    delete aggregator_b;
+    radio_a.Destroy();
+    radio_b.Destroy();
+    delete air;
+}
+
+/**
+ * @brief Read all records received by B and check they hold the reading
+ *
+ * @return amount of records
+ */
+size_t ReceiveAll(void)
+{
+    size_t amount = 0;
+    size_t size;
+    while ((size = aggregator_b->ReceiveRecord(buffer, sizeof(buffer))) > 0)
+    {
+        TEST_ASSERT_EQUAL(sizeof(kReading), size);
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(kReading, buffer, size);
+        amount++;
+    }
+    return amount;
+}
+
+void test_records_are_sent_as_one_frame(void)
+{
+    for (size_t i = 0; i < 5; i++)
+    {
+        TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Write(kReading, sizeof(kReading), kAddressB, kChannel));
+    }
+    TEST_ASSERT_EQUAL(0, air->GetTransmissions());
+    TEST_ASSERT_EQUAL(5 * (sizeof(kReading) + LoRaAggregation::kRecordHeaderSize), aggregator_a->GetAmountPending());
+
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Flush());
+    TEST_ASSERT_EQUAL(1, air->GetTransmissions());
+    TEST_ASSERT_EQUAL(0, aggregator_a->GetAmountPending());
+    TEST_ASSERT_EQUAL(5, ReceiveAll());
+}
+
+void test_full_batch_is_sent(void)
+{
+    const size_t record_size = sizeof(kReading) + LoRaAggregation::kRecordHeaderSize;
+    const size_t records_per_frame = (kLoRaAggregationFrameSize - LoRaAggregation::kFrameHeaderSize) / record_size;
+    for (size_t i = 0; i <= records_per_frame; i++)
+    {
+        TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Write(kReading, sizeof(kReading), kAddressB, kChannel));
+    }
+
+    // The record which did not fit starts a new batch
+    TEST_ASSERT_EQUAL(1, air->GetTransmissions());
+    TEST_ASSERT_EQUAL(record_size, aggregator_a->GetAmountPending());
+    TEST_ASSERT_EQUAL(records_per_frame, ReceiveAll());
+}
+
+void test_flush_threshold(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, aggregator_a->SetFlushThreshold(kLoRaAggregationFrameSize + 1));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->SetFlushThreshold(2 * (sizeof(kReading) + LoRaAggregation::kRecordHeaderSize)));
+
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Write(kReading, sizeof(kReading), kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(0, air->GetTransmissions());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Write(kReading, sizeof(kReading), kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(1, air->GetTransmissions());
+    TEST_ASSERT_EQUAL(2, ReceiveAll());
+}
+
+void test_old_batch_is_sent(void)
+{
+    aggregator_a->SetMaximumAge(1000);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Write(kReading, sizeof(kReading), kAddressB, kChannel));
+
+    VirtualClock::Advance(999);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Update());
+    TEST_ASSERT_EQUAL(0, air->GetTransmissions());
+
+    VirtualClock::Advance(1);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Update());
+    TEST_ASSERT_EQUAL(1, air->GetTransmissions());
+    TEST_ASSERT_EQUAL(1, ReceiveAll());
+}
+
+void test_destinations_are_kept_apart(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Write(kReading, sizeof(kReading), kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Write(kReading, sizeof(kReading), 3, kChannel));
+    TEST_ASSERT_EQUAL(0, air->GetTransmissions());
+
+    // A third destination sends the oldest batch to make room
+    VirtualClock::Advance(1);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Write(kReading, sizeof(kReading), 4, kChannel));
+    TEST_ASSERT_EQUAL(1, air->GetTransmissions());
+    TEST_ASSERT_EQUAL(1, ReceiveAll());
+
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Flush());
+    TEST_ASSERT_EQUAL(3, air->GetTransmissions());
+    TEST_ASSERT_EQUAL(0, ReceiveAll());
+}
+
+void test_frames_received_together_are_counted(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Write(kReading, sizeof(kReading), kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Write(kReading, sizeof(kReading), kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Flush());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Write(kReading, sizeof(kReading), kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Flush());
+
+    // Both frames are waiting in the module before the first record is read
+    TEST_ASSERT_EQUAL(3, ReceiveAll());
+    TEST_ASSERT_EQUAL(2, aggregator_b->GetStatistics().frames_received);
+    TEST_ASSERT_EQUAL(3, aggregator_b->GetStatistics().records_received);
+}
+
+void test_first_error_is_returned(void)
+{
+    // Module in transparent mode, so only batches for fixed point destinations fail
+    EmulatedUsrLg206P module;
+    RS485 rs(kEmulatedEnablePin, kEmulatedEnablePin, &module, false);
+    UsrLg206P lora(&rs);
+    LoRaAggregation::LoRaAggregator aggregator(&lora);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator.SetFlushThreshold(sizeof(kReading) + LoRaAggregation::kRecordHeaderSize));
+
+    const uint8_t small_record[] = {1};
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator.Write(small_record, sizeof(small_record), 3, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator.Write(small_record, sizeof(small_record), 4, kChannel));
+
+    // Making room fails, sending the batch of this record afterwards succeeds
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kWrongWorkMode, aggregator.Write(kReading, sizeof(kReading)));
+    TEST_ASSERT_EQUAL(1, aggregator.GetStatistics().frames_sent);
+}
+
+void test_invalid_records(void)
+{
+    uint8_t record[LoRaAggregation::kMaximumRecordSize + 1] = {0};
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, aggregator_a->Write(record, 0, kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kMessageTooLarge, aggregator_a->Write(record, sizeof(record), kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, aggregator_a->Write(record, sizeof(record) - 1, kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(1, air->GetTransmissions());
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_records_are_sent_as_one_frame);
+    RUN_TEST(test_full_batch_is_sent);
+    RUN_TEST(test_flush_threshold);
+    RUN_TEST(test_old_batch_is_sent);
+    RUN_TEST(test_destinations_are_kept_apart);
+    RUN_TEST(test_frames_received_together_are_counted);
+    RUN_TEST(test_first_error_is_returned);
+    RUN_TEST(test_invalid_records);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,252 @@
+/**
+ * @file test_allocations.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Reports the heap use of every driver call and guards the hot paths against allocating
+ * @version 0.1
+ * @date 2024-03-05
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+#include <stdio.h>
+
+#include "allocation_tracker.h"
+#include "emulated_usr_lg206_p.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p.h"
+
+const uint8_t enable_pin = 2;
+
+/**
+ * @brief Most heap one driver call may use at once, a quarter of the heap of an 8 KB AVR
+ *
+ */
+const long kMaximumPeakHeap = 512;
+
+const char kMessage[] = "Hello world!";
+const size_t kMessageSize = sizeof(kMessage) - 1;
+
+EmulatedUsrLg206P *module;
+RS485 *rs;
+
+/**
+ * @brief The object being tested against
+ *
+ */
+UsrLg206P *lora;
+
+uint8_t buffer[128];
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    module = new EmulatedUsrLg206P();
+    rs = new RS485(enable_pin, enable_pin, module, false);
+    lora = new UsrLg206P(rs);
+}
+
+void tearDown(void)
+{
+    delete lora;
+    delete rs;
+    delete module;
+}
+
+/**
+ * @brief Track the heap use of one call and print it
+ *
+ * @param name of the call
+ * @param operation call to track
+ * @return heap use of the call
+ */
+template <typename Operation>
+AllocationCounters Measure(const char *name, Operation operation)
+{
+    AllocationTracker::Reset();
+    AllocationTracker::Enable();
+    operation();
+    AllocationTracker::Disable();
+
+    const AllocationCounters counters = AllocationTracker::Get();
+    printf("%s: %lu allocations, %lu frees, %lu bytes requested, peak %ld bytes\n",
+           name, counters.allocations, counters.deallocations, counters.bytes, counters.peak_bytes);
+    return counters;
+}
+
+/**
+ * @brief Assert a call does not touch the heap at all
+ *
+ */
+template <typename Operation>
+void AssertNoAllocations(const char *name, Operation operation)
+{
+    const AllocationCounters counters = Measure(name, operation);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, counters.allocations, name);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, counters.deallocations, name);
+}
+
+/**
+ * @brief Assert a call gives back everything it allocated and stays below the peak budget
+ *
+ */
+template <typename Operation>
+void AssertNoLeak(const char *name, Operation operation)
+{
+    const AllocationCounters counters = Measure(name, operation);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, counters.current_bytes, name);
+    TEST_ASSERT_LESS_OR_EQUAL(kMaximumPeakHeap, counters.peak_bytes);
+}
+
+void test_send_does_not_allocate(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->BeginAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->SetWorkMode(LoRaSettings::WorkMode::kWorkModeFixedPoint));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->EndAtMode());
+
+    AssertNoAllocations("SendMessage/bytes", []()
+                        { lora->SendMessage(reinterpret_cast<const uint8_t *>(kMessage), kMessageSize); });
+    AssertNoAllocations("SendMessage/chars", []()
+                        { lora->SendMessage(kMessage, kMessageSize); });
+    AssertNoAllocations("SendMessage/fixed_point", []()
+                        { lora->SendMessage(kMessage, kMessageSize, 1, 40); });
+}
+
+void test_receive_does_not_allocate(void)
+{
+    module->InjectFrame(reinterpret_cast<const uint8_t *>(kMessage), kMessageSize);
+
+    AssertNoAllocations("Available", []()
+                        { lora->Available(); });
+    AssertNoAllocations("ReceiveMessage", []()
+                        { lora->ReceiveMessage(buffer, sizeof(buffer)); });
+    TEST_ASSERT_EQUAL_STRING(kMessage, reinterpret_cast<char *>(buffer));
+}
+
+void test_cached_getters_do_not_allocate(void)
+{
+    LoRaSettings::CommandEchoFunction echo;
+    LoRaSettings::WorkMode work_mode;
+    LoRaUartSettings::LoRaUartSettings uart_settings;
+    LoRaSettings::PowerConsumptionMode power_consumption_mode;
+    LoRaSettings::LoRaAirRateLevel air_rate_level;
+    LoRaSettings::ForwardErrorCorrection forward_error_correction;
+    int value;
+    // Room is reserved up front, so copying the cached value does not have to grow the string
+    String node_id;
+    node_id.reserve(32);
+    String firmware_version;
+    firmware_version.reserve(32);
+
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->BeginAtMode());
+
+    // First calls query the module and fill the cache
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->GetEcho(echo));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->GetNodeId(node_id));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->GetFirmwareVersion(firmware_version));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->GetWorkMode(work_mode));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->GetUartSettings(uart_settings));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->GetPowerConsumptionMode(power_consumption_mode));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->GetWakingUpInterval(value));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->GetAirRateLevel(air_rate_level));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->GetDestinationAddress(value));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->GetChannel(value));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->GetForwardErrorCorrection(forward_error_correction));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->GetPowerTransmissionValue(value));
+
+    AssertNoAllocations("GetEcho/cached", [&]()
+                        { lora->GetEcho(echo); });
+    AssertNoAllocations("GetNodeId/cached", [&]()
+                        { lora->GetNodeId(node_id); });
+    AssertNoAllocations("GetFirmwareVersion/cached", [&]()
+                        { lora->GetFirmwareVersion(firmware_version); });
+    AssertNoAllocations("GetWorkMode/cached", [&]()
+                        { lora->GetWorkMode(work_mode); });
+    AssertNoAllocations("GetUartSettings/cached", [&]()
+                        { lora->GetUartSettings(uart_settings); });
+    AssertNoAllocations("GetPowerConsumptionMode/cached", [&]()
+                        { lora->GetPowerConsumptionMode(power_consumption_mode); });
+    AssertNoAllocations("GetWakingUpInterval/cached", [&]()
+                        { lora->GetWakingUpInterval(value); });
+    AssertNoAllocations("GetAirRateLevel/cached", [&]()
+                        { lora->GetAirRateLevel(air_rate_level); });
+    AssertNoAllocations("GetDestinationAddress/cached", [&]()
+                        { lora->GetDestinationAddress(value); });
+    AssertNoAllocations("GetChannel/cached", [&]()
+                        { lora->GetChannel(value); });
+    AssertNoAllocations("GetForwardErrorCorrection/cached", [&]()
+                        { lora->GetForwardErrorCorrection(forward_error_correction); });
+    AssertNoAllocations("GetPowerTransmissionValue/cached", [&]()
+                        { lora->GetPowerTransmissionValue(value); });
+}
+
+/**
+ * @brief Commands are allowed to use the heap, but must give everything back
+ *
+ */
+void test_commands_do_not_leak(void)
+{
+    AssertNoLeak("BeginAtMode", []()
+                 { lora->BeginAtMode(); });
+    AssertNoLeak("SetEcho", []()
+                 { lora->SetEcho(LoRaSettings::CommandEchoFunction::kCommandEchoFunctionIsOff); });
+    AssertNoLeak("SetWorkMode", []()
+                 { lora->SetWorkMode(LoRaSettings::WorkMode::kWorkModeFixedPoint); });
+    AssertNoLeak("SetUartSettings", []()
+                 { lora->SetUartSettings(LoRaUartSettings::LoRaUartSettings(true)); });
+    AssertNoLeak("SetPowerConsumptionMode", []()
+                 { lora->SetPowerConsumptionMode(LoRaSettings::PowerConsumptionMode::kPowerConsumptionModeWakeUp); });
+    AssertNoLeak("SetWakingUpInterval", []()
+                 { lora->SetWakingUpInterval(500); });
+    AssertNoLeak("SetAirRateLevel", []()
+                 { lora->SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268); });
+    AssertNoLeak("SetDestinationAddress", []()
+                 { lora->SetDestinationAddress(1); });
+    AssertNoLeak("SetChannel", []()
+                 { lora->SetChannel(40); });
+    AssertNoLeak("SetForwardErrorCorrection", []()
+                 { lora->SetForwardErrorCorrection(LoRaSettings::ForwardErrorCorrection::kForwardErrorCorrectionIsOn); });
+    AssertNoLeak("SetPowerTransmissionValue", []()
+                 { lora->SetPowerTransmissionValue(10); });
+    AssertNoLeak("QueryTransmissionInterval", []()
+                 { lora->QueryTransmissionInterval(); });
+    AssertNoLeak("EndAtMode", []()
+                 { lora->EndAtMode(); });
+}
+
+/**
+ * @brief Getters which query the module keep the result, only report their use
+ *
+ */
+void test_report_cold_getters(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->BeginAtMode());
+
+    String node_id;
+    int channel;
+    LoRaUartSettings::LoRaUartSettings uart_settings;
+    Measure("GetNodeId/cold", [&]()
+            { lora->GetNodeId(node_id); });
+    Measure("GetChannel/cold", [&]()
+            { lora->GetChannel(channel); });
+    Measure("GetUartSettings/cold", [&]()
+            { lora->GetUartSettings(uart_settings); });
+    AssertNoLeak("LoRaUartSettings::fromString", [&]()
+                 { uart_settings.fromString("115200,8,1,NONE,485"); });
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_send_does_not_allocate);
+    RUN_TEST(test_receive_does_not_allocate);
+    RUN_TEST(test_cached_getters_do_not_allocate);
+    RUN_TEST(test_commands_do_not_leak);
+    RUN_TEST(test_report_cold_getters);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
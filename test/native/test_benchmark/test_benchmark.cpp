@@ -0,0 +1,316 @@
+/**
+ * @file test_benchmark.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Benchmarks of the driver against the emulated module
+ * Every benchmark prints one JSON object per line, so results can be compared between library versions.
+ * @version 0.1
+ * @date 2024-03-04
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+
+#include "allocation_tracker.h"
+#include "emulated_usr_lg206_p.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p.h"
+
+const uint8_t enable_pin = 2;
+
+/**
+ * @brief Amount of times every operation is measured
+ *
+ */
+const size_t kIterations = 200;
+
+const char kMessage[] = "Hello world!";
+const size_t kMessageSize = sizeof(kMessage) - 1;
+const uint16_t kDestinationAddress = 1;
+const uint8_t kDestinationChannel = 40;
+
+EmulatedUsrLg206P *module;
+RS485 *rs;
+
+/**
+ * @brief The object being benchmarked
+ *
+ */
+UsrLg206P *lora;
+
+uint8_t buffer[128];
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    module = new EmulatedUsrLg206P();
+    rs = new RS485(enable_pin, enable_pin, module, false);
+    lora = new UsrLg206P(rs);
+}
+
+void tearDown(void)
+{
+    delete lora;
+    delete rs;
+    delete module;
+}
+
+/**
+ * @brief Replace the driver by a new one, so no setting is cached anymore
+ *
+ */
+void RecreateDriver(void)
+{
+    lora->EndAtMode();
+    delete lora;
+    lora = new UsrLg206P(rs);
+    lora->BeginAtMode();
+}
+
+/**
+ * @brief Measure an operation and print the result as JSON
+ *
+ * @param name of the benchmark
+ * @param setup called before every iteration, not measured
+ * @param operation measured, returns true if the operation succeeded
+ * @param warm_up true to call the operation once before measuring
+ */
+template <typename Setup, typename Operation>
+void RunBenchmark(const char *name, Setup setup, Operation operation, const bool warm_up = false)
+{
+    if (warm_up)
+    {
+        setup(0);
+        operation(0);
+    }
+
+    unsigned long long total_time = 0;
+    unsigned long total_bytes = 0;
+    unsigned long total_air_time = 0;
+    unsigned long total_delay = 0;
+    AllocationCounters total_allocations = {0, 0, 0, 0, 0};
+
+    for (size_t i = 0; i < kIterations; i++)
+    {
+        setup(i);
+
+        module->ResetCounters();
+        const unsigned long delay_before = VirtualClock::total_delay;
+        AllocationTracker::Reset();
+        AllocationTracker::Enable();
+        const auto start = std::chrono::steady_clock::now();
+
+        const bool succes = operation(i);
+
+        const auto end = std::chrono::steady_clock::now();
+        AllocationTracker::Disable();
+
+        TEST_ASSERT_TRUE_MESSAGE(succes, name);
+
+        total_time += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        const EmulatorCounters &counters = module->GetCounters();
+        total_bytes += counters.bytes_from_host + counters.bytes_to_host;
+        total_air_time += counters.air_time;
+        total_delay += VirtualClock::total_delay - delay_before;
+
+        const AllocationCounters allocations = AllocationTracker::Get();
+        total_allocations.allocations += allocations.allocations;
+        total_allocations.deallocations += allocations.deallocations;
+        total_allocations.bytes += allocations.bytes;
+        if (allocations.peak_bytes > total_allocations.peak_bytes)
+        {
+            total_allocations.peak_bytes = allocations.peak_bytes;
+        }
+    }
+
+    const double iterations = kIterations;
+    const double uart_time = LoRaAirTime::GetUartTime(LoRaUartSettings::LoRaUartSettings(true), total_bytes);
+    printf("{\"library\":\"USR-LG206-P\",\"version\":\"%s\",\"benchmark\":\"%s\",\"iterations\":%u,"
+           "\"ns_per_op\":%.1f,\"bytes_per_op\":%.1f,\"allocs_per_op\":%.2f,\"alloc_bytes_per_op\":%.1f,\"peak_heap_bytes\":%ld,"
+           "\"uart_us_per_op\":%.1f,\"air_us_per_op\":%.1f,\"delay_ms_per_op\":%.1f}\n",
+           USR_LG206_P_VERSION, name, static_cast<unsigned>(kIterations),
+           total_time / iterations, total_bytes / iterations,
+           total_allocations.allocations / iterations, total_allocations.bytes / iterations, total_allocations.peak_bytes,
+           uart_time / iterations, total_air_time / iterations, total_delay / iterations);
+}
+
+template <typename Operation>
+void RunBenchmark(const char *name, Operation operation)
+{
+    RunBenchmark(name, [](size_t) {}, operation);
+}
+
+void test_benchmark_at_mode(void)
+{
+    RunBenchmark(
+        "BeginAtMode", [](size_t)
+        { lora->EndAtMode(); },
+        [](size_t)
+        { return lora->BeginAtMode() == LoRaErrorCode::kSucces; });
+
+    RunBenchmark(
+        "EndAtMode", [](size_t)
+        { lora->BeginAtMode(); },
+        [](size_t)
+        { return lora->EndAtMode() == LoRaErrorCode::kSucces; });
+}
+
+void test_benchmark_setters(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->BeginAtMode());
+
+    // Values alternate, otherwise the cached setting prevents the command from being sent
+    RunBenchmark("SetEcho", [](size_t i)
+                 { return lora->SetEcho(i % 2 ? LoRaSettings::CommandEchoFunction::kCommandEchoFunctionIsOn : LoRaSettings::CommandEchoFunction::kCommandEchoFunctionIsOff) == LoRaErrorCode::kSucces; });
+    RunBenchmark("SetWorkMode", [](size_t i)
+                 { return lora->SetWorkMode(i % 2 ? LoRaSettings::WorkMode::kWorkModeTransparent : LoRaSettings::WorkMode::kWorkModeFixedPoint) == LoRaErrorCode::kSucces; });
+    RunBenchmark("SetUartSettings", [](size_t)
+                 { return lora->SetUartSettings(LoRaUartSettings::LoRaUartSettings(true)) == LoRaErrorCode::kSucces; });
+    RunBenchmark("SetPowerConsumptionMode", [](size_t i)
+                 { return lora->SetPowerConsumptionMode(i % 2 ? LoRaSettings::PowerConsumptionMode::kPowerConsumptionModeRun : LoRaSettings::PowerConsumptionMode::kPowerConsumptionModeWakeUp) == LoRaErrorCode::kSucces; });
+    RunBenchmark("SetWakingUpInterval", [](size_t i)
+                 { return lora->SetWakingUpInterval(i % 2 ? 500 : 4000) == LoRaErrorCode::kSucces; });
+    RunBenchmark("SetAirRateLevel", [](size_t i)
+                 { return lora->SetAirRateLevel(i % 2 ? LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268 : LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875) == LoRaErrorCode::kSucces; });
+    RunBenchmark("SetDestinationAddress", [](size_t i)
+                 { return lora->SetDestinationAddress(i % 2 ? 1 : 2) == LoRaErrorCode::kSucces; });
+    RunBenchmark("SetChannel", [](size_t i)
+                 { return lora->SetChannel(i % 2 ? 37 : 40) == LoRaErrorCode::kSucces; });
+    RunBenchmark("SetForwardErrorCorrection", [](size_t i)
+                 { return lora->SetForwardErrorCorrection(i % 2 ? LoRaSettings::ForwardErrorCorrection::kForwardErrorCorrectionIsOn : LoRaSettings::ForwardErrorCorrection::kForwardErrorCorrectionIsOff) == LoRaErrorCode::kSucces; });
+    RunBenchmark("SetPowerTransmissionValue", [](size_t i)
+                 { return lora->SetPowerTransmissionValue(i % 2 ? 10 : 20) == LoRaErrorCode::kSucces; });
+    RunBenchmark("SetTransmissionInterval", [](size_t)
+                 { return lora->SetTransmissionInterval(2000) == LoRaErrorCode::kSucces; });
+    RunBenchmark("SetKey", [](size_t)
+                 { return lora->SetKey("FFFFFFFFFFFFFFFF") == LoRaErrorCode::kSucces; });
+    RunBenchmark("QueryTransmissionInterval", [](size_t)
+                 { return lora->QueryTransmissionInterval() == LoRaErrorCode::kSucces; });
+}
+
+/**
+ * @brief Benchmark every getter, cold means the setting is not cached by the driver yet
+ *
+ * @param cold true to recreate the driver before every iteration
+ */
+void BenchmarkGetters(const bool cold)
+{
+    auto setup = [cold](size_t)
+    {
+        if (cold)
+        {
+            RecreateDriver();
+        }
+    };
+    const bool warm_up = !cold;
+
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->BeginAtMode());
+
+    RunBenchmark(cold ? "GetEcho/cold" : "GetEcho/cached", setup, [](size_t)
+                 { LoRaSettings::CommandEchoFunction value; return lora->GetEcho(value) == LoRaErrorCode::kSucces; }, warm_up);
+    RunBenchmark(cold ? "GetNodeId/cold" : "GetNodeId/cached", setup, [](size_t)
+                 { String value; return lora->GetNodeId(value) == LoRaErrorCode::kSucces; }, warm_up);
+    RunBenchmark(cold ? "GetFirmwareVersion/cold" : "GetFirmwareVersion/cached", setup, [](size_t)
+                 { String value; return lora->GetFirmwareVersion(value) == LoRaErrorCode::kSucces; }, warm_up);
+    RunBenchmark(cold ? "GetWorkMode/cold" : "GetWorkMode/cached", setup, [](size_t)
+                 { LoRaSettings::WorkMode value; return lora->GetWorkMode(value) == LoRaErrorCode::kSucces; }, warm_up);
+    RunBenchmark(cold ? "GetUartSettings/cold" : "GetUartSettings/cached", setup, [](size_t)
+                 { LoRaUartSettings::LoRaUartSettings value; return lora->GetUartSettings(value) == LoRaErrorCode::kSucces; }, warm_up);
+    RunBenchmark(cold ? "GetPowerConsumptionMode/cold" : "GetPowerConsumptionMode/cached", setup, [](size_t)
+                 { LoRaSettings::PowerConsumptionMode value; return lora->GetPowerConsumptionMode(value) == LoRaErrorCode::kSucces; }, warm_up);
+    RunBenchmark(cold ? "GetWakingUpInterval/cold" : "GetWakingUpInterval/cached", setup, [](size_t)
+                 { int value; return lora->GetWakingUpInterval(value) == LoRaErrorCode::kSucces; }, warm_up);
+    RunBenchmark(cold ? "GetAirRateLevel/cold" : "GetAirRateLevel/cached", setup, [](size_t)
+                 { LoRaSettings::LoRaAirRateLevel value; return lora->GetAirRateLevel(value) == LoRaErrorCode::kSucces; }, warm_up);
+    RunBenchmark(cold ? "GetDestinationAddress/cold" : "GetDestinationAddress/cached", setup, [](size_t)
+                 { int value; return lora->GetDestinationAddress(value) == LoRaErrorCode::kSucces; }, warm_up);
+    RunBenchmark(cold ? "GetChannel/cold" : "GetChannel/cached", setup, [](size_t)
+                 { int value; return lora->GetChannel(value) == LoRaErrorCode::kSucces; }, warm_up);
+    RunBenchmark(cold ? "GetForwardErrorCorrection/cold" : "GetForwardErrorCorrection/cached", setup, [](size_t)
+                 { LoRaSettings::ForwardErrorCorrection value; return lora->GetForwardErrorCorrection(value) == LoRaErrorCode::kSucces; }, warm_up);
+    RunBenchmark(cold ? "GetPowerTransmissionValue/cold" : "GetPowerTransmissionValue/cached", setup, [](size_t)
+                 { int value; return lora->GetPowerTransmissionValue(value) == LoRaErrorCode::kSucces; }, warm_up);
+}
+
+void test_benchmark_getters_cold(void)
+{
+    BenchmarkGetters(true);
+}
+
+void test_benchmark_getters_cached(void)
+{
+    BenchmarkGetters(false);
+}
+
+void test_benchmark_send(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->BeginAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->EndAtMode());
+
+    RunBenchmark("SendMessage/bytes", [](size_t)
+                 { return lora->SendMessage(reinterpret_cast<const uint8_t *>(kMessage), kMessageSize) == static_cast<int>(kMessageSize); });
+    RunBenchmark("SendMessage/chars", [](size_t)
+                 { return lora->SendMessage(kMessage, kMessageSize) == static_cast<int>(kMessageSize); });
+
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->BeginAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->SetWorkMode(LoRaSettings::WorkMode::kWorkModeFixedPoint));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->EndAtMode());
+
+    RunBenchmark("SendMessage/fixed_point", [](size_t)
+                 { return lora->SendMessage(kMessage, kMessageSize, kDestinationAddress, kDestinationChannel) == static_cast<int>(kMessageSize + 3); });
+}
+
+void test_benchmark_receive(void)
+{
+    RunBenchmark(
+        "ReceiveMessage", [](size_t)
+        { module->InjectFrame(reinterpret_cast<const uint8_t *>(kMessage), kMessageSize); },
+        [](size_t)
+        { return lora->ReceiveMessage(buffer, sizeof(buffer)) == kMessageSize; });
+}
+
+void test_benchmark_checksum(void)
+{
+    static uint8_t data[256];
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = i * 31;
+    }
+
+    RunBenchmark("Crc16/256", [](size_t)
+                 { return LoRaCrc::Crc16(data, sizeof(data)) != 0; });
+    RunBenchmark("Crc32/256", [](size_t)
+                 { return LoRaCrc::Crc32(data, sizeof(data)) != 0; });
+
+    lora->SetChecksum(true);
+    RunBenchmark("SendMessage/checksum", [](size_t)
+                 { return lora->SendMessage(kMessage, kMessageSize) == static_cast<int>(kMessageSize + UsrLg206P::kChecksumOverhead); });
+
+    module->SetLoopback(true);
+    RunBenchmark(
+        "ReceiveMessage/checksum", [](size_t)
+        { lora->SendMessage(kMessage, kMessageSize); },
+        [](size_t)
+        { return lora->ReceiveMessage(buffer, sizeof(buffer)) == kMessageSize; });
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_benchmark_at_mode);
+    RUN_TEST(test_benchmark_setters);
+    RUN_TEST(test_benchmark_getters_cold);
+    RUN_TEST(test_benchmark_getters_cached);
+    RUN_TEST(test_benchmark_send);
+    RUN_TEST(test_benchmark_receive);
+    RUN_TEST(test_benchmark_checksum);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,279 @@
+/**
+ * @file test_bulk_transfer.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of transferring files between two emulated modules
+ * @version 0.1
+ * @date 2024-03-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_network.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_bulk_transfer.h"
+
+const uint8_t kChannel = 40;
+const uint16_t kSenderAddress = 1;
+const uint16_t kReceiverAddress = 2;
+const uint32_t kFileSize = 10000;
+
+EmulatedAir *air;
+EmulatedRadio sender_radio;
+EmulatedRadio receiver_radio;
+LoRaBulkTransfer::LoRaBulkTransfer *sender;
+LoRaBulkTransfer::LoRaBulkTransfer *receiver;
+
+uint8_t received_file[kFileSize];
+uint32_t bytes_written;
+bool corrupt;
+
+/**
+ * @brief Result of the last transfer on each side
+ *
+ */
+struct Result
+{
+    bool done;
+    LoRaErrorCode result;
+    uint32_t progress;
+};
+
+Result sender_result;
+Result receiver_result;
+
+uint8_t FileByte(const uint32_t offset)
+{
+    return (offset * 7 + (offset >> 8)) & 0xFF;
+}
+
+size_t ReadFile(const uint32_t offset, uint8_t *buffer, const size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        buffer[i] = FileByte(offset + i) ^ (corrupt ? 0xFF : 0);
+    }
+    return size;
+}
+
+void WriteFile(const uint32_t offset, const uint8_t *data, const size_t size)
+{
+    TEST_ASSERT_EQUAL(bytes_written, offset);
+    memcpy(received_file + offset, data, size);
+    bytes_written += size;
+}
+
+void Progress(const uint16_t peer_address, const uint32_t bytes_done, const uint32_t size)
+{
+    Result &result = (peer_address == kReceiverAddress) ? sender_result : receiver_result;
+    TEST_ASSERT_TRUE(bytes_done >= result.progress);
+    TEST_ASSERT_TRUE(bytes_done <= size);
+    result.progress = bytes_done;
+}
+
+void Complete(const uint16_t peer_address, const bool sending, const LoRaErrorCode result)
+{
+    Result &side = sending ? sender_result : receiver_result;
+    side.done = true;
+    side.result = result;
+}
+
+LoRaBulkTransfer::LoRaBulkTransfer *Create(UsrLg206P *lora, const uint16_t address)
+{
+    LoRaBulkTransfer::LoRaBulkTransfer *transfer = new LoRaBulkTransfer::LoRaBulkTransfer(lora, address, kChannel);
+    transfer->SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875);
+    transfer->SetReadCallback(ReadFile);
+    transfer->SetWriteCallback(WriteFile);
+    transfer->SetProgressCallback(Progress);
+    transfer->SetCompleteCallback(Complete);
+    return transfer;
+}
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    air = new EmulatedAir();
+    sender_radio.Create(air, kSenderAddress, kChannel);
+    receiver_radio.Create(air, kReceiverAddress, kChannel);
+    sender = Create(sender_radio.lora, kSenderAddress);
+    receiver = Create(receiver_radio.lora, kReceiverAddress);
+
+    memset(received_file, 0, sizeof(received_file));
+    bytes_written = 0;
+    corrupt = false;
+    memset(&sender_result, 0, sizeof(sender_result));
+    memset(&receiver_result, 0, sizeof(receiver_result));
+}
+
+void tearDown(void)
+{
+    delete sender;
+    delete receiver;
+    sender_radio.Destroy();
+    receiver_radio.Destroy();
+    delete air;
+}
+
+/**
+ * @brief Update both sides every millisecond until the sender is done
+ *
+ * @return time the transfer took in milliseconds
+ */
+unsigned long Run(void)
+{
+    const unsigned long started_at = millis();
+    while (sender->IsSending() && millis() - started_at < 600000UL)
+    {
+        sender->Update();
+        receiver->Update();
+        VirtualClock::Advance(1);
+    }
+    return millis() - started_at;
+}
+
+void TestFileReceived(const uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++)
+    {
+        if (received_file[i] != FileByte(i))
+        {
+            TEST_FAIL_MESSAGE("File differs");
+        }
+    }
+}
+
+void test_transfer_over_lossy_link(void)
+{
+    air->SetLossRate(10);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender->Send(kFileSize, kReceiverAddress, kChannel));
+    Run();
+
+    TEST_ASSERT_TRUE(sender_result.done);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender_result.result);
+    TEST_ASSERT_TRUE(receiver_result.done);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, receiver_result.result);
+    TEST_ASSERT_EQUAL(kFileSize, bytes_written);
+    TEST_ASSERT_EQUAL(kFileSize, sender_result.progress);
+    TestFileReceived(kFileSize);
+
+    // Only lost chunks are sent again
+    const unsigned long chunks = (kFileSize + kLoRaBulkTransferMaximumChunkSize - 1) / kLoRaBulkTransferMaximumChunkSize;
+    TEST_ASSERT_EQUAL(chunks, sender->GetStatistics().chunks_sent);
+    TEST_ASSERT_GREATER_THAN(0, sender->GetStatistics().retransmissions);
+    TEST_ASSERT_LESS_THAN(chunks / 2, sender->GetStatistics().retransmissions);
+}
+
+void test_resume_after_interruption(void)
+{
+    const uint32_t size = 3000;
+    sender->SetMaximumRetries(2);
+    sender->Send(size, kReceiverAddress, kChannel);
+    while (bytes_written < 1000)
+    {
+        sender->Update();
+        receiver->Update();
+        VirtualClock::Advance(1);
+    }
+
+    air->SetInRange(sender_radio.module, receiver_radio.module, false);
+    Run();
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kNoResponse, sender_result.result);
+    TEST_ASSERT_FALSE(receiver_result.done);
+    const uint32_t written_before = bytes_written;
+
+    air->SetInRange(sender_radio.module, receiver_radio.module, true);
+    const unsigned long chunks_before = sender->GetStatistics().chunks_sent;
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender->Send(size, kReceiverAddress, kChannel));
+    Run();
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender_result.result);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, receiver_result.result);
+    TEST_ASSERT_EQUAL(size, bytes_written);
+    TestFileReceived(size);
+
+    // Second attempt continued where the receiver was
+    const unsigned long chunks_after = sender->GetStatistics().chunks_sent - chunks_before;
+    TEST_ASSERT_LESS_OR_EQUAL((size - written_before + kLoRaBulkTransferMaximumChunkSize - 1) / kLoRaBulkTransferMaximumChunkSize, chunks_after);
+}
+
+/**
+ * @brief Time both modules were on air, every acknowledgement also costs the sender a turnaround
+ *
+ */
+unsigned long GetAirTime(void)
+{
+    return sender_radio.module->GetCounters().air_time + receiver_radio.module->GetCounters().air_time;
+}
+
+void test_window_needs_fewer_acknowledgements(void)
+{
+    const uint32_t size = 2000;
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender->SetWindowSize(1));
+    sender->Send(size, kReceiverAddress, kChannel);
+    Run();
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender_result.result);
+    const unsigned long stop_and_wait_acknowledgements = receiver_radio.module->GetCounters().frames_transmitted;
+    const unsigned long stop_and_wait_air_time = GetAirTime();
+
+    // Other chunk size, so the receiver starts over with a new file
+    sender_radio.module->ResetCounters();
+    receiver_radio.module->ResetCounters();
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender->SetWindowSize(kLoRaBulkTransferWindowSize));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender->SetChunkSize(kLoRaBulkTransferMaximumChunkSize - 1));
+    bytes_written = 0;
+    memset(&sender_result, 0, sizeof(sender_result));
+    memset(&receiver_result, 0, sizeof(receiver_result));
+    sender->Send(size, kReceiverAddress, kChannel);
+    Run();
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender_result.result);
+    TestFileReceived(size);
+
+    TEST_ASSERT_LESS_OR_EQUAL(stop_and_wait_acknowledgements / (kLoRaBulkTransferWindowSize / 2), receiver_radio.module->GetCounters().frames_transmitted);
+    TEST_ASSERT_LESS_THAN(stop_and_wait_air_time, GetAirTime());
+}
+
+void test_checksum_mismatch(void)
+{
+    sender->Send(500, kReceiverAddress, kChannel);
+    // File changed after the checksum was calculated
+    corrupt = true;
+    Run();
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kChecksumMismatch, sender_result.result);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kChecksumMismatch, receiver_result.result);
+    TEST_ASSERT_EQUAL(1, receiver->GetStatistics().transfers_failed);
+}
+
+void test_invalid_transfers(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, sender->Send(0, kReceiverAddress, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, sender->SetChunkSize(0));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, sender->SetWindowSize(kLoRaBulkTransferWindowSize + 1));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kMessageTooLarge, sender->Send(static_cast<uint32_t>(LoRaBulkTransfer::kMaximumAmountOfChunks) * kLoRaBulkTransferMaximumChunkSize + 1, kReceiverAddress, kChannel));
+
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender->Send(100, kReceiverAddress, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kQueueFull, sender->Send(100, kReceiverAddress, kChannel));
+    sender->Abort();
+    TEST_ASSERT_FALSE(sender->IsSending());
+
+    // Receiver without place to write refuses
+    receiver->SetWriteCallback(nullptr);
+    sender->Send(100, kReceiverAddress, kChannel);
+    Run();
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, sender_result.result);
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_transfer_over_lossy_link);
+    RUN_TEST(test_resume_after_interruption);
+    RUN_TEST(test_window_needs_fewer_acknowledgements);
+    RUN_TEST(test_checksum_mismatch);
+    RUN_TEST(test_invalid_transfers);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
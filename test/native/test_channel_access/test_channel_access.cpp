@@ -0,0 +1,149 @@
+/**
+ * @file test_channel_access.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of listen before talk with backoff
+ * @version 0.1
+ * @date 2024-03-11
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_usr_lg206_p.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_channel_access.h"
+
+const uint8_t enable_pin = 2;
+const uint8_t kMessage[] = {1, 2, 3};
+
+EmulatedUsrLg206P *module;
+RS485 *rs;
+UsrLg206P *lora;
+LoRaChannelAccess::LoRaChannelAccess *channel_access;
+
+/**
+ * @brief Amount of delays during which another module keeps transmitting
+ *
+ */
+size_t busy_delays;
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    busy_delays = 0;
+    // Another module transmits while the code under test waits
+    When(Method(ArduinoFake(), delay)).AlwaysDo([](unsigned long ms)
+                                                 {
+                                                     VirtualClock::now += ms * 1000;
+                                                     VirtualClock::total_delay += ms;
+                                                     if (busy_delays > 0)
+                                                     {
+                                                         busy_delays--;
+                                                         module->InjectFrame(kMessage, sizeof(kMessage));
+                                                     } });
+
+    module = new EmulatedUsrLg206P();
+    rs = new RS485(enable_pin, enable_pin, module, false);
+    lora = new UsrLg206P(rs);
+    channel_access = new LoRaChannelAccess::LoRaChannelAccess(lora);
+}
+
+void tearDown(void)
+{
+    delete channel_access;
+    delete lora;
+    delete rs;
+    delete module;
+}
+
+void test_clear_channel_sends_right_away(void)
+{
+    TEST_ASSERT_TRUE(channel_access->IsChannelClear());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, channel_access->SendMessage(kMessage, sizeof(kMessage)));
+    TEST_ASSERT_EQUAL(1, module->GetCounters().frames_transmitted);
+    TEST_ASSERT_EQUAL(0, channel_access->GetStatistics().deferrals);
+    TEST_ASSERT_EQUAL(0, VirtualClock::total_delay);
+}
+
+void test_received_data_makes_channel_busy(void)
+{
+    TEST_ASSERT_TRUE(channel_access->IsChannelClear());
+    module->InjectFrame(kMessage, sizeof(kMessage));
+    TEST_ASSERT_FALSE(channel_access->IsChannelClear());
+
+    // Reading the data is activity as well
+    VirtualClock::Advance(channel_access->GetSlotTime() - 1);
+    uint8_t buffer[8];
+    lora->ReceiveMessage(buffer, sizeof(buffer));
+    TEST_ASSERT_FALSE(channel_access->IsChannelClear());
+
+    VirtualClock::Advance(channel_access->GetSlotTime());
+    TEST_ASSERT_TRUE(channel_access->IsChannelClear());
+}
+
+void test_busy_channel_defers(void)
+{
+    module->InjectFrame(kMessage, sizeof(kMessage));
+    busy_delays = 2;
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, channel_access->SendMessage(kMessage, sizeof(kMessage)));
+    TEST_ASSERT_EQUAL(3, channel_access->GetStatistics().deferrals);
+    TEST_ASSERT_EQUAL(VirtualClock::total_delay, channel_access->GetStatistics().backoff_time);
+    TEST_ASSERT_GREATER_OR_EQUAL(3 * channel_access->GetSlotTime(), VirtualClock::total_delay);
+    TEST_ASSERT_EQUAL(1, module->GetCounters().frames_transmitted);
+}
+
+void test_channel_stays_busy(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, channel_access->SetMaximumAttempts(0));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, channel_access->SetMaximumAttempts(3));
+    module->InjectFrame(kMessage, sizeof(kMessage));
+    busy_delays = 100;
+
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kChannelBusy, channel_access->SendMessage(kMessage, sizeof(kMessage)));
+    TEST_ASSERT_EQUAL(3, channel_access->GetStatistics().deferrals);
+    TEST_ASSERT_EQUAL(1, channel_access->GetStatistics().failures);
+    TEST_ASSERT_EQUAL(0, module->GetCounters().frames_transmitted);
+}
+
+void test_slot_time_follows_air_rate(void)
+{
+    TEST_ASSERT_EQUAL(kLoRaChannelAccessSlotTime, channel_access->GetSlotTime());
+    channel_access->SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268);
+    const unsigned long slow = channel_access->GetSlotTime();
+    channel_access->SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875);
+    TEST_ASSERT_GREATER_THAN(channel_access->GetSlotTime(), slow);
+}
+
+void test_seeds_give_different_backoff(void)
+{
+    unsigned long backoff[2];
+    for (size_t i = 0; i < 2; i++)
+    {
+        LoRaChannelAccess::LoRaChannelAccess access(lora);
+        access.SetRandomSeed(i + 1);
+        access.SetMaximumAttempts(4);
+        module->InjectFrame(kMessage, sizeof(kMessage));
+        busy_delays = 100;
+        access.SendMessage(kMessage, sizeof(kMessage));
+        backoff[i] = access.GetStatistics().backoff_time;
+    }
+    TEST_ASSERT_TRUE(backoff[0] != backoff[1]);
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_clear_channel_sends_right_away);
+    RUN_TEST(test_received_data_makes_channel_busy);
+    RUN_TEST(test_busy_channel_defers);
+    RUN_TEST(test_channel_stays_busy);
+    RUN_TEST(test_slot_time_follows_air_rate);
+    RUN_TEST(test_seeds_give_different_backoff);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,190 @@
+/**
+ * @file test_channel_survey.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the channel survey and moving a pair to another channel
+ * @version 0.1
+ * @date 2024-03-15
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_network.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_channel_survey.h"
+
+const uint16_t kAddressA = 1;
+const uint16_t kAddressB = 2;
+const uint8_t kChannel = 40;
+const uint8_t kBusyChannel = 41;
+const uint8_t kModerateChannel = 43;
+const uint8_t kTraffic[20] = {0};
+
+EmulatedAir *air;
+EmulatedRadio radio_a;
+EmulatedRadio radio_b;
+LoRaChannelSurvey::LoRaChannelSurvey *survey_a;
+LoRaChannelSurvey::LoRaChannelSurvey *survey_b;
+
+/**
+ * @brief Peer handles its frames while module A waits
+ *
+ */
+bool peer_active;
+bool in_peer;
+size_t amount_of_delays;
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    peer_active = false;
+    in_peer = false;
+    amount_of_delays = 0;
+    // Other modules transmit and the peer runs while the code under test waits
+    When(Method(ArduinoFake(), delay)).AlwaysDo([](unsigned long ms)
+                                                 {
+                                                     VirtualClock::now += ms * 1000;
+                                                     VirtualClock::total_delay += ms;
+                                                     amount_of_delays++;
+                                                     // Only while dwelling, the driver can not enter the AT mode while data comes in
+                                                     if (ms == kLoRaChannelSurveyPollInterval && !radio_a.module->IsAtMode() && !radio_a.module->IsFixedPoint())
+                                                     {
+                                                         if (radio_a.module->GetChannel() == kBusyChannel ||
+                                                             (radio_a.module->GetChannel() == kModerateChannel && amount_of_delays % 10 == 0))
+                                                         {
+                                                             radio_a.module->InjectFrame(kTraffic, sizeof(kTraffic));
+                                                         }
+                                                     }
+                                                     if (peer_active && !in_peer)
+                                                     {
+                                                         in_peer = true;
+                                                         uint8_t buffer[16];
+                                                         survey_b->Receive(buffer, sizeof(buffer));
+                                                         in_peer = false;
+                                                     } });
+
+    air = new EmulatedAir();
+    radio_a.Create(air, kAddressA, kChannel);
+    radio_b.Create(air, kAddressB, kChannel);
+
+    survey_a = new LoRaChannelSurvey::LoRaChannelSurvey(radio_a.lora, kAddressA, kChannel);
+    survey_b = new LoRaChannelSurvey::LoRaChannelSurvey(radio_b.lora, kAddressB, kChannel);
+    survey_a->SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875);
+    survey_b->SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875);
+}
+
+void tearDown(void)
+{
+    delete survey_a;
+    delete survey_b;
+    radio_a.Destroy();
+    radio_b.Destroy();
+    delete air;
+}
+
+void test_survey_ranks_channels(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, survey_a->Survey(41, 44, 500));
+
+    LoRaChannelSurvey::ChannelResult results[kLoRaChannelSurveyMaximumChannels];
+    TEST_ASSERT_EQUAL(4, survey_a->GetRanking(results, kLoRaChannelSurveyMaximumChannels));
+    TEST_ASSERT_EQUAL(42, results[0].channel);
+    TEST_ASSERT_EQUAL(44, results[1].channel);
+    TEST_ASSERT_EQUAL(kModerateChannel, results[2].channel);
+    TEST_ASSERT_EQUAL(kBusyChannel, results[3].channel);
+
+    TEST_ASSERT_EQUAL(0, results[0].frames);
+    TEST_ASSERT_EQUAL(0, results[0].occupancy);
+    TEST_ASSERT_GREATER_THAN(results[2].frames, results[3].frames);
+    TEST_ASSERT_GREATER_THAN(results[2].occupancy, results[3].occupancy);
+    TEST_ASSERT_EQUAL(results[3].frames * sizeof(kTraffic), results[3].bytes);
+
+    // Module is back on its own channel and work mode
+    TEST_ASSERT_EQUAL(kChannel, radio_a.module->GetChannel());
+    TEST_ASSERT_TRUE(radio_a.module->IsFixedPoint());
+    TEST_ASSERT_EQUAL(kChannel, survey_a->GetChannel());
+
+    // Smaller array gets the best channels
+    TEST_ASSERT_EQUAL(1, survey_a->GetRanking(results, 1));
+    TEST_ASSERT_EQUAL(42, results[0].channel);
+}
+
+void test_unset_level_assumes_slowest(void)
+{
+    LoRaChannelSurvey::LoRaChannelSurvey survey(radio_a.lora, kAddressA, kChannel);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, survey.Survey(kBusyChannel, kBusyChannel, 500));
+
+    LoRaChannelSurvey::ChannelResult result;
+    TEST_ASSERT_EQUAL(1, survey.GetRanking(&result, 1));
+    const unsigned long time_on_air = result.frames * LoRaAirTime::GetTimeOnAir(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268, sizeof(kTraffic));
+    TEST_ASSERT_GREATER_THAN(0, result.occupancy);
+    TEST_ASSERT_EQUAL(time_on_air / 500 < 1000 ? time_on_air / 500 : 1000, result.occupancy);
+}
+
+void test_survey_range(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, survey_a->Survey(44, 41, 500));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, survey_a->Survey(120, 128, 500));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, survey_a->Survey(0, kLoRaChannelSurveyMaximumChannels, 500));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, survey_a->Survey(41, 44, 0));
+
+    LoRaChannelSurvey::ChannelResult results[1];
+    TEST_ASSERT_EQUAL(0, survey_a->GetRanking(results, 1));
+}
+
+void test_pair_moves_together(void)
+{
+    peer_active = true;
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, survey_a->MovePair(kAddressB, 42));
+    TEST_ASSERT_EQUAL(42, radio_a.module->GetChannel());
+    TEST_ASSERT_EQUAL(42, radio_b.module->GetChannel());
+    TEST_ASSERT_EQUAL(42, survey_b->GetChannel());
+    TEST_ASSERT_TRUE(radio_a.module->IsFixedPoint());
+
+    // Pair still talks on the new channel
+    const unsigned long received = radio_b.module->GetCounters().frames_received;
+    const uint8_t message[] = {1, 2, 3};
+    radio_a.lora->SendMessage(reinterpret_cast<const char *>(message), sizeof(message), kAddressB, 42);
+    TEST_ASSERT_EQUAL(received + 1, radio_b.module->GetCounters().frames_received);
+}
+
+void test_lost_acknowledgement_still_moves(void)
+{
+    // Peer moved on a request of which the acknowledgement was lost
+    const uint8_t request[LoRaChannelSurvey::kFrameSize] = {0x80, LoRaChannelSurvey::kFrameSize - 2, 0, kAddressA, 45};
+    air->DropNext(1);
+    TEST_ASSERT_TRUE(survey_b->HandleFrame(request, sizeof(request)));
+    TEST_ASSERT_EQUAL(45, radio_b.module->GetChannel());
+
+    peer_active = true;
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, survey_a->MovePair(kAddressB, 45));
+    TEST_ASSERT_EQUAL(45, radio_a.module->GetChannel());
+    TEST_ASSERT_EQUAL(45, radio_b.module->GetChannel());
+}
+
+void test_unreachable_peer_stays(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, survey_a->MovePair(kAddressB, 128));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kNoResponse, survey_a->MovePair(kAddressB, 46));
+    TEST_ASSERT_EQUAL(kChannel, radio_a.module->GetChannel());
+    TEST_ASSERT_EQUAL(kChannel, survey_a->GetChannel());
+    TEST_ASSERT_EQUAL(kLoRaChannelSurveyMaximumRequests + 1, radio_a.module->GetCounters().frames_transmitted);
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_survey_ranks_channels);
+    RUN_TEST(test_unset_level_assumes_slowest);
+    RUN_TEST(test_survey_range);
+    RUN_TEST(test_pair_moves_together);
+    RUN_TEST(test_lost_acknowledgement_still_moves);
+    RUN_TEST(test_unreachable_peer_stays);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,242 @@
+/**
+ * @file test_compression.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the compression codec and the varint and delta helpers
+ * @version 0.1
+ * @date 2024-03-08
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "emulated_usr_lg206_p.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_compression.h"
+
+const uint8_t enable_pin = 2;
+
+/**
+ * @brief Typical sensor message, the dictionary holds the parts which are the same every time
+ *
+ */
+const char kSensorMessage[] = "{\"id\":12,\"temperature\":21.5,\"humidity\":48,\"battery\":3.71}";
+const char kDictionary[] = "{\"id\":,\"temperature\":,\"humidity\":,\"battery\":}";
+
+EmulatedUsrLg206P *module;
+RS485 *rs;
+UsrLg206P *lora;
+
+uint8_t compressed[256];
+uint8_t decompressed[256];
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    module = new EmulatedUsrLg206P();
+    rs = new RS485(enable_pin, enable_pin, module, false);
+    lora = new UsrLg206P(rs);
+}
+
+void tearDown(void)
+{
+    delete lora;
+    delete rs;
+    delete module;
+}
+
+void AssertRoundTrip(const uint8_t *data, const size_t size, const uint8_t *dictionary, const size_t dictionary_size)
+{
+    const size_t compressed_size = LoRaCompression::Compress(data, size, compressed, sizeof(compressed), dictionary, dictionary_size);
+    TEST_ASSERT_GREATER_THAN(0, compressed_size);
+    TEST_ASSERT_EQUAL(size, LoRaCompression::Decompress(compressed, compressed_size, decompressed, sizeof(decompressed), dictionary, dictionary_size));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(data, decompressed, size);
+}
+
+void test_repetitive_data_is_compressed(void)
+{
+    uint8_t data[100];
+    memset(data, 'a', sizeof(data));
+    AssertRoundTrip(data, sizeof(data), nullptr, 0);
+    TEST_ASSERT_LESS_THAN(20, LoRaCompression::Compress(data, sizeof(data), compressed, sizeof(compressed)));
+}
+
+void test_random_data_round_trips(void)
+{
+    uint8_t data[200];
+    uint32_t seed = 3;
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = seed >> 16;
+    }
+    AssertRoundTrip(data, sizeof(data), nullptr, 0);
+}
+
+void test_dictionary_shrinks_sensor_message(void)
+{
+    const uint8_t *message = reinterpret_cast<const uint8_t *>(kSensorMessage);
+    const uint8_t *dictionary = reinterpret_cast<const uint8_t *>(kDictionary);
+    const size_t size = sizeof(kSensorMessage) - 1;
+    AssertRoundTrip(message, size, dictionary, sizeof(kDictionary) - 1);
+
+    const size_t without = LoRaCompression::Compress(message, size, compressed, sizeof(compressed));
+    const size_t with = LoRaCompression::Compress(message, size, compressed, sizeof(compressed), dictionary, sizeof(kDictionary) - 1);
+    printf("sensor message: %u bytes, %u compressed, %u with dictionary\n",
+           static_cast<unsigned>(size), static_cast<unsigned>(without), static_cast<unsigned>(with));
+    TEST_ASSERT_LESS_THAN(size * 6 / 10, with);
+}
+
+void test_invalid_data_is_rejected(void)
+{
+    // Match refers before the start of the data
+    const uint8_t data[] = {0x01, 0x00, 0x05};
+    TEST_ASSERT_EQUAL(0, LoRaCompression::Decompress(data, sizeof(data), decompressed, sizeof(decompressed)));
+
+    uint8_t repeated[50];
+    memset(repeated, 'b', sizeof(repeated));
+    const size_t compressed_size = LoRaCompression::Compress(repeated, sizeof(repeated), compressed, sizeof(compressed));
+    TEST_ASSERT_EQUAL(0, LoRaCompression::Decompress(compressed, compressed_size, decompressed, 10));
+    TEST_ASSERT_EQUAL(0, LoRaCompression::Compress(repeated, sizeof(repeated), compressed, 2));
+}
+
+void test_varint(void)
+{
+    uint8_t buffer[5];
+    uint32_t value;
+    TEST_ASSERT_EQUAL(1, LoRaCompression::EncodeVarint(127, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(2, LoRaCompression::EncodeVarint(128, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(2, LoRaCompression::DecodeVarint(buffer, sizeof(buffer), value));
+    TEST_ASSERT_EQUAL(128, value);
+
+    TEST_ASSERT_EQUAL(5, LoRaCompression::EncodeVarint(0xFFFFFFFF, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(5, LoRaCompression::DecodeVarint(buffer, sizeof(buffer), value));
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFF, value);
+
+    TEST_ASSERT_EQUAL(0, LoRaCompression::EncodeVarint(300, buffer, 1));
+    TEST_ASSERT_EQUAL(0, LoRaCompression::DecodeVarint(buffer, 1, value));
+}
+
+void test_zigzag(void)
+{
+    TEST_ASSERT_EQUAL(0, LoRaCompression::EncodeZigZag(0));
+    TEST_ASSERT_EQUAL(1, LoRaCompression::EncodeZigZag(-1));
+    TEST_ASSERT_EQUAL(2, LoRaCompression::EncodeZigZag(1));
+    TEST_ASSERT_EQUAL(-2147483647 - 1, LoRaCompression::DecodeZigZag(LoRaCompression::EncodeZigZag(-2147483647 - 1)));
+    TEST_ASSERT_EQUAL(2147483647, LoRaCompression::DecodeZigZag(LoRaCompression::EncodeZigZag(2147483647)));
+}
+
+void test_deltas_of_slow_series(void)
+{
+    // Temperature in hundredths of degrees, sampled every minute
+    const int32_t series[] = {2150, 2152, 2151, 2155, 2149, 2140, 2138, 2138, 2141, 2145};
+    const size_t amount = sizeof(series) / sizeof(series[0]);
+    uint8_t buffer[64];
+    const size_t size = LoRaCompression::EncodeDeltas(series, amount, buffer, sizeof(buffer));
+    // First value takes two bytes, every difference one byte instead of four
+    TEST_ASSERT_EQUAL(amount + 1, size);
+
+    int32_t decoded[amount];
+    TEST_ASSERT_EQUAL(amount, LoRaCompression::DecodeDeltas(buffer, size, decoded, amount));
+    TEST_ASSERT_EQUAL_INT32_ARRAY(series, decoded, amount);
+
+    TEST_ASSERT_EQUAL(0, LoRaCompression::EncodeDeltas(series, amount, buffer, 4));
+}
+
+void test_codec_round_trip(void)
+{
+    module->SetLoopback(true);
+    LoRaCompression::LoRaCompression codec(lora);
+    codec.SetDictionary(reinterpret_cast<const uint8_t *>(kDictionary), sizeof(kDictionary) - 1);
+
+    const size_t size = sizeof(kSensorMessage) - 1;
+    TEST_ASSERT_GREATER_THAN(0, codec.SendMessage(reinterpret_cast<const uint8_t *>(kSensorMessage), size));
+    TEST_ASSERT_LESS_THAN(codec.GetBytesIn(), codec.GetBytesOut());
+    TEST_ASSERT_EQUAL(size, codec.ReceiveMessage(decompressed, sizeof(decompressed)));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(kSensorMessage, decompressed, size);
+
+    // Data which does not compress costs the two header bytes
+    const uint8_t short_message[] = {1, 2, 3};
+    TEST_ASSERT_GREATER_THAN(0, codec.SendMessage(short_message, sizeof(short_message)));
+    TEST_ASSERT_EQUAL(sizeof(short_message), codec.ReceiveMessage(decompressed, sizeof(decompressed)));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(short_message, decompressed, sizeof(short_message));
+
+    uint8_t large_message[kLoRaCompressionMaximumMessageSize + 1] = {0};
+    TEST_ASSERT_EQUAL(-1, codec.SendMessage(large_message, sizeof(large_message)));
+}
+
+void test_largest_raw_message_round_trips(void)
+{
+    module->SetLoopback(true);
+    LoRaCompression::LoRaCompression codec(lora);
+
+    // Random data does not compress, so it is sent raw with the header in front
+    uint8_t message[kLoRaCompressionMaximumMessageSize];
+    uint32_t seed = 5;
+    for (size_t i = 0; i < sizeof(message); i++)
+    {
+        seed = seed * 1103515245UL + 12345UL;
+        message[i] = seed >> 16;
+    }
+    TEST_ASSERT_EQUAL(sizeof(message) + LoRaCompression::kHeaderSize, codec.SendMessage(message, sizeof(message)));
+    TEST_ASSERT_EQUAL(sizeof(message), codec.ReceiveMessage(decompressed, sizeof(decompressed)));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(message, decompressed, sizeof(message));
+}
+
+void test_frames_received_together_are_split(void)
+{
+    module->SetLoopback(true);
+    LoRaCompression::LoRaCompression codec(lora);
+
+    // Both frames are in the receive buffer of the module before the first one is read
+    uint8_t repeated[60];
+    memset(repeated, 'c', sizeof(repeated));
+    const uint8_t short_message[] = {1, 2, 3};
+    TEST_ASSERT_GREATER_THAN(0, codec.SendMessage(repeated, sizeof(repeated)));
+    TEST_ASSERT_GREATER_THAN(0, codec.SendMessage(short_message, sizeof(short_message)));
+
+    TEST_ASSERT_EQUAL(sizeof(repeated), codec.ReceiveMessage(decompressed, sizeof(decompressed)));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(repeated, decompressed, sizeof(repeated));
+    TEST_ASSERT_EQUAL(sizeof(short_message), codec.ReceiveMessage(decompressed, sizeof(decompressed)));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(short_message, decompressed, sizeof(short_message));
+    TEST_ASSERT_EQUAL(0, codec.ReceiveMessage(decompressed, sizeof(decompressed)));
+}
+
+void test_largest_dictionary_round_trips(void)
+{
+    // The message repeats the end of a dictionary of kMaximumOffset bytes
+    static uint8_t dictionary[LoRaCompression::kMaximumOffset];
+    uint32_t seed = 7;
+    for (size_t i = 0; i < sizeof(dictionary); i++)
+    {
+        seed = seed * 1103515245UL + 12345UL;
+        dictionary[i] = seed >> 16;
+    }
+    const uint8_t *message = dictionary + sizeof(dictionary) - 36;
+    AssertRoundTrip(message, 36, dictionary, sizeof(dictionary));
+    TEST_ASSERT_LESS_THAN(18, LoRaCompression::Compress(message, 36, compressed, sizeof(compressed), dictionary, sizeof(dictionary)));
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_repetitive_data_is_compressed);
+    RUN_TEST(test_random_data_round_trips);
+    RUN_TEST(test_dictionary_shrinks_sensor_message);
+    RUN_TEST(test_invalid_data_is_rejected);
+    RUN_TEST(test_varint);
+    RUN_TEST(test_zigzag);
+    RUN_TEST(test_deltas_of_slow_series);
+    RUN_TEST(test_codec_round_trip);
+    RUN_TEST(test_largest_raw_message_round_trips);
+    RUN_TEST(test_frames_received_together_are_split);
+    RUN_TEST(test_largest_dictionary_round_trips);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,195 @@
+/**
+ * @file test_crc.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the CRC functions and the end to end checksum of the driver
+ * @version 0.1
+ * @date 2024-03-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_usr_lg206_p.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p.h"
+
+const uint8_t enable_pin = 2;
+const uint16_t kAddressA = 1;
+const uint16_t kAddressB = 2;
+const uint8_t kChannel = 40;
+
+/**
+ * @brief Standard input to compare CRC implementations with
+ *
+ */
+const uint8_t kCheckInput[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+
+const char kMessage[] = "Hello world!";
+const size_t kMessageSize = sizeof(kMessage) - 1;
+
+EmulatedAir *air;
+EmulatedUsrLg206P *module_a;
+EmulatedUsrLg206P *module_b;
+RS485 *rs_a;
+RS485 *rs_b;
+UsrLg206P *lora_a;
+UsrLg206P *lora_b;
+
+uint8_t buffer[64];
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    air = new EmulatedAir();
+    module_a = new EmulatedUsrLg206P();
+    module_b = new EmulatedUsrLg206P();
+    air->Attach(module_a);
+    air->Attach(module_b);
+    rs_a = new RS485(enable_pin, enable_pin, module_a, false);
+    rs_b = new RS485(enable_pin, enable_pin, module_b, false);
+    lora_a = new UsrLg206P(rs_a);
+    lora_b = new UsrLg206P(rs_b);
+    lora_a->SetChecksum(true);
+    lora_b->SetChecksum(true);
+}
+
+void tearDown(void)
+{
+    delete lora_a;
+    delete lora_b;
+    delete rs_a;
+    delete rs_b;
+    delete module_a;
+    delete module_b;
+    delete air;
+}
+
+/**
+ * @brief Build a frame as sent with the checksum turned on
+ *
+ * @return size of the frame
+ */
+size_t BuildCheckedFrame(uint8_t *frame, const uint8_t *message, const size_t size)
+{
+    frame[0] = size;
+    memcpy(frame + 1, message, size);
+    const uint16_t crc = LoRaCrc::Crc16(frame, size + 1);
+    frame[size + 1] = (crc & 0xFF00) >> 8;
+    frame[size + 2] = (crc & 0xFF);
+    return size + UsrLg206P::kChecksumOverhead;
+}
+
+void test_Crc32(void)
+{
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926UL, LoRaCrc::Crc32(kCheckInput, sizeof(kCheckInput)));
+    TEST_ASSERT_EQUAL_HEX32(0, LoRaCrc::Crc32(kCheckInput, 0));
+
+    // Continuing from every split gives the same result as one call
+    for (size_t split = 0; split <= sizeof(kCheckInput); split++)
+    {
+        const uint32_t crc = LoRaCrc::Crc32(kCheckInput, split);
+        TEST_ASSERT_EQUAL_HEX32(0xCBF43926UL, LoRaCrc::Crc32(kCheckInput + split, sizeof(kCheckInput) - split, crc));
+    }
+}
+
+void test_Crc16(void)
+{
+    TEST_ASSERT_EQUAL_HEX16(0x29B1, LoRaCrc::Crc16(kCheckInput, sizeof(kCheckInput)));
+    TEST_ASSERT_EQUAL_HEX16(LoRaCrc::kCrc16Initial, LoRaCrc::Crc16(kCheckInput, 0));
+
+    for (size_t split = 0; split <= sizeof(kCheckInput); split++)
+    {
+        const uint16_t crc = LoRaCrc::Crc16(kCheckInput, split);
+        TEST_ASSERT_EQUAL_HEX16(0x29B1, LoRaCrc::Crc16(kCheckInput + split, sizeof(kCheckInput) - split, crc));
+    }
+}
+
+void test_checksum_round_trip(void)
+{
+    TEST_ASSERT_EQUAL(kMessageSize + UsrLg206P::kChecksumOverhead, lora_a->SendMessage(kMessage, kMessageSize));
+    TEST_ASSERT_EQUAL(kMessageSize, lora_b->ReceiveMessage(buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_STRING(kMessage, reinterpret_cast<char *>(buffer));
+
+    // Commands are not affected by the checksum
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora_a->BeginAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora_a->SetWorkMode(LoRaSettings::WorkMode::kWorkModeFixedPoint));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora_a->SetChannel(kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora_a->EndAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora_b->BeginAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora_b->SetWorkMode(LoRaSettings::WorkMode::kWorkModeFixedPoint));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora_b->SetDestinationAddress(kAddressB));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora_b->SetChannel(kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora_b->EndAtMode());
+
+    TEST_ASSERT_EQUAL(3 + kMessageSize + UsrLg206P::kChecksumOverhead, lora_a->SendMessage(kMessage, kMessageSize, kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(kMessageSize, lora_b->ReceiveMessage(buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_STRING(kMessage, reinterpret_cast<char *>(buffer));
+    TEST_ASSERT_EQUAL(0, lora_b->GetChecksumErrors());
+}
+
+void test_corrupted_frames_dropped(void)
+{
+    uint8_t frame[kMessageSize + UsrLg206P::kChecksumOverhead];
+    const size_t size = BuildCheckedFrame(frame, reinterpret_cast<const uint8_t *>(kMessage), kMessageSize);
+
+    frame[4] ^= 0x10;
+    module_b->InjectFrame(frame, size);
+    TEST_ASSERT_EQUAL(0, lora_b->ReceiveMessage(buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_STRING("", reinterpret_cast<char *>(buffer));
+    TEST_ASSERT_EQUAL(1, lora_b->GetChecksumErrors());
+
+    // Frame which stops before its length
+    frame[4] ^= 0x10;
+    module_b->InjectFrame(frame, size - 1);
+    TEST_ASSERT_EQUAL(0, lora_b->ReceiveMessage(buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(2, lora_b->GetChecksumErrors());
+
+    // Frames arriving back to back are returned one at a time
+    module_b->InjectFrame(frame, size);
+    module_b->InjectFrame(frame, size);
+    TEST_ASSERT_EQUAL(kMessageSize, lora_b->ReceiveMessage(buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(kMessageSize, lora_b->ReceiveMessage(buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(0, lora_b->Available());
+    TEST_ASSERT_EQUAL(2, lora_b->GetChecksumErrors());
+}
+
+void test_message_larger_than_buffer(void)
+{
+    uint8_t frame[kMessageSize + UsrLg206P::kChecksumOverhead];
+    const size_t size = BuildCheckedFrame(frame, reinterpret_cast<const uint8_t *>(kMessage), kMessageSize);
+    module_b->InjectFrame(frame, size);
+
+    uint8_t small[6];
+    TEST_ASSERT_EQUAL(sizeof(small) - 1, lora_b->ReceiveMessage(small, sizeof(small)));
+    TEST_ASSERT_EQUAL_STRING("Hello", reinterpret_cast<char *>(small));
+    TEST_ASSERT_EQUAL(0, lora_b->Available());
+    TEST_ASSERT_EQUAL(0, lora_b->GetChecksumErrors());
+}
+
+void test_message_too_large(void)
+{
+    uint8_t large[UsrLg206P::kMaximumCheckedMessageSize + 1] = {0};
+    TEST_ASSERT_EQUAL(-1, lora_a->SendMessage(large, sizeof(large)));
+    TEST_ASSERT_EQUAL(0, air->GetTransmissions());
+
+    lora_a->SetChecksum(false);
+    TEST_ASSERT_EQUAL(sizeof(large), lora_a->SendMessage(large, sizeof(large)));
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_Crc32);
+    RUN_TEST(test_Crc16);
+    RUN_TEST(test_checksum_round_trip);
+    RUN_TEST(test_corrupted_frames_dropped);
+    RUN_TEST(test_message_larger_than_buffer);
+    RUN_TEST(test_message_too_large);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,128 @@
+/**
+ * @file test_deduplication.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the cache of recently received frames
+ * @version 0.1
+ * @date 2024-03-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "virtual_clock.h"
+#include "usr_lg206_p_deduplication.h"
+
+LoRaDeduplication::LoRaDeduplicationCache *cache;
+
+const uint8_t kReading[] = {0x12, 0x34, 0x56, 0x78};
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    cache = new LoRaDeduplication::LoRaDeduplicationCache();
+}
+
+void tearDown(void)
+{
+    delete cache;
+}
+
+void test_sequence_numbers(void)
+{
+    TEST_ASSERT_FALSE(cache->IsDuplicate(1, 0));
+    TEST_ASSERT_TRUE(cache->IsDuplicate(1, 0));
+    // Same sequence number from another module
+    TEST_ASSERT_FALSE(cache->IsDuplicate(2, 0));
+    TEST_ASSERT_FALSE(cache->IsDuplicate(1, 1));
+    TEST_ASSERT_FALSE(cache->IsDuplicate(256, 1));
+    TEST_ASSERT_TRUE(cache->IsDuplicate(256, 1));
+}
+
+void test_payloads(void)
+{
+    uint8_t other[sizeof(kReading)];
+    memcpy(other, kReading, sizeof(kReading));
+    other[3]++;
+
+    TEST_ASSERT_FALSE(cache->IsDuplicate(kReading, sizeof(kReading)));
+    TEST_ASSERT_TRUE(cache->IsDuplicate(kReading, sizeof(kReading)));
+    TEST_ASSERT_FALSE(cache->IsDuplicate(other, sizeof(other)));
+    TEST_ASSERT_FALSE(cache->IsDuplicate(kReading, sizeof(kReading) - 1));
+
+    // Bytes of a sequence number key do not match a payload
+    const uint8_t key[] = {0x00, 0x01, 0x00};
+    TEST_ASSERT_FALSE(cache->IsDuplicate(1, 0));
+    TEST_ASSERT_FALSE(cache->IsDuplicate(key, sizeof(key)));
+}
+
+void test_oldest_frame_forgotten_when_full(void)
+{
+    for (size_t i = 0; i < kLoRaDeduplicationCacheSize; i++)
+    {
+        TEST_ASSERT_FALSE(cache->IsDuplicate(1, i));
+    }
+    TEST_ASSERT_TRUE(cache->IsDuplicate(1, 0));
+
+    TEST_ASSERT_FALSE(cache->IsDuplicate(2, 0));
+    TEST_ASSERT_FALSE(cache->IsDuplicate(1, 0));
+    TEST_ASSERT_TRUE(cache->IsDuplicate(1, kLoRaDeduplicationCacheSize - 1));
+}
+
+void test_frames_expire(void)
+{
+    TEST_ASSERT_FALSE(cache->IsDuplicate(1, 0));
+    VirtualClock::Advance(kLoRaDeduplicationLifetime - 1);
+    TEST_ASSERT_TRUE(cache->IsDuplicate(1, 0));
+    VirtualClock::Advance(1);
+    // Sequence number used again after wrapping around
+    TEST_ASSERT_FALSE(cache->IsDuplicate(1, 0));
+    TEST_ASSERT_TRUE(cache->IsDuplicate(1, 0));
+}
+
+void test_statistics(void)
+{
+    TEST_ASSERT_EQUAL(0, cache->GetHitRate());
+    cache->IsDuplicate(kReading, sizeof(kReading));
+    cache->IsDuplicate(kReading, sizeof(kReading));
+    cache->IsDuplicate(kReading, sizeof(kReading));
+    cache->IsDuplicate(1, 0);
+
+    TEST_ASSERT_EQUAL(4, cache->GetStatistics().lookups);
+    TEST_ASSERT_EQUAL(2, cache->GetStatistics().hits);
+    TEST_ASSERT_EQUAL(50, cache->GetHitRate());
+
+    cache->Clear();
+    TEST_ASSERT_FALSE(cache->IsDuplicate(kReading, sizeof(kReading)));
+    TEST_ASSERT_EQUAL(5, cache->GetStatistics().lookups);
+}
+
+void test_remembered_frames_are_not_counted(void)
+{
+    // Frames sent by this module
+    cache->Remember(1, 0);
+    cache->Remember(1, 0);
+    TEST_ASSERT_EQUAL(0, cache->GetStatistics().lookups);
+
+    TEST_ASSERT_TRUE(cache->IsDuplicate(1, 0));
+    TEST_ASSERT_FALSE(cache->IsDuplicate(1, 1));
+    TEST_ASSERT_EQUAL(2, cache->GetStatistics().lookups);
+    TEST_ASSERT_EQUAL(50, cache->GetHitRate());
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_sequence_numbers);
+    RUN_TEST(test_payloads);
+    RUN_TEST(test_oldest_frame_forgotten_when_full);
+    RUN_TEST(test_frames_expire);
+    RUN_TEST(test_statistics);
+    RUN_TEST(test_remembered_frames_are_not_counted);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,294 @@
+/**
+ * @file test_dispatcher.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the dispatcher of received frames
+ * @version 0.1
+ * @date 2024-03-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_usr_lg206_p.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_dispatcher.h"
+
+const uint8_t enable_pin = 2;
+const uint8_t kChannel = 40;
+
+EmulatedUsrLg206P *module;
+RS485 *rs;
+UsrLg206P *lora;
+LoRaDispatcher::LoRaDispatcher *dispatcher;
+
+/**
+ * @brief What a handler was called with
+ *
+ */
+struct Call
+{
+    size_t count;
+    size_t size;
+    uint16_t source_address;
+    uint8_t first_byte;
+};
+
+Call sensor_calls;
+Call default_calls;
+
+void SensorHandler(const uint8_t *message, const size_t size, const uint16_t source_address)
+{
+    sensor_calls.count++;
+    sensor_calls.size = size;
+    sensor_calls.source_address = source_address;
+    sensor_calls.first_byte = message[0];
+}
+
+void DefaultHandler(const uint8_t *message, const size_t size, const uint16_t source_address)
+{
+    default_calls.count++;
+    default_calls.size = size;
+    default_calls.source_address = source_address;
+    default_calls.first_byte = message[0];
+}
+
+void SelfRemovingHandler(const uint8_t *, const size_t, const uint16_t)
+{
+    dispatcher->Unregister(SelfRemovingHandler);
+    default_calls.count++;
+}
+
+void Configure(const LoRaSettings::WorkMode work_mode)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->BeginAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->SetWorkMode(work_mode));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->SetChannel(kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, lora->EndAtMode());
+}
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    module = new EmulatedUsrLg206P();
+    rs = new RS485(enable_pin, enable_pin, module, false);
+    lora = new UsrLg206P(rs);
+    dispatcher = new LoRaDispatcher::LoRaDispatcher(lora);
+    memset(&sensor_calls, 0, sizeof(sensor_calls));
+    memset(&default_calls, 0, sizeof(default_calls));
+}
+
+void tearDown(void)
+{
+    delete dispatcher;
+    delete lora;
+    delete rs;
+    delete module;
+}
+
+/**
+ * @brief Inject a frame with the source address in its first two bytes
+ *
+ */
+void InjectFrom(const uint16_t source_address, const uint8_t value)
+{
+    const uint8_t frame[] = {static_cast<uint8_t>(source_address >> 8), static_cast<uint8_t>(source_address & 0xFF), value};
+    module->InjectFrame(frame, sizeof(frame));
+}
+
+void test_transparent_handler(void)
+{
+    Configure(LoRaSettings::WorkMode::kWorkModeTransparent);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, dispatcher->Register(LoRaSettings::WorkMode::kWorkModeTransparent, DefaultHandler));
+    TEST_ASSERT_EQUAL(0, dispatcher->Poll());
+
+    const uint8_t frame[] = {7, 8, 9};
+    module->InjectFrame(frame, sizeof(frame));
+    TEST_ASSERT_EQUAL(1, dispatcher->Poll());
+    TEST_ASSERT_EQUAL(1, default_calls.count);
+    TEST_ASSERT_EQUAL(sizeof(frame), default_calls.size);
+    TEST_ASSERT_EQUAL(7, default_calls.first_byte);
+    TEST_ASSERT_EQUAL(LoRaDispatcher::kAnySource, default_calls.source_address);
+}
+
+void test_handlers_per_source_address(void)
+{
+    Configure(LoRaSettings::WorkMode::kWorkModeFixedPoint);
+    dispatcher->SetSourceAddressOffset(0);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, dispatcher->Register(LoRaSettings::WorkMode::kWorkModeFixedPoint, SensorHandler, 0x0102));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, dispatcher->Register(LoRaSettings::WorkMode::kWorkModeFixedPoint, DefaultHandler));
+
+    InjectFrom(0x0102, 1);
+    TEST_ASSERT_EQUAL(1, dispatcher->Poll());
+    TEST_ASSERT_EQUAL(1, sensor_calls.count);
+    TEST_ASSERT_EQUAL(0x0102, sensor_calls.source_address);
+    TEST_ASSERT_EQUAL(0, default_calls.count);
+
+    // Only the default handler receives frames of other modules
+    InjectFrom(3, 2);
+    TEST_ASSERT_EQUAL(1, dispatcher->Poll());
+    TEST_ASSERT_EQUAL(1, sensor_calls.count);
+    TEST_ASSERT_EQUAL(1, default_calls.count);
+    TEST_ASSERT_EQUAL(3, default_calls.source_address);
+    TEST_ASSERT_EQUAL(2, dispatcher->GetStatistics().frames_dispatched);
+}
+
+void test_work_mode_filter(void)
+{
+    Configure(LoRaSettings::WorkMode::kWorkModeTransparent);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, dispatcher->Register(LoRaSettings::WorkMode::kWorkModeFixedPoint, DefaultHandler));
+
+    InjectFrom(1, 1);
+    TEST_ASSERT_EQUAL(1, dispatcher->Poll());
+    TEST_ASSERT_EQUAL(0, default_calls.count);
+    TEST_ASSERT_EQUAL(1, dispatcher->GetStatistics().frames_unhandled);
+
+    Configure(LoRaSettings::WorkMode::kWorkModeFixedPoint);
+    InjectFrom(1, 1);
+    TEST_ASSERT_EQUAL(1, dispatcher->Poll());
+    TEST_ASSERT_EQUAL(1, default_calls.count);
+}
+
+void test_checksum_separates_frames(void)
+{
+    Configure(LoRaSettings::WorkMode::kWorkModeFixedPoint);
+    dispatcher->SetSourceAddressOffset(0);
+    dispatcher->Register(LoRaSettings::WorkMode::kWorkModeFixedPoint, DefaultHandler);
+    lora->SetChecksum(true);
+
+    // Sent by a module with the checksum on, received back to back
+    uint8_t frame[3 + UsrLg206P::kChecksumOverhead] = {3, 0, 5, 42};
+    const uint16_t crc = LoRaCrc::Crc16(frame, 4);
+    frame[4] = crc >> 8;
+    frame[5] = crc & 0xFF;
+    module->InjectFrame(frame, sizeof(frame));
+    module->InjectFrame(frame, sizeof(frame));
+
+    TEST_ASSERT_EQUAL(2, dispatcher->Poll());
+    TEST_ASSERT_EQUAL(2, default_calls.count);
+    TEST_ASSERT_EQUAL(3, default_calls.size);
+    TEST_ASSERT_EQUAL(5, default_calls.source_address);
+}
+
+void test_registration(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, dispatcher->Register(LoRaSettings::WorkMode::kWorkModeFixedPoint, nullptr));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, dispatcher->Register(LoRaSettings::WorkMode::kWorkModeTransparent, DefaultHandler, 1));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, dispatcher->Register(static_cast<LoRaSettings::WorkMode>(3), DefaultHandler));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, dispatcher->Register(LoRaDispatcher::kAnyWorkMode, DefaultHandler, 1));
+
+    for (size_t i = 0; i < kLoRaDispatcherAmountOfHandlers; i++)
+    {
+        TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, dispatcher->Register(LoRaSettings::WorkMode::kWorkModeFixedPoint, SensorHandler, i));
+    }
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kQueueFull, dispatcher->Register(LoRaSettings::WorkMode::kWorkModeTransparent, DefaultHandler));
+
+    dispatcher->Unregister(SensorHandler);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, dispatcher->Register(LoRaSettings::WorkMode::kWorkModeTransparent, SelfRemovingHandler));
+
+    // A handler can unregister itself while it is called
+    Configure(LoRaSettings::WorkMode::kWorkModeTransparent);
+    InjectFrom(1, 1);
+    dispatcher->Poll();
+    InjectFrom(1, 1);
+    dispatcher->Poll();
+    TEST_ASSERT_EQUAL(1, default_calls.count);
+}
+
+void test_unknown_work_mode(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, dispatcher->Register(LoRaSettings::WorkMode::kWorkModeTransparent, SensorHandler));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, dispatcher->Register(LoRaDispatcher::kAnyWorkMode, DefaultHandler));
+
+    // The work mode was never set or read with the driver
+    TEST_ASSERT_EQUAL(LoRaSettings::WorkMode::kWorkModeUndefined, lora->GetKnownWorkMode());
+    InjectFrom(1, 1);
+    TEST_ASSERT_EQUAL(1, dispatcher->Poll());
+    TEST_ASSERT_EQUAL(0, sensor_calls.count);
+    TEST_ASSERT_EQUAL(1, default_calls.count);
+
+    Configure(LoRaSettings::WorkMode::kWorkModeTransparent);
+    InjectFrom(1, 1);
+    TEST_ASSERT_EQUAL(1, dispatcher->Poll());
+    TEST_ASSERT_EQUAL(1, sensor_calls.count);
+    TEST_ASSERT_EQUAL(2, default_calls.count);
+
+    dispatcher->Unregister(DefaultHandler);
+    dispatcher->Unregister(SensorHandler);
+    dispatcher->Register(LoRaSettings::WorkMode::kWorkModeFixedPoint, SensorHandler);
+    InjectFrom(1, 1);
+    TEST_ASSERT_EQUAL(1, dispatcher->Poll());
+    TEST_ASSERT_EQUAL(1, dispatcher->GetStatistics().frames_unhandled);
+}
+
+void test_duplicates_dropped(void)
+{
+    LoRaDeduplication::LoRaDeduplicationCache cache;
+    Configure(LoRaSettings::WorkMode::kWorkModeFixedPoint);
+    dispatcher->SetSourceAddressOffset(0);
+    dispatcher->SetDeduplicationCache(&cache);
+    dispatcher->Register(LoRaSettings::WorkMode::kWorkModeFixedPoint, DefaultHandler);
+
+    // The same frame repeated by a relay
+    InjectFrom(1, 1);
+    TEST_ASSERT_EQUAL(1, dispatcher->Poll());
+    InjectFrom(1, 1);
+    TEST_ASSERT_EQUAL(1, dispatcher->Poll());
+    InjectFrom(1, 2);
+    TEST_ASSERT_EQUAL(1, dispatcher->Poll());
+    TEST_ASSERT_EQUAL(2, default_calls.count);
+    TEST_ASSERT_EQUAL(1, dispatcher->GetStatistics().frames_duplicate);
+
+    dispatcher->SetDeduplicationCache(nullptr);
+    InjectFrom(1, 1);
+    dispatcher->Poll();
+    TEST_ASSERT_EQUAL(3, default_calls.count);
+}
+
+void test_duplicates_dropped_by_sequence_number(void)
+{
+    LoRaDeduplication::LoRaDeduplicationCache cache;
+    Configure(LoRaSettings::WorkMode::kWorkModeFixedPoint);
+    dispatcher->SetSourceAddressOffset(0);
+    dispatcher->SetSequenceNumberOffset(2);
+    dispatcher->SetDeduplicationCache(&cache);
+    dispatcher->Register(LoRaSettings::WorkMode::kWorkModeFixedPoint, DefaultHandler);
+
+    // Address, sequence number and a reading, the same reading is sent again in the next frame
+    const uint8_t first[] = {0, 1, 1, 20};
+    const uint8_t second[] = {0, 1, 2, 20};
+    const uint8_t other_source[] = {0, 2, 1, 20};
+    module->InjectFrame(first, sizeof(first));
+    dispatcher->Poll();
+    module->InjectFrame(second, sizeof(second));
+    dispatcher->Poll();
+    module->InjectFrame(other_source, sizeof(other_source));
+    dispatcher->Poll();
+    TEST_ASSERT_EQUAL(3, default_calls.count);
+
+    // Repeated by a relay which changed the last byte
+    const uint8_t repeated[] = {0, 1, 1, 21};
+    module->InjectFrame(repeated, sizeof(repeated));
+    dispatcher->Poll();
+    TEST_ASSERT_EQUAL(3, default_calls.count);
+    TEST_ASSERT_EQUAL(1, dispatcher->GetStatistics().frames_duplicate);
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_transparent_handler);
+    RUN_TEST(test_handlers_per_source_address);
+    RUN_TEST(test_work_mode_filter);
+    RUN_TEST(test_checksum_separates_frames);
+    RUN_TEST(test_registration);
+    RUN_TEST(test_unknown_work_mode);
+    RUN_TEST(test_duplicates_dropped);
+    RUN_TEST(test_duplicates_dropped_by_sequence_number);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,340 @@
+/**
+ * @file test_fragmentation.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the fragmentation layer between two emulated modules
+ * @version 0.1
+ * @date 2024-03-07
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_network.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_fragmentation.h"
+
+const uint16_t kAddressA = 1;
+const uint16_t kAddressB = 2;
+const uint8_t kChannel = 40;
+
+/**
+ * @brief Fits in the output buffer of the emulated module including headers
+ *
+ */
+const size_t kLargeMessageSize = 400;
+
+/**
+ * @brief Fits in the output buffer of the emulated module including headers and parity fragments
+ *
+ */
+const size_t kParityMessageSize = 300;
+
+EmulatedAir *air;
+EmulatedRadio radio_a;
+EmulatedRadio radio_b;
+LoRaFragmentation::LoRaFragmentation *fragmentation_a;
+LoRaFragmentation::LoRaFragmentation *fragmentation_b;
+
+uint8_t message[kLoRaFragmentationMaximumMessageSize + 1];
+uint8_t buffer[kLoRaFragmentationMaximumMessageSize];
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    air = new EmulatedAir();
+    radio_a.Create(air, kAddressA, kChannel);
+    radio_b.Create(air, kAddressB, kChannel);
+
+    fragmentation_a = new LoRaFragmentation::LoRaFragmentation(radio_a.lora, kAddressA);
+    fragmentation_b = new LoRaFragmentation::LoRaFragmentation(radio_b.lora, kAddressB);
+
+    for (size_t i = 0; i < sizeof(message); i++)
+    {
+        message[i] = i * 7;
+    }
+}
+
+void tearDown(void)
+{
+    delete fragmentation_a;
+    delete fragmentation_b;
+    radio_a.Destroy();
+    radio_b.Destroy();
+    delete air;
+}
+
+/**
+ * @brief Let B handle everything it received
+ *
+ * @param source_address OUTPUT address of the sender of the last message
+ * @return size of the last complete message
+ */
+size_t ReceiveAll(uint16_t &source_address)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < 32; i++)
+    {
+        size_t received = fragmentation_b->Receive(buffer, sizeof(buffer), source_address);
+        if (received > 0)
+        {
+            size = received;
+        }
+    }
+    return size;
+}
+
+/**
+ * @brief Hand a fragment to module B as if it was sent over the air
+ *
+ */
+void InjectFragment(const uint8_t message_id, const uint8_t index, const uint8_t amount_of_fragments, const size_t fragment_size, const size_t size)
+{
+    uint8_t frame[kLoRaFragmentationMaximumFrameSize];
+    const size_t offset = index * fragment_size;
+    const size_t length = (size - offset < fragment_size) ? size - offset : fragment_size;
+    frame[0] = LoRaFragmentation::kFrameTypeFragment;
+    frame[1] = length;
+    frame[2] = 0;
+    frame[3] = kAddressA;
+    frame[4] = message_id;
+    frame[5] = index;
+    frame[6] = amount_of_fragments;
+    frame[7] = size >> 8;
+    frame[8] = size & 0xFF;
+    memcpy(frame + LoRaFragmentation::kHeaderSize, message + offset, length);
+    radio_b.module->InjectFrame(frame, LoRaFragmentation::kHeaderSize + length);
+}
+
+/**
+ * @brief Hand the parity fragment of a group to module B, the XOR of the fragments in the group
+ *
+ */
+void InjectParity(const uint8_t message_id, const uint8_t first_index, const uint8_t group_size, const uint8_t amount_of_fragments, const size_t fragment_size, const size_t size)
+{
+    uint8_t frame[kLoRaFragmentationMaximumFrameSize] = {0};
+    size_t parity_length = 0;
+    for (size_t index = first_index; index < first_index + group_size && index < amount_of_fragments; index++)
+    {
+        const size_t offset = index * fragment_size;
+        const size_t length = (size - offset < fragment_size) ? size - offset : fragment_size;
+        parity_length = (length > parity_length) ? length : parity_length;
+        for (size_t i = 0; i < length; i++)
+        {
+            frame[LoRaFragmentation::kHeaderSize + i] ^= message[offset + i];
+        }
+    }
+    frame[0] = LoRaFragmentation::kFrameTypeFragment | group_size;
+    frame[1] = parity_length;
+    frame[2] = 0;
+    frame[3] = kAddressA;
+    frame[4] = message_id;
+    frame[5] = first_index;
+    frame[6] = amount_of_fragments;
+    frame[7] = size >> 8;
+    frame[8] = size & 0xFF;
+    radio_b.module->InjectFrame(frame, LoRaFragmentation::kHeaderSize + parity_length);
+}
+
+void test_large_message_is_reassembled(void)
+{
+    const size_t amount_of_fragments = fragmentation_a->GetAmountOfFragments(kLargeMessageSize);
+    TEST_ASSERT_GREATER_THAN(1, amount_of_fragments);
+    const unsigned long started_at = millis();
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, fragmentation_a->Send(message, kLargeMessageSize, kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(amount_of_fragments, fragmentation_a->GetStatistics().fragments_sent);
+
+    // Spaced by the time on air of the slowest level when no level is set
+    const unsigned long fragment_time = LoRaAirTime::GetTimeOnAir(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268, kLoRaFragmentationMaximumFrameSize + 3) / 1000;
+    TEST_ASSERT_GREATER_OR_EQUAL((amount_of_fragments - 1) * fragment_time, millis() - started_at);
+
+    uint16_t source = 0;
+    TEST_ASSERT_EQUAL(kLargeMessageSize, ReceiveAll(source));
+    TEST_ASSERT_EQUAL(kAddressA, source);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(message, buffer, kLargeMessageSize);
+    TEST_ASSERT_EQUAL(1, fragmentation_b->GetStatistics().messages_received);
+}
+
+void test_small_message_is_one_fragment(void)
+{
+    TEST_ASSERT_EQUAL(1, fragmentation_a->GetAmountOfFragments(10));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, fragmentation_a->Send(message, 10, kAddressB, kChannel));
+
+    uint16_t source = 0;
+    TEST_ASSERT_EQUAL(10, ReceiveAll(source));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(message, buffer, 10);
+}
+
+void test_fragments_out_of_order(void)
+{
+    const size_t fragment_size = 20;
+    const size_t size = 70;
+    InjectFragment(3, 3, 4, fragment_size, size);
+    InjectFragment(3, 1, 4, fragment_size, size);
+    InjectFragment(3, 1, 4, fragment_size, size);
+    InjectFragment(3, 0, 4, fragment_size, size);
+    InjectFragment(3, 2, 4, fragment_size, size);
+
+    uint16_t source = 0;
+    TEST_ASSERT_EQUAL(size, ReceiveAll(source));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(message, buffer, size);
+    TEST_ASSERT_EQUAL(1, fragmentation_b->GetStatistics().duplicate_fragments);
+}
+
+void test_incomplete_message_times_out(void)
+{
+    // Second fragment is lost
+    InjectFragment(1, 0, 3, 20, 50);
+    InjectFragment(1, 2, 3, 20, 50);
+
+    uint16_t source = 0;
+    TEST_ASSERT_EQUAL(0, ReceiveAll(source));
+    VirtualClock::Advance(kLoRaFragmentationReassemblyTimeout);
+    TEST_ASSERT_EQUAL(0, ReceiveAll(source));
+    TEST_ASSERT_EQUAL(1, fragmentation_b->GetStatistics().messages_timed_out);
+
+    // The late fragment starts a new message instead of completing the dropped one
+    InjectFragment(1, 1, 3, 20, 50);
+    TEST_ASSERT_EQUAL(0, ReceiveAll(source));
+}
+
+void test_slow_message_does_not_time_out(void)
+{
+    // Every fragment arrives within the timeout, the whole message takes longer
+    uint16_t source = 0;
+    for (uint8_t index = 0; index < 3; index++)
+    {
+        InjectFragment(2, index, 3, 20, 50);
+        const size_t size = ReceiveAll(source);
+        if (index < 2)
+        {
+            TEST_ASSERT_EQUAL(0, size);
+            VirtualClock::Advance(kLoRaFragmentationReassemblyTimeout * 2 / 3);
+            fragmentation_b->Update();
+        }
+        else
+        {
+            TEST_ASSERT_EQUAL(50, size);
+        }
+    }
+    TEST_ASSERT_EQUAL(0, fragmentation_b->GetStatistics().messages_timed_out);
+}
+
+void test_oldest_message_is_dropped_when_buffers_are_full(void)
+{
+    uint16_t source = 0;
+    for (size_t i = 0; i <= kLoRaFragmentationAmountOfBuffers; i++)
+    {
+        InjectFragment(i, 0, 2, 20, 30);
+        TEST_ASSERT_EQUAL(0, ReceiveAll(source));
+        VirtualClock::Advance(1);
+    }
+    TEST_ASSERT_EQUAL(1, fragmentation_b->GetStatistics().messages_dropped);
+
+    // Most recent message can still be completed
+    InjectFragment(kLoRaFragmentationAmountOfBuffers, 1, 2, 20, 30);
+    TEST_ASSERT_EQUAL(30, ReceiveAll(source));
+}
+
+void test_invalid_parameters(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kMessageTooLarge, fragmentation_a->Send(message, kLoRaFragmentationMaximumMessageSize + 1, kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, fragmentation_a->Send(message, 0, kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, fragmentation_a->SetFrameSize(LoRaFragmentation::kHeaderSize));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, fragmentation_a->SetFrameSize(kLoRaFragmentationMaximumFrameSize + 1));
+
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, radio_a.lora->BeginAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, radio_a.lora->SetWorkMode(LoRaSettings::WorkMode::kWorkModeTransparent));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, radio_a.lora->EndAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kWrongWorkMode, fragmentation_a->Send(message, 10, kAddressB, kChannel));
+}
+
+void test_parity_rebuilds_lost_fragment(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, fragmentation_a->SetParityGroupSize(4));
+    const size_t amount_of_fragments = fragmentation_a->GetAmountOfFragments(kParityMessageSize);
+
+    // First fragment is lost
+    air->DropNext(1);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, fragmentation_a->Send(message, kParityMessageSize, kAddressB, kChannel));
+    TEST_ASSERT_EQUAL((amount_of_fragments + 3) / 4, fragmentation_a->GetStatistics().parity_sent);
+
+    uint16_t source = 0;
+    TEST_ASSERT_EQUAL(kParityMessageSize, ReceiveAll(source));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(message, buffer, kParityMessageSize);
+    TEST_ASSERT_EQUAL(1, fragmentation_b->GetStatistics().fragments_recovered);
+
+    // Parity arriving after a complete message does not start a new one
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, fragmentation_a->Send(message, kParityMessageSize, kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(kParityMessageSize, ReceiveAll(source));
+    VirtualClock::Advance(kLoRaFragmentationReassemblyTimeout);
+    fragmentation_b->Update();
+    TEST_ASSERT_EQUAL(0, fragmentation_b->GetStatistics().messages_timed_out);
+    TEST_ASSERT_EQUAL(2, fragmentation_b->GetStatistics().messages_received);
+}
+
+void test_parity_rebuilds_short_last_fragment(void)
+{
+    // Groups hold fragments 0 to 2 and fragment 3, which is shorter
+    const size_t fragment_size = 20;
+    const size_t size = 70;
+    InjectFragment(1, 0, 4, fragment_size, size);
+    InjectFragment(1, 1, 4, fragment_size, size);
+    InjectFragment(1, 2, 4, fragment_size, size);
+    InjectParity(1, 0, 3, 4, fragment_size, size);
+    InjectParity(1, 3, 3, 4, fragment_size, size);
+
+    uint16_t source = 0;
+    TEST_ASSERT_EQUAL(size, ReceiveAll(source));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(message, buffer, size);
+
+    // Lost fragment in the middle of a group which ends with the last fragment
+    InjectFragment(2, 0, 4, fragment_size, size);
+    InjectFragment(2, 1, 4, fragment_size, size);
+    InjectFragment(2, 3, 4, fragment_size, size);
+    InjectParity(2, 0, 4, 4, fragment_size, size);
+    TEST_ASSERT_EQUAL(size, ReceiveAll(source));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(message, buffer, size);
+    TEST_ASSERT_EQUAL(2, fragmentation_b->GetStatistics().fragments_recovered);
+}
+
+void test_parity_can_not_rebuild_two_fragments(void)
+{
+    const size_t fragment_size = 20;
+    const size_t size = 70;
+    InjectFragment(1, 0, 4, fragment_size, size);
+    InjectFragment(1, 3, 4, fragment_size, size);
+    InjectParity(1, 0, 4, 4, fragment_size, size);
+
+    uint16_t source = 0;
+    TEST_ASSERT_EQUAL(0, ReceiveAll(source));
+    TEST_ASSERT_EQUAL(0, fragmentation_b->GetStatistics().fragments_recovered);
+
+    // The message is completed when one of them arrives after all
+    InjectFragment(1, 2, 4, fragment_size, size);
+    InjectParity(1, 0, 4, 4, fragment_size, size);
+    TEST_ASSERT_EQUAL(size, ReceiveAll(source));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(message, buffer, size);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, fragmentation_a->SetParityGroupSize(LoRaFragmentation::kMaximumParityGroupSize + 1));
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_large_message_is_reassembled);
+    RUN_TEST(test_small_message_is_one_fragment);
+    RUN_TEST(test_fragments_out_of_order);
+    RUN_TEST(test_incomplete_message_times_out);
+    RUN_TEST(test_slow_message_does_not_time_out);
+    RUN_TEST(test_oldest_message_is_dropped_when_buffers_are_full);
+    RUN_TEST(test_invalid_parameters);
+    RUN_TEST(test_parity_rebuilds_lost_fragment);
+    RUN_TEST(test_parity_rebuilds_short_last_fragment);
+    RUN_TEST(test_parity_can_not_rebuild_two_fragments);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
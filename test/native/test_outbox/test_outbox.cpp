@@ -0,0 +1,348 @@
+/**
+ * @file test_outbox.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the persistent outbox through outages of the link
+ * @version 0.1
+ * @date 2024-03-25
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_network.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_outbox.h"
+
+const uint16_t kAddressNode = 1;
+const uint16_t kAddressGateway = 2;
+const uint8_t kChannel = 40;
+const uint16_t kAmountOfSlots = 8;
+const uint32_t kStorageSize = LoRaOutbox::kStorageHeaderSize + kAmountOfSlots * LoRaOutbox::kSlotSize;
+
+EmulatedAir *air;
+EmulatedRadio radio_node;
+EmulatedRadio radio_gateway;
+LoRaReliable::LoRaReliable *reliable_node;
+LoRaReliable::LoRaReliable *reliable_gateway;
+LoRaOutbox::LoRaOutbox *outbox;
+
+/**
+ * @brief Emulated EEPROM, survives recreating the outbox like a reboot
+ *
+ */
+uint8_t eeprom[kStorageSize];
+size_t eeprom_writes;
+size_t slot_writes[kAmountOfSlots];
+
+/**
+ * @brief Amount of writes before the power is lost, later writes are ignored
+ *
+ */
+size_t writes_left;
+
+uint8_t received[32][kLoRaOutboxMaximumMessageSize];
+size_t amount_received;
+size_t amount_batches;
+
+void ReadRam(const uint32_t address, uint8_t *buffer, const size_t size)
+{
+    memcpy(buffer, eeprom + address, size);
+}
+
+void WriteRam(const uint32_t address, const uint8_t *data, const size_t size)
+{
+    TEST_ASSERT_LESS_OR_EQUAL(kStorageSize, address + size);
+    if (writes_left == 0)
+    {
+        return;
+    }
+    writes_left--;
+
+    memcpy(eeprom + address, data, size);
+    eeprom_writes++;
+    if (address >= LoRaOutbox::kStorageHeaderSize)
+    {
+        slot_writes[(address - LoRaOutbox::kStorageHeaderSize) / LoRaOutbox::kSlotSize]++;
+    }
+}
+
+void OnDelivery(const uint16_t destination_address, const uint8_t sequence_number, const bool delivered)
+{
+    outbox->HandleDelivery(destination_address, sequence_number, delivered);
+}
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    air = new EmulatedAir();
+    radio_node.Create(air, kAddressNode, kChannel);
+    radio_gateway.Create(air, kAddressGateway, kChannel);
+
+    reliable_node = new LoRaReliable::LoRaReliable(radio_node.lora, kAddressNode, kChannel);
+    reliable_gateway = new LoRaReliable::LoRaReliable(radio_gateway.lora, kAddressGateway, kChannel);
+    reliable_node->SetDeliveryCallback(OnDelivery);
+    reliable_node->SetMaximumRetries(2);
+
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    eeprom_writes = 0;
+    memset(slot_writes, 0, sizeof(slot_writes));
+    writes_left = SIZE_MAX;
+    outbox = new LoRaOutbox::LoRaOutbox(reliable_node, ReadRam, WriteRam, kStorageSize);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, outbox->Begin());
+    amount_received = 0;
+    amount_batches = 0;
+}
+
+void tearDown(void)
+{
+    delete outbox;
+    delete reliable_node;
+    delete reliable_gateway;
+    radio_node.Destroy();
+    radio_gateway.Destroy();
+    delete air;
+}
+
+/**
+ * @brief Let the outbox send, the gateway unpack batches and the node handle acknowledgements
+ *
+ * @param steps amount of 100 ms steps
+ */
+void Run(const size_t steps)
+{
+    uint8_t batch[kLoRaReliableMaximumPayloadSize];
+    uint16_t source;
+    for (size_t i = 0; i < steps; i++)
+    {
+        outbox->Update();
+        const size_t size = reliable_gateway->Receive(batch, sizeof(batch), source);
+        if (size > 0)
+        {
+            amount_batches++;
+            size_t offset = 0;
+            while (LoRaOutbox::ReadMessage(batch, size, offset, received[amount_received], kLoRaOutboxMaximumMessageSize) > 0)
+            {
+                amount_received++;
+            }
+        }
+        reliable_node->Receive(batch, sizeof(batch), source);
+        VirtualClock::Advance(100);
+        reliable_node->Update();
+    }
+}
+
+/**
+ * @brief Recreate the reliable layer and the outbox, like a reboot of the node
+ *
+ */
+void Reboot(void)
+{
+    delete outbox;
+    delete reliable_node;
+    reliable_node = new LoRaReliable::LoRaReliable(radio_node.lora, kAddressNode, kChannel);
+    reliable_node->SetDeliveryCallback(OnDelivery);
+    outbox = new LoRaOutbox::LoRaOutbox(reliable_node, ReadRam, WriteRam, kStorageSize);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, outbox->Begin());
+}
+
+void Add(const uint8_t value, const uint8_t priority = 0)
+{
+    const uint8_t message[4] = {value, value, value, value};
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, outbox->Add(message, sizeof(message), kAddressGateway, kChannel, priority));
+}
+
+void test_messages_survive_outage(void)
+{
+    air->SetInRange(radio_node.module, radio_gateway.module, false);
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        Add(i);
+    }
+    Run(600);
+    TEST_ASSERT_EQUAL(0, amount_received);
+    TEST_ASSERT_EQUAL(5, outbox->GetAmountPending());
+    TEST_ASSERT_GREATER_THAN(0, outbox->GetStatistics().failed_deliveries);
+
+    // Link is back, the backlog is sent after the retry interval in one batch
+    air->SetInRange(radio_node.module, radio_gateway.module, true);
+    Run(kLoRaOutboxRetryInterval / 100 + 10);
+    TEST_ASSERT_EQUAL(5, amount_received);
+    TEST_ASSERT_EQUAL(1, amount_batches);
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        TEST_ASSERT_EQUAL(i, received[i][0]);
+    }
+    TEST_ASSERT_EQUAL(0, outbox->GetAmountPending());
+    TEST_ASSERT_EQUAL(5, outbox->GetStatistics().messages_delivered);
+}
+
+void test_messages_survive_reboot(void)
+{
+    air->SetInRange(radio_node.module, radio_gateway.module, false);
+    Add(1);
+    Add(2);
+    Run(100);
+
+    // Reboot, the reliable layer forgets the batch in flight
+    Reboot();
+    TEST_ASSERT_EQUAL(2, outbox->GetAmountPending());
+
+    air->SetInRange(radio_node.module, radio_gateway.module, true);
+    Run(10);
+    TEST_ASSERT_EQUAL(2, amount_received);
+    TEST_ASSERT_EQUAL(1, received[0][0]);
+    TEST_ASSERT_EQUAL(2, received[1][0]);
+
+    // Messages added after the reboot are sent after the ones before it
+    Reboot();
+    Add(3);
+    Run(10);
+    TEST_ASSERT_EQUAL(3, amount_received);
+    TEST_ASSERT_EQUAL(3, received[2][0]);
+}
+
+void test_power_loss(void)
+{
+    // Use every slot once, so the next entry goes into a slot holding a delivered message
+    for (uint8_t i = 0; i < kAmountOfSlots; i++)
+    {
+        Add(i);
+    }
+    Run(10);
+    TEST_ASSERT_EQUAL(kAmountOfSlots, amount_received);
+
+    // An entry cut off by a power loss is not replayed, neither is the delivered message it overwrote
+    const uint8_t message[4] = {9, 9, 9, 9};
+    writes_left = 1;
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, outbox->Add(message, sizeof(message), kAddressGateway, kChannel));
+    writes_left = SIZE_MAX;
+    Reboot();
+    TEST_ASSERT_EQUAL(0, outbox->GetAmountPending());
+
+    // Power lost after the acknowledgement while the batch is marked, the rest of the batch is sent again
+    amount_received = 0;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        Add(i);
+    }
+    writes_left = 1;
+    Run(10);
+    TEST_ASSERT_EQUAL(3, amount_received);
+    writes_left = SIZE_MAX;
+    Reboot();
+    TEST_ASSERT_EQUAL(2, outbox->GetAmountPending());
+    Run(10);
+    TEST_ASSERT_EQUAL(5, amount_received);
+    TEST_ASSERT_EQUAL(1, received[3][0]);
+    TEST_ASSERT_EQUAL(2, received[4][0]);
+}
+
+void test_priority_first(void)
+{
+    outbox->SetReplayOrder(LoRaOutbox::ReplayOrder::kReplayOrderPriorityFirst);
+    Add(1, 0);
+    Add(2, 5);
+    const uint8_t other[] = {3};
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, outbox->Add(other, sizeof(other), 3, kChannel, 9));
+    Add(4, 5);
+
+    // Node 3 does not exist, its message is tried last and fails
+    Run(10);
+    TEST_ASSERT_EQUAL(3, amount_received);
+    TEST_ASSERT_EQUAL(2, received[0][0]);
+    TEST_ASSERT_EQUAL(4, received[1][0]);
+    TEST_ASSERT_EQUAL(1, received[2][0]);
+    TEST_ASSERT_EQUAL(1, outbox->GetAmountPending());
+}
+
+void test_full_storage_and_wear(void)
+{
+    air->SetInRange(radio_node.module, radio_gateway.module, false);
+    for (uint8_t i = 0; i < kAmountOfSlots; i++)
+    {
+        Add(i);
+    }
+    const uint8_t message[] = {7};
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kQueueFull, outbox->Add(message, sizeof(message), kAddressGateway, kChannel));
+    TEST_ASSERT_EQUAL(1, outbox->GetStatistics().messages_dropped);
+    TEST_ASSERT_EQUAL(0, outbox->GetAmountFree());
+
+    air->SetInRange(radio_node.module, radio_gateway.module, true);
+    Run(kLoRaOutboxRetryInterval / 100 + 10);
+    TEST_ASSERT_EQUAL(kAmountOfSlots, amount_received);
+    TEST_ASSERT_EQUAL(kAmountOfSlots, outbox->GetAmountFree());
+
+    // A message which stays pending is skipped, the other slots are used in turn and wear the same
+    // Node 3 does not exist
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, outbox->Add(message, sizeof(message), 3, kChannel));
+    const size_t pending_slot_writes = slot_writes[0];
+    for (size_t round = 0; round < 3 * (kAmountOfSlots - 1); round++)
+    {
+        Add(round);
+        Run(5);
+    }
+    TEST_ASSERT_EQUAL(1, outbox->GetAmountPending());
+    TEST_ASSERT_EQUAL(pending_slot_writes, slot_writes[0]);
+    for (uint16_t slot = 2; slot < kAmountOfSlots; slot++)
+    {
+        TEST_ASSERT_EQUAL(slot_writes[1], slot_writes[slot]);
+    }
+}
+
+void test_file_storage(void)
+{
+    const char *path = "test_outbox.bin";
+    remove(path);
+    LoRaOutbox::SetFilePath(path);
+
+    uint8_t data[4];
+    LoRaOutbox::ReadFile(10, data, sizeof(data));
+    TEST_ASSERT_EQUAL(0xFF, data[0]);
+    TEST_ASSERT_EQUAL(0xFF, data[3]);
+
+    LoRaOutbox::LoRaOutbox file_outbox(reliable_node, LoRaOutbox::ReadFile, LoRaOutbox::WriteFile, 1024);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, file_outbox.Begin());
+    const uint8_t message[] = "reading";
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, file_outbox.Add(message, sizeof(message), kAddressGateway, kChannel));
+
+    LoRaOutbox::LoRaOutbox reopened(reliable_node, LoRaOutbox::ReadFile, LoRaOutbox::WriteFile, 1024);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reopened.Begin());
+    TEST_ASSERT_EQUAL(1, reopened.GetAmountPending());
+    remove(path);
+}
+
+void test_invalid_parameters(void)
+{
+    const uint8_t message[kLoRaOutboxMaximumMessageSize + 1] = {0};
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, outbox->Add(message, 0, kAddressGateway, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kMessageTooLarge, outbox->Add(message, sizeof(message), kAddressGateway, kChannel));
+
+    LoRaOutbox::LoRaOutbox small(reliable_node, ReadRam, WriteRam, 8);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, small.Begin());
+
+    // Corrupt batches stop reading
+    const uint8_t batch[] = {2, 1, 2, 9, 1};
+    uint8_t buffer[8];
+    size_t offset = 0;
+    TEST_ASSERT_EQUAL(2, LoRaOutbox::ReadMessage(batch, sizeof(batch), offset, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(0, LoRaOutbox::ReadMessage(batch, sizeof(batch), offset, buffer, sizeof(buffer)));
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_messages_survive_outage);
+    RUN_TEST(test_messages_survive_reboot);
+    RUN_TEST(test_power_loss);
+    RUN_TEST(test_priority_first);
+    RUN_TEST(test_full_storage_and_wear);
+    RUN_TEST(test_file_storage);
+    RUN_TEST(test_invalid_parameters);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,216 @@
+/**
+ * @file test_ports.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the logical ports sharing one module
+ * @version 0.1
+ * @date 2024-03-21
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_usr_lg206_p.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_ports.h"
+
+const uint8_t enable_pin = 2;
+const uint8_t kTelemetryPort = 0;
+const uint8_t kConfigurationPort = 1;
+
+EmulatedUsrLg206P *module;
+RS485 *rs;
+UsrLg206P *lora;
+LoRaPorts::LoRaPorts *ports;
+
+const uint8_t kTelemetry[] = {1, 2, 3};
+const uint8_t kConfiguration[] = {9, 8};
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    module = new EmulatedUsrLg206P();
+    // Frames sent are received back, so one module is both ends of the link
+    module->SetLoopback(true);
+    rs = new RS485(enable_pin, enable_pin, module, false);
+    lora = new UsrLg206P(rs);
+    ports = new LoRaPorts::LoRaPorts(lora);
+    ports->SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875);
+}
+
+void tearDown(void)
+{
+    delete ports;
+    delete lora;
+    delete rs;
+    delete module;
+}
+
+/**
+ * @brief Wait until the previous message is on air and send the next one, it is received back by the next update
+ *
+ * @return port of the frame sent
+ */
+uint8_t Step(void)
+{
+    VirtualClock::Advance(1000);
+    TEST_ASSERT_TRUE(ports->Update());
+    size_t size;
+    return module->GetLastFrame(size)[0] & 0x0F;
+}
+
+void test_round_trip_on_two_ports(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, ports->Open(kTelemetryPort));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, ports->Open(kConfigurationPort));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, ports->Send(kTelemetryPort, kTelemetry, sizeof(kTelemetry)));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, ports->Send(kConfigurationPort, kConfiguration, sizeof(kConfiguration)));
+    TEST_ASSERT_EQUAL(1, ports->GetAmountQueued(kTelemetryPort));
+
+    Step();
+    Step();
+    ports->Update();
+
+    uint8_t buffer[kLoRaPortsMaximumMessageSize];
+    TEST_ASSERT_EQUAL(1, ports->GetAmountReceived(kConfigurationPort));
+    TEST_ASSERT_EQUAL(sizeof(kConfiguration), ports->Receive(kConfigurationPort, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_MEMORY(kConfiguration, buffer, sizeof(kConfiguration));
+    TEST_ASSERT_EQUAL(sizeof(kTelemetry), ports->Receive(kTelemetryPort, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_MEMORY(kTelemetry, buffer, sizeof(kTelemetry));
+    TEST_ASSERT_EQUAL(0, ports->Receive(kTelemetryPort, buffer, sizeof(buffer)));
+
+    TEST_ASSERT_EQUAL(1, ports->GetStatistics(kTelemetryPort).sent);
+    TEST_ASSERT_EQUAL(1, ports->GetStatistics(kConfigurationPort).received);
+}
+
+void test_waits_for_time_on_air(void)
+{
+    ports->SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268);
+    ports->Open(kTelemetryPort);
+    ports->Send(kTelemetryPort, kTelemetry, sizeof(kTelemetry));
+    ports->Send(kTelemetryPort, kTelemetry, sizeof(kTelemetry));
+
+    TEST_ASSERT_TRUE(ports->Update());
+    TEST_ASSERT_FALSE(ports->Update());
+    VirtualClock::Advance(1000);
+    TEST_ASSERT_TRUE(ports->Update());
+}
+
+void test_full_port_does_not_block_others(void)
+{
+    ports->Open(kTelemetryPort);
+    ports->Open(kConfigurationPort);
+
+    // Telemetry is never read
+    for (size_t i = 0; i < kLoRaPortsQueueSize + 1; i++)
+    {
+        TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, ports->Send(kTelemetryPort, kTelemetry, sizeof(kTelemetry)));
+        Step();
+    }
+    ports->Send(kConfigurationPort, kConfiguration, sizeof(kConfiguration));
+    Step();
+    ports->Update();
+
+    uint8_t buffer[kLoRaPortsMaximumMessageSize];
+    TEST_ASSERT_EQUAL(sizeof(kConfiguration), ports->Receive(kConfigurationPort, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(kLoRaPortsQueueSize, ports->GetAmountReceived(kTelemetryPort));
+    TEST_ASSERT_EQUAL(1, ports->GetStatistics(kTelemetryPort).dropped);
+    TEST_ASSERT_EQUAL(0, ports->GetStatistics(kConfigurationPort).dropped);
+}
+
+void test_weighted_round_robin(void)
+{
+    ports->Open(kTelemetryPort);
+    ports->Open(kConfigurationPort);
+    for (size_t i = 0; i < kLoRaPortsQueueSize; i++)
+    {
+        ports->Send(kTelemetryPort, kTelemetry, sizeof(kTelemetry));
+        ports->Send(kConfigurationPort, kConfiguration, sizeof(kConfiguration));
+    }
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kQueueFull, ports->Send(kTelemetryPort, kTelemetry, sizeof(kTelemetry)));
+
+    // Equal weights take turns
+    TEST_ASSERT_EQUAL(kTelemetryPort, Step());
+    TEST_ASSERT_EQUAL(kConfigurationPort, Step());
+    TEST_ASSERT_EQUAL(kTelemetryPort, Step());
+    TEST_ASSERT_EQUAL(kConfigurationPort, Step());
+    VirtualClock::Advance(1000);
+    TEST_ASSERT_FALSE(ports->Update());
+
+    // Telemetry sends two messages for every configuration message
+    ports->Open(kTelemetryPort, 2);
+    for (size_t i = 0; i < kLoRaPortsQueueSize; i++)
+    {
+        ports->Send(kTelemetryPort, kTelemetry, sizeof(kTelemetry));
+        ports->Send(kConfigurationPort, kConfiguration, sizeof(kConfiguration));
+    }
+    ports->Send(kConfigurationPort, kConfiguration, sizeof(kConfiguration));
+    const uint8_t first = Step();
+    const uint8_t second = Step();
+    const uint8_t third = Step();
+    TEST_ASSERT_EQUAL(2, (first == kTelemetryPort) + (second == kTelemetryPort) + (third == kTelemetryPort));
+}
+
+void test_invalid_parameters(void)
+{
+    const uint8_t large[kLoRaPortsMaximumMessageSize + 1] = {0};
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, ports->Open(kLoRaPortsAmountOfPorts));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, ports->Open(kTelemetryPort, 0));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, ports->Send(kTelemetryPort, kTelemetry, sizeof(kTelemetry)));
+
+    ports->Open(kTelemetryPort);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, ports->Send(kTelemetryPort, kTelemetry, 0));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kMessageTooLarge, ports->Send(kTelemetryPort, large, sizeof(large)));
+
+    // Frames of other layers and of closed ports are ignored
+    const uint8_t other_layer[] = {0x10, 1, 2};
+    const uint8_t closed_port[] = {LoRaPorts::kFrameTypePort | kConfigurationPort, 1, 5};
+    module->InjectFrame(other_layer, sizeof(other_layer));
+    ports->Update();
+    module->InjectFrame(closed_port, sizeof(closed_port));
+    ports->Update();
+    TEST_ASSERT_EQUAL(0, ports->GetAmountReceived(kTelemetryPort));
+    TEST_ASSERT_EQUAL(0, ports->GetAmountReceived(kConfigurationPort));
+
+    ports->Send(kTelemetryPort, kTelemetry, sizeof(kTelemetry));
+    ports->Close(kTelemetryPort);
+    TEST_ASSERT_EQUAL(0, ports->GetAmountQueued(kTelemetryPort));
+    TEST_ASSERT_FALSE(ports->Update());
+
+    TEST_ASSERT_EQUAL(0, ports->GetStatistics(kLoRaPortsAmountOfPorts).received);
+}
+
+void test_frames_received_together_are_split(void)
+{
+    ports->Open(kTelemetryPort);
+    ports->Open(kConfigurationPort);
+
+    // Both frames are waiting in the module before the ports read them
+    const uint8_t frames[] = {LoRaPorts::kFrameTypePort | kTelemetryPort, 3, 1, 2, 3,
+                              LoRaPorts::kFrameTypePort | kConfigurationPort, 2, 9, 8};
+    module->InjectFrame(frames, sizeof(frames));
+    ports->Update();
+
+    uint8_t buffer[kLoRaPortsMaximumMessageSize];
+    TEST_ASSERT_EQUAL(sizeof(kTelemetry), ports->Receive(kTelemetryPort, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_MEMORY(kTelemetry, buffer, sizeof(kTelemetry));
+    TEST_ASSERT_EQUAL(sizeof(kConfiguration), ports->Receive(kConfigurationPort, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_MEMORY(kConfiguration, buffer, sizeof(kConfiguration));
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_round_trip_on_two_ports);
+    RUN_TEST(test_waits_for_time_on_air);
+    RUN_TEST(test_full_port_does_not_block_others);
+    RUN_TEST(test_weighted_round_robin);
+    RUN_TEST(test_invalid_parameters);
+    RUN_TEST(test_frames_received_together_are_split);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,168 @@
+/**
+ * @file test_power_control.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the transmission power control
+ * @version 0.1
+ * @date 2024-03-14
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_usr_lg206_p.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_power_control.h"
+
+const uint8_t enable_pin = 2;
+
+EmulatedUsrLg206P *module;
+RS485 *rs;
+UsrLg206P *lora;
+LoRaPowerControl::LoRaPowerControl *power_control;
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    module = new EmulatedUsrLg206P();
+    rs = new RS485(enable_pin, enable_pin, module, false);
+    lora = new UsrLg206P(rs);
+    power_control = new LoRaPowerControl::LoRaPowerControl(lora);
+}
+
+void tearDown(void)
+{
+    delete power_control;
+    delete lora;
+    delete rs;
+    delete module;
+}
+
+void Report(const size_t amount, const bool delivered)
+{
+    for (size_t i = 0; i < amount; i++)
+    {
+        power_control->ReportDelivery(delivered);
+    }
+}
+
+int GetModulePower(void)
+{
+    return atoi(module->GetRegister("PWR"));
+}
+
+void test_power_lowered_while_delivered(void)
+{
+    TEST_ASSERT_EQUAL(20, power_control->GetPower());
+    Report(kLoRaPowerControlWindow - 1, true);
+    TEST_ASSERT_EQUAL(20, power_control->GetPower());
+
+    Report(1, true);
+    TEST_ASSERT_EQUAL(19, power_control->GetPower());
+    TEST_ASSERT_EQUAL(19, GetModulePower());
+    TEST_ASSERT_FALSE(module->IsAtMode());
+    TEST_ASSERT_EQUAL(1, power_control->GetStatistics().reductions);
+}
+
+void test_changes_are_rate_limited(void)
+{
+    Report(kLoRaPowerControlWindow, true);
+    Report(kLoRaPowerControlWindow, true);
+    TEST_ASSERT_EQUAL(19, power_control->GetPower());
+    TEST_ASSERT_EQUAL(1, power_control->GetStatistics().deferred);
+
+    VirtualClock::Advance(kLoRaPowerControlMinimumInterval - 1);
+    power_control->Update();
+    TEST_ASSERT_EQUAL(19, GetModulePower());
+
+    VirtualClock::Advance(1);
+    power_control->Update();
+    TEST_ASSERT_EQUAL(18, power_control->GetPower());
+    TEST_ASSERT_EQUAL(18, GetModulePower());
+}
+
+void test_power_raised_on_loss(void)
+{
+    for (size_t i = 0; i < 4; i++)
+    {
+        Report(kLoRaPowerControlWindow, true);
+        VirtualClock::Advance(kLoRaPowerControlMinimumInterval);
+    }
+    TEST_ASSERT_EQUAL(16, power_control->GetPower());
+
+    // Window can not meet the target anymore, raised before it is complete
+    const size_t allowed_losses = kLoRaPowerControlWindow * (100 - kLoRaPowerControlTargetRatio) / 100;
+    Report(allowed_losses, false);
+    TEST_ASSERT_EQUAL(16, power_control->GetPower());
+    TEST_ASSERT_LESS_THAN(100, power_control->GetDeliveryRatio());
+    Report(1, false);
+    TEST_ASSERT_EQUAL(16 + LoRaPowerControl::kStepUp, power_control->GetPower());
+    TEST_ASSERT_EQUAL(16 + LoRaPowerControl::kStepUp, GetModulePower());
+    TEST_ASSERT_EQUAL(100, power_control->GetDeliveryRatio());
+
+    // Raise waiting for the interval is not replaced by a reduction
+    Report(allowed_losses + 1, false);
+    Report(kLoRaPowerControlWindow, true);
+    VirtualClock::Advance(kLoRaPowerControlMinimumInterval);
+    power_control->Update();
+    TEST_ASSERT_EQUAL(16 + 2 * LoRaPowerControl::kStepUp, GetModulePower());
+    TEST_ASSERT_EQUAL(2, power_control->GetStatistics().raises);
+}
+
+void test_power_range(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, power_control->SetPowerRange(9, 20));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, power_control->SetPowerRange(10, 21));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, power_control->SetPowerRange(15, 12));
+
+    // Maximum below the current power is applied right away
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, power_control->SetPowerRange(12, 14));
+    TEST_ASSERT_EQUAL(14, GetModulePower());
+
+    for (size_t i = 0; i < 4; i++)
+    {
+        VirtualClock::Advance(kLoRaPowerControlMinimumInterval);
+        Report(kLoRaPowerControlWindow, true);
+    }
+    TEST_ASSERT_EQUAL(12, GetModulePower());
+
+    for (size_t i = 0; i < 4; i++)
+    {
+        VirtualClock::Advance(kLoRaPowerControlMinimumInterval);
+        Report(kLoRaPowerControlWindow, false);
+    }
+    TEST_ASSERT_EQUAL(14, GetModulePower());
+}
+
+void test_power_read_at_begin(void)
+{
+    module->SetRegister("PWR", "15");
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, power_control->Begin());
+    TEST_ASSERT_EQUAL(15, power_control->GetPower());
+    TEST_ASSERT_FALSE(module->IsAtMode());
+
+    // Lowered from the power of the module, not from the highest power
+    Report(kLoRaPowerControlWindow, true);
+    TEST_ASSERT_EQUAL(14, GetModulePower());
+
+    // Not answered, the power stays as it was
+    module->SetResponding(false);
+    TEST_ASSERT_TRUE(power_control->Begin() != LoRaErrorCode::kSucces);
+    TEST_ASSERT_EQUAL(14, power_control->GetPower());
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_power_lowered_while_delivered);
+    RUN_TEST(test_changes_are_rate_limited);
+    RUN_TEST(test_power_raised_on_loss);
+    RUN_TEST(test_power_range);
+    RUN_TEST(test_power_read_at_begin);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
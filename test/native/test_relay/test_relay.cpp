@@ -0,0 +1,224 @@
+/**
+ * @file test_relay.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the multi hop relay in an emulated topology
+ * @version 0.1
+ * @date 2024-03-16
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_network.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_relay.h"
+
+const uint8_t kChannel = 40;
+const size_t kAmountOfNodes = 5;
+
+/**
+ * @brief Topology, node 1 reaches node 4 through 2 and 3, node 5 is a dead end next to node 1
+ * 5 - 1 - 2 - 3 - 4
+ *
+ */
+const bool kInRange[kAmountOfNodes][kAmountOfNodes] = {
+    {false, true, false, false, true},
+    {true, false, true, false, false},
+    {false, true, false, true, false},
+    {false, false, true, false, false},
+    {true, false, false, false, false},
+};
+
+EmulatedAir *air;
+EmulatedRadio radios[kAmountOfNodes];
+LoRaRelay::LoRaRelay *relays[kAmountOfNodes];
+
+const uint8_t kMessage[] = {1, 2, 3, 4, 5, 6, 7, 8};
+uint8_t received[kAmountOfNodes][kLoRaRelayMaximumPayloadSize];
+size_t received_size[kAmountOfNodes];
+uint16_t received_from[kAmountOfNodes];
+
+uint16_t AddressOf(const size_t index)
+{
+    return index + 1;
+}
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    air = new EmulatedAir();
+    for (size_t i = 0; i < kAmountOfNodes; i++)
+    {
+        radios[i].Create(air, AddressOf(i), kChannel);
+        relays[i] = new LoRaRelay::LoRaRelay(radios[i].lora, AddressOf(i), kChannel);
+        received_size[i] = 0;
+    }
+
+    for (size_t i = 0; i < kAmountOfNodes; i++)
+    {
+        for (size_t j = i + 1; j < kAmountOfNodes; j++)
+        {
+            air->SetInRange(radios[i].module, radios[j].module, kInRange[i][j]);
+        }
+    }
+}
+
+void tearDown(void)
+{
+    for (size_t i = 0; i < kAmountOfNodes; i++)
+    {
+        delete relays[i];
+        radios[i].Destroy();
+    }
+    delete air;
+}
+
+/**
+ * @brief Let every node handle its frames until none are left
+ *
+ */
+void Run(void)
+{
+    bool busy = true;
+    while (busy)
+    {
+        busy = false;
+        for (size_t i = 0; i < kAmountOfNodes; i++)
+        {
+            if (radios[i].lora->Available() <= 0)
+            {
+                continue;
+            }
+
+            busy = true;
+            const size_t size = relays[i]->Receive(received[i], sizeof(received[i]), received_from[i]);
+            if (size > 0)
+            {
+                received_size[i] = size;
+            }
+        }
+    }
+}
+
+void test_flooded_message_reaches_node_out_of_range(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, relays[0]->Send(kMessage, sizeof(kMessage), 4));
+    Run();
+
+    TEST_ASSERT_EQUAL(sizeof(kMessage), received_size[3]);
+    TEST_ASSERT_EQUAL_MEMORY(kMessage, received[3], sizeof(kMessage));
+    TEST_ASSERT_EQUAL(1, received_from[3]);
+    // Relays do not deliver frames for others
+    TEST_ASSERT_EQUAL(0, received_size[1]);
+    TEST_ASSERT_EQUAL(0, received_size[4]);
+
+    // Node 4 learned the way back
+    uint16_t next_hop;
+    uint8_t hops;
+    TEST_ASSERT_TRUE(relays[3]->GetRoute(1, next_hop, hops));
+    TEST_ASSERT_EQUAL(3, next_hop);
+    TEST_ASSERT_EQUAL(3, hops);
+    TEST_ASSERT_GREATER_THAN(0, relays[0]->GetStatistics().duplicates);
+}
+
+void test_routed_reply_uses_fewer_transmissions(void)
+{
+    // Flood, node 5 forwards as well
+    unsigned long transmissions = air->GetTransmissions();
+    relays[0]->Send(kMessage, sizeof(kMessage), 4);
+    Run();
+    const unsigned long flooded = air->GetTransmissions() - transmissions;
+    TEST_ASSERT_EQUAL(1, relays[4]->GetStatistics().forwarded);
+
+    // Reply follows the learned route, one transmission per hop
+    transmissions = air->GetTransmissions();
+    relays[3]->Send(kMessage, sizeof(kMessage), 1);
+    Run();
+    TEST_ASSERT_EQUAL(sizeof(kMessage), received_size[0]);
+    TEST_ASSERT_EQUAL(4, received_from[0]);
+    TEST_ASSERT_EQUAL(3, air->GetTransmissions() - transmissions);
+
+    // Now both ways are known
+    transmissions = air->GetTransmissions();
+    received_size[3] = 0;
+    relays[0]->Send(kMessage, sizeof(kMessage), 4);
+    Run();
+    TEST_ASSERT_EQUAL(sizeof(kMessage), received_size[3]);
+    const unsigned long routed = air->GetTransmissions() - transmissions;
+    TEST_ASSERT_EQUAL(3, routed);
+    TEST_ASSERT_LESS_THAN(flooded, routed);
+    TEST_ASSERT_EQUAL(1, relays[4]->GetStatistics().forwarded);
+}
+
+void test_hop_limit(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, relays[0]->SetMaximumHops(0));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, relays[0]->SetMaximumHops(2));
+    relays[0]->Send(kMessage, sizeof(kMessage), 4);
+    Run();
+    TEST_ASSERT_EQUAL(0, received_size[3]);
+    TEST_ASSERT_EQUAL(1, relays[2]->GetStatistics().expired);
+}
+
+void test_broadcast_reaches_all(void)
+{
+    relays[1]->Send(kMessage, sizeof(kMessage), LoRaRelay::kBroadcastAddress);
+    Run();
+    for (size_t i = 0; i < kAmountOfNodes; i++)
+    {
+        if (i != 1)
+        {
+            TEST_ASSERT_EQUAL(sizeof(kMessage), received_size[i]);
+            TEST_ASSERT_EQUAL(2, received_from[i]);
+        }
+    }
+    // Every node sent the frame once
+    TEST_ASSERT_EQUAL(kAmountOfNodes, air->GetTransmissions());
+}
+
+void test_routes_expire(void)
+{
+    relays[0]->Send(kMessage, sizeof(kMessage), 4);
+    Run();
+    uint16_t next_hop;
+    uint8_t hops;
+    TEST_ASSERT_TRUE(relays[3]->GetRoute(1, next_hop, hops));
+    TEST_ASSERT_FALSE(relays[3]->GetRoute(5, next_hop, hops));
+
+    VirtualClock::Advance(kLoRaRelayRouteLifetime);
+    TEST_ASSERT_FALSE(relays[3]->GetRoute(1, next_hop, hops));
+}
+
+void test_invalid_messages(void)
+{
+    const uint8_t large[kLoRaRelayMaximumPayloadSize + 1] = {0};
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, relays[0]->Send(kMessage, 0, 4));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kMessageTooLarge, relays[0]->Send(large, sizeof(large), 4));
+    TEST_ASSERT_EQUAL(0, air->GetTransmissions());
+
+    // Module which is not in fixed point mode
+    EmulatedUsrLg206P module;
+    RS485 rs(kEmulatedEnablePin, kEmulatedEnablePin, &module, false);
+    UsrLg206P lora(&rs);
+    LoRaRelay::LoRaRelay relay(&lora, 9, kChannel);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kWrongWorkMode, relay.Send(kMessage, sizeof(kMessage), 4));
+    TEST_ASSERT_EQUAL(0, module.GetCounters().frames_transmitted);
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_flooded_message_reaches_node_out_of_range);
+    RUN_TEST(test_routed_reply_uses_fewer_transmissions);
+    RUN_TEST(test_hop_limit);
+    RUN_TEST(test_broadcast_reaches_all);
+    RUN_TEST(test_routes_expire);
+    RUN_TEST(test_invalid_messages);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
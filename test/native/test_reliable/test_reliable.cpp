@@ -0,0 +1,319 @@
+/**
+ * @file test_reliable.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the reliable delivery layer between two emulated modules
+ * @version 0.1
+ * @date 2024-03-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_network.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_reliable.h"
+
+const uint16_t kAddressA = 1;
+const uint16_t kAddressB = 2;
+const uint8_t kChannel = 40;
+
+EmulatedAir *air;
+EmulatedRadio radio_a;
+EmulatedRadio radio_b;
+LoRaReliable::LoRaReliable *reliable_a;
+LoRaReliable::LoRaReliable *reliable_b;
+
+uint8_t buffer[kLoRaReliableMaximumPayloadSize];
+size_t amount_delivered;
+size_t amount_failed;
+
+void OnDelivery(const uint16_t destination_address, const uint8_t sequence_number, const bool delivered)
+{
+    if (delivered)
+    {
+        amount_delivered++;
+    }
+    else
+    {
+        amount_failed++;
+    }
+}
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    air = new EmulatedAir();
+    radio_a.Create(air, kAddressA, kChannel);
+    radio_b.Create(air, kAddressB, kChannel);
+
+    reliable_a = new LoRaReliable::LoRaReliable(radio_a.lora, kAddressA, kChannel);
+    reliable_b = new LoRaReliable::LoRaReliable(radio_b.lora, kAddressB, kChannel);
+    reliable_a->SetDeliveryCallback(OnDelivery);
+    amount_delivered = 0;
+    amount_failed = 0;
+}
+
+void tearDown(void)
+{
+    delete reliable_a;
+    delete reliable_b;
+    radio_a.Destroy();
+    radio_b.Destroy();
+    delete air;
+}
+
+/**
+ * @brief Let both sides handle everything they received
+ *
+ * @return amount of new messages received by B
+ */
+size_t Pump(void)
+{
+    size_t received = 0;
+    uint16_t source;
+    for (size_t i = 0; i < 8; i++)
+    {
+        if (reliable_b->Receive(buffer, sizeof(buffer), source) > 0)
+        {
+            TEST_ASSERT_EQUAL(kAddressA, source);
+            received++;
+        }
+        reliable_a->Receive(buffer, sizeof(buffer), source);
+    }
+    return received;
+}
+
+void test_message_is_acknowledged(void)
+{
+    const uint8_t message[] = "reading";
+    uint8_t sequence_number = 0xFF;
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reliable_a->Send(message, sizeof(message), kAddressB, kChannel, &sequence_number));
+    TEST_ASSERT_EQUAL(0, sequence_number);
+    TEST_ASSERT_EQUAL(1, reliable_a->GetAmountInFlight(kAddressB));
+
+    TEST_ASSERT_EQUAL(1, Pump());
+    TEST_ASSERT_EQUAL_STRING(reinterpret_cast<const char *>(message), reinterpret_cast<char *>(buffer));
+    TEST_ASSERT_EQUAL(0, reliable_a->GetAmountInFlight());
+    TEST_ASSERT_EQUAL(1, amount_delivered);
+    TEST_ASSERT_EQUAL(1, reliable_b->GetStatistics().acknowledgements_sent);
+}
+
+void test_window_limits_messages_in_flight(void)
+{
+    const uint8_t message[] = "x";
+    for (size_t i = 0; i < kLoRaReliableWindowSize; i++)
+    {
+        TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+    }
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kWindowFull, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+
+    // All frames arrive at B at once and are split again
+    TEST_ASSERT_EQUAL(kLoRaReliableWindowSize, Pump());
+    TEST_ASSERT_EQUAL(kLoRaReliableWindowSize, amount_delivered);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+}
+
+void test_lost_message_is_retransmitted(void)
+{
+    const uint8_t message[] = "lost";
+    air->DropNext(1);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(0, Pump());
+
+    // Nothing happens before the timeout expired
+    VirtualClock::Advance(reliable_a->GetRetransmissionTimeout(sizeof(message)) / 2);
+    reliable_a->Update();
+    TEST_ASSERT_EQUAL(0, reliable_a->GetStatistics().retransmissions);
+
+    VirtualClock::Advance(reliable_a->GetRetransmissionTimeout(sizeof(message)));
+    reliable_a->Update();
+    TEST_ASSERT_EQUAL(1, reliable_a->GetStatistics().retransmissions);
+    TEST_ASSERT_EQUAL(1, Pump());
+    TEST_ASSERT_EQUAL(1, amount_delivered);
+}
+
+void test_lost_acknowledgement_is_not_delivered_twice(void)
+{
+    const uint8_t message[] = "once";
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+
+    // Acknowledgement of B is lost
+    air->DropNext(1);
+    TEST_ASSERT_EQUAL(1, Pump());
+    TEST_ASSERT_EQUAL(1, reliable_a->GetAmountInFlight());
+
+    VirtualClock::Advance(reliable_a->GetRetransmissionTimeout(sizeof(message)));
+    reliable_a->Update();
+    TEST_ASSERT_EQUAL(0, Pump());
+    TEST_ASSERT_EQUAL(1, reliable_b->GetStatistics().duplicates_received);
+    TEST_ASSERT_EQUAL(1, amount_delivered);
+}
+
+void test_gap_triggers_negative_acknowledgement(void)
+{
+    const uint8_t message[] = "gap";
+    air->DropNext(1);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+
+    // The second message is acknowledged selectively and the first one is sent again without waiting for the timeout
+    TEST_ASSERT_EQUAL(2, Pump());
+    TEST_ASSERT_EQUAL(1, reliable_b->GetStatistics().negative_acknowledgements_sent);
+    TEST_ASSERT_EQUAL(1, reliable_a->GetStatistics().retransmissions);
+    TEST_ASSERT_EQUAL(2, amount_delivered);
+    TEST_ASSERT_EQUAL(0, reliable_a->GetAmountInFlight());
+}
+
+void test_message_fails_after_retries(void)
+{
+    const uint8_t message[] = "gone";
+    air->SetLossRate(100);
+    reliable_a->SetMaximumRetries(2);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+
+    for (size_t i = 0; i < 10; i++)
+    {
+        VirtualClock::Advance(reliable_a->GetRetransmissionTimeout(sizeof(message)) << i);
+        reliable_a->Update();
+    }
+    TEST_ASSERT_EQUAL(2, reliable_a->GetStatistics().retransmissions);
+    TEST_ASSERT_EQUAL(1, amount_failed);
+    TEST_ASSERT_EQUAL(0, reliable_a->GetAmountInFlight());
+}
+
+void test_given_up_message_is_not_reported_delivered(void)
+{
+    const uint8_t message[] = "seq";
+    reliable_a->SetMaximumRetries(0);
+    air->DropNext(1);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+    size_t received = Pump();
+
+    // The window does not slide past the lost message while it is in flight
+    for (size_t i = 1; i < kLoRaReliableWindowSize; i++)
+    {
+        TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+        received += Pump();
+    }
+    TEST_ASSERT_EQUAL(1, reliable_a->GetAmountInFlight());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kWindowFull, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+
+    VirtualClock::Advance(reliable_a->GetRetransmissionTimeout(sizeof(message) + LoRaReliable::kSessionIdSize));
+    reliable_a->Update();
+    TEST_ASSERT_EQUAL(1, amount_failed);
+
+    // B skips the given up sequence number, only the messages it received are reported delivered
+    for (size_t i = 0; i < 10; i++)
+    {
+        TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+        received += Pump();
+    }
+    TEST_ASSERT_EQUAL(kLoRaReliableWindowSize - 1 + 10, received);
+    TEST_ASSERT_EQUAL(received, amount_delivered);
+    TEST_ASSERT_EQUAL(1, amount_failed);
+    TEST_ASSERT_EQUAL(0, reliable_a->GetAmountInFlight());
+}
+
+void test_lossy_link_delivers_everything(void)
+{
+    air->SetLossRate(30, 7);
+    reliable_a->SetMaximumRetries(20);
+
+    const size_t amount = 50;
+    size_t sent = 0;
+    size_t received = 0;
+    while (sent < amount || reliable_a->GetAmountInFlight() > 0)
+    {
+        uint8_t message[2] = {static_cast<uint8_t>(sent), 0};
+        if (sent < amount && reliable_a->Send(message, sizeof(message), kAddressB, kChannel) == LoRaErrorCode::kSucces)
+        {
+            sent++;
+        }
+        received += Pump();
+        VirtualClock::Advance(100);
+        reliable_a->Update();
+    }
+
+    TEST_ASSERT_EQUAL(amount, received);
+    TEST_ASSERT_EQUAL(amount, amount_delivered);
+    TEST_ASSERT_EQUAL(0, amount_failed);
+}
+
+void test_restarted_sender_is_not_taken_for_duplicates(void)
+{
+    const uint8_t message[] = "before";
+    reliable_a->SetSessionId(1);
+    for (size_t i = 0; i < 3; i++)
+    {
+        TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+        TEST_ASSERT_EQUAL(1, Pump());
+    }
+
+    // A reboots while B expects sequence number 3, the new session numbers from 0 again
+    delete reliable_a;
+    reliable_a = new LoRaReliable::LoRaReliable(radio_a.lora, kAddressA, kChannel);
+    reliable_a->SetDeliveryCallback(OnDelivery);
+    reliable_a->SetSessionId(2);
+
+    const uint8_t restarted[] = "after";
+    for (size_t i = 0; i < 3; i++)
+    {
+        uint8_t sequence_number = 0xFF;
+        TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, reliable_a->Send(restarted, sizeof(restarted), kAddressB, kChannel, &sequence_number));
+        TEST_ASSERT_EQUAL(i, sequence_number);
+        if (i == 0)
+        {
+            // The acknowledgement is lost, the retransmission of the same session is recognised
+            air->DropNext(1);
+            TEST_ASSERT_EQUAL(1, Pump());
+            VirtualClock::Advance(reliable_a->GetRetransmissionTimeout(sizeof(restarted) + LoRaReliable::kSessionIdSize));
+            reliable_a->Update();
+            TEST_ASSERT_EQUAL(0, Pump());
+            TEST_ASSERT_EQUAL(1, reliable_b->GetStatistics().duplicates_received);
+            continue;
+        }
+        TEST_ASSERT_EQUAL(1, Pump());
+        TEST_ASSERT_EQUAL_STRING(reinterpret_cast<const char *>(restarted), reinterpret_cast<char *>(buffer));
+    }
+    TEST_ASSERT_EQUAL(6, reliable_b->GetStatistics().messages_received);
+    TEST_ASSERT_EQUAL(6, amount_delivered);
+    TEST_ASSERT_EQUAL(0, reliable_a->GetAmountInFlight());
+}
+
+void test_invalid_parameters(void)
+{
+    uint8_t message[kLoRaReliableMaximumPayloadSize + 1] = {0};
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kMessageTooLarge, reliable_a->Send(message, sizeof(message), kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, reliable_a->Send(message, 0, kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, reliable_a->SetWindowSize(0));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, reliable_a->SetWindowSize(kLoRaReliableWindowSize + 1));
+
+    // Transparent mode has no addresses, so acknowledgements can not be sent back
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, radio_a.lora->BeginAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, radio_a.lora->SetWorkMode(LoRaSettings::WorkMode::kWorkModeTransparent));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, radio_a.lora->EndAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kWrongWorkMode, reliable_a->Send(message, 1, kAddressB, kChannel));
+    TEST_ASSERT_EQUAL(0, reliable_a->GetAmountInFlight());
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_message_is_acknowledged);
+    RUN_TEST(test_window_limits_messages_in_flight);
+    RUN_TEST(test_lost_message_is_retransmitted);
+    RUN_TEST(test_lost_acknowledgement_is_not_delivered_twice);
+    RUN_TEST(test_gap_triggers_negative_acknowledgement);
+    RUN_TEST(test_message_fails_after_retries);
+    RUN_TEST(test_given_up_message_is_not_reported_delivered);
+    RUN_TEST(test_lossy_link_delivers_everything);
+    RUN_TEST(test_restarted_sender_is_not_taken_for_duplicates);
+    RUN_TEST(test_invalid_parameters);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,323 @@
+/**
+ * @file test_remote_config.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of changing settings of a module over the air
+ * @version 0.1
+ * @date 2024-03-23
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_network.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_remote_config.h"
+
+const uint8_t kOldChannel = 40;
+const uint8_t kNewChannel = 50;
+const uint16_t kGatewayAddress = 1;
+const uint16_t kNodeAddress = 2;
+const uint16_t kDeadline = 10;
+
+const uint8_t kKey[LoRaRemoteConfig::kKeySize] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+
+EmulatedAir *air;
+EmulatedRadio gateway_radio;
+EmulatedRadio node_radio;
+LoRaRemoteConfig::LoRaRemoteConfig *gateway;
+LoRaRemoteConfig::LoRaRemoteConfig *node;
+
+/**
+ * @brief Emulated EEPROM of the node, survives recreating the layer like a reboot
+ *
+ */
+uint8_t storage[LoRaRemoteConfig::kStorageSize];
+
+void ReadStorage(const uint32_t address, uint8_t *buffer, const size_t size)
+{
+    memcpy(buffer, storage + address, size);
+}
+
+void WriteStorage(const uint32_t address, const uint8_t *data, const size_t size)
+{
+    memcpy(storage + address, data, size);
+}
+
+size_t amount_of_confirms;
+uint16_t confirmed_sequence_number;
+LoRaErrorCode confirmed_result;
+
+void ConfirmCallback(const uint16_t source_address, const uint16_t sequence_number, const LoRaErrorCode result)
+{
+    TEST_ASSERT_EQUAL(kNodeAddress, source_address);
+    amount_of_confirms++;
+    confirmed_sequence_number = sequence_number;
+    confirmed_result = result;
+}
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    air = new EmulatedAir();
+    gateway_radio.Create(air, kGatewayAddress, kOldChannel);
+    node_radio.Create(air, kNodeAddress, kOldChannel);
+    gateway = new LoRaRemoteConfig::LoRaRemoteConfig(gateway_radio.lora, kGatewayAddress, kOldChannel, kKey);
+    node = new LoRaRemoteConfig::LoRaRemoteConfig(node_radio.lora, kNodeAddress, kOldChannel, kKey);
+    gateway->SetConfirmCallback(ConfirmCallback);
+    amount_of_confirms = 0;
+    memset(storage, 0xFF, sizeof(storage));
+}
+
+void tearDown(void)
+{
+    delete gateway;
+    delete node;
+    gateway_radio.Destroy();
+    node_radio.Destroy();
+    delete air;
+}
+
+LoRaRemoteConfig::LoRaRemoteSettings NewChannel(void)
+{
+    LoRaRemoteConfig::LoRaRemoteSettings settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.fields = LoRaRemoteConfig::kFieldChannel;
+    settings.channel = kNewChannel;
+    return settings;
+}
+
+/**
+ * @brief Move the gateway to the new channel, as done after all modules received the change
+ *
+ */
+void MoveGateway(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, gateway_radio.lora->BeginAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, gateway_radio.lora->SetChannel(kNewChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, gateway_radio.lora->EndAtMode());
+    gateway->SetLocalChannel(kNewChannel);
+}
+
+void test_committed_change_is_kept(void)
+{
+    uint16_t sequence_number;
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, gateway->SendSettings(NewChannel(), kDeadline, kNodeAddress, kOldChannel, &sequence_number));
+    node->Update();
+    TEST_ASSERT_TRUE(node->IsPending());
+    TEST_ASSERT_EQUAL(kNewChannel, node_radio.module->GetChannel());
+
+    MoveGateway();
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, gateway->Commit(sequence_number, kNodeAddress, kNewChannel));
+    node->Update();
+    TEST_ASSERT_FALSE(node->IsPending());
+    gateway->Update();
+    TEST_ASSERT_EQUAL(1, amount_of_confirms);
+    TEST_ASSERT_EQUAL(sequence_number, confirmed_sequence_number);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, confirmed_result);
+
+    // A repeated commit is confirmed again
+    gateway->Commit(sequence_number, kNodeAddress, kNewChannel);
+    node->Update();
+    gateway->Update();
+    TEST_ASSERT_EQUAL(2, amount_of_confirms);
+
+    VirtualClock::Advance(kDeadline * 1000UL);
+    node->Update();
+    TEST_ASSERT_EQUAL(kNewChannel, node_radio.module->GetChannel());
+    TEST_ASSERT_EQUAL(1, node->GetStatistics().committed);
+    TEST_ASSERT_EQUAL(0, node->GetStatistics().rolled_back);
+}
+
+void test_rollback_without_commit(void)
+{
+    uint16_t sequence_number;
+    gateway->SendSettings(NewChannel(), kDeadline, kNodeAddress, kOldChannel, &sequence_number);
+    node->Update();
+    TEST_ASSERT_EQUAL(kNewChannel, node_radio.module->GetChannel());
+
+    VirtualClock::Advance(kDeadline * 1000UL - 1);
+    node->Update();
+    TEST_ASSERT_TRUE(node->IsPending());
+    VirtualClock::Advance(1);
+    node->Update();
+    TEST_ASSERT_FALSE(node->IsPending());
+    TEST_ASSERT_EQUAL(kOldChannel, node_radio.module->GetChannel());
+    TEST_ASSERT_EQUAL(1, node->GetStatistics().rolled_back);
+
+    // The gateway still reaches the module, but the change can not be committed anymore
+    gateway->Commit(sequence_number, kNodeAddress, kOldChannel);
+    node->Update();
+    gateway->Update();
+    TEST_ASSERT_EQUAL(0, amount_of_confirms);
+    TEST_ASSERT_EQUAL(1, node->GetStatistics().rejected);
+}
+
+void test_failed_rollback_is_retried(void)
+{
+    gateway->SendSettings(NewChannel(), kDeadline, kNodeAddress, kOldChannel);
+    node->Update();
+    TEST_ASSERT_EQUAL(kNewChannel, node_radio.module->GetChannel());
+
+    // The module does not answer when the deadline expires, the change stays pending
+    node_radio.module->SetResponding(false);
+    VirtualClock::Advance(kDeadline * 1000UL);
+    node->Update();
+    TEST_ASSERT_TRUE(node->IsPending());
+    TEST_ASSERT_EQUAL(0, node->GetStatistics().rolled_back);
+    TEST_ASSERT_EQUAL(1, node->GetStatistics().failed_rollbacks);
+
+    node_radio.module->SetResponding(true);
+    node->Update();
+    TEST_ASSERT_TRUE(node->IsPending());
+    VirtualClock::Advance(1000);
+    node->Update();
+    TEST_ASSERT_FALSE(node->IsPending());
+    TEST_ASSERT_EQUAL(kOldChannel, node_radio.module->GetChannel());
+    TEST_ASSERT_EQUAL(1, node->GetStatistics().rolled_back);
+}
+
+void test_failed_change_is_restored(void)
+{
+    LoRaRemoteConfig::LoRaRemoteSettings settings = NewChannel();
+    settings.fields |= LoRaRemoteConfig::kFieldPowerTransmissionValue;
+    settings.power_transmission_value = 5;
+    gateway->SendSettings(settings, kDeadline, kNodeAddress, kOldChannel);
+    node->Update();
+    TEST_ASSERT_FALSE(node->IsPending());
+    TEST_ASSERT_EQUAL(kOldChannel, node_radio.module->GetChannel());
+
+    gateway->Update();
+    TEST_ASSERT_EQUAL(1, amount_of_confirms);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, confirmed_result);
+}
+
+void test_failed_restore_is_retried(void)
+{
+    // The module holds a power the driver refuses to write back, so the restore fails as well
+    node_radio.module->SetRegister("PWR", "5");
+    LoRaRemoteConfig::LoRaRemoteSettings settings = NewChannel();
+    settings.fields |= LoRaRemoteConfig::kFieldPowerTransmissionValue;
+    settings.power_transmission_value = 5;
+    gateway->SendSettings(settings, kDeadline, kNodeAddress, kOldChannel);
+    node->Update();
+    TEST_ASSERT_TRUE(node->IsPending());
+    TEST_ASSERT_EQUAL(1, node->GetStatistics().failed_rollbacks);
+    TEST_ASSERT_EQUAL(0, node->GetStatistics().applied);
+
+    // Update takes over the retries
+    VirtualClock::Advance(1000);
+    node->Update();
+    TEST_ASSERT_TRUE(node->IsPending());
+    TEST_ASSERT_EQUAL(2, node->GetStatistics().failed_rollbacks);
+}
+
+void test_unsigned_and_replayed_frames(void)
+{
+    const uint8_t other_key[LoRaRemoteConfig::kKeySize] = {0};
+    LoRaRemoteConfig::LoRaRemoteConfig intruder(gateway_radio.lora, kGatewayAddress, kOldChannel, other_key);
+    intruder.SendSettings(NewChannel(), kDeadline, kNodeAddress, kOldChannel);
+    node->Update();
+    TEST_ASSERT_FALSE(node->IsPending());
+    TEST_ASSERT_EQUAL(1, node->GetStatistics().rejected);
+
+    uint16_t sequence_number;
+    gateway->SendSettings(NewChannel(), kDeadline, kNodeAddress, kOldChannel, &sequence_number);
+    size_t size;
+    const uint8_t *frame = gateway_radio.module->GetLastFrame(size);
+    uint8_t recorded[64];
+    memcpy(recorded, frame, size);
+    node->Update();
+    MoveGateway();
+    gateway->Commit(sequence_number, kNodeAddress, kNewChannel);
+    node->Update();
+
+    // Replaying the change is rejected
+    node_radio.module->InjectFrame(recorded, size);
+    node->Update();
+    TEST_ASSERT_EQUAL(2, node->GetStatistics().rejected);
+    TEST_ASSERT_EQUAL(1, node->GetStatistics().applied);
+}
+
+void test_replay_after_reboot_is_rejected(void)
+{
+    node->SetStorage(ReadStorage, WriteStorage, 0);
+    uint16_t sequence_number;
+    gateway->SendSettings(NewChannel(), kDeadline, kNodeAddress, kOldChannel, &sequence_number);
+    size_t size;
+    const uint8_t *frame = gateway_radio.module->GetLastFrame(size);
+    uint8_t recorded[64];
+    memcpy(recorded, frame, size);
+    node->Update();
+    MoveGateway();
+    gateway->Commit(sequence_number, kNodeAddress, kNewChannel);
+    node->Update();
+    TEST_ASSERT_FALSE(node->IsPending());
+
+    // The node reboots and reads the last sequence number back
+    delete node;
+    node = new LoRaRemoteConfig::LoRaRemoteConfig(node_radio.lora, kNodeAddress, kNewChannel, kKey);
+    node->SetStorage(ReadStorage, WriteStorage, 0);
+    node_radio.module->InjectFrame(recorded, size);
+    node->Update();
+    TEST_ASSERT_FALSE(node->IsPending());
+    TEST_ASSERT_EQUAL(1, node->GetStatistics().rejected);
+
+    // A gateway keeping its sequence numbers as well continues where it was
+    uint8_t gateway_storage[LoRaRemoteConfig::kStorageSize];
+    memcpy(gateway_storage, storage, sizeof(storage));
+    memset(storage, 0xFF, sizeof(storage));
+    gateway->SetStorage(ReadStorage, WriteStorage, 0);
+    gateway->SendSettings(NewChannel(), kDeadline, kNodeAddress, kNewChannel, &sequence_number);
+    delete gateway;
+    gateway = new LoRaRemoteConfig::LoRaRemoteConfig(gateway_radio.lora, kGatewayAddress, kNewChannel, kKey);
+    gateway->SetStorage(ReadStorage, WriteStorage, 0);
+    uint16_t next_sequence_number;
+    gateway->SendSettings(NewChannel(), kDeadline, kNodeAddress, kNewChannel, &next_sequence_number);
+    TEST_ASSERT_EQUAL(sequence_number + 1, next_sequence_number);
+    memcpy(storage, gateway_storage, sizeof(storage));
+}
+
+void test_invalid_parameters(void)
+{
+    LoRaRemoteConfig::LoRaRemoteSettings settings = NewChannel();
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, gateway->SendSettings(settings, 0, kNodeAddress, kOldChannel));
+    settings.fields = 0;
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, gateway->SendSettings(settings, kDeadline, kNodeAddress, kOldChannel));
+
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, gateway_radio.lora->BeginAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, gateway_radio.lora->SetWorkMode(LoRaSettings::WorkMode::kWorkModeTransparent));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, gateway_radio.lora->EndAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kWrongWorkMode, gateway->SendSettings(NewChannel(), kDeadline, kNodeAddress, kOldChannel));
+}
+
+void test_SipHash(void)
+{
+    // Test vector of the SipHash paper
+    uint8_t message[15];
+    for (uint8_t i = 0; i < sizeof(message); i++)
+    {
+        message[i] = i;
+    }
+    TEST_ASSERT_TRUE(LoRaRemoteConfig::LoRaRemoteConfig::SipHash(kKey, message, sizeof(message)) == 0xa129ca6149be45e5ULL);
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_committed_change_is_kept);
+    RUN_TEST(test_rollback_without_commit);
+    RUN_TEST(test_failed_rollback_is_retried);
+    RUN_TEST(test_failed_change_is_restored);
+    RUN_TEST(test_failed_restore_is_retried);
+    RUN_TEST(test_unsigned_and_replayed_frames);
+    RUN_TEST(test_replay_after_reboot_is_rejected);
+    RUN_TEST(test_invalid_parameters);
+    RUN_TEST(test_SipHash);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,248 @@
+/**
+ * @file test_rpc.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of requests and responses between a gateway and two sensors
+ * @version 0.1
+ * @date 2024-03-22
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_network.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_rpc.h"
+
+const uint8_t kChannel = 40;
+const size_t kAmountOfNodes = 3;
+const uint16_t kGatewayAddress = 1;
+
+EmulatedAir *air;
+EmulatedRadio radios[kAmountOfNodes];
+LoRaRpc::LoRaRpc *rpcs[kAmountOfNodes];
+
+/**
+ * @brief Responses in the order the callback received them
+ *
+ */
+struct Response
+{
+    uint16_t destination_address;
+    uint8_t correlation_id;
+    bool timed_out;
+    size_t size;
+    uint8_t first_byte;
+};
+
+Response responses[kLoRaRpcAmountOfPending];
+size_t amount_of_responses;
+
+/**
+ * @brief Sensor answers with the first byte of the request plus 100
+ *
+ */
+size_t SensorHandler(const uint8_t *request, const size_t size, const uint16_t source_address, uint8_t *response, const size_t response_size)
+{
+    TEST_ASSERT_EQUAL(kGatewayAddress, source_address);
+    response[0] = request[0] + 100;
+    return 1;
+}
+
+void ResponseCallback(const uint16_t destination_address, const uint8_t correlation_id, const uint8_t *response, const size_t size)
+{
+    Response &received = responses[amount_of_responses++];
+    received.destination_address = destination_address;
+    received.correlation_id = correlation_id;
+    received.timed_out = response == nullptr;
+    received.size = size;
+    received.first_byte = (size > 0) ? response[0] : 0;
+}
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    air = new EmulatedAir();
+    // Frames take their time on air, a module misses a frame while it transmits
+    air->SetTimed(true);
+    for (size_t i = 0; i < kAmountOfNodes; i++)
+    {
+        radios[i].Create(air, i + 1, kChannel);
+        rpcs[i] = new LoRaRpc::LoRaRpc(radios[i].lora, i + 1, kChannel);
+        rpcs[i]->SetRequestHandler(SensorHandler);
+    }
+    rpcs[0]->SetRequestHandler(nullptr);
+    rpcs[0]->SetResponseCallback(ResponseCallback);
+    amount_of_responses = 0;
+}
+
+void tearDown(void)
+{
+    for (size_t i = 0; i < kAmountOfNodes; i++)
+    {
+        delete rpcs[i];
+        radios[i].Destroy();
+    }
+    delete air;
+}
+
+/**
+ * @brief Let the sensors answer and the gateway handle the responses
+ *
+ */
+void Run(void)
+{
+    for (size_t i = 1; i < kAmountOfNodes; i++)
+    {
+        rpcs[i]->Update();
+    }
+    rpcs[0]->Update();
+}
+
+/**
+ * @brief Let every module do its work for a while in steps of 10 milliseconds
+ *
+ * @param duration in milliseconds
+ */
+void RunFor(const unsigned long duration)
+{
+    const unsigned long end = millis() + duration;
+    while (millis() < end)
+    {
+        Run();
+        VirtualClock::Advance(10);
+    }
+}
+
+void test_pipelined_calls(void)
+{
+    uint8_t ids[4];
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        const uint8_t request = i;
+        TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, rpcs[0]->Call(&request, 1, 2 + i % 2, kChannel, &ids[i]));
+    }
+    TEST_ASSERT_EQUAL(4, rpcs[0]->GetAmountPending());
+    TEST_ASSERT_EQUAL(2, rpcs[0]->GetAmountPending(2));
+
+    // Only the first request is on the air, the others wait for its response
+    TEST_ASSERT_EQUAL(1, radios[0].module->GetCounters().frames_transmitted);
+    RunFor(2000);
+    TEST_ASSERT_EQUAL(4, amount_of_responses);
+    TEST_ASSERT_EQUAL(0, air->GetCollisions());
+    TEST_ASSERT_EQUAL(0, rpcs[0]->GetAmountPending());
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        TEST_ASSERT_FALSE(responses[i].timed_out);
+        TEST_ASSERT_EQUAL(1, responses[i].size);
+        TEST_ASSERT_EQUAL(100 + (responses[i].correlation_id - ids[0]), responses[i].first_byte);
+    }
+    TEST_ASSERT_EQUAL(4, rpcs[0]->GetStatistics().responses);
+    TEST_ASSERT_EQUAL(2, rpcs[1]->GetStatistics().requests_handled);
+}
+
+void test_timeout(void)
+{
+    air->SetInRange(radios[0].module, radios[2].module, false);
+    const uint8_t request = 7;
+    uint8_t id;
+    rpcs[0]->Call(&request, 1, 3, kChannel, &id);
+
+    const unsigned long timeout = rpcs[0]->GetTimeout(1, kLoRaRpcMaximumPayloadSize);
+    VirtualClock::Advance(timeout - 1);
+    Run();
+    TEST_ASSERT_EQUAL(0, amount_of_responses);
+
+    VirtualClock::Advance(1);
+    Run();
+    TEST_ASSERT_EQUAL(1, amount_of_responses);
+    TEST_ASSERT_TRUE(responses[0].timed_out);
+    TEST_ASSERT_EQUAL(3, responses[0].destination_address);
+    TEST_ASSERT_EQUAL(id, responses[0].correlation_id);
+    TEST_ASSERT_EQUAL(1, rpcs[0]->GetStatistics().timeouts);
+}
+
+void test_queued_calls_wait_for_the_channel(void)
+{
+    air->SetInRange(radios[0].module, radios[2].module, false);
+    const uint8_t request = 7;
+    for (size_t i = 0; i < 3; i++)
+    {
+        rpcs[0]->Call(&request, 1, 3, kChannel, nullptr, 1);
+    }
+    TEST_ASSERT_EQUAL(1, radios[0].module->GetCounters().frames_transmitted);
+
+    // The next request is sent when the previous call timed out, its timeout starts then
+    const unsigned long timeout = rpcs[0]->GetTimeout(1, 1);
+    VirtualClock::Advance(timeout);
+    Run();
+    TEST_ASSERT_EQUAL(1, amount_of_responses);
+    TEST_ASSERT_EQUAL(2, radios[0].module->GetCounters().frames_transmitted);
+
+    VirtualClock::Advance(timeout - 1);
+    Run();
+    TEST_ASSERT_EQUAL(1, amount_of_responses);
+    VirtualClock::Advance(1);
+    Run();
+    TEST_ASSERT_EQUAL(2, amount_of_responses);
+    VirtualClock::Advance(timeout);
+    Run();
+    TEST_ASSERT_EQUAL(3, amount_of_responses);
+}
+
+void test_late_response_is_unmatched(void)
+{
+    const uint8_t request = 7;
+    rpcs[0]->Call(&request, 1, 2, kChannel, nullptr, 1);
+    VirtualClock::Advance(rpcs[0]->GetTimeout(1, 1));
+    rpcs[0]->Update();
+    TEST_ASSERT_EQUAL(1, amount_of_responses);
+
+    RunFor(1000);
+    TEST_ASSERT_EQUAL(1, amount_of_responses);
+    TEST_ASSERT_EQUAL(1, rpcs[0]->GetStatistics().responses_unmatched);
+}
+
+void test_timeout_follows_air_time(void)
+{
+    const unsigned long slow = rpcs[0]->GetTimeout(1, 1);
+    TEST_ASSERT_GREATER_THAN(slow, rpcs[0]->GetTimeout(1, kLoRaRpcMaximumPayloadSize));
+    rpcs[0]->SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875);
+    TEST_ASSERT_LESS_THAN(slow, rpcs[0]->GetTimeout(1, 1));
+    TEST_ASSERT_GREATER_OR_EQUAL(kLoRaRpcProcessingTime, rpcs[0]->GetTimeout(1, 1));
+}
+
+void test_invalid_calls(void)
+{
+    const uint8_t request[kLoRaRpcMaximumPayloadSize + 1] = {0};
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, radios[1].lora->BeginAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, radios[1].lora->SetWorkMode(LoRaSettings::WorkMode::kWorkModeTransparent));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, radios[1].lora->EndAtMode());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kWrongWorkMode, rpcs[1]->Call(request, 1, 1, kChannel));
+
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, rpcs[0]->Call(request, 0, 2, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kMessageTooLarge, rpcs[0]->Call(request, sizeof(request), 2, kChannel));
+
+    for (size_t i = 0; i < kLoRaRpcAmountOfPending; i++)
+    {
+        TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, rpcs[0]->Call(request, 1, 2, kChannel));
+    }
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kQueueFull, rpcs[0]->Call(request, 1, 2, kChannel));
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_pipelined_calls);
+    RUN_TEST(test_timeout);
+    RUN_TEST(test_queued_calls_wait_for_the_channel);
+    RUN_TEST(test_late_response_is_unmatched);
+    RUN_TEST(test_timeout_follows_air_time);
+    RUN_TEST(test_invalid_calls);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,137 @@
+/**
+ * @file test_schema.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the compile time schema codec
+ * @version 0.1
+ * @date 2024-03-19
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "usr_lg206_p_schema.h"
+
+enum class SensorState : uint8_t
+{
+    kIdle,
+    kMeasuring,
+    kError,
+};
+
+struct Reading
+{
+    uint32_t code;       // 10000 - 99999
+    float temperature;   // -40.0 - 62.3 degrees
+    bool alarm;
+    SensorState state;
+    uint16_t battery;    // 2000 - 4000 mV in steps of 10
+    int16_t not_sent;
+};
+
+using ReadingSchema = LoRaSchema::LoRaSchema<
+    Reading,
+    LoRaSchema::Field<Reading, uint32_t, &Reading::code, 17, 10000>,
+    LoRaSchema::Field<Reading, float, &Reading::temperature, 10, -400, 10>,
+    LoRaSchema::Field<Reading, bool, &Reading::alarm, 1>,
+    LoRaSchema::Field<Reading, SensorState, &Reading::state, 2>,
+    LoRaSchema::Field<Reading, uint16_t, &Reading::battery, 8, 200, 1, 10>>;
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_size(void)
+{
+    TEST_ASSERT_EQUAL(38, ReadingSchema::kBits);
+    TEST_ASSERT_EQUAL(5, ReadingSchema::kSize);
+    // The same reading as text would be at least "99999,-40.0,1,2,4000"
+    TEST_ASSERT_LESS_THAN(20, ReadingSchema::kSize);
+}
+
+void test_round_trip(void)
+{
+    const Reading reading = {54321, 21.7f, true, SensorState::kMeasuring, 3310, 1234};
+    uint8_t buffer[ReadingSchema::kSize];
+    TEST_ASSERT_EQUAL(ReadingSchema::kSize, ReadingSchema::Encode(reading, buffer, sizeof(buffer)));
+
+    Reading decoded;
+    decoded.not_sent = -1;
+    TEST_ASSERT_TRUE(ReadingSchema::Decode(buffer, sizeof(buffer), decoded));
+    TEST_ASSERT_EQUAL(54321, decoded.code);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, 21.7f, decoded.temperature);
+    TEST_ASSERT_TRUE(decoded.alarm);
+    TEST_ASSERT_EQUAL(static_cast<uint8_t>(SensorState::kMeasuring), static_cast<uint8_t>(decoded.state));
+    TEST_ASSERT_EQUAL(3310, decoded.battery);
+    TEST_ASSERT_EQUAL(-1, decoded.not_sent);
+
+    const Reading negative = {10000, -12.34f, false, SensorState::kError, 2000, 0};
+    ReadingSchema::Encode(negative, buffer, sizeof(buffer));
+    ReadingSchema::Decode(buffer, sizeof(buffer), decoded);
+    TEST_ASSERT_EQUAL(10000, decoded.code);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, -12.3f, decoded.temperature);
+    TEST_ASSERT_FALSE(decoded.alarm);
+    TEST_ASSERT_EQUAL(static_cast<uint8_t>(SensorState::kError), static_cast<uint8_t>(decoded.state));
+    TEST_ASSERT_EQUAL(2000, decoded.battery);
+}
+
+void test_values_out_of_range_are_clamped(void)
+{
+    const Reading reading = {5, 100.0f, false, SensorState::kIdle, 9000, 0};
+    uint8_t buffer[ReadingSchema::kSize];
+    ReadingSchema::Encode(reading, buffer, sizeof(buffer));
+
+    Reading decoded;
+    ReadingSchema::Decode(buffer, sizeof(buffer), decoded);
+    TEST_ASSERT_EQUAL(10000, decoded.code);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, 62.3f, decoded.temperature);
+    TEST_ASSERT_EQUAL(4550, decoded.battery);
+}
+
+void test_bit_layout(void)
+{
+    // Fields are packed most significant bit first without padding
+    const Reading reading = {10001, -40.0f, true, SensorState::kError, 2000, 0};
+    uint8_t buffer[ReadingSchema::kSize];
+    ReadingSchema::Encode(reading, buffer, sizeof(buffer));
+    // 17 bits code = 1, 10 bits temperature = 0, alarm = 1, state = 2, battery = 0
+    const uint8_t expected[] = {0x00, 0x00, 0x80, 0x18, 0x00};
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buffer, sizeof(expected));
+
+    uint8_t bits[8] = {0};
+    LoRaSchema::WriteBits(bits, 3, 32, 0xDEADBEEFUL);
+    TEST_ASSERT_EQUAL_HEX32(0xDEADBEEFUL, LoRaSchema::ReadBits(bits, 3, 32));
+    TEST_ASSERT_EQUAL_HEX8(0x1B, bits[0]);
+}
+
+void test_small_buffers(void)
+{
+    const Reading reading = {54321, 21.7f, true, SensorState::kMeasuring, 3310, 0};
+    uint8_t buffer[ReadingSchema::kSize];
+    TEST_ASSERT_EQUAL(0, ReadingSchema::Encode(reading, buffer, sizeof(buffer) - 1));
+
+    ReadingSchema::Encode(reading, buffer, sizeof(buffer));
+    Reading decoded = {0, 0, false, SensorState::kIdle, 0, 0};
+    TEST_ASSERT_FALSE(ReadingSchema::Decode(buffer, sizeof(buffer) - 1, decoded));
+    TEST_ASSERT_EQUAL(0, decoded.code);
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_size);
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_values_out_of_range_are_clamped);
+    RUN_TEST(test_bit_layout);
+    RUN_TEST(test_small_buffers);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,210 @@
+/**
+ * @file test_time_division.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the beacon synchronisation and slot scheduling
+ * @version 0.1
+ * @date 2024-03-12
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_network.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_time_division.h"
+
+const uint16_t kGatewayAddress = 100;
+const uint8_t kChannel = 40;
+const size_t kAmountOfNodes = 3;
+const LoRaSettings::LoRaAirRateLevel kLevel = LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875;
+
+EmulatedAir *air;
+EmulatedRadio radios[kAmountOfNodes + 1];
+LoRaTimeDivision::LoRaTimeDivisionGateway *gateway;
+LoRaTimeDivision::LoRaTimeDivisionNode *nodes[kAmountOfNodes];
+
+const uint8_t kReading[] = {1, 2, 3, 4, 5, 6, 7, 8};
+uint8_t buffer[kLoRaTimeDivisionMaximumMessageSize + 1];
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    air = new EmulatedAir();
+    for (size_t i = 0; i <= kAmountOfNodes; i++)
+    {
+        // Module 0 is the gateway, the others are nodes with address 1, 2 and 3
+        radios[i].Create(air, i == 0 ? kGatewayAddress : i, kChannel);
+    }
+
+    gateway = new LoRaTimeDivision::LoRaTimeDivisionGateway(radios[0].lora, kGatewayAddress, kChannel);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, gateway->Configure(kAmountOfNodes, LoRaTimeDivision::GetSlotLength(kLevel, sizeof(kReading))));
+    for (size_t i = 0; i < kAmountOfNodes; i++)
+    {
+        nodes[i] = new LoRaTimeDivision::LoRaTimeDivisionNode(radios[i + 1].lora, i + 1);
+        nodes[i]->SetAirRateLevel(kLevel);
+    }
+}
+
+void tearDown(void)
+{
+    delete gateway;
+    for (size_t i = 0; i < kAmountOfNodes; i++)
+    {
+        delete nodes[i];
+    }
+    for (size_t i = 0; i <= kAmountOfNodes; i++)
+    {
+        radios[i].Destroy();
+    }
+    delete air;
+}
+
+/**
+ * @brief Let every module do its work for a while in steps of a few milliseconds
+ *
+ * @param duration in milliseconds
+ * @param send_times OUTPUT network time of the last transmission of every node, may be nullptr
+ */
+void Run(const unsigned long duration, unsigned long *send_times)
+{
+    const unsigned long end = millis() + duration;
+    while (millis() < end)
+    {
+        gateway->Update();
+        for (size_t i = 0; i < kAmountOfNodes; i++)
+        {
+            nodes[i]->Receive(buffer, sizeof(buffer));
+            if (!nodes[i]->HasPendingMessage())
+            {
+                nodes[i]->Send(kReading, sizeof(kReading), kGatewayAddress, kChannel);
+            }
+            const unsigned long network_time = nodes[i]->GetNetworkTime();
+            if (nodes[i]->Update() && send_times != nullptr)
+            {
+                send_times[i] = network_time;
+            }
+        }
+        VirtualClock::Advance(3);
+    }
+}
+
+void test_nodes_synchronise_to_beacon(void)
+{
+    TEST_ASSERT_FALSE(nodes[0]->IsSynchronised());
+    TEST_ASSERT_EQUAL(0, nodes[0]->GetSlot());
+
+    Run(10, nullptr);
+    for (size_t i = 0; i < kAmountOfNodes; i++)
+    {
+        TEST_ASSERT_TRUE(nodes[i]->IsSynchronised());
+        // Clocks of the emulated modules are the same, only the delays of the emulated UARTs remain
+        const long difference = static_cast<long>(nodes[i]->GetNetworkTime() - millis());
+        TEST_ASSERT_INT32_WITHIN(kLoRaTimeDivisionGuardTime / 2, 0, difference);
+    }
+    TEST_ASSERT_EQUAL(2, nodes[0]->GetSlot());
+    TEST_ASSERT_EQUAL(3, nodes[1]->GetSlot());
+    TEST_ASSERT_EQUAL(1, nodes[2]->GetSlot());
+}
+
+void test_nodes_send_in_their_own_slot(void)
+{
+    const unsigned long slot_length = LoRaTimeDivision::GetSlotLength(kLevel, sizeof(kReading));
+    const unsigned long superframe_length = gateway->GetSuperframeLength();
+    TEST_ASSERT_EQUAL((kAmountOfNodes + 1) * slot_length, superframe_length);
+
+    for (size_t superframe = 0; superframe < 3; superframe++)
+    {
+        unsigned long send_times[kAmountOfNodes] = {0};
+        const unsigned long transmitted_before = air->GetTransmissions();
+        Run(superframe_length, send_times);
+
+        // One beacon and one message per node every superframe
+        TEST_ASSERT_EQUAL(kAmountOfNodes + 1, air->GetTransmissions() - transmitted_before);
+        for (size_t i = 0; i < kAmountOfNodes; i++)
+        {
+            TEST_ASSERT_EQUAL(nodes[i]->GetSlot(), (send_times[i] % superframe_length) / slot_length);
+        }
+    }
+    TEST_ASSERT_EQUAL(3 * kAmountOfNodes, radios[0].module->GetCounters().frames_received);
+}
+
+void test_node_without_beacon_stays_silent(void)
+{
+    nodes[0]->Send(kReading, sizeof(kReading), kGatewayAddress, kChannel);
+    TEST_ASSERT_FALSE(nodes[0]->Update());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kQueueFull, nodes[0]->Send(kReading, sizeof(kReading), kGatewayAddress, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, nodes[1]->Send(kReading, 0, kGatewayAddress, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kMessageTooLarge, nodes[1]->Send(buffer, kLoRaTimeDivisionMaximumMessageSize + 1, kGatewayAddress, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, gateway->Configure(0, 100));
+
+    // Node loses synchronisation when beacons stop
+    Run(10, nullptr);
+    TEST_ASSERT_TRUE(nodes[0]->IsSynchronised());
+    VirtualClock::Advance(kLoRaTimeDivisionMissedBeacons * gateway->GetSuperframeLength());
+    TEST_ASSERT_FALSE(nodes[0]->IsSynchronised());
+}
+
+void test_beacon_sets_network_time(void)
+{
+    const uint8_t beacon[LoRaTimeDivision::kBeaconSize] = {LoRaTimeDivision::kFrameTypeBeacon, LoRaTimeDivision::kBeaconSize - 2,
+                                                           0, kGatewayAddress, 0x00, 0x01, 0x86, 0xA0, 4, 0x01, 0xF4};
+    TEST_ASSERT_TRUE(nodes[0]->HandleFrame(beacon, sizeof(beacon)));
+    const unsigned long correction = LoRaAirTime::GetTimeOnAir(kLevel, LoRaTimeDivision::kBeaconSize + 3) / 1000 + LoRaTimeDivision::kReceiveDelay;
+    TEST_ASSERT_EQUAL(100000 + correction, nodes[0]->GetNetworkTime());
+
+    // Network time 100000 lies in slot 0 of a superframe of 5 slots of 500 ms, slot 2 starts 1000 ms later
+    TEST_ASSERT_EQUAL(2, nodes[0]->GetSlot());
+    TEST_ASSERT_EQUAL(1000 - correction, nodes[0]->GetTimeUntilSlot());
+
+    const uint8_t data[] = {1, 2, 3};
+    TEST_ASSERT_FALSE(nodes[0]->HandleFrame(data, sizeof(data)));
+}
+
+void test_message_longer_than_slot(void)
+{
+    // Queued before the slot length is known
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, nodes[0]->Send(buffer, kLoRaTimeDivisionMaximumMessageSize, kGatewayAddress, kChannel));
+
+    // Slots of 10 ms, shorter than the time on air of the message
+    const uint8_t beacon[LoRaTimeDivision::kBeaconSize] = {LoRaTimeDivision::kFrameTypeBeacon, LoRaTimeDivision::kBeaconSize - 2,
+                                                           0, kGatewayAddress, 0x00, 0x00, 0x00, 0x00, 4, 0x00, 10};
+    TEST_ASSERT_TRUE(nodes[0]->HandleFrame(beacon, sizeof(beacon)));
+    TEST_ASSERT_FALSE(nodes[0]->Update());
+    TEST_ASSERT_FALSE(nodes[0]->HasPendingMessage());
+
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kMessageTooLarge, nodes[0]->Send(buffer, kLoRaTimeDivisionMaximumMessageSize, kGatewayAddress, kChannel));
+    TEST_ASSERT_FALSE(nodes[0]->HasPendingMessage());
+}
+
+void test_unset_level_assumes_slowest(void)
+{
+    // Slots are sized for the level of the network, a node which does not know it assumes the slowest
+    LoRaTimeDivision::LoRaTimeDivisionNode node(radios[1].lora, 1);
+    const unsigned long slot_length = LoRaTimeDivision::GetSlotLength(kLevel, sizeof(kReading));
+    const uint8_t beacon[LoRaTimeDivision::kBeaconSize] = {LoRaTimeDivision::kFrameTypeBeacon, LoRaTimeDivision::kBeaconSize - 2,
+                                                           0, kGatewayAddress, 0x00, 0x00, 0x00, 0x00, kAmountOfNodes,
+                                                           static_cast<uint8_t>(slot_length >> 8), static_cast<uint8_t>(slot_length & 0xFF)};
+    TEST_ASSERT_TRUE(node.HandleFrame(beacon, sizeof(beacon)));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kMessageTooLarge, node.Send(kReading, sizeof(kReading), kGatewayAddress, kChannel));
+
+    node.SetAirRateLevel(kLevel);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, node.Send(kReading, sizeof(kReading), kGatewayAddress, kChannel));
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_nodes_synchronise_to_beacon);
+    RUN_TEST(test_nodes_send_in_their_own_slot);
+    RUN_TEST(test_node_without_beacon_stays_silent);
+    RUN_TEST(test_unset_level_assumes_slowest);
+    RUN_TEST(test_beacon_sets_network_time);
+    RUN_TEST(test_message_longer_than_slot);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
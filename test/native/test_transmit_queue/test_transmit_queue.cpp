@@ -0,0 +1,186 @@
+/**
+ * @file test_transmit_queue.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the priority transmit queue
+ * @version 0.1
+ * @date 2024-03-10
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_usr_lg206_p.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_transmit_queue.h"
+
+using LoRaTransmitQueue::DropPolicy;
+using LoRaTransmitQueue::Priority;
+
+const uint8_t enable_pin = 2;
+
+EmulatedUsrLg206P *module;
+RS485 *rs;
+UsrLg206P *lora;
+LoRaTransmitQueue::LoRaTransmitQueue *queue;
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    module = new EmulatedUsrLg206P();
+    rs = new RS485(enable_pin, enable_pin, module, false);
+    lora = new UsrLg206P(rs);
+    queue = new LoRaTransmitQueue::LoRaTransmitQueue(lora);
+}
+
+void tearDown(void)
+{
+    delete queue;
+    delete lora;
+    delete rs;
+    delete module;
+}
+
+void Enqueue(const uint8_t id, const Priority priority, const LoRaErrorCode expected = LoRaErrorCode::kSucces)
+{
+    TEST_ASSERT_EQUAL(expected, queue->Enqueue(&id, 1, priority));
+}
+
+/**
+ * @brief Wait until the module is free, send the next message and check which one it was
+ *
+ */
+void AssertSent(const uint8_t id)
+{
+    VirtualClock::Advance(queue->GetTimeUntilFree());
+    TEST_ASSERT_TRUE(queue->Update());
+    size_t size;
+    const uint8_t *frame = module->GetLastFrame(size);
+    TEST_ASSERT_EQUAL(1, size);
+    TEST_ASSERT_EQUAL(id, frame[0]);
+}
+
+void test_alarm_is_sent_before_bulk(void)
+{
+    Enqueue(1, Priority::kPriorityBulk);
+    Enqueue(2, Priority::kPriorityNormal);
+    Enqueue(3, Priority::kPriorityBulk);
+    Enqueue(4, Priority::kPriorityAlarm);
+
+    AssertSent(4);
+    AssertSent(2);
+    AssertSent(1);
+    AssertSent(3);
+    TEST_ASSERT_FALSE(queue->Update());
+    TEST_ASSERT_EQUAL(0, queue->GetAmountQueued());
+}
+
+void test_class_depth_rejects_new(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, queue->SetClassLimit(Priority::kPriorityNormal, 2, DropPolicy::kDropPolicyRejectNew));
+    Enqueue(1, Priority::kPriorityNormal);
+    Enqueue(2, Priority::kPriorityNormal);
+    Enqueue(3, Priority::kPriorityNormal, LoRaErrorCode::kQueueFull);
+    TEST_ASSERT_EQUAL(1, queue->GetStatistics(Priority::kPriorityNormal).dropped);
+
+    AssertSent(1);
+    AssertSent(2);
+}
+
+void test_class_depth_drops_oldest(void)
+{
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, queue->SetClassLimit(Priority::kPriorityBulk, 2, DropPolicy::kDropPolicyDropOldest));
+    Enqueue(1, Priority::kPriorityBulk);
+    Enqueue(2, Priority::kPriorityBulk);
+    Enqueue(3, Priority::kPriorityBulk);
+    TEST_ASSERT_EQUAL(2, queue->GetAmountQueued(Priority::kPriorityBulk));
+
+    AssertSent(2);
+    AssertSent(3);
+}
+
+void test_alarm_pushes_out_bulk_when_full(void)
+{
+    for (uint8_t i = 0; i < kLoRaTransmitQueueSize; i++)
+    {
+        Enqueue(i, Priority::kPriorityBulk);
+    }
+    Enqueue(100, Priority::kPriorityBulk, LoRaErrorCode::kQueueFull);
+
+    Enqueue(200, Priority::kPriorityAlarm);
+    TEST_ASSERT_EQUAL(kLoRaTransmitQueueSize - 1, queue->GetAmountQueued(Priority::kPriorityBulk));
+    AssertSent(200);
+    // Newest bulk message was dropped, the oldest is still first in line
+    AssertSent(0);
+}
+
+void test_air_time_budget(void)
+{
+    queue->SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268);
+    Enqueue(1, Priority::kPriorityBulk);
+    Enqueue(2, Priority::kPriorityBulk);
+
+    AssertSent(1);
+    const unsigned long time_on_air = queue->GetTimeUntilFree();
+    TEST_ASSERT_EQUAL(LoRaAirTime::GetTimeOnAir(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268, 1) / 1000, time_on_air);
+
+    // An alarm raised meanwhile goes first once the module is free
+    Enqueue(3, Priority::kPriorityAlarm);
+    TEST_ASSERT_FALSE(queue->Update());
+    VirtualClock::Advance(time_on_air);
+    AssertSent(3);
+    TEST_ASSERT_EQUAL(time_on_air, queue->GetStatistics(Priority::kPriorityAlarm).maximum_latency);
+}
+
+void test_unset_level_assumes_slowest(void)
+{
+    Enqueue(1, Priority::kPriorityBulk);
+    AssertSent(1);
+    TEST_ASSERT_EQUAL(LoRaAirTime::GetTimeOnAir(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel268, 1) / 1000, queue->GetTimeUntilFree());
+}
+
+void test_duty_cycle(void)
+{
+    queue->SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, queue->SetDutyCycle(0));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, queue->SetDutyCycle(10));
+    Enqueue(1, Priority::kPriorityNormal);
+    Enqueue(2, Priority::kPriorityNormal);
+
+    AssertSent(1);
+    const unsigned long time_on_air = LoRaAirTime::GetTimeOnAir(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875, 1) / 1000;
+    TEST_ASSERT_EQUAL(time_on_air * 100, queue->GetTimeUntilFree());
+}
+
+void test_invalid_messages(void)
+{
+    uint8_t message[kLoRaTransmitQueueMaximumMessageSize + 1] = {0};
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kMessageTooLarge, queue->Enqueue(message, sizeof(message), Priority::kPriorityNormal));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, queue->Enqueue(message, 0, Priority::kPriorityNormal));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, queue->SetClassLimit(Priority::kPriorityNormal, 0, DropPolicy::kDropPolicyRejectNew));
+
+    // Fixed point messages can not be sent in transparent mode and are dropped
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, queue->Enqueue(message, 1, 2, 40, Priority::kPriorityNormal));
+    TEST_ASSERT_FALSE(queue->Update());
+    TEST_ASSERT_EQUAL(1, queue->GetStatistics(Priority::kPriorityNormal).dropped);
+    TEST_ASSERT_EQUAL(0, queue->GetAmountQueued());
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_alarm_is_sent_before_bulk);
+    RUN_TEST(test_class_depth_rejects_new);
+    RUN_TEST(test_class_depth_drops_oldest);
+    RUN_TEST(test_alarm_pushes_out_bulk_when_full);
+    RUN_TEST(test_air_time_budget);
+    RUN_TEST(test_unset_level_assumes_slowest);
+    RUN_TEST(test_duty_cycle);
+    RUN_TEST(test_invalid_messages);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
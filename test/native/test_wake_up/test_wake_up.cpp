@@ -0,0 +1,186 @@
+/**
+ * @file test_wake_up.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the bursts sent to modules in wake up mode
+ * @version 0.1
+ * @date 2024-03-26
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_network.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_wake_up.h"
+
+const uint16_t kAddressGateway = 1;
+const uint16_t kAddressNode = 2;
+const uint8_t kChannel = 40;
+const unsigned long kLatency = 5000;
+
+EmulatedAir *air;
+EmulatedRadio radio_gateway;
+EmulatedRadio radio_node;
+LoRaWakeUp::LoRaWakeUpSender *sender;
+LoRaWakeUp::LoRaWakeUpReceiver *receiver;
+
+uint8_t received[16][LoRaWakeUp::kMaximumMessageSize];
+size_t received_size[16];
+size_t amount_received;
+
+void OnMessage(const uint8_t *message, const size_t size)
+{
+    TEST_ASSERT_LESS_THAN(16, amount_received);
+    memcpy(received[amount_received], message, size);
+    received_size[amount_received] = size;
+    amount_received++;
+}
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    air = new EmulatedAir();
+    // The frames of a burst arrive one after another, so Drain waits for them like on a real module
+    air->SetTimed(true);
+    radio_gateway.Create(air, kAddressGateway, kChannel);
+    radio_node.Create(air, kAddressNode, kChannel);
+
+    sender = new LoRaWakeUp::LoRaWakeUpSender(radio_gateway.lora);
+    receiver = new LoRaWakeUp::LoRaWakeUpReceiver(radio_node.lora);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender->AddPeer(kAddressNode, kChannel, kLatency));
+    amount_received = 0;
+}
+
+void tearDown(void)
+{
+    delete sender;
+    delete receiver;
+    radio_gateway.Destroy();
+    radio_node.Destroy();
+    delete air;
+}
+
+void test_burst_packs_messages_in_one_frame(void)
+{
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        const uint8_t message[4] = {i, i, i, i};
+        TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender->Send(message, sizeof(message), kAddressNode, kChannel));
+    }
+    TEST_ASSERT_EQUAL(5, sender->GetAmountQueued(kAddressNode));
+    TEST_ASSERT_EQUAL(0, air->GetTransmissions());
+
+    VirtualClock::Advance(kLatency - 1);
+    sender->Update();
+    TEST_ASSERT_EQUAL(0, air->GetTransmissions());
+    VirtualClock::Advance(1);
+    sender->Update();
+    TEST_ASSERT_EQUAL(1, air->GetTransmissions());
+    TEST_ASSERT_EQUAL(0, sender->GetAmountQueued());
+
+    TEST_ASSERT_EQUAL(5, receiver->Drain(OnMessage));
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        TEST_ASSERT_EQUAL(4, received_size[i]);
+        TEST_ASSERT_EQUAL(i, received[i][0]);
+    }
+    TEST_ASSERT_EQUAL(1, sender->GetStatistics().bursts);
+    TEST_ASSERT_EQUAL(0, receiver->GetStatistics().incomplete_drains);
+}
+
+void test_burst_spans_frames(void)
+{
+    for (uint8_t i = 0; i < 11; i++)
+    {
+        const uint8_t message[10] = {i};
+        sender->Send(message, sizeof(message), kAddressNode, kChannel);
+    }
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender->Flush());
+    TEST_ASSERT_EQUAL(3, air->GetTransmissions());
+    TEST_ASSERT_EQUAL(1, sender->GetStatistics().bursts);
+
+    // Last frame tells the receiver it can sleep, without waiting for the timeout
+    const unsigned long start = millis();
+    TEST_ASSERT_EQUAL(11, receiver->Drain(OnMessage));
+    TEST_ASSERT_LESS_THAN(receiver->GetDrainTimeout(), millis() - start);
+    TEST_ASSERT_EQUAL(3, receiver->GetStatistics().frames_received);
+    for (uint8_t i = 0; i < 11; i++)
+    {
+        TEST_ASSERT_EQUAL(i, received[i][0]);
+    }
+
+    // A full queue sends its burst before the next message is queued
+    const uint8_t large[LoRaWakeUp::kMaximumMessageSize] = {0};
+    sender->Send(large, sizeof(large), kAddressNode, kChannel);
+    sender->Send(large, sizeof(large), kAddressNode, kChannel);
+    TEST_ASSERT_EQUAL(3, air->GetTransmissions());
+    sender->Send(large, sizeof(large), kAddressNode, kChannel);
+    TEST_ASSERT_EQUAL(5, air->GetTransmissions());
+    TEST_ASSERT_EQUAL(1, sender->GetAmountQueued());
+}
+
+void test_drain_waits_for_rest_of_burst(void)
+{
+    // First frame of a burst of two, the second one is lost
+    const uint8_t frame[] = {1, 3, 2, 7, 8};
+    radio_node.module->InjectFrame(frame, sizeof(frame));
+
+    const unsigned long start = millis();
+    TEST_ASSERT_EQUAL(1, receiver->Drain(OnMessage));
+    TEST_ASSERT_GREATER_OR_EQUAL(receiver->GetDrainTimeout(), millis() - start);
+    TEST_ASSERT_EQUAL(2, received_size[0]);
+    TEST_ASSERT_EQUAL(8, received[0][1]);
+    TEST_ASSERT_EQUAL(1, receiver->GetStatistics().incomplete_drains);
+
+    // Faster air rate, shorter wait
+    const unsigned long timeout = receiver->GetDrainTimeout();
+    receiver->SetAirRateLevel(LoRaSettings::LoRaAirRateLevel::kLoRaAirRateLevel21875);
+    TEST_ASSERT_LESS_THAN(timeout, receiver->GetDrainTimeout());
+}
+
+void test_other_destinations_are_sent_directly(void)
+{
+    const uint8_t message[] = {1, 2, 3};
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender->Send(message, sizeof(message), 3, kChannel));
+    TEST_ASSERT_EQUAL(1, air->GetTransmissions());
+    TEST_ASSERT_EQUAL(1, sender->GetStatistics().messages_sent_directly);
+
+    // Removing a module sends what was queued for it
+    sender->Send(message, sizeof(message), kAddressNode, kChannel);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender->RemovePeer(kAddressNode, kChannel));
+    TEST_ASSERT_EQUAL(2, air->GetTransmissions());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, sender->RemovePeer(kAddressNode, kChannel));
+    sender->Send(message, sizeof(message), kAddressNode, kChannel);
+    TEST_ASSERT_EQUAL(3, air->GetTransmissions());
+}
+
+void test_invalid_parameters(void)
+{
+    const uint8_t message[LoRaWakeUp::kMaximumMessageSize + 1] = {0};
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, sender->Send(message, 0, kAddressNode, kChannel));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kMessageTooLarge, sender->Send(message, sizeof(message), kAddressNode, kChannel));
+
+    for (uint16_t i = 1; i < kLoRaWakeUpAmountOfPeers; i++)
+    {
+        TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, sender->AddPeer(kAddressNode + i, kChannel));
+    }
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kQueueFull, sender->AddPeer(100, kChannel));
+    TEST_ASSERT_EQUAL(0, air->GetTransmissions());
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_burst_packs_messages_in_one_frame);
+    RUN_TEST(test_burst_spans_frames);
+    RUN_TEST(test_drain_waits_for_rest_of_burst);
+    RUN_TEST(test_other_destinations_are_sent_directly);
+    RUN_TEST(test_invalid_parameters);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
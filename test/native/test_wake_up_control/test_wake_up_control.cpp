@@ -0,0 +1,280 @@
+/**
+ * @file test_wake_up_control.cpp
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Tests of the wake up interval adapting to the received traffic
+ * @version 0.1
+ * @date 2024-03-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <unity.h>
+
+#include "emulated_network.h"
+#include "virtual_clock.h"
+#include "usr_lg206_p_wake_up_control.h"
+
+const uint16_t kAddressNode = 1;
+const uint16_t kAddressGateway = 2;
+const uint8_t kChannel = 40;
+
+EmulatedAir *air;
+EmulatedRadio radio_node;
+EmulatedRadio radio_gateway;
+LoRaWakeUpControl::LoRaWakeUpControl *wake_up_control;
+LoRaWakeUpControl::LoRaWakeUpControl *gateway_control;
+
+uint8_t buffer[32];
+
+void setUp(void)
+{
+    VirtualClock::Install();
+    air = new EmulatedAir();
+    radio_node.Create(air, kAddressNode, kChannel);
+    radio_gateway.Create(air, kAddressGateway, kChannel);
+
+    wake_up_control = new LoRaWakeUpControl::LoRaWakeUpControl(radio_node.lora, kAddressNode, kAddressGateway, kChannel, LoRaWakeUpControl::Role::kRoleNode);
+    gateway_control = new LoRaWakeUpControl::LoRaWakeUpControl(radio_gateway.lora, kAddressGateway, kAddressNode, kChannel, LoRaWakeUpControl::Role::kRoleSender);
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, wake_up_control->Begin());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, gateway_control->Begin());
+}
+
+void tearDown(void)
+{
+    delete wake_up_control;
+    delete gateway_control;
+    radio_node.Destroy();
+    radio_gateway.Destroy();
+    delete air;
+}
+
+/**
+ * @brief Let both sides handle requests and acknowledgements
+ *
+ */
+void Exchange(void)
+{
+    for (size_t i = 0; i < 2; i++)
+    {
+        TEST_ASSERT_EQUAL(0, gateway_control->Receive(buffer, sizeof(buffer)));
+        TEST_ASSERT_EQUAL(0, wake_up_control->Receive(buffer, sizeof(buffer)));
+    }
+}
+
+/**
+ * @brief Report arrivals with a fixed time in between
+ *
+ */
+void Arrive(const size_t amount, const unsigned long inter_arrival_time)
+{
+    for (size_t i = 0; i < amount; i++)
+    {
+        VirtualClock::Advance(inter_arrival_time);
+        wake_up_control->ReportArrival();
+    }
+}
+
+int GetModuleInterval(const EmulatedUsrLg206P *module)
+{
+    return atoi(module->GetRegister("WTM"));
+}
+
+/**
+ * @brief Energy per millisecond in milliseconds of listening, the model CalculateInterval minimises
+ *
+ */
+double GetCost(const double interval, const double inter_arrival_time)
+{
+    return kLoRaWakeUpControlListenTime / interval + interval / 2 / inter_arrival_time;
+}
+
+void test_calculate_interval(void)
+{
+    TEST_ASSERT_EQUAL(1900, LoRaWakeUpControl::CalculateInterval(60000, 4000));
+    TEST_ASSERT_TRUE(GetCost(1900, 60000) < GetCost(1500, 60000));
+    TEST_ASSERT_TRUE(GetCost(1900, 60000) < GetCost(2500, 60000));
+
+    // Clamped to the range of the module
+    TEST_ASSERT_EQUAL(4000, LoRaWakeUpControl::CalculateInterval(600000, 4000));
+    TEST_ASSERT_EQUAL(4000, LoRaWakeUpControl::CalculateInterval(4000000000UL, 4000));
+    TEST_ASSERT_EQUAL(500, LoRaWakeUpControl::CalculateInterval(1000, 4000));
+    TEST_ASSERT_EQUAL(500, LoRaWakeUpControl::CalculateInterval(0, 4000));
+
+    // Latency target goes before energy
+    TEST_ASSERT_EQUAL(1250, LoRaWakeUpControl::CalculateInterval(600000, 1250));
+}
+
+void test_begin_reads_interval_of_module(void)
+{
+    // A new driver, the one of the node knows the interval already
+    radio_node.module->SetRegister("WTM", "3000");
+    UsrLg206P lora(radio_node.rs);
+    LoRaWakeUpControl::LoRaWakeUpControl control(&lora, kAddressNode, kAddressGateway, kChannel, LoRaWakeUpControl::Role::kRoleNode);
+    TEST_ASSERT_EQUAL(LoRaWakeUpControl::kDefaultInterval, control.GetInterval());
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, control.Begin());
+    TEST_ASSERT_EQUAL(3000, control.GetInterval());
+    TEST_ASSERT_FALSE(radio_node.module->IsAtMode());
+}
+
+void test_rare_traffic_sleeps_longer_after_acknowledgement(void)
+{
+    TEST_ASSERT_EQUAL(LoRaWakeUpControl::kDefaultInterval, wake_up_control->GetInterval());
+    Arrive(4, 600000);
+    TEST_ASSERT_EQUAL(600000, wake_up_control->GetMeanInterArrivalTime());
+
+    // The node keeps waking up often until the gateway sends the longer preamble
+    wake_up_control->Update();
+    TEST_ASSERT_TRUE(wake_up_control->HasPendingChange());
+    TEST_ASSERT_EQUAL(LoRaWakeUpControl::kDefaultInterval, wake_up_control->GetInterval());
+    TEST_ASSERT_EQUAL(LoRaWakeUpControl::kDefaultInterval, GetModuleInterval(radio_node.module));
+
+    Exchange();
+    TEST_ASSERT_FALSE(wake_up_control->HasPendingChange());
+    TEST_ASSERT_EQUAL(4000, wake_up_control->GetInterval());
+    TEST_ASSERT_EQUAL(4000, GetModuleInterval(radio_node.module));
+    TEST_ASSERT_EQUAL(4000, GetModuleInterval(radio_gateway.module));
+    TEST_ASSERT_FALSE(radio_node.module->IsAtMode());
+    TEST_ASSERT_EQUAL(1, wake_up_control->GetStatistics().increases);
+}
+
+void test_busy_traffic_wakes_more_often_right_away(void)
+{
+    Arrive(10, 2000);
+    wake_up_control->Update();
+    TEST_ASSERT_EQUAL(500, wake_up_control->GetInterval());
+    TEST_ASSERT_EQUAL(500, GetModuleInterval(radio_node.module));
+    TEST_ASSERT_EQUAL(LoRaWakeUpControl::kDefaultInterval, GetModuleInterval(radio_gateway.module));
+    TEST_ASSERT_EQUAL(1, wake_up_control->GetStatistics().decreases);
+
+    Exchange();
+    TEST_ASSERT_FALSE(wake_up_control->HasPendingChange());
+    TEST_ASSERT_EQUAL(500, GetModuleInterval(radio_gateway.module));
+
+    // The mean follows slower traffic gradually, the AT mode took some time as well
+    Arrive(1, 10000);
+    TEST_ASSERT_UINT32_WITHIN(100, 3000, wake_up_control->GetMeanInterArrivalTime());
+}
+
+void test_lost_acknowledgement_is_requested_again(void)
+{
+    Arrive(4, 600000);
+    wake_up_control->Update();
+
+    // The gateway already sends the longer preamble, which still wakes the node
+    air->DropNext(1);
+    Exchange();
+    TEST_ASSERT_EQUAL(4000, GetModuleInterval(radio_gateway.module));
+    TEST_ASSERT_EQUAL(LoRaWakeUpControl::kDefaultInterval, GetModuleInterval(radio_node.module));
+    TEST_ASSERT_TRUE(wake_up_control->HasPendingChange());
+
+    VirtualClock::Advance(60000);
+    wake_up_control->Update();
+    Exchange();
+    TEST_ASSERT_FALSE(wake_up_control->HasPendingChange());
+    TEST_ASSERT_EQUAL(4000, GetModuleInterval(radio_node.module));
+}
+
+void test_unreachable_sender_keeps_interval(void)
+{
+    air->SetLossRate(100);
+    Arrive(4, 600000);
+    for (size_t i = 0; i <= kLoRaWakeUpControlMaximumRequests; i++)
+    {
+        wake_up_control->Update();
+        Exchange();
+        VirtualClock::Advance(60000);
+    }
+
+    TEST_ASSERT_FALSE(wake_up_control->HasPendingChange());
+    TEST_ASSERT_EQUAL(1, wake_up_control->GetStatistics().failed_requests);
+    TEST_ASSERT_EQUAL(LoRaWakeUpControl::kDefaultInterval, wake_up_control->GetInterval());
+    TEST_ASSERT_EQUAL(LoRaWakeUpControl::kDefaultInterval, GetModuleInterval(radio_node.module));
+    TEST_ASSERT_EQUAL(kLoRaWakeUpControlMaximumRequests, air->GetTransmissions());
+}
+
+void test_silence_and_rate_limit(void)
+{
+    // Nothing is changed before anything is known
+    wake_up_control->Update();
+    TEST_ASSERT_FALSE(wake_up_control->HasPendingChange());
+    TEST_ASSERT_EQUAL(LoRaWakeUpControl::kDefaultInterval, wake_up_control->GetInterval());
+
+    Arrive(10, 2000);
+    wake_up_control->Update();
+    Exchange();
+    TEST_ASSERT_EQUAL(500, wake_up_control->GetInterval());
+
+    // Traffic stopped, the silence counts as a long time between messages
+    VirtualClock::Advance(kLoRaWakeUpControlMinimumInterval / 2);
+    wake_up_control->Update();
+    TEST_ASSERT_FALSE(wake_up_control->HasPendingChange());
+    VirtualClock::Advance(kLoRaWakeUpControlMinimumInterval / 2);
+    wake_up_control->Update();
+    Exchange();
+    TEST_ASSERT_EQUAL(1900, wake_up_control->GetInterval());
+    TEST_ASSERT_EQUAL(1900, GetModuleInterval(radio_node.module));
+    TEST_ASSERT_EQUAL(1900, GetModuleInterval(radio_gateway.module));
+}
+
+void test_latency_target_and_hysteresis(void)
+{
+    // The best interval of 1900 ms is too close to the current one to use the AT mode for
+    Arrive(4, 60000);
+    wake_up_control->Update();
+    TEST_ASSERT_FALSE(wake_up_control->HasPendingChange());
+
+    // A tighter latency target is applied even when the change is small
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kInvalidParameter, wake_up_control->SetLatencyTarget(499));
+    TEST_ASSERT_EQUAL(LoRaErrorCode::kSucces, wake_up_control->SetLatencyTarget(1800));
+    wake_up_control->Update();
+    TEST_ASSERT_EQUAL(1800, wake_up_control->GetInterval());
+    TEST_ASSERT_EQUAL(1800, GetModuleInterval(radio_node.module));
+    Exchange();
+    TEST_ASSERT_EQUAL(1800, GetModuleInterval(radio_gateway.module));
+}
+
+void test_roles(void)
+{
+    // The sender does not measure the traffic, it only follows the node
+    for (size_t i = 0; i < 4; i++)
+    {
+        VirtualClock::Advance(600000);
+        gateway_control->ReportArrival();
+    }
+    gateway_control->Update();
+    TEST_ASSERT_FALSE(gateway_control->HasPendingChange());
+    TEST_ASSERT_EQUAL(0, air->GetTransmissions());
+
+    // A request for a longer interval would let the node sleep through the preamble of its sender
+    const uint8_t longer[] = {static_cast<uint8_t>(LoRaWakeUpControl::FrameType::kFrameTypeRequest), 4, 0, kAddressGateway, 4000 >> 8, 4000 & 0xFF};
+    TEST_ASSERT_TRUE(wake_up_control->HandleFrame(longer, sizeof(longer)));
+    TEST_ASSERT_EQUAL(LoRaWakeUpControl::kDefaultInterval, GetModuleInterval(radio_node.module));
+    TEST_ASSERT_EQUAL(1, wake_up_control->GetStatistics().rejected_requests);
+    TEST_ASSERT_EQUAL(0, air->GetTransmissions());
+
+    // A shorter interval is always safe
+    const uint8_t shorter[] = {static_cast<uint8_t>(LoRaWakeUpControl::FrameType::kFrameTypeRequest), 4, 0, kAddressGateway, 1000 >> 8, 1000 & 0xFF};
+    TEST_ASSERT_TRUE(wake_up_control->HandleFrame(shorter, sizeof(shorter)));
+    TEST_ASSERT_EQUAL(1000, GetModuleInterval(radio_node.module));
+    TEST_ASSERT_EQUAL(1, air->GetTransmissions());
+}
+
+void RunAllTests(void)
+{
+    RUN_TEST(test_calculate_interval);
+    RUN_TEST(test_begin_reads_interval_of_module);
+    RUN_TEST(test_rare_traffic_sleeps_longer_after_acknowledgement);
+    RUN_TEST(test_busy_traffic_wakes_more_often_right_away);
+    RUN_TEST(test_lost_acknowledgement_is_requested_again);
+    RUN_TEST(test_unreachable_sender_keeps_interval);
+    RUN_TEST(test_silence_and_rate_limit);
+    RUN_TEST(test_latency_target_and_hysteresis);
+    RUN_TEST(test_roles);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RunAllTests();
+    return UNITY_END();
+}
@@ -0,0 +1,67 @@
+/**
+ * @file virtual_clock.h
+ * @author Rik Vos (rik.vos01@gmail.com)
+ * @brief Time source for native tests, delay() advances the clock instead of sleeping
+ * @version 0.1
+ * @date 2024-03-04
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef VIRTUAL_CLOCK_H_
+#define VIRTUAL_CLOCK_H_
+
+#ifndef ARDUINO
+
+#include <ArduinoFake.h>
+
+using namespace fakeit;
+
+namespace VirtualClock
+{
+    /**
+     * @brief Current time in microseconds
+     *
+     */
+    static unsigned long now = 0;
+
+    /**
+     * @brief Sum of all delays requested by the code under test in milliseconds
+     *
+     */
+    static unsigned long total_delay = 0;
+
+    /**
+     * @brief Route the Arduino time functions to the virtual clock and silence the pin functions used by RS485
+     *
+     */
+    inline void Install(void)
+    {
+        now = 0;
+        total_delay = 0;
+        When(Method(ArduinoFake(), millis)).AlwaysDo([]() -> unsigned long
+                                                      { return now / 1000; });
+        When(Method(ArduinoFake(), micros)).AlwaysDo([]() -> unsigned long
+                                                      { return now; });
+        When(Method(ArduinoFake(), delay)).AlwaysDo([](unsigned long ms)
+                                                     { now += ms * 1000; total_delay += ms; });
+        When(Method(ArduinoFake(), delayMicroseconds)).AlwaysDo([](unsigned int us)
+                                                                 { now += us; });
+        When(Method(ArduinoFake(), pinMode)).AlwaysReturn();
+        When(Method(ArduinoFake(), digitalWrite)).AlwaysReturn();
+    }
+
+    /**
+     * @brief Let time pass without the code under test asking for it
+     *
+     * @param ms amount of milliseconds
+     */
+    inline void Advance(const unsigned long ms)
+    {
+        now += ms * 1000;
+    }
+} // namespace VirtualClock
+
+#endif // ARDUINO
+
+#endif // VIRTUAL_CLOCK_H_